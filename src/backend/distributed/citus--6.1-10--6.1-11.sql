@@ -0,0 +1,22 @@
+/* citus--6.1-10--6.1-11.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION task_tracker_assign_task(bigint, integer, text, integer)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$task_tracker_assign_task$$;
+COMMENT ON FUNCTION task_tracker_assign_task(bigint, integer, text, integer)
+    IS 'assign a task to execute with the given scheduling priority';
+
+CREATE FUNCTION task_tracker_job_task_counts(OUT job_id bigint,
+                                             OUT user_name text,
+                                             OUT running_task_count integer,
+                                             OUT queued_task_count integer)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$task_tracker_job_task_counts$$;
+COMMENT ON FUNCTION task_tracker_job_task_counts()
+    IS 'show the number of running and queued tasks per job';
+
+RESET search_path;
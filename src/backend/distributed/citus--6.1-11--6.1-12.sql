@@ -0,0 +1,17 @@
+/* citus--6.1-11--6.1-12.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION task_tracker_task_statuses(job_ids bigint[],
+                                           since_sequence bigint,
+                                           OUT job_id bigint,
+                                           OUT task_id integer,
+                                           OUT task_status integer,
+                                           OUT status_sequence bigint)
+    RETURNS SETOF record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$task_tracker_task_statuses$$;
+COMMENT ON FUNCTION task_tracker_task_statuses(bigint[], bigint)
+    IS 'return statuses of the given jobs'' tasks that changed since a sequence number';
+
+RESET search_path;
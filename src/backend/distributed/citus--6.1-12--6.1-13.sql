@@ -0,0 +1,37 @@
+/* citus--6.1-12--6.1-13.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_range_partition_table(bigint, integer, text, text, oid, anyarray,
+                                             text[], integer[], integer[])
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_range_partition_table$$;
+COMMENT ON FUNCTION worker_range_partition_table(bigint, integer, text, text, oid,
+                                                 anyarray, text[], integer[], integer[])
+    IS 'range partition query results and push partitions to merge task nodes';
+
+CREATE FUNCTION worker_hash_partition_table(bigint, integer, text, text, oid, integer,
+                                            text[], integer[], integer[])
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_hash_partition_table$$;
+COMMENT ON FUNCTION worker_hash_partition_table(bigint, integer, text, text, oid,
+                                                integer, text[], integer[], integer[])
+    IS 'hash partition query results and push partitions to merge task nodes';
+
+CREATE FUNCTION worker_prepare_partition_push(bigint, integer, integer)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_prepare_partition_push$$;
+COMMENT ON FUNCTION worker_prepare_partition_push(bigint, integer, integer)
+    IS 'prepare to receive a partition file pushed by a map task';
+
+CREATE FUNCTION worker_finish_partition_push(bigint, integer, integer)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_finish_partition_push$$;
+COMMENT ON FUNCTION worker_finish_partition_push(bigint, integer, integer)
+    IS 'move a partition file pushed by a map task into place';
+
+RESET search_path;
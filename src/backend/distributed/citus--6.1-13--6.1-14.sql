@@ -0,0 +1,14 @@
+/* citus--6.1-13--6.1-14.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_partition_compression_stats(OUT compressed_block_count bigint,
+                                                   OUT uncompressed_bytes bigint,
+                                                   OUT compressed_bytes bigint)
+    RETURNS record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_partition_compression_stats$$;
+COMMENT ON FUNCTION worker_partition_compression_stats()
+    IS 'return statistics on compressed partition files written on this node';
+
+RESET search_path;
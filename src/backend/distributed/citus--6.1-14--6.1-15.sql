@@ -0,0 +1,12 @@
+/* citus--6.1-14--6.1-15.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_read_task_files(anyelement, bigint, integer)
+    RETURNS SETOF anyelement
+    LANGUAGE C
+    AS 'MODULE_PATHNAME', $$worker_read_task_files$$;
+COMMENT ON FUNCTION worker_read_task_files(anyelement, bigint, integer)
+    IS 'read the rows in a task''s merge files without loading them into a table';
+
+RESET search_path;
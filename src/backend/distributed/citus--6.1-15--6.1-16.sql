@@ -0,0 +1,16 @@
+/* citus--6.1-15--6.1-16.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_hash_partition_table(bigint, integer, text, text, oid, integer,
+                                            text[], integer[], integer[],
+                                            text[], integer[], boolean[])
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_hash_partition_table$$;
+COMMENT ON FUNCTION worker_hash_partition_table(bigint, integer, text, text, oid,
+                                                integer, text[], integer[], integer[],
+                                                text[], integer[], boolean[])
+    IS 'hash partition query results and spread or replicate frequent keys';
+
+RESET search_path;
@@ -0,0 +1,19 @@
+/* citus--6.1-16--6.1-17.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_build_semi_join_filter(text, text, oid, integer)
+    RETURNS bytea
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_build_semi_join_filter$$;
+COMMENT ON FUNCTION worker_build_semi_join_filter(text, text, oid, integer)
+    IS 'build a bloom filter over the join keys a query returns';
+
+CREATE FUNCTION worker_store_semi_join_filter(bigint, bytea)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_store_semi_join_filter$$;
+COMMENT ON FUNCTION worker_store_semi_join_filter(bigint, bytea)
+    IS 'store a bloom filter for the map tasks of a repartition job';
+
+RESET search_path;
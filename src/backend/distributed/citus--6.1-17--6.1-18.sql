@@ -0,0 +1,39 @@
+/* citus--6.1-17--6.1-18.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE TABLE citus.pg_dist_table_statistic (
+    logicalrelid regclass NOT NULL,
+    reltuples float8 NOT NULL,
+    relsize bigint NOT NULL
+);
+
+CREATE UNIQUE INDEX pg_dist_table_statistic_logicalrelid_index
+ON citus.pg_dist_table_statistic using btree(logicalrelid);
+
+ALTER TABLE citus.pg_dist_table_statistic SET SCHEMA pg_catalog;
+
+CREATE TABLE citus.pg_dist_column_statistic (
+    logicalrelid regclass NOT NULL,
+    attnum int2 NOT NULL,
+    null_frac float4 NOT NULL,
+    avg_width int NOT NULL,
+    n_distinct float4 NOT NULL,
+    most_common_vals text[],
+    most_common_freqs float4[],
+    histogram_bounds text[]
+);
+
+CREATE UNIQUE INDEX pg_dist_column_statistic_logicalrelid_attnum_index
+ON citus.pg_dist_column_statistic using btree(logicalrelid, attnum);
+
+ALTER TABLE citus.pg_dist_column_statistic SET SCHEMA pg_catalog;
+
+CREATE FUNCTION master_update_table_statistics(logicalrelid regclass)
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$master_update_table_statistics$$;
+COMMENT ON FUNCTION master_update_table_statistics(regclass)
+    IS 'merge the statistics of a distributed table''s shards into the coordinator';
+
+RESET search_path;
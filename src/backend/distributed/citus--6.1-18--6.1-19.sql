@@ -0,0 +1,14 @@
+/* citus--6.1-18--6.1-19.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_commit_protocol_stats(OUT one_phase_commit_count bigint,
+                                            OUT two_phase_commit_count bigint,
+                                            OUT downgraded_commit_count bigint)
+    RETURNS record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_commit_protocol_stats$$;
+COMMENT ON FUNCTION citus_commit_protocol_stats()
+    IS 'return the number of coordinated transactions committed with each commit protocol';
+
+RESET search_path;
@@ -0,0 +1,15 @@
+/* citus--6.1-19--6.1-20.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION citus_transaction_recovery_stats(OUT recovery_count bigint,
+                                                 OUT committed_transaction_count bigint,
+                                                 OUT aborted_transaction_count bigint,
+                                                 OUT failed_transaction_count bigint)
+    RETURNS record
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$citus_transaction_recovery_stats$$;
+COMMENT ON FUNCTION citus_transaction_recovery_stats()
+    IS 'return the number of prepared transactions resolved by transaction recovery';
+
+RESET search_path;
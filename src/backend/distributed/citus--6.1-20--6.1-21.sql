@@ -0,0 +1,13 @@
+/* citus--6.1-20--6.1-21.sql */
+
+SET search_path = 'pg_catalog';
+
+CREATE FUNCTION worker_hash_partition_table(bigint, integer, text, text, oid, integer[])
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_hash_partition_table$$;
+COMMENT ON FUNCTION worker_hash_partition_table(bigint, integer, text, text, oid,
+                                                integer[])
+    IS 'hash partition query results by ranges of hashed values';
+
+RESET search_path;
@@ -0,0 +1,14 @@
+/* citus--6.1-21--6.1-22.sql */
+
+SET search_path = 'pg_catalog';
+
+DROP FUNCTION worker_finish_partition_push(bigint, integer, integer);
+
+CREATE FUNCTION worker_finish_partition_stream(bigint, integer, integer[])
+    RETURNS void
+    LANGUAGE C STRICT
+    AS 'MODULE_PATHNAME', $$worker_finish_partition_stream$$;
+COMMENT ON FUNCTION worker_finish_partition_stream(bigint, integer, integer[])
+    IS 'split partitions streamed by a map task into pushed partition files';
+
+RESET search_path;
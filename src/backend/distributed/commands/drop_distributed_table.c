@@ -13,6 +13,7 @@
 
 #include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
+#include "distributed/master_statistics.h"
 #include "distributed/metadata_sync.h"
 #include "distributed/worker_transaction.h"
 #include "utils/builtins.h"
@@ -41,6 +42,7 @@ master_drop_distributed_table_metadata(PG_FUNCTION_ARGS)
 	CheckTableSchemaNameForDrop(relationId, &schemaName, &tableName);
 
 	DeletePartitionRow(relationId);
+	DeleteDistributedTableStatistics(relationId);
 
 	shouldSyncMetadata = ShouldSyncTableMetadata(relationId);
 	if (shouldSyncMetadata)
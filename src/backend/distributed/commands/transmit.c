@@ -14,6 +14,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "distributed/partition_memory.h"
 #include "distributed/relay_utility.h"
 #include "distributed/transmit.h"
 #include "libpq/libpq.h"
@@ -74,7 +75,9 @@ RedirectCopyDataToRegularFile(const char *filename)
 /*
  * SendRegularFile reads data from the given file, and sends these data to
  * stdout using the standard copy protocol. After all file data are sent, the
- * function ends the copy protocol and closes the file.
+ * function ends the copy protocol and closes the file. If the file is a
+ * partition file kept in shared memory, the function sends the data from
+ * memory instead.
  */
 void
 SendRegularFile(const char *filename)
@@ -86,6 +89,22 @@ SendRegularFile(const char *filename)
 	const int fileFlags = (O_RDONLY | PG_BINARY);
 	const int fileMode = 0;
 
+	StringInfo partitionData = LoadInMemoryPartition(filename);
+	if (partitionData != NULL)
+	{
+		SendCopyOutStart();
+
+		if (partitionData->len > 0)
+		{
+			SendCopyData(partitionData);
+		}
+
+		SendCopyDone();
+
+		FreeStringInfo(partitionData);
+		return;
+	}
+
 	/* we currently do not check if the caller has permissions for this file */
 	fileDesc = FileOpenForTransmit(filename, fileFlags, fileMode);
 
@@ -277,6 +277,23 @@ MultiClientConnectionUp(int32 connectionId)
 }
 
 
+/*
+ * MultiClientSocket returns the socket descriptor of the given connection, so
+ * that callers can wait for activity on the connection.
+ */
+int
+MultiClientSocket(int32 connectionId)
+{
+	MultiConnection *connection = NULL;
+
+	Assert(connectionId != INVALID_CONNECTION_ID);
+	connection = ClientConnectionArray[connectionId];
+	Assert(connection != NULL);
+
+	return PQsocket(connection->pgConn);
+}
+
+
 /* MultiClientExecute synchronously executes a query over the given connection. */
 bool
 MultiClientExecute(int32 connectionId, const char *query, void **queryResult,
@@ -75,8 +75,11 @@ multi_ExecutorStart(QueryDesc *queryDesc, int eflags)
 		{
 			PlannedStmt *masterSelectPlan = MasterNodeSelectPlan(multiPlan);
 			CreateStmt *masterCreateStmt = MasterNodeCreateStatement(multiPlan);
+			List *mergeCreateStmtList = MasterNodeMergeCreateStatementList(multiPlan);
 			List *masterCopyStmtList = MasterNodeCopyStatementList(multiPlan);
-			RangeTblEntry *masterRangeTableEntry = NULL;
+			List *taskCopyStmtList = NIL;
+			ListCell *mergeCreateStmtCell = NULL;
+			ListCell *masterRangeTableCell = NULL;
 			StringInfo jobDirectoryName = NULL;
 
 			/*
@@ -89,6 +92,44 @@ multi_ExecutorStart(QueryDesc *queryDesc, int eflags)
 			ResourceOwnerEnlargeJobDirectories(CurrentResourceOwner);
 			ResourceOwnerRememberJobDirectory(CurrentResourceOwner, workerJob->jobId);
 
+			/*
+			 * We create the result relation before executing tasks, so that the
+			 * executors can copy task results into it as tasks complete.
+			 */
+			ProcessUtility((Node *) masterCreateStmt,
+						   "(temp table creation)",
+						   PROCESS_UTILITY_QUERY,
+						   NULL,
+						   None_Receiver,
+						   NULL);
+
+			/* make the temporary table visible */
+			CommandCounterIncrement();
+
+			/* if we merge sorted task results, create a child table for each task */
+			foreach(mergeCreateStmtCell, mergeCreateStmtList)
+			{
+				Node *mergeCreateStmt = (Node *) lfirst(mergeCreateStmtCell);
+
+				ProcessUtility(mergeCreateStmt,
+							   "(merge table creation)",
+							   PROCESS_UTILITY_QUERY,
+							   NULL,
+							   None_Receiver,
+							   NULL);
+			}
+
+			if (mergeCreateStmtList != NIL)
+			{
+				CommandCounterIncrement();
+			}
+
+			/* unless copying results incrementally, executors leave copies to us */
+			if (EnableIncrementalResultCopy)
+			{
+				taskCopyStmtList = masterCopyStmtList;
+			}
+
 			/* pick distributed executor to use */
 			if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
 			{
@@ -96,27 +137,24 @@ multi_ExecutorStart(QueryDesc *queryDesc, int eflags)
 			}
 			else if (executorType == MULTI_EXECUTOR_REAL_TIME)
 			{
-				MultiRealTimeExecute(workerJob);
+				MultiRealTimeExecute(workerJob, taskCopyStmtList);
 			}
 			else if (executorType == MULTI_EXECUTOR_TASK_TRACKER)
 			{
-				MultiTaskTrackerExecute(workerJob);
+				MultiTaskTrackerExecute(workerJob, taskCopyStmtList);
 			}
 
-			/* then create the result relation */
-			ProcessUtility((Node *) masterCreateStmt,
-						   "(temp table creation)",
-						   PROCESS_UTILITY_QUERY,
-						   NULL,
-						   None_Receiver,
-						   NULL);
-
-			/* make the temporary table visible */
-			CommandCounterIncrement();
-
 			if (!(eflags & EXEC_FLAG_EXPLAIN_ONLY))
 			{
-				CopyQueryResults(masterCopyStmtList);
+				if (taskCopyStmtList == NIL)
+				{
+					CopyQueryResults(masterCopyStmtList);
+				}
+				else
+				{
+					/* make the incrementally copied contents visible */
+					CommandCounterIncrement();
+				}
 			}
 
 			/*
@@ -129,14 +167,18 @@ multi_ExecutorStart(QueryDesc *queryDesc, int eflags)
 			queryDesc->snapshot->curcid = GetCurrentCommandId(false);
 
 			/*
-			 * Set the OID of the RTE used in the master select statement to point
-			 * to the now created (and filled) temporary table. The target
-			 * relation's oid is only known now.
+			 * Set the OIDs of the RTEs used in the master select statement to
+			 * point to the now created (and filled) temporary tables. The target
+			 * relations' oids are only known now.
 			 */
-			masterRangeTableEntry =
-				(RangeTblEntry *) linitial(masterSelectPlan->rtable);
-			masterRangeTableEntry->relid =
-				RelnameGetRelid(masterRangeTableEntry->eref->aliasname);
+			foreach(masterRangeTableCell, masterSelectPlan->rtable)
+			{
+				RangeTblEntry *masterRangeTableEntry =
+					(RangeTblEntry *) lfirst(masterRangeTableCell);
+
+				masterRangeTableEntry->relid =
+					RelnameGetRelid(masterRangeTableEntry->eref->aliasname);
+			}
 
 			/*
 			 * Replace to-be-run query with the master select query. As the
@@ -257,7 +299,8 @@ multi_ExecutorEnd(QueryDesc *queryDesc)
 
 	/*
 	 * Final step of a distributed query is executing the master node select
-	 * query. We clean up the temp tables after executing it, if we already created it.
+	 * query. We clean up the temp tables after executing it, if we already created
+	 * them. Besides the master table, these include any tables we merged.
 	 */
 	if (eflags & EXEC_FLAG_CITUS_MASTER_SELECT)
 	{
@@ -265,14 +308,20 @@ multi_ExecutorEnd(QueryDesc *queryDesc)
 		int savedLogMinMessages = 0;
 		int savedClientMinMessages = 0;
 
-		RangeTblEntry *rangeTableEntry = linitial(planStatement->rtable);
-		Oid masterTableRelid = rangeTableEntry->relid;
+		ObjectAddresses *masterTableObjects = new_object_addresses();
+		ListCell *rangeTableCell = NULL;
+
+		foreach(rangeTableCell, planStatement->rtable)
+		{
+			RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+			ObjectAddress masterTableObject = { InvalidOid, InvalidOid, 0 };
 
-		ObjectAddress masterTableObject = { InvalidOid, InvalidOid, 0 };
+			masterTableObject.classId = RelationRelationId;
+			masterTableObject.objectId = rangeTableEntry->relid;
+			masterTableObject.objectSubId = 0;
 
-		masterTableObject.classId = RelationRelationId;
-		masterTableObject.objectId = masterTableRelid;
-		masterTableObject.objectSubId = 0;
+			add_exact_object_address(&masterTableObject, masterTableObjects);
+		}
 
 		/*
 		 * Temporarily change logging level to avoid DEBUG2 logging output by
@@ -285,7 +334,8 @@ multi_ExecutorEnd(QueryDesc *queryDesc)
 		log_min_messages = INFO;
 		client_min_messages = INFO;
 
-		performDeletion(&masterTableObject, DROP_RESTRICT, PERFORM_DELETION_INTERNAL);
+		performMultipleDeletions(masterTableObjects, DROP_RESTRICT,
+								 PERFORM_DELETION_INTERNAL);
 
 		log_min_messages = savedLogMinMessages;
 		client_min_messages = savedClientMinMessages;
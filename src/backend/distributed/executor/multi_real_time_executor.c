@@ -35,11 +35,13 @@
 
 /* Local functions forward declarations */
 static ConnectAction ManageTaskExecution(Task *task, TaskExecution *taskExecution,
-										 TaskExecutionStatus *executionStatus);
+										 TaskExecutionStatus *executionStatus,
+										 TopKBound *topKBound);
 static bool TaskExecutionReadyToStart(TaskExecution *taskExecution);
 static bool TaskExecutionCompleted(TaskExecution *taskExecution);
 static void CancelTaskExecutionIfActive(TaskExecution *taskExecution);
 static void CancelRequestIfActive(TaskExecStatus taskStatus, int connectionId);
+static void CleanupTaskExecutionList(List *taskExecutionList);
 
 /* Worker node state hash functions */
 static HTAB * WorkerHash(const char *workerHashName, List *workerNodeList);
@@ -63,10 +65,11 @@ static void UpdateConnectionCounter(WorkerNodeState *workerNode,
  * MultiRealTimeExecute loops over the given tasks, and manages their execution
  * until either one task permanently fails or all tasks successfully complete.
  * The function opens up a connection for each task it needs to execute, and
- * manages these tasks' execution in real-time.
+ * manages these tasks' execution in real-time. If master copy statements are
+ * given, the function copies each task's results as soon as the task completes.
  */
 void
-MultiRealTimeExecute(Job *job)
+MultiRealTimeExecute(Job *job, List *masterCopyStmtList)
 {
 	List *taskList = job->taskList;
 	List *taskExecutionList = NIL;
@@ -76,6 +79,8 @@ MultiRealTimeExecute(Job *job)
 	bool allTasksCompleted = false;
 	bool taskCompleted = false;
 	bool taskFailed = false;
+	TopKBound *topKBound = NULL;
+	HTAB *taskCopyStatementHash = NULL;
 
 	List *workerNodeList = NIL;
 	HTAB *workerHash = NULL;
@@ -94,6 +99,12 @@ MultiRealTimeExecute(Job *job)
 		taskExecutionList = lappend(taskExecutionList, taskExecution);
 	}
 
+	/* for top-k queries, track a bound to tighten tasks that did not start yet */
+	topKBound = CreateTopKBound(job);
+
+	/* if copying results as tasks complete, look up copy statements by task id */
+	taskCopyStatementHash = TaskCopyStatementHash(job, masterCopyStmtList);
+
 	/* loop around until all tasks complete, one task fails, or user cancels */
 	while (!(allTasksCompleted || taskFailed || QueryCancelPending))
 	{
@@ -113,6 +124,7 @@ MultiRealTimeExecute(Job *job)
 			ConnectAction connectAction = CONNECT_ACTION_NONE;
 			WorkerNodeState *workerNodeState = NULL;
 			TaskExecutionStatus executionStatus;
+			bool taskPreviouslyCompleted = false;
 
 			workerNodeState = LookupWorkerForTask(workerHash, task, taskExecution);
 
@@ -125,7 +137,9 @@ MultiRealTimeExecute(Job *job)
 			}
 
 			/* call the function that performs the core task execution logic */
-			connectAction = ManageTaskExecution(task, taskExecution, &executionStatus);
+			taskPreviouslyCompleted = TaskExecutionCompleted(taskExecution);
+			connectAction = ManageTaskExecution(task, taskExecution, &executionStatus,
+												topKBound);
 
 			/* update the connection counter for throttling */
 			UpdateConnectionCounter(workerNodeState, connectAction);
@@ -146,6 +160,28 @@ MultiRealTimeExecute(Job *job)
 			if (taskCompleted)
 			{
 				completedTaskCount++;
+
+				if (!taskPreviouslyCompleted)
+				{
+					PG_TRY();
+					{
+						CopyTaskResults(taskCopyStatementHash, task);
+					}
+					PG_CATCH();
+					{
+						/* close connections and open files before erroring out */
+						CleanupTaskExecutionList(taskExecutionList);
+
+						PG_RE_THROW();
+					}
+					PG_END_TRY();
+
+					/* use the newly fetched results to bound the remaining tasks */
+					if (topKBound != NULL)
+					{
+						UpdateTopKBound(topKBound, task);
+					}
+				}
 			}
 			else
 			{
@@ -209,12 +245,7 @@ MultiRealTimeExecute(Job *job)
 	}
 
 	/* close connections and open files */
-	taskExecutionCell = NULL;
-	foreach(taskExecutionCell, taskExecutionList)
-	{
-		TaskExecution *taskExecution = (TaskExecution *) lfirst(taskExecutionCell);
-		CleanupTaskExecution(taskExecution);
-	}
+	CleanupTaskExecutionList(taskExecutionList);
 
 	RESUME_INTERRUPTS();
 
@@ -243,11 +274,12 @@ MultiRealTimeExecute(Job *job)
  * separate connection to the worker node for each execution. The function
  * returns a ConnectAction enum indicating whether a connection has been opened
  * or closed in this call.  Via the executionStatus parameter this function returns
- * what a Task is blocked on.
+ * what a Task is blocked on. If a top-k bound is given, the function applies the
+ * bound to the task's query when sending it.
  */
 static ConnectAction
 ManageTaskExecution(Task *task, TaskExecution *taskExecution,
-					TaskExecutionStatus *executionStatus)
+					TaskExecutionStatus *executionStatus, TopKBound *topKBound)
 {
 	TaskExecStatus *taskStatusArray = taskExecution->taskStatusArray;
 	int32 *connectionIdArray = taskExecution->connectionIdArray;
@@ -466,6 +498,11 @@ ManageTaskExecution(Task *task, TaskExecution *taskExecution,
 			/* construct new query to copy query results to stdout */
 			char *queryString = task->queryString;
 			StringInfo computeTaskQuery = makeStringInfo();
+			if (topKBound != NULL)
+			{
+				queryString = TopKBoundedQueryString(topKBound, task);
+			}
+
 			if (BinaryMasterCopyFormat)
 			{
 				appendStringInfo(computeTaskQuery, COPY_QUERY_TO_STDOUT_BINARY,
@@ -707,6 +744,23 @@ CancelRequestIfActive(TaskExecStatus taskStatus, int connectionId)
 }
 
 
+/*
+ * CleanupTaskExecutionList closes the connections and open files of the given
+ * task executions. Closing a connection does not wait on the worker node, so
+ * the function is also safe to call while an error propagates.
+ */
+static void
+CleanupTaskExecutionList(List *taskExecutionList)
+{
+	ListCell *taskExecutionCell = NULL;
+	foreach(taskExecutionCell, taskExecutionList)
+	{
+		TaskExecution *taskExecution = (TaskExecution *) lfirst(taskExecutionCell);
+		CleanupTaskExecution(taskExecution);
+	}
+}
+
+
 /*
  * WorkerHash creates a worker node hash with the given name. The function
  * then inserts one entry for each worker node in the given worker node
@@ -20,11 +20,13 @@
 
 #include <string.h>
 
+#include "access/heapam.h"
 #include "access/htup.h"
 #include "access/sdir.h"
 #include "access/transam.h"
 #include "access/tupdesc.h"
 #include "access/xact.h"
+#include "catalog/pg_index.h"
 #include "catalog/pg_type.h"
 #include "distributed/citus_clauses.h"
 #include "distributed/citus_ruleutils.h"
@@ -40,11 +42,13 @@
 #include "distributed/multi_planner.h"
 #include "distributed/multi_router_executor.h"
 #include "distributed/multi_router_planner.h"
+#include "distributed/multi_server_executor.h"
 #include "distributed/multi_shard_transaction.h"
 #include "distributed/relay_utility.h"
 #include "distributed/remote_commands.h"
 #include "distributed/remote_transaction.h"
 #include "distributed/resource_lock.h"
+#include "distributed/worker_manager.h"
 #include "executor/execdesc.h"
 #include "executor/executor.h"
 #include "executor/instrument.h"
@@ -66,12 +70,18 @@
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/palloc.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+#include "utils/syscache.h"
 #include "utils/tuplestore.h"
 
 
 /* controls use of locks to enforce safe commutativity */
 bool AllModificationsCommutative = false;
 
+/* controls whether modifications in transaction blocks wait for their results */
+bool PipelineTransactionModifications = false;
+
 
 /*
  * The following static variables are necessary to track the progression of
@@ -87,14 +97,50 @@ bool AllModificationsCommutative = false;
 static HTAB *xactParticipantHash = NULL;
 static List *xactShardConnSetList = NIL;
 
+/*
+ * Connections of the current transaction on which we sent a modification
+ * without waiting for its result, see ExecutePipelinedModifyTask.
+ */
+static List *pipelinedConnectionList = NIL;
+
+/*
+ * Jobs of repartitioned INSERT ... SELECT queries that failed before removing
+ * their files from the worker nodes, see ExecuteRepartitionedInsertSelect.
+ */
+static List *failedJobIdList = NIL;
+
 /* functions needed during start phase */
 static void InitTransactionStateForTask(Task *task);
 static HTAB * CreateXactParticipantHash(void);
 
+/*
+ * NodeCommandList holds the commands to run on a node, in order. We use it to
+ * run commands on multiple nodes in parallel.
+ */
+typedef struct NodeCommandList
+{
+	char *nodeName;
+	uint32 nodePort;
+	List *commandList;
+} NodeCommandList;
+
+
 /* functions needed during run phase */
 static void ReacquireMetadataLocks(List *taskList);
+static void ExecuteRepartitionedInsertSelect(QueryDesc *queryDesc, Job *workerJob);
+static void CleanupFailedJobs(void);
+static List * ExecuteMapTasks(List *mapTaskList);
+static void FetchMapOutputs(List *insertTaskList, List *mapTaskList,
+							List *mapPlacementList);
+static List * AppendNodeCommand(List *nodeCommandList, char *nodeName,
+								uint32 nodePort, char *command);
+static void ExecuteNodeCommandLists(List *nodeCommandList, int elevel);
 static bool ExecuteSingleTask(QueryDesc *queryDesc, Task *task,
 							  bool isModificationQuery, bool expectResults);
+static bool ExecuteSingleModifyTask(QueryDesc *queryDesc, Task *task,
+									bool expectResults);
+static void ExecutePipelinedModifyTask(QueryDesc *queryDesc, Task *task);
+static void FinishPipelinedModification(PGconn *connection);
 static void ExecuteMultipleTasks(QueryDesc *queryDesc, List *taskList,
 								 bool isModificationQuery, bool expectResults);
 static int64 ExecuteModifyTasks(List *taskList, bool expectResults,
@@ -105,6 +151,7 @@ static List * TaskShardIntervalList(List *taskList);
 static void AcquireExecutorShardLock(Task *task, CmdType commandType);
 static void AcquireExecutorMultiShardLocks(List *taskList);
 static bool RequiresConsistentSnapshot(Task *task);
+static bool ShardHasUniqueIndex(uint64 shardId);
 static uint64 ReturnRowsFromTuplestore(uint64 tupleCount, TupleDesc tupleDescriptor,
 									   DestReceiver *destination,
 									   Tuplestorestate *tupleStore);
@@ -346,8 +393,6 @@ AcquireExecutorShardLock(Task *task, CmdType commandType)
 		 * out-of-order only affects the table order on disk, but not the
 		 * contents.
 		 *
-		 * When a unique constraint exists, INSERTs are not strictly commutative,
-		 * but whichever INSERT comes last will error out and thus has no effect.
 		 * INSERT is not commutative with UPDATE/DELETE/UPSERT, since the
 		 * UPDATE/DELETE/UPSERT may consider the INSERT, depending on execution
 		 * order.
@@ -356,9 +401,22 @@ AcquireExecutorShardLock(Task *task, CmdType commandType)
 		 * multiple INSERT commands to proceed concurrently. It conflicts with
 		 * ExclusiveLock obtained by UPDATE/DELETE/UPSERT, ensuring those do
 		 * not run concurrently with INSERT.
+		 *
+		 * When a unique constraint exists, INSERTs are not strictly commutative.
+		 * Since we send a modification to all placements at once, two INSERTs
+		 * of the same key may each reach a different placement first, in which
+		 * case both error out and leave different rows on the replicas. We
+		 * therefore serialize INSERTs into such shards using an ExclusiveLock.
 		 */
 
-		lockMode = RowExclusiveLock;
+		if (ShardHasUniqueIndex(shardId))
+		{
+			lockMode = ExclusiveLock;
+		}
+		else
+		{
+			lockMode = RowExclusiveLock;
+		}
 	}
 	else
 	{
@@ -389,6 +447,53 @@ AcquireExecutorShardLock(Task *task, CmdType commandType)
 }
 
 
+/*
+ * ShardHasUniqueIndex returns whether the distributed table of the given shard
+ * has a unique index or an exclusion constraint, either of which may make
+ * concurrent INSERTs fail on some placements but not on others.
+ */
+static bool
+ShardHasUniqueIndex(uint64 shardId)
+{
+	ShardInterval *shardInterval = LoadShardInterval(shardId);
+	Oid relationId = shardInterval->relationId;
+	Relation relation = heap_open(relationId, AccessShareLock);
+	List *indexOidList = RelationGetIndexList(relation);
+	ListCell *indexOidCell = NULL;
+	bool hasUniqueIndex = false;
+
+	foreach(indexOidCell, indexOidList)
+	{
+		Oid indexOid = lfirst_oid(indexOidCell);
+		HeapTuple indexTuple = SearchSysCache1(INDEXRELID, ObjectIdGetDatum(indexOid));
+		Form_pg_index indexForm = NULL;
+
+		if (!HeapTupleIsValid(indexTuple))
+		{
+			ereport(ERROR, (errmsg("cache lookup failed for index %u", indexOid)));
+		}
+
+		indexForm = (Form_pg_index) GETSTRUCT(indexTuple);
+		if (indexForm->indisunique || indexForm->indisexclusion)
+		{
+			hasUniqueIndex = true;
+		}
+
+		ReleaseSysCache(indexTuple);
+
+		if (hasUniqueIndex)
+		{
+			break;
+		}
+	}
+
+	list_free(indexOidList);
+	heap_close(relation, NoLock);
+
+	return hasUniqueIndex;
+}
+
+
 /*
  * AcquireExecutorMultiShardLocks acquires shard locks needed for execution
  * of writes on multiple shards. In addition to honouring commutativity
@@ -629,7 +734,11 @@ RouterExecutorRun(QueryDesc *queryDesc, ScanDirection direction, long count)
 			RebuildQueryStrings(jobQuery, taskList);
 		}
 
-		if (list_length(taskList) == 1)
+		if (workerJob->dependedJobList != NIL)
+		{
+			ExecuteRepartitionedInsertSelect(queryDesc, workerJob);
+		}
+		else if (list_length(taskList) == 1)
 		{
 			Task *task = (Task *) linitial(taskList);
 			bool resultsOK = false;
@@ -707,15 +816,11 @@ ExecuteSingleTask(QueryDesc *queryDesc, Task *task,
 {
 	CmdType operation = queryDesc->operation;
 	TupleDesc tupleDescriptor = queryDesc->tupDesc;
-	EState *executorState = queryDesc->estate;
 	MaterialState *routerState = (MaterialState *) queryDesc->planstate;
 	ParamListInfo paramListInfo = queryDesc->params;
 	bool resultsOK = false;
 	List *taskPlacementList = task->taskPlacementList;
 	ListCell *taskPlacementCell = NULL;
-	List *failedPlacementList = NIL;
-	int64 affectedTupleCount = -1;
-	bool gotResults = false;
 	char *queryString = task->queryString;
 
 	if (XactModificationLevel == XACT_MODIFICATION_MULTI_SHARD)
@@ -740,6 +845,20 @@ ExecuteSingleTask(QueryDesc *queryDesc, Task *task,
 	/* prevent replicas of the same shard from diverging */
 	AcquireExecutorShardLock(task, operation);
 
+	/* in transaction blocks, modifications may return before they finish */
+	if (isModificationQuery && !expectResults && PipelineTransactionModifications &&
+		xactParticipantHash != NULL)
+	{
+		ExecutePipelinedModifyTask(queryDesc, task);
+		return true;
+	}
+
+	/* modifications run on all placements at once */
+	if (isModificationQuery)
+	{
+		return ExecuteSingleModifyTask(queryDesc, task, expectResults);
+	}
+
 	/*
 	 * Try to run the query to completion on one placement. If the query fails
 	 * attempt the query on the next placement.
@@ -755,7 +874,6 @@ ExecuteSingleTask(QueryDesc *queryDesc, Task *task,
 
 		if (connection == NULL)
 		{
-			failedPlacementList = lappend(failedPlacementList, taskPlacement);
 			continue;
 		}
 
@@ -763,16 +881,10 @@ ExecuteSingleTask(QueryDesc *queryDesc, Task *task,
 		if (!queryOK)
 		{
 			PurgeConnectionForPlacement(connection, taskPlacement);
-			failedPlacementList = lappend(failedPlacementList, taskPlacement);
 			continue;
 		}
 
-		/*
-		 * If caller is interested, store query results the first time
-		 * through. The output of the query's execution on other shards is
-		 * discarded if we run there (because it's a modification query).
-		 */
-		if (!gotResults && expectResults)
+		if (expectResults)
 		{
 			queryOK = StoreQueryResult(routerState, connection, tupleDescriptor,
 									   failOnError, &currentAffectedTupleCount);
@@ -785,6 +897,125 @@ ExecuteSingleTask(QueryDesc *queryDesc, Task *task,
 
 		if (queryOK)
 		{
+			resultsOK = true;
+			break;
+		}
+
+		PurgeConnectionForPlacement(connection, taskPlacement);
+	}
+
+	return resultsOK;
+}
+
+
+/*
+ * ExecuteSingleModifyTask executes a modification task on all placements of
+ * its shard. The function first sends the command to all placements, and then
+ * collects the results in placement order, so that replicas run the command
+ * concurrently rather than one after the other. Results are stored from the
+ * first placement that succeeds, if the caller expects results.
+ *
+ * Placements on which the command fails are marked as invalid, unless the
+ * command failed on all placements, in which case we error out. Constraint
+ * violations are reraised, since all placements must report them. This relies
+ * on AcquireExecutorShardLock serializing INSERTs into shards with unique
+ * indexes, as concurrent INSERTs could otherwise win the same key on
+ * different placements.
+ */
+static bool
+ExecuteSingleModifyTask(QueryDesc *queryDesc, Task *task, bool expectResults)
+{
+	TupleDesc tupleDescriptor = queryDesc->tupDesc;
+	EState *executorState = queryDesc->estate;
+	MaterialState *routerState = (MaterialState *) queryDesc->planstate;
+	ParamListInfo paramListInfo = queryDesc->params;
+	bool resultsOK = false;
+	List *taskPlacementList = task->taskPlacementList;
+	ListCell *taskPlacementCell = NULL;
+	ListCell *failedPlacementCell = NULL;
+	List *failedPlacementList = NIL;
+	int placementCount = list_length(taskPlacementList);
+	PGconn **connectionArray = (PGconn **) palloc0(placementCount * sizeof(PGconn *));
+	int placementIndex = 0;
+	int64 affectedTupleCount = -1;
+	bool gotResults = false;
+	char *queryString = task->queryString;
+
+	/* send the command to all placements before waiting for any of them */
+	foreach(taskPlacementCell, taskPlacementList)
+	{
+		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(taskPlacementCell);
+		bool isModificationQuery = true;
+		bool queryOK = false;
+		PGconn *connection = GetConnectionForPlacement(taskPlacement,
+													   isModificationQuery);
+
+		if (connection == NULL)
+		{
+			failedPlacementList = lappend(failedPlacementList, taskPlacement);
+			placementIndex++;
+			continue;
+		}
+
+		queryOK = SendQueryInSingleRowMode(connection, queryString, paramListInfo);
+		if (!queryOK)
+		{
+			PurgeConnectionForPlacement(connection, taskPlacement);
+			failedPlacementList = lappend(failedPlacementList, taskPlacement);
+			placementIndex++;
+			continue;
+		}
+
+		connectionArray[placementIndex] = connection;
+		placementIndex++;
+	}
+
+	PG_TRY();
+	{
+		placementIndex = 0;
+
+		/* collect the results in placement order */
+		foreach(taskPlacementCell, taskPlacementList)
+		{
+			ShardPlacement *taskPlacement =
+				(ShardPlacement *) lfirst(taskPlacementCell);
+			PGconn *connection = connectionArray[placementIndex];
+			bool queryOK = false;
+			bool failOnError = false;
+			int64 currentAffectedTupleCount = 0;
+
+			/* we're done with this placement's results, whatever happens */
+			connectionArray[placementIndex] = NULL;
+			placementIndex++;
+
+			if (connection == NULL)
+			{
+				continue;
+			}
+
+			/*
+			 * If caller is interested, store query results the first time
+			 * through. The output of the query's execution on other shards is
+			 * discarded.
+			 */
+			if (!gotResults && expectResults)
+			{
+				queryOK = StoreQueryResult(routerState, connection, tupleDescriptor,
+										   failOnError, &currentAffectedTupleCount);
+			}
+			else
+			{
+				queryOK = ConsumeQueryResult(connection, failOnError,
+											 &currentAffectedTupleCount);
+			}
+
+			if (!queryOK)
+			{
+				PurgeConnectionForPlacement(connection, taskPlacement);
+				failedPlacementList = lappend(failedPlacementList, taskPlacement);
+				continue;
+			}
+
 			if ((affectedTupleCount == -1) ||
 				(affectedTupleCount == currentAffectedTupleCount))
 			{
@@ -808,49 +1039,174 @@ ExecuteSingleTask(QueryDesc *queryDesc, Task *task,
 
 			resultsOK = true;
 			gotResults = true;
+		}
+	}
+	PG_CATCH();
+	{
+		int remainingIndex = 0;
 
-			/*
-			 * Modifications have to be executed on all placements, but for
-			 * read queries we can stop here.
-			 */
-			if (!isModificationQuery)
+		/*
+		 * The other placements may still be running the command, and waiting
+		 * for their results could delay the error for a long time. We close
+		 * their connections instead of reading their results.
+		 */
+		for (remainingIndex = 0; remainingIndex < placementCount; remainingIndex++)
+		{
+			PGconn *connection = connectionArray[remainingIndex];
+
+			if (connection != NULL)
 			{
-				break;
+				ShardPlacement *taskPlacement =
+					(ShardPlacement *) list_nth(taskPlacementList, remainingIndex);
+
+				PurgeConnectionForPlacement(connection, taskPlacement);
 			}
 		}
-		else
-		{
-			PurgeConnectionForPlacement(connection, taskPlacement);
 
-			failedPlacementList = lappend(failedPlacementList, taskPlacement);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
 
-			continue;
-		}
+	/* if all placements failed, error out */
+	if (list_length(failedPlacementList) == placementCount)
+	{
+		ereport(ERROR, (errmsg("could not modify any active placements")));
 	}
 
-	if (isModificationQuery)
+	/* otherwise, mark failed placements as inactive: they're stale */
+	foreach(failedPlacementCell, failedPlacementList)
+	{
+		ShardPlacement *failedPlacement = (ShardPlacement *) lfirst(failedPlacementCell);
+
+		UpdateShardPlacementState(failedPlacement->placementId, FILE_INACTIVE);
+	}
+
+	executorState->es_processed = affectedTupleCount;
+
+	return resultsOK;
+}
+
+
+/*
+ * ExecutePipelinedModifyTask sends a modification that returns no rows to all
+ * placements of its shard over the transaction's connections, but does not
+ * wait for the results. FinishPipelinedModification collects a result before
+ * its connection is used again, and FinishPipelinedModifications collects all
+ * remaining results at commit time. Since the number
+ * of modified rows is not known yet, the command reports zero rows.
+ *
+ * Placements we cannot send the command to are marked as invalid right away,
+ * as in ExecuteSingleModifyTask.
+ */
+static void
+ExecutePipelinedModifyTask(QueryDesc *queryDesc, Task *task)
+{
+	EState *executorState = queryDesc->estate;
+	ParamListInfo paramListInfo = queryDesc->params;
+	List *taskPlacementList = task->taskPlacementList;
+	ListCell *taskPlacementCell = NULL;
+	ListCell *failedPlacementCell = NULL;
+	List *failedPlacementList = NIL;
+	char *queryString = task->queryString;
+	MemoryContext oldContext = NULL;
+
+	foreach(taskPlacementCell, taskPlacementList)
 	{
-		ListCell *failedPlacementCell = NULL;
+		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(taskPlacementCell);
+		bool isModificationQuery = true;
+		bool queryOK = false;
+		PGconn *connection = GetConnectionForPlacement(taskPlacement,
+													   isModificationQuery);
 
-		/* if all placements failed, error out */
-		if (list_length(failedPlacementList) == list_length(task->taskPlacementList))
+		if (connection == NULL)
 		{
-			ereport(ERROR, (errmsg("could not modify any active placements")));
+			failedPlacementList = lappend(failedPlacementList, taskPlacement);
+			continue;
 		}
 
-		/* otherwise, mark failed placements as inactive: they're stale */
-		foreach(failedPlacementCell, failedPlacementList)
+		queryOK = SendQueryInSingleRowMode(connection, queryString, paramListInfo);
+		if (!queryOK)
 		{
-			ShardPlacement *failedPlacement =
-				(ShardPlacement *) lfirst(failedPlacementCell);
-
-			UpdateShardPlacementState(failedPlacement->placementId, FILE_INACTIVE);
+			PurgeConnectionForPlacement(connection, taskPlacement);
+			failedPlacementList = lappend(failedPlacementList, taskPlacement);
+			continue;
 		}
 
-		executorState->es_processed = affectedTupleCount;
+		/* the list must last until we collect the results */
+		oldContext = MemoryContextSwitchTo(TopTransactionContext);
+		pipelinedConnectionList = lappend(pipelinedConnectionList, connection);
+		MemoryContextSwitchTo(oldContext);
 	}
 
-	return resultsOK;
+	/* if all placements failed, error out */
+	if (list_length(failedPlacementList) == list_length(taskPlacementList))
+	{
+		ereport(ERROR, (errmsg("could not modify any active placements")));
+	}
+
+	/* otherwise, mark failed placements as inactive: they're stale */
+	foreach(failedPlacementCell, failedPlacementList)
+	{
+		ShardPlacement *failedPlacement = (ShardPlacement *) lfirst(failedPlacementCell);
+
+		UpdateShardPlacementState(failedPlacement->placementId, FILE_INACTIVE);
+	}
+
+	executorState->es_processed = 0;
+}
+
+
+/*
+ * FinishPipelinedModifications collects the results of all modifications that
+ * ExecutePipelinedModifyTask sent without waiting for them.
+ */
+void
+FinishPipelinedModifications(void)
+{
+	while (pipelinedConnectionList != NIL)
+	{
+		PGconn *connection = (PGconn *) linitial(pipelinedConnectionList);
+
+		FinishPipelinedModification(connection);
+	}
+}
+
+
+/*
+ * FinishPipelinedModification collects the result of the modification sent
+ * over the given connection without waiting for it, if there is one. Any
+ * failure raises an error, which aborts the transaction: the statement that
+ * failed already returned, so we cannot fail it on its own.
+ */
+static void
+FinishPipelinedModification(PGconn *connection)
+{
+	bool failOnError = true;
+	int64 affectedTupleCount = 0;
+	bool queryOK = false;
+
+	if (!list_member_ptr(pipelinedConnectionList, connection))
+	{
+		return;
+	}
+
+	/* whatever happens, don't wait on this connection again */
+	pipelinedConnectionList = list_delete_ptr(pipelinedConnectionList, connection);
+
+	/* abort in case of cancellation */
+	CHECK_FOR_INTERRUPTS();
+
+	queryOK = ConsumeQueryResult(connection, failOnError, &affectedTupleCount);
+	if (!queryOK)
+	{
+		char *nodeName = ConnectionGetOptionValue(connection, "host");
+		char *nodePort = ConnectionGetOptionValue(connection, "port");
+
+		RemoveXactConnection(connection);
+
+		ereport(ERROR, (errmsg("could not receive the result of a pipelined "
+							   "modification from %s:%s", nodeName, nodePort)));
+	}
 }
 
 
@@ -882,6 +1238,473 @@ ExecuteMultipleTasks(QueryDesc *queryDesc, List *taskList,
 }
 
 
+/*
+ * ExecuteRepartitionedInsertSelect executes an INSERT ... SELECT query whose
+ * SELECT results are repartitioned by the target table's shards. The function
+ * first runs the map tasks in the worker job's depended job, which partition
+ * the SELECT's results on the source shards' nodes. It then has each target
+ * shard placement fetch its partition files, and runs the worker job's tasks
+ * to insert the fetched rows. The target shards are modified in the coordinated
+ * transaction like other multi-shard modifications, while partitioning and
+ * fetching happen outside of it. Finally, the function removes the job's files
+ * from all involved nodes.
+ *
+ * If the query fails, we do not wait on the nodes while the error propagates.
+ * We instead remember the job, and remove its files from all worker nodes the
+ * next time this function runs.
+ */
+static void
+ExecuteRepartitionedInsertSelect(QueryDesc *queryDesc, Job *workerJob)
+{
+	Job *mapJob = (Job *) linitial(workerJob->dependedJobList);
+	List *mapTaskList = mapJob->taskList;
+	List *insertTaskList = workerJob->taskList;
+	List *cleanupCommandList = NIL;
+	StringInfo jobCleanupQuery = makeStringInfo();
+	ListCell *taskCell = NULL;
+
+	/*
+	 * The map tasks read the source shards over new connections, which cannot
+	 * see the transaction's earlier modifications.
+	 */
+	if (XactModificationLevel > XACT_MODIFICATION_NONE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_ACTIVE_SQL_TRANSACTION),
+						errmsg("cannot open new connections after the first "
+							   "modification command within a transaction")));
+	}
+
+	if (failedJobIdList != NIL)
+	{
+		CleanupFailedJobs();
+	}
+
+	appendStringInfo(jobCleanupQuery, JOB_CLEANUP_QUERY, workerJob->jobId);
+
+	/* both the map and the insert tasks' nodes may have files for the job */
+	foreach(taskCell, list_concat(list_copy(mapTaskList), insertTaskList))
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		ListCell *placementCell = NULL;
+
+		foreach(placementCell, task->taskPlacementList)
+		{
+			ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+
+			cleanupCommandList = AppendNodeCommand(cleanupCommandList,
+												   placement->nodeName,
+												   placement->nodePort,
+												   jobCleanupQuery->data);
+		}
+	}
+
+	PG_TRY();
+	{
+		List *mapPlacementList = ExecuteMapTasks(mapTaskList);
+
+		FetchMapOutputs(insertTaskList, mapTaskList, mapPlacementList);
+
+		/* modify target shards the same way as other multi-shard modifications */
+		ExecuteMultipleTasks(queryDesc, insertTaskList, true, false);
+	}
+	PG_CATCH();
+	{
+		MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+		uint64 *jobIdPointer = (uint64 *) palloc(sizeof(uint64));
+
+		*jobIdPointer = workerJob->jobId;
+		failedJobIdList = lappend(failedJobIdList, jobIdPointer);
+
+		MemoryContextSwitchTo(oldContext);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	ExecuteNodeCommandLists(cleanupCommandList, WARNING);
+}
+
+
+/*
+ * CleanupFailedJobs removes the files of failed repartitioned INSERT ... SELECT
+ * jobs from all worker nodes. Failures are only reported as warnings, and the
+ * jobs are forgotten either way, since the task trackers remove all job files
+ * when they restart.
+ */
+static void
+CleanupFailedJobs(void)
+{
+	List *jobIdList = failedJobIdList;
+	List *workerNodeList = WorkerNodeList();
+	List *cleanupCommandList = NIL;
+	ListCell *jobIdCell = NULL;
+
+	failedJobIdList = NIL;
+
+	foreach(jobIdCell, jobIdList)
+	{
+		uint64 *jobIdPointer = (uint64 *) lfirst(jobIdCell);
+		StringInfo jobCleanupQuery = makeStringInfo();
+		ListCell *workerNodeCell = NULL;
+
+		appendStringInfo(jobCleanupQuery, JOB_CLEANUP_QUERY, *jobIdPointer);
+
+		foreach(workerNodeCell, workerNodeList)
+		{
+			WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+
+			cleanupCommandList = AppendNodeCommand(cleanupCommandList,
+												   workerNode->workerName,
+												   workerNode->workerPort,
+												   jobCleanupQuery->data);
+		}
+	}
+
+	list_free_deep(jobIdList);
+
+	ExecuteNodeCommandLists(cleanupCommandList, WARNING);
+}
+
+
+/*
+ * ExecuteMapTasks runs the given map tasks in parallel over new connections, and
+ * returns the placements on which each of the tasks succeeded, in task order. If
+ * a task fails on a placement, the function retries it on the task's next
+ * placement, and errors out if the task failed on all of its placements.
+ */
+static List *
+ExecuteMapTasks(List *mapTaskList)
+{
+	int taskCount = list_length(mapTaskList);
+	MultiConnection **connectionArray = palloc0(taskCount * sizeof(MultiConnection *));
+	ListCell **placementCellArray = palloc0(taskCount * sizeof(ListCell *));
+	bool *taskDoneArray = palloc0(taskCount * sizeof(bool));
+	int pendingTaskCount = taskCount;
+	List *mapPlacementList = NIL;
+	ListCell *taskCell = NULL;
+	int taskIndex = 0;
+
+	foreach(taskCell, mapTaskList)
+	{
+		Task *mapTask = (Task *) lfirst(taskCell);
+
+		placementCellArray[taskIndex] = list_head(mapTask->taskPlacementList);
+		if (placementCellArray[taskIndex] == NULL)
+		{
+			ereport(ERROR, (errmsg("could not find any placements for shard "
+								   UINT64_FORMAT, mapTask->anchorShardId)));
+		}
+
+		taskIndex++;
+	}
+
+	while (pendingTaskCount > 0)
+	{
+		/* start all connections first, so that we connect to nodes in parallel */
+		for (taskIndex = 0; taskIndex < taskCount; taskIndex++)
+		{
+			ShardPlacement *placement = NULL;
+
+			if (taskDoneArray[taskIndex])
+			{
+				continue;
+			}
+
+			placement = (ShardPlacement *) lfirst(placementCellArray[taskIndex]);
+			connectionArray[taskIndex] = StartNodeConnection(FORCE_NEW_CONNECTION,
+															 placement->nodeName,
+															 placement->nodePort);
+		}
+
+		taskIndex = 0;
+		foreach(taskCell, mapTaskList)
+		{
+			Task *mapTask = (Task *) lfirst(taskCell);
+			MultiConnection *connection = connectionArray[taskIndex];
+			int querySent = 0;
+
+			if (taskDoneArray[taskIndex])
+			{
+				taskIndex++;
+				continue;
+			}
+
+			FinishConnectionEstablishment(connection);
+			if (PQstatus(connection->pgConn) == CONNECTION_OK)
+			{
+				querySent = SendRemoteCommand(connection, mapTask->queryString);
+			}
+
+			if (querySent == 0)
+			{
+				ReportConnectionError(connection, WARNING);
+				CloseConnection(connection);
+				connectionArray[taskIndex] = NULL;
+			}
+
+			taskIndex++;
+		}
+
+		for (taskIndex = 0; taskIndex < taskCount; taskIndex++)
+		{
+			MultiConnection *connection = connectionArray[taskIndex];
+			const bool raiseInterrupts = true;
+			PGresult *result = NULL;
+
+			if (taskDoneArray[taskIndex] || connection == NULL)
+			{
+				continue;
+			}
+
+			result = GetRemoteCommandResult(connection, raiseInterrupts);
+			if (IsResponseOK(result))
+			{
+				taskDoneArray[taskIndex] = true;
+				pendingTaskCount--;
+			}
+			else
+			{
+				ReportResultError(connection, result, WARNING);
+			}
+
+			PQclear(result);
+			ForgetResults(connection);
+			CloseConnection(connection);
+			connectionArray[taskIndex] = NULL;
+		}
+
+		/* move the failed tasks to their next placements */
+		taskIndex = 0;
+		foreach(taskCell, mapTaskList)
+		{
+			Task *mapTask = (Task *) lfirst(taskCell);
+
+			if (!taskDoneArray[taskIndex])
+			{
+				placementCellArray[taskIndex] = lnext(placementCellArray[taskIndex]);
+				if (placementCellArray[taskIndex] == NULL)
+				{
+					ereport(ERROR, (errmsg("could not partition shard " UINT64_FORMAT
+										   " on any of its placements",
+										   mapTask->anchorShardId)));
+				}
+			}
+
+			taskIndex++;
+		}
+	}
+
+	for (taskIndex = 0; taskIndex < taskCount; taskIndex++)
+	{
+		ShardPlacement *placement = lfirst(placementCellArray[taskIndex]);
+
+		mapPlacementList = lappend(mapPlacementList, placement);
+	}
+
+	return mapPlacementList;
+}
+
+
+/*
+ * FetchMapOutputs has the nodes of each insert task's placements fetch the
+ * partition files for the task's shard from all map tasks. Fetches run in
+ * parallel across nodes, and the function errors out if any of them fails,
+ * since a placement without its rows would diverge from its replicas.
+ */
+static void
+FetchMapOutputs(List *insertTaskList, List *mapTaskList, List *mapPlacementList)
+{
+	List *fetchCommandList = NIL;
+	ListCell *insertTaskCell = NULL;
+
+	foreach(insertTaskCell, insertTaskList)
+	{
+		Task *insertTask = (Task *) lfirst(insertTaskCell);
+		ListCell *insertPlacementCell = NULL;
+
+		foreach(insertPlacementCell, insertTask->taskPlacementList)
+		{
+			ShardPlacement *insertPlacement = lfirst(insertPlacementCell);
+			ListCell *mapTaskCell = NULL;
+			ListCell *mapPlacementCell = NULL;
+
+			forboth(mapTaskCell, mapTaskList, mapPlacementCell, mapPlacementList)
+			{
+				Task *mapTask = (Task *) lfirst(mapTaskCell);
+				ShardPlacement *mapPlacement = lfirst(mapPlacementCell);
+				StringInfo fetchCommand = makeStringInfo();
+
+				appendStringInfo(fetchCommand, MAP_OUTPUT_FETCH_COMMAND,
+								 insertTask->jobId, mapTask->taskId,
+								 insertTask->partitionId, insertTask->taskId,
+								 mapPlacement->nodeName, mapPlacement->nodePort);
+
+				fetchCommandList = AppendNodeCommand(fetchCommandList,
+													 insertPlacement->nodeName,
+													 insertPlacement->nodePort,
+													 fetchCommand->data);
+			}
+		}
+	}
+
+	ExecuteNodeCommandLists(fetchCommandList, ERROR);
+}
+
+
+/*
+ * AppendNodeCommand appends the given command to the command list of the given
+ * node, and creates a command list for the node if it does not have one yet. The
+ * function skips commands that the node's list already contains, and returns the
+ * updated list of node command lists.
+ */
+static List *
+AppendNodeCommand(List *nodeCommandList, char *nodeName, uint32 nodePort,
+				  char *command)
+{
+	NodeCommandList *nodeCommands = NULL;
+	ListCell *nodeCommandCell = NULL;
+
+	foreach(nodeCommandCell, nodeCommandList)
+	{
+		NodeCommandList *existingNodeCommands = lfirst(nodeCommandCell);
+
+		if (strncmp(existingNodeCommands->nodeName, nodeName, MAX_NODE_LENGTH) == 0 &&
+			existingNodeCommands->nodePort == nodePort)
+		{
+			nodeCommands = existingNodeCommands;
+			break;
+		}
+	}
+
+	if (nodeCommands == NULL)
+	{
+		nodeCommands = palloc0(sizeof(NodeCommandList));
+		nodeCommands->nodeName = nodeName;
+		nodeCommands->nodePort = nodePort;
+
+		nodeCommandList = lappend(nodeCommandList, nodeCommands);
+	}
+
+	if (!list_member(nodeCommands->commandList, makeString(command)))
+	{
+		nodeCommands->commandList = lappend(nodeCommands->commandList,
+											makeString(command));
+	}
+
+	return nodeCommandList;
+}
+
+
+/*
+ * ExecuteNodeCommandLists runs the commands of each node command list over a new
+ * connection to its node. Nodes run their commands one at a time, but in
+ * parallel with other nodes. Connection and command failures are reported at
+ * the given log level; if that level does not throw, the function stops running
+ * commands on the failed node and continues with the other nodes.
+ */
+static void
+ExecuteNodeCommandLists(List *nodeCommandList, int elevel)
+{
+	int nodeCount = list_length(nodeCommandList);
+	MultiConnection **connectionArray = palloc0(nodeCount * sizeof(MultiConnection *));
+	ListCell **commandCellArray = palloc0(nodeCount * sizeof(ListCell *));
+	bool commandsPending = true;
+	ListCell *nodeCommandCell = NULL;
+	int nodeIndex = 0;
+
+	/* start all connections first, so that we connect to nodes in parallel */
+	foreach(nodeCommandCell, nodeCommandList)
+	{
+		NodeCommandList *nodeCommands = lfirst(nodeCommandCell);
+
+		connectionArray[nodeIndex] = StartNodeConnection(FORCE_NEW_CONNECTION,
+														 nodeCommands->nodeName,
+														 nodeCommands->nodePort);
+		commandCellArray[nodeIndex] = list_head(nodeCommands->commandList);
+		nodeIndex++;
+	}
+
+	for (nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++)
+	{
+		MultiConnection *connection = connectionArray[nodeIndex];
+
+		FinishConnectionEstablishment(connection);
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			ReportConnectionError(connection, elevel);
+			commandCellArray[nodeIndex] = NULL;
+		}
+	}
+
+	while (commandsPending)
+	{
+		bool *querySentArray = palloc0(nodeCount * sizeof(bool));
+
+		for (nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++)
+		{
+			MultiConnection *connection = connectionArray[nodeIndex];
+			ListCell *commandCell = commandCellArray[nodeIndex];
+			int querySent = 0;
+
+			if (commandCell == NULL)
+			{
+				continue;
+			}
+
+			querySent = SendRemoteCommand(connection, strVal(lfirst(commandCell)));
+			if (querySent == 0)
+			{
+				ReportConnectionError(connection, elevel);
+				commandCellArray[nodeIndex] = NULL;
+				continue;
+			}
+
+			querySentArray[nodeIndex] = true;
+		}
+
+		commandsPending = false;
+
+		for (nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++)
+		{
+			MultiConnection *connection = connectionArray[nodeIndex];
+			const bool raiseInterrupts = true;
+			PGresult *result = NULL;
+
+			if (!querySentArray[nodeIndex])
+			{
+				continue;
+			}
+
+			result = GetRemoteCommandResult(connection, raiseInterrupts);
+			if (IsResponseOK(result))
+			{
+				commandCellArray[nodeIndex] = lnext(commandCellArray[nodeIndex]);
+			}
+			else
+			{
+				ReportResultError(connection, result, elevel);
+				commandCellArray[nodeIndex] = NULL;
+			}
+
+			PQclear(result);
+			ForgetResults(connection);
+
+			if (commandCellArray[nodeIndex] != NULL)
+			{
+				commandsPending = true;
+			}
+		}
+
+		pfree(querySentArray);
+	}
+
+	for (nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++)
+	{
+		CloseConnection(connectionArray[nodeIndex]);
+	}
+}
+
+
 /*
  * ExecuteModifyTasksWithoutResults provides a wrapper around ExecuteModifyTasks
  * for calls that do not require results. In this case, the expectResults flag
@@ -1175,12 +1998,17 @@ GetConnectionForPlacement(ShardPlacement *placement, bool isModificationQuery)
 
 	if (entryFound)
 	{
+		PGconn *connection = participantEntry->connection->pgConn;
+
 		if (isModificationQuery)
 		{
 			RecordShardIdParticipant(placement->shardId, participantEntry);
 		}
 
-		return participantEntry->connection->pgConn;
+		/* an earlier modification may still be running on the connection */
+		FinishPipelinedModification(connection);
+
+		return connection;
 	}
 	else
 	{
@@ -1714,6 +2542,7 @@ RouterExecutorPostCommit(void)
 	/* reset transaction state */
 	xactParticipantHash = NULL;
 	xactShardConnSetList = NIL;
+	pipelinedConnectionList = NIL;
 }
 
 
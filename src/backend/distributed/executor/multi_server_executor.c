@@ -17,18 +17,46 @@
 #include "postgres.h"
 #include "miscadmin.h"
 
+#include <arpa/inet.h>
 #include <unistd.h>
 
+#include "access/nbtree.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_resowner.h"
 #include "distributed/multi_server_executor.h"
 #include "distributed/worker_protocol.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/clauses.h"
+#include "optimizer/tlist.h"
+#include "parser/parsetree.h"
+#include "storage/fd.h"
+#include "tcop/utility.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+
+
+/* signature that starts each file written in the binary copy format */
+static const char BinaryCopySignature[11] = "PGCOPY\n\377\r\n\0";
 
 
 int RemoteTaskCheckInterval = 100; /* per cycle sleep interval in millisecs */
 int TaskExecutorType = MULTI_EXECUTOR_REAL_TIME; /* distributed executor type */
 bool BinaryMasterCopyFormat = false; /* copy data from workers in binary format */
+bool EnableTopKBoundPropagation = true; /* tighten top-k tasks as results arrive */
+bool EnableIncrementalResultCopy = false; /* copy results as tasks complete */
+
+
+/* Local functions forward declarations for propagating top-k bounds */
+static bool TopKBoundableJob(Job *job);
+static int ResultColumnIndex(List *targetList, TargetEntry *targetEntry);
+static StringInfo ReadTaskFile(Task *task);
+static bool LastRowTextValue(StringInfo fileData, int columnIndex, int64 rowCount,
+							 char **valueString);
+static char * UnescapeCopyTextField(const char *field, int fieldLength);
+static bool LastRowBinaryValue(StringInfo fileData, int columnIndex, int64 rowCount,
+							   StringInfo valueData);
 
 
 /*
@@ -255,3 +283,659 @@ AdjustStateForFailure(TaskExecution *taskExecution)
 	taskExecution->dataFetchTaskIndex = -1; /* reset data fetch counter */
 	taskExecution->failureCount++;          /* record failure */
 }
+
+
+/*
+ * TaskCopyStatementHash creates a hash that maps each task in the given job to
+ * the statement that copies the task's results into its table on the master
+ * node. The given copy statements follow the order of tasks in the job's task
+ * list. If no copy statements are given, the function returns NULL.
+ */
+HTAB *
+TaskCopyStatementHash(Job *job, List *masterCopyStmtList)
+{
+	HTAB *taskCopyStatementHash = NULL;
+	HASHCTL info;
+	int hashFlags = 0;
+	ListCell *taskCell = NULL;
+	ListCell *masterCopyStmtCell = NULL;
+
+	if (masterCopyStmtList == NIL)
+	{
+		return NULL;
+	}
+
+	Assert(list_length(job->taskList) == list_length(masterCopyStmtList));
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint32);
+	info.entrysize = sizeof(TaskCopyStatement);
+	info.hash = tag_hash;
+	info.hcxt = CurrentMemoryContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	taskCopyStatementHash = hash_create("Task Copy Statement Hash",
+										list_length(job->taskList), &info, hashFlags);
+
+	forboth(taskCell, job->taskList, masterCopyStmtCell, masterCopyStmtList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		TaskCopyStatement *taskCopyStatement = NULL;
+		bool found = false;
+
+		taskCopyStatement = hash_search(taskCopyStatementHash, &task->taskId,
+										HASH_ENTER, &found);
+		Assert(!found);
+
+		taskCopyStatement->copyStatement = (Node *) lfirst(masterCopyStmtCell);
+	}
+
+	return taskCopyStatementHash;
+}
+
+
+/*
+ * CopyTaskResults copies the results of the given completed task, which were
+ * fetched into a file on the master node, into the task's temporary table. The
+ * executors call this function as tasks complete, so that loading results into
+ * the master table overlaps with remote execution. Only the copy overlaps: the
+ * master query still combines partial aggregates after all tasks complete. If
+ * no copy statement hash is given, the function does nothing; results are then
+ * copied after execution.
+ *
+ * Callers must not hold interrupts, so that the user can cancel a long copy.
+ * The copy may then error out, and callers therefore need to release their
+ * connections before the error propagates.
+ */
+void
+CopyTaskResults(HTAB *taskCopyStatementHash, Task *task)
+{
+	TaskCopyStatement *taskCopyStatement = NULL;
+	bool found = false;
+
+	if (taskCopyStatementHash == NULL)
+	{
+		return;
+	}
+
+	taskCopyStatement = hash_search(taskCopyStatementHash, &task->taskId,
+									HASH_FIND, &found);
+	Assert(found);
+	Assert(InterruptHoldoffCount == 0);
+
+	ProcessUtility(taskCopyStatement->copyStatement,
+				   "(copy task results)",
+				   PROCESS_UTILITY_QUERY,
+				   NULL,
+				   None_Receiver,
+				   NULL);
+}
+
+
+/*
+ * CreateTopKBound checks if the given job returns the top-k rows of a single
+ * relation, and if so, creates the state that tracks the most selective bound
+ * on the job's first sort column. If bounds cannot be propagated for the job,
+ * the function returns NULL.
+ */
+TopKBound *
+CreateTopKBound(Job *job)
+{
+	TopKBound *topKBound = NULL;
+	Query *jobQuery = job->jobQuery;
+	SortGroupClause *sortClause = NULL;
+	TargetEntry *sortTargetEntry = NULL;
+	Const *limitCountConst = NULL;
+	Oid sortOperatorId = InvalidOid;
+	Oid operatorFamilyId = InvalidOid;
+	Oid operatorInputTypeId = InvalidOid;
+	int16 sortStrategy = InvalidStrategy;
+	int16 boundStrategy = InvalidStrategy;
+	bool orderingOperator = false;
+
+	if (!EnableTopKBoundPropagation || !TopKBoundableJob(job))
+	{
+		return NULL;
+	}
+
+	sortClause = (SortGroupClause *) linitial(jobQuery->sortClause);
+	sortTargetEntry = get_sortgroupclause_tle(sortClause, jobQuery->targetList);
+	sortOperatorId = sortClause->sortop;
+
+	orderingOperator = get_ordering_op_properties(sortOperatorId, &operatorFamilyId,
+												  &operatorInputTypeId, &sortStrategy);
+	if (!orderingOperator)
+	{
+		return NULL;
+	}
+
+	/* we keep rows equal to the bound, so that ties resolve as before */
+	if (sortStrategy == BTLessStrategyNumber)
+	{
+		boundStrategy = BTLessEqualStrategyNumber;
+	}
+	else
+	{
+		boundStrategy = BTGreaterEqualStrategyNumber;
+	}
+
+	limitCountConst = (Const *) jobQuery->limitCount;
+
+	topKBound = palloc0(sizeof(TopKBound));
+	topKBound->job = job;
+	topKBound->limitCount = DatumGetInt64(limitCountConst->constvalue);
+	topKBound->sortColumnIndex = ResultColumnIndex(jobQuery->targetList,
+												   sortTargetEntry);
+	topKBound->sortExpression = sortTargetEntry->expr;
+	topKBound->sortColumnTypeId = exprType((Node *) sortTargetEntry->expr);
+	topKBound->sortColumnTypeMod = exprTypmod((Node *) sortTargetEntry->expr);
+	topKBound->sortCollationId = exprCollation((Node *) sortTargetEntry->expr);
+	topKBound->boundOperatorId = get_opfamily_member(operatorFamilyId,
+													 operatorInputTypeId,
+													 operatorInputTypeId,
+													 boundStrategy);
+	topKBound->boundExists = false;
+	topKBound->boundValue = (Datum) 0;
+
+	if (topKBound->boundOperatorId == InvalidOid)
+	{
+		return NULL;
+	}
+
+	fmgr_info(get_opcode(sortOperatorId), &topKBound->sortFunctionInfo);
+
+	return topKBound;
+}
+
+
+/*
+ * TopKBoundableJob checks if the given job's tasks each return the top-k rows
+ * of one shard, ordered by an expression that we can filter on. We only handle
+ * orders that put nulls last, as null values would otherwise make it into the
+ * top-k rows but never pass the filter on the bound.
+ */
+static bool
+TopKBoundableJob(Job *job)
+{
+	Query *jobQuery = job->jobQuery;
+	RangeTblEntry *rangeTableEntry = NULL;
+	SortGroupClause *sortClause = NULL;
+	TargetEntry *sortTargetEntry = NULL;
+	Node *sortExpression = NULL;
+	Const *limitCountConst = NULL;
+
+	if (jobQuery == NULL || CitusIsA(job, MapMergeJob))
+	{
+		return false;
+	}
+
+	/* bounds are only meaningful when there are tasks left to start */
+	if (job->dependedJobList != NIL || job->subqueryPushdown ||
+		list_length(job->taskList) < 2)
+	{
+		return false;
+	}
+
+	if (list_length(jobQuery->rtable) != 1)
+	{
+		return false;
+	}
+
+	rangeTableEntry = rt_fetch(1, jobQuery->rtable);
+	if (rangeTableEntry->rtekind != RTE_RELATION)
+	{
+		return false;
+	}
+
+	if (jobQuery->limitCount == NULL || !IsA(jobQuery->limitCount, Const) ||
+		jobQuery->sortClause == NIL)
+	{
+		return false;
+	}
+
+	limitCountConst = (Const *) jobQuery->limitCount;
+	if (limitCountConst->constisnull || DatumGetInt64(limitCountConst->constvalue) <= 0)
+	{
+		return false;
+	}
+
+	/* filters on ungrouped rows do not carry over to aggregates or distinct rows */
+	if (jobQuery->groupClause != NIL || jobQuery->hasAggs ||
+		jobQuery->hasWindowFuncs || jobQuery->distinctClause != NIL)
+	{
+		return false;
+	}
+
+	sortClause = (SortGroupClause *) linitial(jobQuery->sortClause);
+	if (sortClause->nulls_first)
+	{
+		return false;
+	}
+
+	/* we read the bound from task results, which do not include junk columns */
+	sortTargetEntry = get_sortgroupclause_tle(sortClause, jobQuery->targetList);
+	if (sortTargetEntry->resjunk)
+	{
+		return false;
+	}
+
+	sortExpression = (Node *) sortTargetEntry->expr;
+	if (contain_volatile_functions(sortExpression) || contain_agg_clause(sortExpression))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * UpdateTopKBound reads the results of the given completed task. If the task
+ * returned k rows, the function uses the value of the first sort column in the
+ * last row as a bound candidate, and keeps it if it is more selective than the
+ * current bound. The function returns true if the bound changed.
+ */
+bool
+UpdateTopKBound(TopKBound *topKBound, Task *task)
+{
+	StringInfo fileData = NULL;
+	Oid typeIOParam = InvalidOid;
+	Datum candidateValue = 0;
+	bool lastValueFound = false;
+
+	fileData = ReadTaskFile(task);
+	if (fileData == NULL)
+	{
+		return false;
+	}
+
+	if (BinaryMasterCopyFormat)
+	{
+		Oid typeReceiveFunctionId = InvalidOid;
+		StringInfoData valueData;
+
+		initStringInfo(&valueData);
+		lastValueFound = LastRowBinaryValue(fileData, topKBound->sortColumnIndex,
+											topKBound->limitCount, &valueData);
+		if (lastValueFound)
+		{
+			getTypeBinaryInputInfo(topKBound->sortColumnTypeId, &typeReceiveFunctionId,
+								   &typeIOParam);
+			candidateValue = OidReceiveFunctionCall(typeReceiveFunctionId, &valueData,
+													typeIOParam,
+													topKBound->sortColumnTypeMod);
+		}
+	}
+	else
+	{
+		Oid typeInputFunctionId = InvalidOid;
+		char *valueString = NULL;
+
+		lastValueFound = LastRowTextValue(fileData, topKBound->sortColumnIndex,
+										  topKBound->limitCount, &valueString);
+		if (lastValueFound)
+		{
+			getTypeInputInfo(topKBound->sortColumnTypeId, &typeInputFunctionId,
+							 &typeIOParam);
+			candidateValue = OidInputFunctionCall(typeInputFunctionId, valueString,
+												  typeIOParam,
+												  topKBound->sortColumnTypeMod);
+		}
+	}
+
+	pfree(fileData->data);
+
+	if (!lastValueFound)
+	{
+		return false;
+	}
+
+	/* keep the candidate only if it sorts before the current bound */
+	if (topKBound->boundExists)
+	{
+		Datum candidateSortsFirst = FunctionCall2Coll(&topKBound->sortFunctionInfo,
+													  topKBound->sortCollationId,
+													  candidateValue,
+													  topKBound->boundValue);
+		if (!DatumGetBool(candidateSortsFirst))
+		{
+			return false;
+		}
+	}
+
+	topKBound->boundExists = true;
+	topKBound->boundValue = candidateValue;
+
+	ereport(DEBUG4, (errmsg("tightened top-k bound for job " UINT64_FORMAT
+							" using results of task %u", task->jobId, task->taskId)));
+
+	return true;
+}
+
+
+/*
+ * TopKBoundedQueryString returns the query string to send for the given task.
+ * If we have found a bound, the function adds it as a filter on the sort column
+ * to the task's query. Otherwise, the function returns the task's query as is.
+ */
+char *
+TopKBoundedQueryString(TopKBound *topKBound, Task *task)
+{
+	Const *boundConst = NULL;
+	Expr *boundClause = NULL;
+	int16 typeLength = 0;
+	bool typeByValue = false;
+
+	if (!topKBound->boundExists)
+	{
+		return task->queryString;
+	}
+
+	get_typlenbyval(topKBound->sortColumnTypeId, &typeLength, &typeByValue);
+
+	boundConst = makeConst(topKBound->sortColumnTypeId, topKBound->sortColumnTypeMod,
+						   topKBound->sortCollationId, typeLength,
+						   topKBound->boundValue, false, typeByValue);
+
+	boundClause = make_opclause(topKBound->boundOperatorId, BOOLOID, false,
+								copyObject(topKBound->sortExpression),
+								(Expr *) boundConst, InvalidOid,
+								topKBound->sortCollationId);
+
+	return SingleShardTaskQueryString(topKBound->job, task, list_make1(boundClause));
+}
+
+
+/*
+ * ResultColumnIndex returns the zero-based position of the given target entry
+ * among the columns a task returns, skipping over junk entries.
+ */
+static int
+ResultColumnIndex(List *targetList, TargetEntry *targetEntry)
+{
+	ListCell *targetEntryCell = NULL;
+	int columnIndex = 0;
+
+	foreach(targetEntryCell, targetList)
+	{
+		TargetEntry *currentEntry = (TargetEntry *) lfirst(targetEntryCell);
+		if (currentEntry == targetEntry)
+		{
+			break;
+		}
+
+		if (!currentEntry->resjunk)
+		{
+			columnIndex++;
+		}
+	}
+
+	return columnIndex;
+}
+
+
+/*
+ * ReadTaskFile reads the results the given task copied to the master node into
+ * memory. Since top-k tasks return at most k rows, these files are small. The
+ * function returns NULL if the file cannot be read.
+ */
+static StringInfo
+ReadTaskFile(Task *task)
+{
+	StringInfo jobDirectoryName = MasterJobDirectoryName(task->jobId);
+	StringInfo taskFilename = TaskFilename(jobDirectoryName, task->taskId);
+	StringInfo fileData = makeStringInfo();
+	char readBuffer[BLCKSZ];
+	size_t bytesRead = 0;
+
+	FILE *taskFile = AllocateFile(taskFilename->data, PG_BINARY_R);
+	if (taskFile == NULL)
+	{
+		ereport(DEBUG4, (errcode_for_file_access(),
+						 errmsg("could not open file \"%s\": %m", taskFilename->data)));
+		return NULL;
+	}
+
+	while ((bytesRead = fread(readBuffer, 1, sizeof(readBuffer), taskFile)) > 0)
+	{
+		appendBinaryStringInfo(fileData, readBuffer, bytesRead);
+	}
+
+	FreeFile(taskFile);
+
+	return fileData;
+}
+
+
+/*
+ * LastRowTextValue walks over rows in the given text copy data. If the data has
+ * exactly the given number of rows and the last row's value for the given column
+ * is not null, the function returns the unescaped value and true.
+ */
+static bool
+LastRowTextValue(StringInfo fileData, int columnIndex, int64 rowCount,
+				 char **valueString)
+{
+	char *lastRowStart = fileData->data;
+	char *fieldStart = NULL;
+	char *fieldEnd = NULL;
+	int64 fileRowCount = 0;
+	int dataIndex = 0;
+	int fieldIndex = 0;
+
+	/* copy escapes newlines within values, so each newline ends a row */
+	for (dataIndex = 0; dataIndex < fileData->len; dataIndex++)
+	{
+		if (fileData->data[dataIndex] == '\n')
+		{
+			fileRowCount++;
+
+			if (dataIndex + 1 < fileData->len)
+			{
+				lastRowStart = fileData->data + dataIndex + 1;
+			}
+		}
+	}
+
+	if (fileRowCount != rowCount)
+	{
+		return false;
+	}
+
+	/* tabs within values are escaped as well, so tabs delimit fields */
+	fieldStart = lastRowStart;
+	for (fieldIndex = 0; fieldIndex < columnIndex; fieldIndex++)
+	{
+		fieldStart = strchr(fieldStart, '\t');
+		if (fieldStart == NULL)
+		{
+			return false;
+		}
+
+		fieldStart++;
+	}
+
+	fieldEnd = fieldStart + strcspn(fieldStart, "\t\n");
+	if (fieldEnd - fieldStart == 2 && strncmp(fieldStart, "\\N", 2) == 0)
+	{
+		return false;
+	}
+
+	*valueString = UnescapeCopyTextField(fieldStart, (int) (fieldEnd - fieldStart));
+
+	return true;
+}
+
+
+/*
+ * UnescapeCopyTextField reverses the backslash escaping COPY TO applies to
+ * values in the text format, and returns the unescaped value.
+ */
+static char *
+UnescapeCopyTextField(const char *field, int fieldLength)
+{
+	StringInfo value = makeStringInfo();
+	int fieldIndex = 0;
+
+	while (fieldIndex < fieldLength)
+	{
+		char currentChar = field[fieldIndex++];
+
+		if (currentChar != '\\' || fieldIndex >= fieldLength)
+		{
+			appendStringInfoChar(value, currentChar);
+			continue;
+		}
+
+		currentChar = field[fieldIndex++];
+		switch (currentChar)
+		{
+			case 'b':
+			{
+				appendStringInfoChar(value, '\b');
+				break;
+			}
+
+			case 'f':
+			{
+				appendStringInfoChar(value, '\f');
+				break;
+			}
+
+			case 'n':
+			{
+				appendStringInfoChar(value, '\n');
+				break;
+			}
+
+			case 'r':
+			{
+				appendStringInfoChar(value, '\r');
+				break;
+			}
+
+			case 't':
+			{
+				appendStringInfoChar(value, '\t');
+				break;
+			}
+
+			case 'v':
+			{
+				appendStringInfoChar(value, '\v');
+				break;
+			}
+
+			case '0': case '1': case '2': case '3':
+			case '4': case '5': case '6': case '7':
+			{
+				int octalValue = currentChar - '0';
+				int digitCount = 1;
+
+				while (digitCount < 3 && fieldIndex < fieldLength &&
+					   field[fieldIndex] >= '0' && field[fieldIndex] <= '7')
+				{
+					octalValue = (octalValue << 3) + (field[fieldIndex++] - '0');
+					digitCount++;
+				}
+
+				appendStringInfoChar(value, (char) (octalValue & 0377));
+				break;
+			}
+
+			default:
+			{
+				/* covers escaped backslashes and any other escaped character */
+				appendStringInfoChar(value, currentChar);
+				break;
+			}
+		}
+	}
+
+	return value->data;
+}
+
+
+/*
+ * LastRowBinaryValue walks over tuples in the given binary copy data. If the
+ * data has exactly the given number of tuples and the last tuple's value for
+ * the given column is not null, the function copies the value's bytes into
+ * valueData and returns true.
+ */
+static bool
+LastRowBinaryValue(StringInfo fileData, int columnIndex, int64 rowCount,
+				   StringInfo valueData)
+{
+	char *data = fileData->data;
+	int dataLength = fileData->len;
+	int dataOffset = 0;
+	int64 fileRowCount = 0;
+	int32 headerExtensionLength = 0;
+	int32 lastValueLength = -1;
+	int lastValueOffset = 0;
+
+	/* skip over the signature, flags field, and header extension */
+	if (dataLength < (int) (sizeof(BinaryCopySignature) + 2 * sizeof(int32)) ||
+		memcmp(data, BinaryCopySignature, sizeof(BinaryCopySignature)) != 0)
+	{
+		return false;
+	}
+
+	dataOffset = sizeof(BinaryCopySignature) + sizeof(int32);
+	memcpy(&headerExtensionLength, data + dataOffset, sizeof(int32));
+	dataOffset += sizeof(int32) + (int32) ntohl(headerExtensionLength);
+
+	while (dataOffset + (int) sizeof(int16) <= dataLength)
+	{
+		int16 fieldCount = 0;
+		int fieldIndex = 0;
+
+		memcpy(&fieldCount, data + dataOffset, sizeof(int16));
+		fieldCount = (int16) ntohs(fieldCount);
+		dataOffset += sizeof(int16);
+
+		/* a field count of -1 marks the file trailer */
+		if (fieldCount < 0)
+		{
+			break;
+		}
+
+		for (fieldIndex = 0; fieldIndex < fieldCount; fieldIndex++)
+		{
+			int32 fieldLength = 0;
+
+			if (dataOffset + (int) sizeof(int32) > dataLength)
+			{
+				return false;
+			}
+
+			memcpy(&fieldLength, data + dataOffset, sizeof(int32));
+			fieldLength = (int32) ntohl(fieldLength);
+			dataOffset += sizeof(int32);
+
+			if (fieldIndex == columnIndex)
+			{
+				lastValueLength = fieldLength;
+				lastValueOffset = dataOffset;
+			}
+
+			/* a field length of -1 denotes a null value without any data */
+			if (fieldLength > 0)
+			{
+				dataOffset += fieldLength;
+			}
+		}
+
+		fileRowCount++;
+	}
+
+	if (fileRowCount != rowCount || lastValueLength < 0 ||
+		lastValueOffset + lastValueLength > dataLength)
+	{
+		return false;
+	}
+
+	appendBinaryStringInfo(valueData, data + lastValueOffset, lastValueLength);
+
+	return true;
+}
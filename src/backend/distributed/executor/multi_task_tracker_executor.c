@@ -24,12 +24,15 @@
 #include <unistd.h>
 #include <math.h>
 
+#include "catalog/pg_type.h"
 #include "commands/dbcommands.h"
 #include "distributed/citus_nodes.h"
 #include "distributed/connection_management.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/remote_commands.h"
+#include "distributed/worker_manager.h"
 #include "distributed/worker_protocol.h"
 #include "storage/fd.h"
 #include "utils/builtins.h"
@@ -38,6 +41,8 @@
 
 
 int MaxAssignTaskBatchSize = 64; /* maximum number of tasks to assign per round */
+int TaskPriority = 0; /* scheduling priority of assigned tasks on task trackers */
+bool BatchTaskStatusQueries = true; /* check statuses of all running tasks at once */
 
 /* TaskMapKey is used as a key in task hash */
 typedef struct TaskMapKey
@@ -84,15 +89,21 @@ static TaskTracker * TrackerHashLookup(HTAB *trackerHash, const char *nodeName,
 /* Local functions forward declarations to manage tasks and their assignments */
 static TaskExecStatus ManageTaskExecution(TaskTracker *taskTracker,
 										  TaskTracker *sourceTaskTracker,
-										  Task *task, TaskExecution *taskExecution);
+										  Task *task, TaskExecution *taskExecution,
+										  TopKBound *topKBound);
 static TransmitExecStatus ManageTransmitExecution(TaskTracker *transmitTracker,
 												  Task *task,
 												  TaskExecution *taskExecution);
 static bool TaskExecutionsCompleted(List *taskList);
 static StringInfo MapFetchTaskQueryString(Task *mapFetchTask, Task *mapTask);
-static void TrackerQueueSqlTask(TaskTracker *taskTracker, Task *task);
+static void TrackerQueueSqlTask(TaskTracker *taskTracker, Task *task,
+								TopKBound *topKBound);
 static void TrackerQueueTask(TaskTracker *taskTracker, Task *task);
+static StringInfo SqlTaskAssignmentQuery(Task *task, char *queryString);
 static StringInfo TaskAssignmentQuery(Task *task, char *queryString);
+static void TrackerRequeueBoundedTasks(HTAB *taskTrackerHash,
+									   List *taskAndExecutionList,
+									   TopKBound *topKBound);
 static TaskStatus TrackerTaskStatus(TaskTracker *taskTracker, Task *task);
 static TrackerTaskState * TrackerTaskStateHashLookup(HTAB *taskStateHash, Task *task);
 static bool TrackerHealthy(TaskTracker *taskTracker);
@@ -118,13 +129,26 @@ static void TrackerReconnectPoll(TaskTracker *taskTracker);
 static List * AssignQueuedTasks(TaskTracker *taskTracker);
 static int32 NextRunningTaskIndex(List *assignedTaskList, int32 currentTaskIndex);
 static TaskStatus TaskStatusQueryResponse(int32 connectionId);
+static bool TaskStateRunning(TrackerTaskState *taskState);
+static void SendTaskStatusBatchQuery(TaskTracker *taskTracker);
+static void TaskStatusBatchQueryResponse(TaskTracker *taskTracker);
+static void TaskStatusBatchQueryFailed(TaskTracker *taskTracker);
 static void ManageTransmitTracker(TaskTracker *transmitTracker);
 static TrackerTaskState * NextQueuedFileTransmit(HTAB *taskStateHash);
 
+/* Local functions forward declarations to build semi-join filters */
+static void ApplySemiJoinFilters(Job *job);
+static void ApplySemiJoinFilter(MapMergeJob *mapMergeJob);
+static bytea * BuildSemiJoinFilter(List *sourceTaskList);
+static bool MergeSemiJoinFilter(bytea **filter, PGresult *result);
+static void StoreSemiJoinFilter(MapMergeJob *mapMergeJob, bytea *filter);
+
 /* Local functions forward declarations to clean up tasks */
 static List * JobIdList(Job *job);
 static void TrackerCleanupResources(HTAB *taskTrackerHash, HTAB *transmitTrackerHash,
 									List *jobIdList, List *taskList);
+static void TrackerDisconnectResources(HTAB *taskTrackerHash,
+									   HTAB *transmitTrackerHash, List *taskList);
 static void TrackerHashWaitActiveRequest(HTAB *taskTrackerHash);
 static void TrackerHashCancelActiveRequest(HTAB *taskTrackerHash);
 static Task * JobCleanupTask(uint64 jobId);
@@ -136,10 +160,12 @@ static void TrackerHashDisconnect(HTAB *taskTrackerHash);
  * MultiTaskTrackerExecute loops over given tasks, and manages their execution
  * until either one task permanently fails or all tasks successfully complete.
  * The function initializes connections to task trackers on worker nodes, and
- * executes tasks through assigning them to these trackers.
+ * executes tasks through assigning them to these trackers. If master copy
+ * statements are given, the function copies each top level task's results as
+ * soon as these results are fetched to the master node.
  */
 void
-MultiTaskTrackerExecute(Job *job)
+MultiTaskTrackerExecute(Job *job, List *masterCopyStmtList)
 {
 	List *jobTaskList = job->taskList;
 	List *taskAndExecutionList = NIL;
@@ -159,6 +185,8 @@ MultiTaskTrackerExecute(Job *job)
 	const char *taskTrackerHashName = "Task Tracker Hash";
 	const char *transmitTrackerHashName = "Transmit Tracker Hash";
 	List *jobIdList = NIL;
+	TopKBound *topKBound = NULL;
+	HTAB *taskCopyStatementHash = NULL;
 
 	/*
 	 * We walk over the task tree, and create a task execution struct for each
@@ -181,6 +209,9 @@ MultiTaskTrackerExecute(Job *job)
 		}
 	}
 
+	/* build semi-join filters before any map task starts to read its input */
+	ApplySemiJoinFilters(job);
+
 	/*
 	 * We get the list of worker nodes, and then create two hashes to manage our
 	 * connections to these nodes. The first hash manages connections used for
@@ -196,6 +227,12 @@ MultiTaskTrackerExecute(Job *job)
 	TrackerHashConnect(taskTrackerHash);
 	TrackerHashConnect(transmitTrackerHash);
 
+	/* for top-k queries, track a bound to tighten tasks that did not start yet */
+	topKBound = CreateTopKBound(job);
+
+	/* if copying results as tasks complete, look up copy statements by task id */
+	taskCopyStatementHash = TaskCopyStatementHash(job, masterCopyStmtList);
+
 	/* loop around until all tasks complete, one task fails, or user cancels */
 	while (!(allTasksCompleted || taskFailed || taskTransmitFailed ||
 			 clusterFailed || QueryCancelPending))
@@ -225,7 +262,7 @@ MultiTaskTrackerExecute(Job *job)
 
 			/* call the function that performs the core task execution logic */
 			taskExecutionStatus = ManageTaskExecution(execTaskTracker, mapTaskTracker,
-													  task, taskExecution);
+													  task, taskExecution, topKBound);
 
 			/*
 			 * If task cannot execute on this task/map tracker, we fail over all
@@ -291,6 +328,7 @@ MultiTaskTrackerExecute(Job *job)
 
 			TaskTracker *execTransmitTracker = NULL;
 			bool transmitCompleted = false;
+			bool transmitPreviouslyCompleted = false;
 
 			/*
 			 * We find the tasks that appear in the top level of the query tree,
@@ -307,6 +345,7 @@ MultiTaskTrackerExecute(Job *job)
 			Assert(execTransmitTracker != NULL);
 
 			/* call the function that fetches results for completed SQL tasks */
+			transmitPreviouslyCompleted = TransmitExecutionCompleted(taskExecution);
 			transmitExecutionStatus = ManageTransmitExecution(execTransmitTracker,
 															  task, taskExecution);
 
@@ -341,6 +380,35 @@ MultiTaskTrackerExecute(Job *job)
 			if (transmitCompleted)
 			{
 				completedTransmitCount++;
+
+				if (!transmitPreviouslyCompleted)
+				{
+					PG_TRY();
+					{
+						CopyTaskResults(taskCopyStatementHash, task);
+					}
+					PG_CATCH();
+					{
+						/*
+						 * Close open files and tracker connections before erroring
+						 * out. We don't wait on task trackers here, so we skip the
+						 * job clean up tasks that TrackerCleanupResources sends.
+						 */
+						TrackerDisconnectResources(taskTrackerHash,
+												   transmitTrackerHash,
+												   taskAndExecutionList);
+
+						PG_RE_THROW();
+					}
+					PG_END_TRY();
+
+					/* use the newly fetched results to bound the remaining tasks */
+					if (topKBound != NULL && UpdateTopKBound(topKBound, task))
+					{
+						TrackerRequeueBoundedTasks(taskTrackerHash,
+												   taskAndExecutionList, topKBound);
+					}
+				}
 			}
 		}
 
@@ -1011,11 +1079,12 @@ TrackerHashLookup(HTAB *trackerHash, const char *nodeName, uint32 nodePort)
  * observes a connection related failure, the function retries the task on the
  * same task tracker. Else if the task tracker isn't considered as healthy, the
  * function signals to the caller that the task needs to be assigned to another
- * task tracker.
+ * task tracker. If a top-k bound is given, the function applies the bound to
+ * SQL tasks' queries when queueing them.
  */
 static TaskExecStatus
 ManageTaskExecution(TaskTracker *taskTracker, TaskTracker *sourceTaskTracker,
-					Task *task, TaskExecution *taskExecution)
+					Task *task, TaskExecution *taskExecution, TopKBound *topKBound)
 {
 	TaskExecStatus *taskStatusArray = taskExecution->taskStatusArray;
 	uint32 currentNodeIndex = taskExecution->currentNodeIndex;
@@ -1057,6 +1126,17 @@ ManageTaskExecution(TaskTracker *taskTracker, TaskTracker *sourceTaskTracker,
 				Task *mapTask = (Task *) linitial(task->dependedTaskList);
 				TaskExecution *mapTaskExecution = mapTask->taskExecution;
 
+				/*
+				 * If the map task pushed its partitions, the merge task's primary
+				 * node already has the map output. We only need to fetch the output
+				 * after the merge task failed over to another node.
+				 */
+				if (mapTask->pushPartitions && taskExecution->currentNodeIndex == 0)
+				{
+					nextExecutionStatus = EXEC_TASK_DONE;
+					break;
+				}
+
 				mapFetchTaskQueryString = MapFetchTaskQueryString(task, mapTask);
 				task->queryString = mapFetchTaskQueryString->data;
 				taskExecution->querySourceNodeIndex = mapTaskExecution->currentNodeIndex;
@@ -1068,7 +1148,7 @@ ManageTaskExecution(TaskTracker *taskTracker, TaskTracker *sourceTaskTracker,
 			 */
 			if (taskType == SQL_TASK)
 			{
-				TrackerQueueSqlTask(taskTracker, task);
+				TrackerQueueSqlTask(taskTracker, task, topKBound);
 			}
 			else
 			{
@@ -1567,14 +1647,38 @@ MapFetchTaskQueryString(Task *mapFetchTask, Task *mapTask)
  * TrackerQueueSqlTask wraps a copy out command around the given task's query,
  * creates a task assignment query from this copy out command, and then queues
  * this assignment query in the given tracker's internal hash. The queued query
- * will be assigned to the remote task tracker at a later time.
+ * will be assigned to the remote task tracker at a later time. If a top-k bound
+ * is given, the function queues the task's query with the bound applied.
  */
 static void
-TrackerQueueSqlTask(TaskTracker *taskTracker, Task *task)
+TrackerQueueSqlTask(TaskTracker *taskTracker, Task *task, TopKBound *topKBound)
 {
 	HTAB *taskStateHash = taskTracker->taskStateHash;
 	TrackerTaskState *taskState = NULL;
 	StringInfo taskAssignmentQuery = NULL;
+	char *queryString = task->queryString;
+
+	if (topKBound != NULL)
+	{
+		queryString = TopKBoundedQueryString(topKBound, task);
+	}
+
+	taskAssignmentQuery = SqlTaskAssignmentQuery(task, queryString);
+
+	taskState = TaskStateHashEnter(taskStateHash, task->jobId, task->taskId);
+	taskState->status = TASK_CLIENT_SIDE_QUEUED;
+	taskState->taskAssignmentQuery = taskAssignmentQuery;
+}
+
+
+/*
+ * SqlTaskAssignmentQuery wraps a copy out command around the given query string
+ * for the given task, and returns a task assignment query for this command.
+ */
+static StringInfo
+SqlTaskAssignmentQuery(Task *task, char *queryString)
+{
+	StringInfo taskAssignmentQuery = NULL;
 
 	/*
 	 * We first wrap a copy out command around the original query string. This
@@ -1589,20 +1693,18 @@ TrackerQueueSqlTask(TaskTracker *taskTracker, Task *task)
 	if (BinaryMasterCopyFormat)
 	{
 		appendStringInfo(copyQueryString, COPY_QUERY_TO_FILE_BINARY,
-						 task->queryString, taskFilename->data);
+						 queryString, taskFilename->data);
 	}
 	else
 	{
 		appendStringInfo(copyQueryString, COPY_QUERY_TO_FILE_TEXT,
-						 task->queryString, taskFilename->data);
+						 queryString, taskFilename->data);
 	}
 
 	/* wrap a task assignment query outside the copy out query */
 	taskAssignmentQuery = TaskAssignmentQuery(task, copyQueryString->data);
 
-	taskState = TaskStateHashEnter(taskStateHash, task->jobId, task->taskId);
-	taskState->status = TASK_CLIENT_SIDE_QUEUED;
-	taskState->taskAssignmentQuery = taskAssignmentQuery;
+	return taskAssignmentQuery;
 }
 
 
@@ -1631,7 +1733,8 @@ TrackerQueueTask(TaskTracker *taskTracker, Task *task)
 /*
  * TaskAssignmentQuery escapes the given query string with quotes, and wraps
  * this escaped query string inside a task assignment command. This way, the
- * query can be assigned to the remote task tracker.
+ * query can be assigned to the remote task tracker. If the user set a task
+ * priority, we also pass the priority along to the task tracker.
  */
 static StringInfo
 TaskAssignmentQuery(Task *task, char *queryString)
@@ -1642,13 +1745,74 @@ TaskAssignmentQuery(Task *task, char *queryString)
 	char *escapedQueryString = quote_literal_cstr(queryString);
 
 	taskAssignmentQuery = makeStringInfo();
-	appendStringInfo(taskAssignmentQuery, TASK_ASSIGNMENT_QUERY,
-					 task->jobId, task->taskId, escapedQueryString);
+	if (TaskPriority != 0)
+	{
+		appendStringInfo(taskAssignmentQuery, TASK_PRIORITY_ASSIGNMENT_QUERY,
+						 task->jobId, task->taskId, escapedQueryString, TaskPriority);
+	}
+	else
+	{
+		appendStringInfo(taskAssignmentQuery, TASK_ASSIGNMENT_QUERY,
+						 task->jobId, task->taskId, escapedQueryString);
+	}
 
 	return taskAssignmentQuery;
 }
 
 
+/*
+ * TrackerRequeueBoundedTasks walks over SQL tasks that were queued with a task
+ * tracker, but did not start running yet. For each such task, the function
+ * applies the given top-k bound to the task's query, and queues the task for
+ * reassignment. The remote task tracker then updates the task's query before
+ * running it.
+ */
+static void
+TrackerRequeueBoundedTasks(HTAB *taskTrackerHash, List *taskAndExecutionList,
+						   TopKBound *topKBound)
+{
+	ListCell *taskAndExecutionCell = NULL;
+
+	foreach(taskAndExecutionCell, taskAndExecutionList)
+	{
+		Task *task = (Task *) lfirst(taskAndExecutionCell);
+		TaskExecution *taskExecution = task->taskExecution;
+		uint32 currentNodeIndex = taskExecution->currentNodeIndex;
+		TaskExecStatus currentExecutionStatus = EXEC_TASK_INVALID_FIRST;
+		TaskTracker *taskTracker = NULL;
+		TrackerTaskState *taskState = NULL;
+		char *queryString = NULL;
+
+		currentExecutionStatus = taskExecution->taskStatusArray[currentNodeIndex];
+		if (task->taskType != SQL_TASK || currentExecutionStatus != EXEC_TASK_QUEUED)
+		{
+			continue;
+		}
+
+		taskTracker = ResolveTaskTracker(taskTrackerHash, task, taskExecution);
+		taskState = TrackerTaskStateHashLookup(taskTracker->taskStateHash, task);
+
+		/* a pending status query would overwrite the status we set here */
+		if (taskState == NULL || taskState == taskTracker->connectionBusyOnTask)
+		{
+			continue;
+		}
+
+		if (taskState->status != TASK_CLIENT_SIDE_QUEUED &&
+			taskState->status != TASK_ASSIGNED &&
+			taskState->status != TASK_SCHEDULED)
+		{
+			continue;
+		}
+
+		queryString = TopKBoundedQueryString(topKBound, task);
+
+		taskState->taskAssignmentQuery = SqlTaskAssignmentQuery(task, queryString);
+		taskState->status = TASK_CLIENT_SIDE_QUEUED;
+	}
+}
+
+
 /*
  * TrackerTaskStatus returns the remote execution status of the given task. Note
  * that the task must have already been queued with the task tracker for status
@@ -2161,6 +2325,9 @@ ManageTaskTracker(TaskTracker *taskTracker)
 	trackerConnectionUp = TrackerConnectionUp(taskTracker);
 	if (!trackerConnectionUp)
 	{
+		/* the node may have restarted, so we start over with task statuses */
+		taskTracker->taskStatusSequence = 0;
+
 		TrackerReconnectPoll(taskTracker);  /* try an async reconnect */
 		return;
 	}
@@ -2174,14 +2341,21 @@ ManageTaskTracker(TaskTracker *taskTracker)
 		List *previousTaskList = taskTracker->assignedTaskList;
 		List *newTaskList = AssignQueuedTasks(taskTracker);
 
-		taskTracker->assignedTaskList = list_concat(previousTaskList, newTaskList);
+		/* reassigned tasks may already be in the list of assigned tasks */
+		taskTracker->assignedTaskList = list_concat_unique_ptr(previousTaskList,
+															   newTaskList);
 	}
 
 	/*
 	 * (2) We find an assigned task. We then send an asynchronous query to check
-	 * task's status.
+	 * task's status. If batched status queries are enabled, we instead check the
+	 * statuses of all running tasks that changed since our last check.
 	 */
-	if (!taskTracker->connectionBusy)
+	if (!taskTracker->connectionBusy && BatchTaskStatusQueries)
+	{
+		SendTaskStatusBatchQuery(taskTracker);
+	}
+	else if (!taskTracker->connectionBusy)
 	{
 		List *assignedTaskList = taskTracker->assignedTaskList;
 		int32 currentTaskIndex = taskTracker->currentTaskIndex;
@@ -2229,17 +2403,31 @@ ManageTaskTracker(TaskTracker *taskTracker)
 		int32 connectionId = taskTracker->connectionId;
 		ResultStatus resultStatus = CLIENT_INVALID_RESULT_STATUS;
 		TrackerTaskState *taskState = taskTracker->connectionBusyOnTask;
-		Assert(taskState != NULL);
+		Assert(taskState != NULL || taskTracker->connectionBusyOnTaskList != NIL);
 
 		/* if connection is available, update task status accordingly */
 		resultStatus = MultiClientResultStatus(connectionId);
 		if (resultStatus == CLIENT_RESULT_READY)
 		{
-			taskState->status = TaskStatusQueryResponse(connectionId);
+			if (taskState != NULL)
+			{
+				taskState->status = TaskStatusQueryResponse(connectionId);
+			}
+			else
+			{
+				TaskStatusBatchQueryResponse(taskTracker);
+			}
 		}
 		else if (resultStatus == CLIENT_RESULT_UNAVAILABLE)
 		{
-			taskState->status = TASK_CLIENT_SIDE_STATUS_FAILED;
+			if (taskState != NULL)
+			{
+				taskState->status = TASK_CLIENT_SIDE_STATUS_FAILED;
+			}
+			else
+			{
+				TaskStatusBatchQueryFailed(taskTracker);
+			}
 		}
 
 		/* if connection is available, give it back to the task tracker */
@@ -2247,6 +2435,7 @@ ManageTaskTracker(TaskTracker *taskTracker)
 		{
 			taskTracker->connectionBusy = false;
 			taskTracker->connectionBusyOnTask = NULL;
+			taskTracker->connectionBusyOnTaskList = NIL;
 		}
 	}
 }
@@ -2436,15 +2625,7 @@ NextRunningTaskIndex(List *assignedTaskList, int32 currentTaskIndex)
 	foreach(assignedTaskCell, assignedTaskList)
 	{
 		TrackerTaskState *assignedTask = (TrackerTaskState *) lfirst(assignedTaskCell);
-		TaskStatus taskStatus = assignedTask->status;
-
-		/* task tracker retries tasks that only failed once (task_failed) */
-		bool taskRunning = false;
-		if (taskStatus == TASK_ASSIGNED || taskStatus == TASK_SCHEDULED ||
-			taskStatus == TASK_RUNNING || taskStatus == TASK_FAILED)
-		{
-			taskRunning = true;
-		}
+		bool taskRunning = TaskStateRunning(assignedTask);
 
 		if (taskRunning && (assignedTaskIndex > currentTaskIndex))
 		{
@@ -2511,6 +2692,203 @@ TaskStatusQueryResponse(int32 connectionId)
 }
 
 
+/*
+ * TaskStateRunning checks if the given task is assigned to the task tracker and
+ * has not yet completed. Note that the task tracker retries tasks that only
+ * failed once (task_failed), so we consider these tasks as running too.
+ */
+static bool
+TaskStateRunning(TrackerTaskState *taskState)
+{
+	TaskStatus taskStatus = taskState->status;
+	bool taskRunning = false;
+
+	if (taskStatus == TASK_ASSIGNED || taskStatus == TASK_SCHEDULED ||
+		taskStatus == TASK_RUNNING || taskStatus == TASK_FAILED)
+	{
+		taskRunning = true;
+	}
+
+	return taskRunning;
+}
+
+
+/*
+ * SendTaskStatusBatchQuery finds the jobs of all running tasks assigned to the
+ * given task tracker, and sends one asynchronous query to fetch the statuses of
+ * these jobs' tasks. The query only asks for statuses that changed after the
+ * highest status sequence number we have seen on this task tracker, so that each
+ * round trip only carries status changes.
+ */
+static void
+SendTaskStatusBatchQuery(TaskTracker *taskTracker)
+{
+	int32 connectionId = taskTracker->connectionId;
+	List *runningTaskList = NIL;
+	List *jobIdList = NIL;
+	ListCell *assignedTaskCell = NULL;
+	ListCell *jobIdCell = NULL;
+	StringInfo jobIdString = makeStringInfo();
+	StringInfo taskStatusQuery = NULL;
+	bool querySent = false;
+
+	foreach(assignedTaskCell, taskTracker->assignedTaskList)
+	{
+		TrackerTaskState *taskState = (TrackerTaskState *) lfirst(assignedTaskCell);
+		bool jobIdFound = false;
+
+		if (!TaskStateRunning(taskState))
+		{
+			continue;
+		}
+
+		runningTaskList = lappend(runningTaskList, taskState);
+
+		foreach(jobIdCell, jobIdList)
+		{
+			uint64 *jobIdPointer = (uint64 *) lfirst(jobIdCell);
+			if ((*jobIdPointer) == taskState->jobId)
+			{
+				jobIdFound = true;
+				break;
+			}
+		}
+
+		if (!jobIdFound)
+		{
+			jobIdList = lappend(jobIdList, &taskState->jobId);
+		}
+	}
+
+	if (runningTaskList == NIL)
+	{
+		return;
+	}
+
+	foreach(jobIdCell, jobIdList)
+	{
+		uint64 *jobIdPointer = (uint64 *) lfirst(jobIdCell);
+
+		if (jobIdString->len > 0)
+		{
+			appendStringInfoChar(jobIdString, ',');
+		}
+
+		appendStringInfo(jobIdString, UINT64_FORMAT, *jobIdPointer);
+	}
+
+	taskStatusQuery = makeStringInfo();
+	appendStringInfo(taskStatusQuery, TASK_STATUS_BATCH_QUERY, jobIdString->data,
+					 taskTracker->taskStatusSequence);
+
+	querySent = MultiClientSendQuery(connectionId, taskStatusQuery->data);
+	if (querySent)
+	{
+		taskTracker->connectionBusy = true;
+		taskTracker->connectionBusyOnTaskList = runningTaskList;
+	}
+	else
+	{
+		taskTracker->connectionBusyOnTaskList = runningTaskList;
+		TaskStatusBatchQueryFailed(taskTracker);
+
+		taskTracker->connectionBusy = false;
+		taskTracker->connectionBusyOnTaskList = NIL;
+	}
+
+	list_free(jobIdList);
+}
+
+
+/*
+ * TaskStatusBatchQueryResponse assumes that a batched task status query has been
+ * previously sent on the given task tracker's connection, and reads the response
+ * for this query. The function then updates the statuses of tasks that are still
+ * running from the coordinator's point of view; tasks that were requeued while
+ * the query was in flight keep their status. The function also remembers the
+ * highest status sequence number it received.
+ */
+static void
+TaskStatusBatchQueryResponse(TaskTracker *taskTracker)
+{
+	int32 connectionId = taskTracker->connectionId;
+	void *queryResult = NULL;
+	int rowCount = 0;
+	int columnCount = 0;
+	int rowIndex = 0;
+	uint64 taskStatusSequence = taskTracker->taskStatusSequence;
+
+	bool resultReceived = MultiClientQueryResult(connectionId, &queryResult,
+												 &rowCount, &columnCount);
+	if (!resultReceived)
+	{
+		TaskStatusBatchQueryFailed(taskTracker);
+		MultiClientClearResult(queryResult);
+		return;
+	}
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		char *jobIdString = MultiClientGetValue(queryResult, rowIndex, 0);
+		char *taskIdString = MultiClientGetValue(queryResult, rowIndex, 1);
+		char *taskStatusString = MultiClientGetValue(queryResult, rowIndex, 2);
+		char *sequenceString = MultiClientGetValue(queryResult, rowIndex, 3);
+
+		TrackerTaskState *taskState = NULL;
+		TrackerTaskState taskStateKey;
+		TaskStatus taskStatus = TASK_STATUS_INVALID_FIRST;
+		uint64 statusSequence = 0;
+		bool handleFound = false;
+
+		taskStateKey.jobId = (uint64) strtoull(jobIdString, NULL, 10);
+		taskStateKey.taskId = (uint32) strtoul(taskIdString, NULL, 10);
+		taskStatus = (TaskStatus) strtoul(taskStatusString, NULL, 10);
+		statusSequence = (uint64) strtoull(sequenceString, NULL, 10);
+
+		Assert(taskStatus > TASK_STATUS_INVALID_FIRST);
+		Assert(taskStatus < TASK_STATUS_LAST);
+
+		taskStatusSequence = Max(taskStatusSequence, statusSequence);
+
+		taskState = (TrackerTaskState *) hash_search(taskTracker->taskStateHash,
+													 &taskStateKey, HASH_FIND,
+													 &handleFound);
+		if (taskState != NULL && TaskStateRunning(taskState))
+		{
+			taskState->status = taskStatus;
+		}
+	}
+
+	taskTracker->taskStatusSequence = taskStatusSequence;
+
+	MultiClientClearResult(queryResult);
+}
+
+
+/*
+ * TaskStatusBatchQueryFailed marks all tasks covered by a failed batched status
+ * query as tasks whose status check failed, as we would for one failed task
+ * status query. The function also starts over with task statuses, so that the
+ * next batched query fetches the statuses of all running tasks.
+ */
+static void
+TaskStatusBatchQueryFailed(TaskTracker *taskTracker)
+{
+	ListCell *taskStateCell = NULL;
+
+	foreach(taskStateCell, taskTracker->connectionBusyOnTaskList)
+	{
+		TrackerTaskState *taskState = (TrackerTaskState *) lfirst(taskStateCell);
+		if (TaskStateRunning(taskState))
+		{
+			taskState->status = TASK_CLIENT_SIDE_STATUS_FAILED;
+		}
+	}
+
+	taskTracker->taskStatusSequence = 0;
+}
+
+
 /*
  * ManageTransmitTracker manages access to the connection we opened to the worker
  * node. If the connection is idle, and we have file transmit requests pending,
@@ -2600,6 +2978,357 @@ NextQueuedFileTransmit(HTAB *taskStateHash)
 }
 
 
+/*
+ * ApplySemiJoinFilters walks over all jobs in the given job tree, and applies
+ * semi-join filters to the MapMerge jobs that have semi-join filter tasks. We do
+ * this as part of execution rather than planning, so that EXPLAIN does not run
+ * the filter tasks. Filters live in job directories on worker nodes, and the
+ * job clean up tasks we send once execution ends remove them with the rest of
+ * the job's resources.
+ */
+static void
+ApplySemiJoinFilters(Job *job)
+{
+	List *jobQueue = list_make1(job);
+
+	while (jobQueue != NIL)
+	{
+		Job *currentJob = (Job *) linitial(jobQueue);
+		jobQueue = list_delete_first(jobQueue);
+
+		if (CitusIsA(currentJob, MapMergeJob))
+		{
+			MapMergeJob *mapMergeJob = (MapMergeJob *) currentJob;
+			if (mapMergeJob->semiJoinSourceTaskList != NIL)
+			{
+				ApplySemiJoinFilter(mapMergeJob);
+			}
+		}
+
+		/* prevent dependedJobList being modified on list_concat() call */
+		if (currentJob->dependedJobList != NIL)
+		{
+			jobQueue = list_concat(jobQueue, list_copy(currentJob->dependedJobList));
+		}
+	}
+}
+
+
+/*
+ * ApplySemiJoinFilter builds a Bloom filter over the join keys of the given
+ * MapMerge job's semi-join source, and stores this filter on the nodes that may
+ * run the job's map tasks. Map tasks then drop rows whose keys are not in the
+ * filter. If we cannot build the filter, map tasks repartition all rows as
+ * usual; the filter only saves work, and is never needed for correct results.
+ */
+static void
+ApplySemiJoinFilter(MapMergeJob *mapMergeJob)
+{
+	bytea *filter = BuildSemiJoinFilter(mapMergeJob->semiJoinSourceTaskList);
+	if (filter == NULL)
+	{
+		ereport(DEBUG1, (errmsg("could not build semi-join filter for job "
+								UINT64_FORMAT, mapMergeJob->job.jobId)));
+		return;
+	}
+
+	StoreSemiJoinFilter(mapMergeJob, filter);
+}
+
+
+/*
+ * BuildSemiJoinFilter runs the given filter building tasks on their first
+ * placements, and merges the filters they return into one. We open one
+ * connection per node, and send all of the node's tasks over it as a single
+ * multi-statement query; nodes then build their filters in parallel. The
+ * function returns NULL if any of the tasks fails.
+ */
+static bytea *
+BuildSemiJoinFilter(List *sourceTaskList)
+{
+	List *nodePlacementList = NIL;
+	List *nodeCommandList = NIL;
+	List *nodeTaskCountList = NIL;
+	List *connectionList = NIL;
+	ListCell *sourceTaskCell = NULL;
+	ListCell *nodePlacementCell = NULL;
+	ListCell *nodeCommandCell = NULL;
+	ListCell *nodeTaskCountCell = NULL;
+	ListCell *connectionCell = NULL;
+	bytea *filter = NULL;
+	bool taskFailed = false;
+
+	/* group the filter building commands by the node they run on */
+	foreach(sourceTaskCell, sourceTaskList)
+	{
+		Task *sourceTask = (Task *) lfirst(sourceTaskCell);
+		ShardPlacement *placement = linitial(sourceTask->taskPlacementList);
+		StringInfo nodeCommand = NULL;
+
+		forthree(nodePlacementCell, nodePlacementList,
+				 nodeCommandCell, nodeCommandList,
+				 nodeTaskCountCell, nodeTaskCountList)
+		{
+			ShardPlacement *nodePlacement = (ShardPlacement *) lfirst(nodePlacementCell);
+			if (strncmp(nodePlacement->nodeName, placement->nodeName,
+						WORKER_LENGTH) == 0 &&
+				nodePlacement->nodePort == placement->nodePort)
+			{
+				nodeCommand = (StringInfo) lfirst(nodeCommandCell);
+				lfirst_int(nodeTaskCountCell)++;
+				break;
+			}
+		}
+
+		if (nodeCommand == NULL)
+		{
+			nodeCommand = makeStringInfo();
+
+			nodePlacementList = lappend(nodePlacementList, placement);
+			nodeCommandList = lappend(nodeCommandList, nodeCommand);
+			nodeTaskCountList = lappend_int(nodeTaskCountList, 1);
+		}
+
+		appendStringInfo(nodeCommand, "%s;", sourceTask->queryString);
+	}
+
+	/* start all connections first, so that we connect to nodes in parallel */
+	foreach(nodePlacementCell, nodePlacementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(nodePlacementCell);
+		MultiConnection *connection = StartNodeConnection(FORCE_NEW_CONNECTION,
+														  placement->nodeName,
+														  placement->nodePort);
+
+		connectionList = lappend(connectionList, connection);
+	}
+
+	forboth(connectionCell, connectionList, nodeCommandCell, nodeCommandList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		StringInfo nodeCommand = (StringInfo) lfirst(nodeCommandCell);
+		int querySent = 0;
+
+		FinishConnectionEstablishment(connection);
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			taskFailed = true;
+			break;
+		}
+
+		querySent = SendRemoteCommand(connection, nodeCommand->data);
+		if (querySent == 0)
+		{
+			taskFailed = true;
+			break;
+		}
+	}
+
+	forboth(connectionCell, connectionList, nodeTaskCountCell, nodeTaskCountList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		int nodeTaskCount = lfirst_int(nodeTaskCountCell);
+		int taskIndex = 0;
+
+		if (taskFailed)
+		{
+			break;
+		}
+
+		/* each statement of the node's query returns one task's filter */
+		for (taskIndex = 0; taskIndex < nodeTaskCount; taskIndex++)
+		{
+			const bool raiseInterrupts = true;
+			PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+
+			taskFailed = !MergeSemiJoinFilter(&filter, result);
+
+			PQclear(result);
+			if (taskFailed)
+			{
+				break;
+			}
+		}
+
+		if (!taskFailed)
+		{
+			ForgetResults(connection);
+		}
+	}
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		CloseConnection(connection);
+	}
+
+	if (taskFailed)
+	{
+		return NULL;
+	}
+
+	return filter;
+}
+
+
+/*
+ * MergeSemiJoinFilter ORs the filter in the given filter building result into
+ * the given filter, or takes the result's filter if there is no filter yet. The
+ * function returns false if the result does not hold a filter of the expected
+ * size.
+ */
+static bool
+MergeSemiJoinFilter(bytea **filter, PGresult *result)
+{
+	char *filterString = NULL;
+	bytea *taskFilter = NULL;
+	uint8 *filterBytes = NULL;
+	uint8 *taskFilterBytes = NULL;
+	uint32 byteCount = 0;
+	uint32 byteIndex = 0;
+
+	if (PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) != 1 ||
+		PQgetisnull(result, 0, 0))
+	{
+		return false;
+	}
+
+	filterString = PQgetvalue(result, 0, 0);
+	taskFilter = DatumGetByteaP(DirectFunctionCall1(byteain,
+													CStringGetDatum(filterString)));
+	if (*filter == NULL)
+	{
+		*filter = taskFilter;
+		return true;
+	}
+
+	if (VARSIZE(taskFilter) != VARSIZE(*filter))
+	{
+		return false;
+	}
+
+	filterBytes = (uint8 *) VARDATA(*filter);
+	taskFilterBytes = (uint8 *) VARDATA(taskFilter);
+	byteCount = VARSIZE(*filter) - VARHDRSZ;
+
+	for (byteIndex = 0; byteIndex < byteCount; byteIndex++)
+	{
+		filterBytes[byteIndex] |= taskFilterBytes[byteIndex];
+	}
+
+	return true;
+}
+
+
+/*
+ * StoreSemiJoinFilter stores the given filter in the job directory of the given
+ * MapMerge job, on each node that has a placement of one of the job's map tasks.
+ * If we cannot store the filter on a node, map tasks on that node run without
+ * the filter.
+ */
+static void
+StoreSemiJoinFilter(MapMergeJob *mapMergeJob, bytea *filter)
+{
+	List *connectionList = NIL;
+	List *nodeList = NIL;
+	ListCell *mapTaskCell = NULL;
+	ListCell *connectionCell = NULL;
+	StringInfo storeCommand = makeStringInfo();
+	char *filterString = DatumGetCString(DirectFunctionCall1(byteaout,
+															 PointerGetDatum(filter)));
+	const Oid parameterTypes[1] = { BYTEAOID };
+	const char *parameterValues[1] = { filterString };
+	int storedNodeCount = 0;
+
+	appendStringInfo(storeCommand, STORE_SEMI_JOIN_FILTER_COMMAND,
+					 mapMergeJob->job.jobId);
+
+	foreach(mapTaskCell, mapMergeJob->mapTaskList)
+	{
+		Task *mapTask = (Task *) lfirst(mapTaskCell);
+		ListCell *placementCell = NULL;
+
+		foreach(placementCell, mapTask->taskPlacementList)
+		{
+			ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+			ListCell *nodeCell = NULL;
+			bool nodeSeen = false;
+
+			foreach(nodeCell, nodeList)
+			{
+				ShardPlacement *nodePlacement = (ShardPlacement *) lfirst(nodeCell);
+				if (strncmp(nodePlacement->nodeName, placement->nodeName,
+							WORKER_LENGTH) == 0 &&
+					nodePlacement->nodePort == placement->nodePort)
+				{
+					nodeSeen = true;
+					break;
+				}
+			}
+
+			if (!nodeSeen)
+			{
+				MultiConnection *connection =
+					StartNodeConnection(FORCE_NEW_CONNECTION, placement->nodeName,
+										placement->nodePort);
+
+				nodeList = lappend(nodeList, placement);
+				connectionList = lappend(connectionList, connection);
+			}
+		}
+	}
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		int querySent = 0;
+
+		FinishConnectionEstablishment(connection);
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			ReportConnectionError(connection, DEBUG1);
+			continue;
+		}
+
+		querySent = SendRemoteCommandParams(connection, storeCommand->data, 1,
+											parameterTypes, parameterValues);
+		if (querySent == 0)
+		{
+			ReportConnectionError(connection, DEBUG1);
+		}
+	}
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+
+		if (PQstatus(connection->pgConn) == CONNECTION_OK &&
+			PQisBusy(connection->pgConn))
+		{
+			const bool raiseInterrupts = true;
+			PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+
+			if (!IsResponseOK(result))
+			{
+				ReportResultError(connection, result, DEBUG1);
+			}
+			else
+			{
+				storedNodeCount++;
+			}
+
+			PQclear(result);
+			ForgetResults(connection);
+		}
+
+		CloseConnection(connection);
+	}
+
+	ereport(DEBUG1, (errmsg("stored semi-join filter on %d of %d nodes",
+							storedNodeCount, list_length(connectionList))));
+}
+
+
 /*
  * JobIdList walks over all jobs in the given job tree and retrieves each job's
  * identifier. The function then inserts these job identifiers in a new list and
@@ -2686,6 +3415,31 @@ TrackerCleanupResources(HTAB *taskTrackerHash, HTAB *transmitTrackerHash,
 }
 
 
+/*
+ * TrackerDisconnectResources closes open files for the given tasks, and closes
+ * connections to task trackers in the given hashes. Unlike
+ * TrackerCleanupResources, the function does not wait on task trackers, and is
+ * therefore safe to call while an error propagates.
+ */
+static void
+TrackerDisconnectResources(HTAB *taskTrackerHash, HTAB *transmitTrackerHash,
+						   List *taskList)
+{
+	ListCell *taskCell = NULL;
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		TaskExecution *taskExecution = task->taskExecution;
+
+		CleanupTaskExecution(taskExecution);
+	}
+
+	TrackerHashDisconnect(taskTrackerHash);
+	TrackerHashDisconnect(transmitTrackerHash);
+}
+
+
 /*
  * TrackerHashWaitActiveRequest walks over task trackers in the given hash, and
  * checks if they have an ongoing request. If they do, the function waits for
@@ -2712,6 +3466,7 @@ TrackerHashWaitActiveRequest(HTAB *taskTrackerHash)
 			{
 				taskTracker->connectionBusy = false;
 				taskTracker->connectionBusyOnTask = NULL;
+				taskTracker->connectionBusyOnTaskList = NIL;
 			}
 		}
 
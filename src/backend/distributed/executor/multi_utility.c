@@ -36,6 +36,7 @@
 #include "distributed/connection_cache.h"
 #include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
+#include "distributed/master_statistics.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/metadata_sync.h"
 #include "distributed/multi_copy.h"
@@ -1031,6 +1032,12 @@ ProcessVacuumStmt(VacuumStmt *vacuumStmt, const char *vacuumCommand)
 	MultiShardCommitProtocol = COMMIT_PROTOCOL_BARE;
 
 	ExecuteModifyTasksWithoutResults(taskList);
+
+	/* shards now have fresh statistics, merge them for the distributed planners */
+	if (vacuumStmt->options & VACOPT_ANALYZE)
+	{
+		UpdateDistributedTableStatistics(relationId);
+	}
 }
 
 
@@ -0,0 +1,1086 @@
+/*-------------------------------------------------------------------------
+ *
+ * master_statistics.c
+ *
+ * Routines for collecting statistics of distributed tables. The coordinator
+ * does not hold the data of distributed tables, and therefore has no
+ * statistics for them. We instead fetch the statistics that worker nodes keep
+ * for each shard, merge them into statistics for the distributed table, and
+ * store these in pg_dist_table_statistic and pg_dist_column_statistic, where
+ * the distributed planners can look them up.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include <math.h>
+
+#include "libpq-fe.h"
+
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_type.h"
+#include "distributed/connection_management.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/master_protocol.h"
+#include "distributed/master_statistics.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/multi_join_order.h"
+#include "distributed/pg_dist_statistic.h"
+#include "distributed/relay_utility.h"
+#include "distributed/remote_commands.h"
+#include "distributed/resource_lock.h"
+#include "distributed/worker_manager.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/typcache.h"
+
+
+/* Columns of the shard statistics query's result */
+#define SHARD_ROW_COUNT_COLUMN 0
+#define SHARD_SIZE_COLUMN 1
+#define ATTNAME_COLUMN 2
+#define NULL_FRAC_COLUMN 3
+#define AVG_WIDTH_COLUMN 4
+#define N_DISTINCT_COLUMN 5
+#define MOST_COMMON_VALS_COLUMN 6
+#define MOST_COMMON_FREQS_COLUMN 7
+#define HISTOGRAM_BOUNDS_COLUMN 8
+
+/*
+ * If a column has more distinct values than this fraction of rows, we assume
+ * the number of distinct values grows with the table, and store the fraction
+ * instead of the number; ANALYZE uses the same rule.
+ */
+#define DISTINCT_FRACTION_THRESHOLD 0.1
+
+
+/* ValueFrequency counts the rows that have one of a column's common values. */
+typedef struct ValueFrequency
+{
+	char *value;
+	double rowCount;
+} ValueFrequency;
+
+
+/*
+ * HistogramBound is one bound of a shard's equi-depth histogram, together
+ * with the number of rows in the histogram bucket that this bound closes.
+ */
+typedef struct HistogramBound
+{
+	char *value;
+	Datum datum;
+	double rowCount;
+} HistogramBound;
+
+
+/* ColumnStatistics accumulates the statistics of one column over all shards. */
+typedef struct ColumnStatistics
+{
+	AttrNumber attnum;
+	double nullRowCount;
+	double valueRowCount;
+	double widthSum;
+	double maxDistinctCount;
+	double distinctCountSum;
+	bool uniqueInShards;
+	List *commonValueList;
+	int commonValueCount;
+	List *histogramBoundList;
+	int histogramBoundCount;
+} ColumnStatistics;
+
+
+/* HistogramSortContext holds what we need to compare histogram bounds */
+typedef struct HistogramSortContext
+{
+	FmgrInfo *compareFunction;
+	Oid collation;
+} HistogramSortContext;
+
+
+/* Local functions forward declarations */
+static List * FetchShardStatistics(Oid relationId, List *shardIntervalList);
+static ColumnStatistics * FindColumnStatistics(List *columnStatisticsList,
+											   AttrNumber attnum);
+static void AddShardColumnStatistics(ColumnStatistics *columnStatistics,
+									 PGresult *result, int rowIndex,
+									 double shardRowCount);
+static Datum * ArrayElements(char *arrayString, Oid elementType, int *elementCount);
+static int CompareValueFrequencies(const void *leftElement, const void *rightElement);
+static int CompareHistogramBounds(const void *leftElement, const void *rightElement,
+								  void *arg);
+static ArrayType * MostCommonValueArray(ColumnStatistics *columnStatistics,
+										double rowCount, ArrayType **frequencyArray);
+static ArrayType * HistogramBoundArray(Oid relationId,
+									   ColumnStatistics *columnStatistics);
+static void InsertTableStatisticRow(Oid relationId, double rowCount, double tableSize);
+static void InsertColumnStatisticRow(Oid relationId, ColumnStatistics *columnStatistics,
+									 double rowCount, bool partitionColumn);
+
+
+/* exports for SQL callable functions */
+PG_FUNCTION_INFO_V1(master_update_table_statistics);
+
+
+/*
+ * master_update_table_statistics fetches the statistics of the given table's
+ * shards from worker nodes, and merges them into statistics for the table.
+ */
+Datum
+master_update_table_statistics(PG_FUNCTION_ARGS)
+{
+	Oid relationId = PG_GETARG_OID(0);
+
+	CheckDistributedTable(relationId);
+	EnsureTableOwner(relationId);
+
+	UpdateDistributedTableStatistics(relationId);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * UpdateDistributedTableStatistics fetches the row count, size, and column
+ * statistics of each of the given table's shards in parallel, merges them, and
+ * replaces the table's statistics with the merged ones. Each shard's statistics
+ * come from one of its finalized placements, and are only as recent as the
+ * last ANALYZE of that placement.
+ *
+ * Statistics only guide planning. If we cannot fetch the statistics of a shard,
+ * the function warns and keeps the table's previous statistics.
+ */
+void
+UpdateDistributedTableStatistics(Oid relationId)
+{
+	List *shardIntervalList = NIL;
+	List *resultList = NIL;
+	ListCell *resultCell = NULL;
+	List *columnStatisticsList = NIL;
+	ListCell *columnStatisticsCell = NULL;
+	Var *partitionKey = PartitionKey(relationId);
+	double rowCount = 0.0;
+	double tableSize = 0.0;
+
+	LockRelationDistributionMetadata(relationId, ShareLock);
+	shardIntervalList = LoadShardIntervalList(relationId);
+
+	resultList = FetchShardStatistics(relationId, shardIntervalList);
+	if (list_length(resultList) != list_length(shardIntervalList))
+	{
+		ereport(WARNING, (errmsg("could not fetch statistics of table \"%s\"",
+								 get_rel_name(relationId)),
+						  errdetail("Keeping the table's previous statistics.")));
+		return;
+	}
+
+	foreach(resultCell, resultList)
+	{
+		PGresult *result = (PGresult *) lfirst(resultCell);
+		double shardRowCount = atof(PQgetvalue(result, 0, SHARD_ROW_COUNT_COLUMN));
+		int rowIndex = 0;
+
+		rowCount += shardRowCount;
+		tableSize += atof(PQgetvalue(result, 0, SHARD_SIZE_COLUMN));
+
+		for (rowIndex = 0; rowIndex < PQntuples(result); rowIndex++)
+		{
+			char *columnName = NULL;
+			AttrNumber attnum = InvalidAttrNumber;
+			ColumnStatistics *columnStatistics = NULL;
+
+			/* shards that were never analyzed have no column statistics */
+			if (PQgetisnull(result, rowIndex, ATTNAME_COLUMN))
+			{
+				continue;
+			}
+
+			/* shards may number their columns differently after dropped columns */
+			columnName = PQgetvalue(result, rowIndex, ATTNAME_COLUMN);
+			attnum = get_attnum(relationId, columnName);
+			if (attnum == InvalidAttrNumber)
+			{
+				continue;
+			}
+
+			columnStatistics = FindColumnStatistics(columnStatisticsList, attnum);
+			if (columnStatistics == NULL)
+			{
+				columnStatistics = palloc0(sizeof(ColumnStatistics));
+				columnStatistics->attnum = attnum;
+				columnStatistics->uniqueInShards = true;
+
+				columnStatisticsList = lappend(columnStatisticsList, columnStatistics);
+			}
+
+			AddShardColumnStatistics(columnStatistics, result, rowIndex, shardRowCount);
+		}
+
+		PQclear(result);
+	}
+
+	DeleteDistributedTableStatistics(relationId);
+	InsertTableStatisticRow(relationId, rowCount, tableSize);
+
+	foreach(columnStatisticsCell, columnStatisticsList)
+	{
+		ColumnStatistics *columnStatistics =
+			(ColumnStatistics *) lfirst(columnStatisticsCell);
+		bool partitionColumn = (partitionKey != NULL &&
+								partitionKey->varattno == columnStatistics->attnum);
+
+		InsertColumnStatisticRow(relationId, columnStatistics, rowCount,
+								 partitionColumn);
+	}
+}
+
+
+/*
+ * FetchShardStatistics runs the shard statistics query for each of the given
+ * shards on the shard's first finalized placement, and returns the results in
+ * the order of the shards. We open one connection per node, and send the
+ * queries for all of the node's shards over it as one multi-statement query;
+ * nodes then answer in parallel. If any query fails, the function returns an
+ * empty list.
+ */
+static List *
+FetchShardStatistics(Oid relationId, List *shardIntervalList)
+{
+	List *nodePlacementList = NIL;
+	List *nodeQueryList = NIL;
+	List *nodeShardIndexList = NIL;
+	List *connectionList = NIL;
+	List *resultList = NIL;
+	ListCell *nodePlacementCell = NULL;
+	ListCell *nodeQueryCell = NULL;
+	ListCell *nodeShardIndexCell = NULL;
+	ListCell *connectionCell = NULL;
+	ListCell *shardIntervalCell = NULL;
+	int shardCount = list_length(shardIntervalList);
+	PGresult **resultArray = palloc0(Max(shardCount, 1) * sizeof(PGresult *));
+	char *relationName = get_rel_name(relationId);
+	char *schemaName = get_namespace_name(get_rel_namespace(relationId));
+	bool queryFailed = false;
+	int shardIndex = 0;
+
+	/* group the shards' statistics queries by the node they run on */
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		uint64 shardId = shardInterval->shardId;
+		List *placementList = FinalizedShardPlacementList(shardId);
+		ShardPlacement *placement = NULL;
+		char *shardName = pstrdup(relationName);
+		StringInfo nodeQuery = NULL;
+
+		if (placementList == NIL)
+		{
+			queryFailed = true;
+			break;
+		}
+
+		placement = (ShardPlacement *) linitial(placementList);
+
+		forthree(nodePlacementCell, nodePlacementList, nodeQueryCell, nodeQueryList,
+				 nodeShardIndexCell, nodeShardIndexList)
+		{
+			ShardPlacement *nodePlacement = (ShardPlacement *) lfirst(nodePlacementCell);
+			if (strncmp(nodePlacement->nodeName, placement->nodeName,
+						WORKER_LENGTH) == 0 &&
+				nodePlacement->nodePort == placement->nodePort)
+			{
+				nodeQuery = (StringInfo) lfirst(nodeQueryCell);
+				lfirst(nodeShardIndexCell) = lappend_int(lfirst(nodeShardIndexCell),
+														 shardIndex);
+				break;
+			}
+		}
+
+		if (nodeQuery == NULL)
+		{
+			nodeQuery = makeStringInfo();
+
+			nodePlacementList = lappend(nodePlacementList, placement);
+			nodeQueryList = lappend(nodeQueryList, nodeQuery);
+			nodeShardIndexList = lappend(nodeShardIndexList,
+										 list_make1_int(shardIndex));
+		}
+
+		AppendShardIdToName(&shardName, shardId);
+		appendStringInfo(nodeQuery, SHARD_STATISTICS_QUERY ";",
+						 quote_literal_cstr(schemaName),
+						 quote_literal_cstr(quote_qualified_identifier(schemaName,
+																	   shardName)));
+
+		shardIndex++;
+	}
+
+	if (queryFailed)
+	{
+		return NIL;
+	}
+
+	/* start all connections first, so that we connect to nodes in parallel */
+	foreach(nodePlacementCell, nodePlacementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(nodePlacementCell);
+		MultiConnection *connection = StartNodeConnection(FORCE_NEW_CONNECTION,
+														  placement->nodeName,
+														  placement->nodePort);
+
+		connectionList = lappend(connectionList, connection);
+	}
+
+	forboth(connectionCell, connectionList, nodeQueryCell, nodeQueryList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		StringInfo nodeQuery = (StringInfo) lfirst(nodeQueryCell);
+		int querySent = 0;
+
+		FinishConnectionEstablishment(connection);
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			ReportConnectionError(connection, WARNING);
+			queryFailed = true;
+			break;
+		}
+
+		querySent = SendRemoteCommand(connection, nodeQuery->data);
+		if (querySent == 0)
+		{
+			ReportConnectionError(connection, WARNING);
+			queryFailed = true;
+			break;
+		}
+	}
+
+	forboth(connectionCell, connectionList, nodeShardIndexCell, nodeShardIndexList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		List *shardIndexList = (List *) lfirst(nodeShardIndexCell);
+		ListCell *shardIndexCell = NULL;
+
+		if (queryFailed)
+		{
+			break;
+		}
+
+		/* each statement of the node's query returns one shard's statistics */
+		foreach(shardIndexCell, shardIndexList)
+		{
+			const bool raiseInterrupts = true;
+			PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+
+			if (PQresultStatus(result) != PGRES_TUPLES_OK)
+			{
+				ReportResultError(connection, result, WARNING);
+				PQclear(result);
+				queryFailed = true;
+				break;
+			}
+
+			/* the shard's pg_class row is always there, even without statistics */
+			if (PQntuples(result) == 0)
+			{
+				PQclear(result);
+				queryFailed = true;
+				break;
+			}
+
+			resultArray[lfirst_int(shardIndexCell)] = result;
+		}
+
+		if (!queryFailed)
+		{
+			ForgetResults(connection);
+		}
+	}
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		CloseConnection(connection);
+	}
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		PGresult *result = resultArray[shardIndex];
+
+		if (queryFailed)
+		{
+			PQclear(result);
+		}
+		else
+		{
+			resultList = lappend(resultList, result);
+		}
+	}
+
+	pfree(resultArray);
+
+	return resultList;
+}
+
+
+/* Finds the statistics we accumulated for the given column so far, if any. */
+static ColumnStatistics *
+FindColumnStatistics(List *columnStatisticsList, AttrNumber attnum)
+{
+	ListCell *columnStatisticsCell = NULL;
+
+	foreach(columnStatisticsCell, columnStatisticsList)
+	{
+		ColumnStatistics *columnStatistics =
+			(ColumnStatistics *) lfirst(columnStatisticsCell);
+
+		if (columnStatistics->attnum == attnum)
+		{
+			return columnStatistics;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * AddShardColumnStatistics adds one shard's statistics for a column to the
+ * statistics accumulated for the column so far. Fractions in pg_stats relate
+ * to the shard's rows, so we convert them into row counts before adding them
+ * up. Common values that a shard does not list count as zero rows for that
+ * shard.
+ */
+static void
+AddShardColumnStatistics(ColumnStatistics *columnStatistics, PGresult *result,
+						 int rowIndex, double shardRowCount)
+{
+	double nullFraction = atof(PQgetvalue(result, rowIndex, NULL_FRAC_COLUMN));
+	double averageWidth = atof(PQgetvalue(result, rowIndex, AVG_WIDTH_COLUMN));
+	double distinctCount = atof(PQgetvalue(result, rowIndex, N_DISTINCT_COLUMN));
+	double valueRowCount = shardRowCount * (1.0 - nullFraction);
+	double commonRowCount = 0.0;
+
+	columnStatistics->nullRowCount += shardRowCount * nullFraction;
+	columnStatistics->valueRowCount += valueRowCount;
+	columnStatistics->widthSum += valueRowCount * averageWidth;
+
+	/* negative distinct counts are fractions of the shard's rows */
+	if (distinctCount != -1.0)
+	{
+		columnStatistics->uniqueInShards = false;
+	}
+
+	if (distinctCount < 0.0)
+	{
+		distinctCount = -distinctCount * shardRowCount;
+	}
+
+	columnStatistics->distinctCountSum += distinctCount;
+	columnStatistics->maxDistinctCount = Max(columnStatistics->maxDistinctCount,
+											 distinctCount);
+
+	if (!PQgetisnull(result, rowIndex, MOST_COMMON_VALS_COLUMN) &&
+		!PQgetisnull(result, rowIndex, MOST_COMMON_FREQS_COLUMN))
+	{
+		int valueCount = 0;
+		int frequencyCount = 0;
+		int valueIndex = 0;
+		Datum *valueArray = ArrayElements(PQgetvalue(result, rowIndex,
+													 MOST_COMMON_VALS_COLUMN),
+										  TEXTOID, &valueCount);
+		Datum *frequencyArray = ArrayElements(PQgetvalue(result, rowIndex,
+														 MOST_COMMON_FREQS_COLUMN),
+											  FLOAT4OID, &frequencyCount);
+
+		valueCount = Min(valueCount, frequencyCount);
+		for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+		{
+			char *value = TextDatumGetCString(valueArray[valueIndex]);
+			double frequency = DatumGetFloat4(frequencyArray[valueIndex]);
+			ValueFrequency *valueFrequency = NULL;
+			ListCell *valueFrequencyCell = NULL;
+
+			foreach(valueFrequencyCell, columnStatistics->commonValueList)
+			{
+				ValueFrequency *existingFrequency =
+					(ValueFrequency *) lfirst(valueFrequencyCell);
+
+				if (strcmp(existingFrequency->value, value) == 0)
+				{
+					valueFrequency = existingFrequency;
+					break;
+				}
+			}
+
+			if (valueFrequency == NULL)
+			{
+				valueFrequency = palloc0(sizeof(ValueFrequency));
+				valueFrequency->value = value;
+
+				columnStatistics->commonValueList =
+					lappend(columnStatistics->commonValueList, valueFrequency);
+			}
+
+			valueFrequency->rowCount += frequency * shardRowCount;
+			commonRowCount += frequency * shardRowCount;
+		}
+
+		columnStatistics->commonValueCount = Max(columnStatistics->commonValueCount,
+												 valueCount);
+	}
+
+	/* histograms cover the rows that do not have one of the common values */
+	if (!PQgetisnull(result, rowIndex, HISTOGRAM_BOUNDS_COLUMN))
+	{
+		int boundCount = 0;
+		int boundIndex = 0;
+		Datum *boundArray = ArrayElements(PQgetvalue(result, rowIndex,
+													 HISTOGRAM_BOUNDS_COLUMN),
+										  TEXTOID, &boundCount);
+		double bucketRowCount = 0.0;
+
+		if (boundCount > 1)
+		{
+			bucketRowCount = Max(valueRowCount - commonRowCount, 0.0) /
+							 (boundCount - 1);
+		}
+
+		for (boundIndex = 0; boundIndex < boundCount; boundIndex++)
+		{
+			HistogramBound *histogramBound = palloc0(sizeof(HistogramBound));
+			histogramBound->value = TextDatumGetCString(boundArray[boundIndex]);
+			histogramBound->rowCount = (boundIndex > 0) ? bucketRowCount : 0.0;
+
+			columnStatistics->histogramBoundList =
+				lappend(columnStatistics->histogramBoundList, histogramBound);
+		}
+
+		columnStatistics->histogramBoundCount =
+			Max(columnStatistics->histogramBoundCount, boundCount);
+	}
+}
+
+
+/*
+ * ArrayElements parses the given text form of a one-dimensional array with the
+ * given element type, and returns the array's elements.
+ */
+static Datum *
+ArrayElements(char *arrayString, Oid elementType, int *elementCount)
+{
+	Datum arrayDatum = OidFunctionCall3(F_ARRAY_IN, CStringGetDatum(arrayString),
+										ObjectIdGetDatum(elementType),
+										Int32GetDatum(-1));
+	ArrayType *array = DatumGetArrayTypeP(arrayDatum);
+	Datum *elementArray = NULL;
+	bool *nullArray = NULL;
+	int16 typeLength = 0;
+	bool typeByValue = false;
+	char typeAlignment = 0;
+
+	get_typlenbyvalalign(elementType, &typeLength, &typeByValue, &typeAlignment);
+	deconstruct_array(array, elementType, typeLength, typeByValue, typeAlignment,
+					  &elementArray, &nullArray, elementCount);
+
+	return elementArray;
+}
+
+
+/* Orders value frequencies by decreasing row counts. */
+static int
+CompareValueFrequencies(const void *leftElement, const void *rightElement)
+{
+	const ValueFrequency *leftFrequency = *((const ValueFrequency **) leftElement);
+	const ValueFrequency *rightFrequency = *((const ValueFrequency **) rightElement);
+
+	if (leftFrequency->rowCount > rightFrequency->rowCount)
+	{
+		return -1;
+	}
+	else if (leftFrequency->rowCount < rightFrequency->rowCount)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/* Orders histogram bounds by their values, using the column type's comparison. */
+static int
+CompareHistogramBounds(const void *leftElement, const void *rightElement, void *arg)
+{
+	const HistogramBound *leftBound = *((const HistogramBound **) leftElement);
+	const HistogramBound *rightBound = *((const HistogramBound **) rightElement);
+	HistogramSortContext *sortContext = (HistogramSortContext *) arg;
+
+	Datum comparison = FunctionCall2Coll(sortContext->compareFunction,
+										 sortContext->collation,
+										 leftBound->datum, rightBound->datum);
+
+	return DatumGetInt32(comparison);
+}
+
+
+/*
+ * MostCommonValueArray returns the column's most common values over all shards
+ * as a text array, and sets the given frequency array to the fractions of all
+ * rows that have these values. We keep as many values as the shard that listed
+ * the most common values.
+ */
+static ArrayType *
+MostCommonValueArray(ColumnStatistics *columnStatistics, double rowCount,
+					 ArrayType **frequencyArray)
+{
+	int valueCount = list_length(columnStatistics->commonValueList);
+	ValueFrequency **valueFrequencyArray = NULL;
+	Datum *valueDatumArray = NULL;
+	Datum *frequencyDatumArray = NULL;
+	ListCell *valueFrequencyCell = NULL;
+	int valueIndex = 0;
+
+	if (valueCount == 0 || rowCount <= 0.0)
+	{
+		*frequencyArray = NULL;
+		return NULL;
+	}
+
+	valueFrequencyArray = palloc0(valueCount * sizeof(ValueFrequency *));
+	foreach(valueFrequencyCell, columnStatistics->commonValueList)
+	{
+		valueFrequencyArray[valueIndex] = (ValueFrequency *) lfirst(valueFrequencyCell);
+		valueIndex++;
+	}
+
+	qsort(valueFrequencyArray, valueCount, sizeof(ValueFrequency *),
+		  CompareValueFrequencies);
+
+	valueCount = Min(valueCount, columnStatistics->commonValueCount);
+	valueDatumArray = palloc0(valueCount * sizeof(Datum));
+	frequencyDatumArray = palloc0(valueCount * sizeof(Datum));
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		ValueFrequency *valueFrequency = valueFrequencyArray[valueIndex];
+		float4 frequency = (float4) (valueFrequency->rowCount / rowCount);
+
+		valueDatumArray[valueIndex] = CStringGetTextDatum(valueFrequency->value);
+		frequencyDatumArray[valueIndex] = Float4GetDatum(frequency);
+	}
+
+	*frequencyArray = construct_array(frequencyDatumArray, valueCount, FLOAT4OID,
+									  sizeof(float4), FLOAT4PASSBYVAL, 'i');
+
+	return construct_array(valueDatumArray, valueCount, TEXTOID, -1, false, 'i');
+}
+
+
+/*
+ * HistogramBoundArray merges the histograms of all shards into one equi-depth
+ * histogram, and returns its bounds as a text array. The function sorts the
+ * bounds of all shard histograms, where each bound carries the rows of the
+ * bucket it closes, and picks the bounds at which the running row count
+ * crosses equal fractions of all rows. The merged histogram has as many bounds
+ * as the largest shard histogram.
+ *
+ * If the column's type has no ordering, the function returns NULL.
+ */
+static ArrayType *
+HistogramBoundArray(Oid relationId, ColumnStatistics *columnStatistics)
+{
+	int boundCount = list_length(columnStatistics->histogramBoundList);
+	int mergedBoundCount = columnStatistics->histogramBoundCount;
+	HistogramBound **boundArray = NULL;
+	Datum *mergedBoundArray = NULL;
+	ListCell *boundCell = NULL;
+	Oid typeId = InvalidOid;
+	int32 typeMod = -1;
+	Oid collation = InvalidOid;
+	Oid inputFunctionId = InvalidOid;
+	Oid typeIOParam = InvalidOid;
+	TypeCacheEntry *typeEntry = NULL;
+	HistogramSortContext sortContext;
+	double totalRowCount = 0.0;
+	double runningRowCount = 0.0;
+	int boundIndex = 0;
+	int mergedBoundIndex = 0;
+
+	if (boundCount < 2 || mergedBoundCount < 2)
+	{
+		return NULL;
+	}
+
+	get_atttypetypmodcoll(relationId, columnStatistics->attnum, &typeId, &typeMod,
+						  &collation);
+
+	typeEntry = lookup_type_cache(typeId, TYPECACHE_CMP_PROC_FINFO);
+	if (!OidIsValid(typeEntry->cmp_proc))
+	{
+		return NULL;
+	}
+
+	getTypeInputInfo(typeId, &inputFunctionId, &typeIOParam);
+
+	boundArray = palloc0(boundCount * sizeof(HistogramBound *));
+	foreach(boundCell, columnStatistics->histogramBoundList)
+	{
+		HistogramBound *histogramBound = (HistogramBound *) lfirst(boundCell);
+		histogramBound->datum = OidInputFunctionCall(inputFunctionId,
+													 histogramBound->value,
+													 typeIOParam, typeMod);
+
+		totalRowCount += histogramBound->rowCount;
+		boundArray[boundIndex] = histogramBound;
+		boundIndex++;
+	}
+
+	sortContext.compareFunction = &typeEntry->cmp_proc_finfo;
+	sortContext.collation = collation;
+	qsort_arg(boundArray, boundCount, sizeof(HistogramBound *),
+			  CompareHistogramBounds, (void *) &sortContext);
+
+	/* the first and last bounds are the smallest and largest values */
+	mergedBoundArray = palloc0(mergedBoundCount * sizeof(Datum));
+	mergedBoundArray[0] = CStringGetTextDatum(boundArray[0]->value);
+	mergedBoundIndex = 1;
+
+	for (boundIndex = 1; boundIndex < boundCount - 1; boundIndex++)
+	{
+		HistogramBound *histogramBound = boundArray[boundIndex];
+		double targetRowCount = totalRowCount * mergedBoundIndex /
+								(mergedBoundCount - 1);
+
+		if (mergedBoundIndex >= mergedBoundCount - 1)
+		{
+			break;
+		}
+
+		runningRowCount += histogramBound->rowCount;
+		if (runningRowCount >= targetRowCount)
+		{
+			mergedBoundArray[mergedBoundIndex] =
+				CStringGetTextDatum(histogramBound->value);
+			mergedBoundIndex++;
+		}
+	}
+
+	mergedBoundArray[mergedBoundIndex] =
+		CStringGetTextDatum(boundArray[boundCount - 1]->value);
+	mergedBoundIndex++;
+
+	return construct_array(mergedBoundArray, mergedBoundIndex, TEXTOID, -1, false,
+						   'i');
+}
+
+
+/*
+ * DeleteDistributedTableStatistics removes the statistics of the given table
+ * from pg_dist_table_statistic and pg_dist_column_statistic.
+ */
+void
+DeleteDistributedTableStatistics(Oid relationId)
+{
+	Relation pgDistTableStatistic = NULL;
+	Relation pgDistColumnStatistic = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	bool indexOK = true;
+	HeapTuple heapTuple = NULL;
+
+	pgDistTableStatistic = heap_open(DistTableStatisticRelationId(), RowExclusiveLock);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_table_statistic_logicalrelid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relationId));
+
+	scanDescriptor = systable_beginscan(pgDistTableStatistic,
+										DistTableStatisticLogicalRelidIndexId(),
+										indexOK, NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		simple_heap_delete(pgDistTableStatistic, &heapTuple->t_self);
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistTableStatistic, RowExclusiveLock);
+
+	pgDistColumnStatistic = heap_open(DistColumnStatisticRelationId(),
+									  RowExclusiveLock);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_column_statistic_logicalrelid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relationId));
+
+	scanDescriptor = systable_beginscan(pgDistColumnStatistic,
+										DistColumnStatisticLogicalRelidAttnumIndexId(),
+										indexOK, NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	while (HeapTupleIsValid(heapTuple))
+	{
+		simple_heap_delete(pgDistColumnStatistic, &heapTuple->t_self);
+		heapTuple = systable_getnext(scanDescriptor);
+	}
+
+	systable_endscan(scanDescriptor);
+
+	/* increment the counter so that next command can see the deletions */
+	CommandCounterIncrement();
+
+	heap_close(pgDistColumnStatistic, RowExclusiveLock);
+}
+
+
+/* Inserts the given table's row count and size into pg_dist_table_statistic. */
+static void
+InsertTableStatisticRow(Oid relationId, double rowCount, double tableSize)
+{
+	Relation pgDistTableStatistic = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_pg_dist_table_statistic];
+	bool isNulls[Natts_pg_dist_table_statistic];
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[Anum_pg_dist_table_statistic_logicalrelid - 1] = ObjectIdGetDatum(relationId);
+	values[Anum_pg_dist_table_statistic_reltuples - 1] = Float8GetDatum(rowCount);
+	values[Anum_pg_dist_table_statistic_relsize - 1] = Int64GetDatum((int64) tableSize);
+
+	pgDistTableStatistic = heap_open(DistTableStatisticRelationId(), RowExclusiveLock);
+
+	tupleDescriptor = RelationGetDescr(pgDistTableStatistic);
+	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	simple_heap_insert(pgDistTableStatistic, heapTuple);
+	CatalogUpdateIndexes(pgDistTableStatistic, heapTuple);
+
+	CommandCounterIncrement();
+	heap_close(pgDistTableStatistic, RowExclusiveLock);
+}
+
+
+/*
+ * InsertColumnStatisticRow finishes merging the given column's statistics, and
+ * inserts them into pg_dist_column_statistic.
+ *
+ * Shards of a table hold disjoint values of the partition column, so we add up
+ * the partition column's distinct values over shards. The same applies to any
+ * column that is unique in every shard. Other columns usually have most of
+ * their values in every shard, so we take the largest shard's count.
+ */
+static void
+InsertColumnStatisticRow(Oid relationId, ColumnStatistics *columnStatistics,
+						 double rowCount, bool partitionColumn)
+{
+	Relation pgDistColumnStatistic = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple heapTuple = NULL;
+	Datum values[Natts_pg_dist_column_statistic];
+	bool isNulls[Natts_pg_dist_column_statistic];
+	double nullFraction = 0.0;
+	double averageWidth = 0.0;
+	double distinctCount = 0.0;
+	ArrayType *commonValueArray = NULL;
+	ArrayType *commonFrequencyArray = NULL;
+	ArrayType *histogramBoundArray = NULL;
+
+	if (rowCount > 0.0)
+	{
+		nullFraction = columnStatistics->nullRowCount / rowCount;
+	}
+
+	if (columnStatistics->valueRowCount > 0.0)
+	{
+		averageWidth = columnStatistics->widthSum / columnStatistics->valueRowCount;
+	}
+
+	if (partitionColumn || columnStatistics->uniqueInShards)
+	{
+		distinctCount = columnStatistics->distinctCountSum;
+	}
+	else
+	{
+		distinctCount = columnStatistics->maxDistinctCount;
+	}
+
+	distinctCount = Min(distinctCount, columnStatistics->valueRowCount);
+	if (columnStatistics->uniqueInShards && partitionColumn)
+	{
+		distinctCount = -1.0;
+	}
+	else if (rowCount > 0.0 && distinctCount > DISTINCT_FRACTION_THRESHOLD * rowCount)
+	{
+		distinctCount = -(distinctCount / rowCount);
+	}
+
+	commonValueArray = MostCommonValueArray(columnStatistics, rowCount,
+											&commonFrequencyArray);
+	histogramBoundArray = HistogramBoundArray(relationId, columnStatistics);
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[Anum_pg_dist_column_statistic_logicalrelid - 1] =
+		ObjectIdGetDatum(relationId);
+	values[Anum_pg_dist_column_statistic_attnum - 1] =
+		Int16GetDatum(columnStatistics->attnum);
+	values[Anum_pg_dist_column_statistic_null_frac - 1] =
+		Float4GetDatum((float4) nullFraction);
+	values[Anum_pg_dist_column_statistic_avg_width - 1] =
+		Int32GetDatum((int32) rint(averageWidth));
+	values[Anum_pg_dist_column_statistic_n_distinct - 1] =
+		Float4GetDatum((float4) distinctCount);
+
+	if (commonValueArray != NULL)
+	{
+		values[Anum_pg_dist_column_statistic_most_common_vals - 1] =
+			PointerGetDatum(commonValueArray);
+		values[Anum_pg_dist_column_statistic_most_common_freqs - 1] =
+			PointerGetDatum(commonFrequencyArray);
+	}
+	else
+	{
+		isNulls[Anum_pg_dist_column_statistic_most_common_vals - 1] = true;
+		isNulls[Anum_pg_dist_column_statistic_most_common_freqs - 1] = true;
+	}
+
+	if (histogramBoundArray != NULL)
+	{
+		values[Anum_pg_dist_column_statistic_histogram_bounds - 1] =
+			PointerGetDatum(histogramBoundArray);
+	}
+	else
+	{
+		isNulls[Anum_pg_dist_column_statistic_histogram_bounds - 1] = true;
+	}
+
+	pgDistColumnStatistic = heap_open(DistColumnStatisticRelationId(),
+									  RowExclusiveLock);
+
+	tupleDescriptor = RelationGetDescr(pgDistColumnStatistic);
+	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	simple_heap_insert(pgDistColumnStatistic, heapTuple);
+	CatalogUpdateIndexes(pgDistColumnStatistic, heapTuple);
+
+	CommandCounterIncrement();
+	heap_close(pgDistColumnStatistic, RowExclusiveLock);
+}
+
+
+/*
+ * DistributedTableStatistics looks up the row count and size of the given
+ * distributed table. The function returns false if we have not collected
+ * statistics for the table.
+ */
+bool
+DistributedTableStatistics(Oid relationId, double *rowCount, double *tableSize)
+{
+	Relation pgDistTableStatistic = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	bool indexOK = true;
+	HeapTuple heapTuple = NULL;
+	bool statisticsFound = false;
+
+	pgDistTableStatistic = heap_open(DistTableStatisticRelationId(), AccessShareLock);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_table_statistic_logicalrelid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relationId));
+
+	scanDescriptor = systable_beginscan(pgDistTableStatistic,
+										DistTableStatisticLogicalRelidIndexId(),
+										indexOK, NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		Form_pg_dist_table_statistic tableStatisticForm =
+			(Form_pg_dist_table_statistic) GETSTRUCT(heapTuple);
+
+		*rowCount = tableStatisticForm->reltuples;
+		*tableSize = (double) tableStatisticForm->relsize;
+		statisticsFound = true;
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistTableStatistic, AccessShareLock);
+
+	return statisticsFound;
+}
+
+
+/*
+ * DistributedColumnDistinctCount looks up the estimated number of distinct
+ * values in the given column of a distributed table. The function returns 0 if
+ * we have not collected statistics for the column.
+ */
+double
+DistributedColumnDistinctCount(Oid relationId, AttrNumber attnum)
+{
+	Relation pgDistColumnStatistic = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[2];
+	int scanKeyCount = 2;
+	bool indexOK = true;
+	HeapTuple heapTuple = NULL;
+	double distinctCount = 0.0;
+
+	pgDistColumnStatistic = heap_open(DistColumnStatisticRelationId(),
+									  AccessShareLock);
+
+	ScanKeyInit(&scanKey[0], Anum_pg_dist_column_statistic_logicalrelid,
+				BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relationId));
+	ScanKeyInit(&scanKey[1], Anum_pg_dist_column_statistic_attnum,
+				BTEqualStrategyNumber, F_INT2EQ, Int16GetDatum(attnum));
+
+	scanDescriptor = systable_beginscan(pgDistColumnStatistic,
+										DistColumnStatisticLogicalRelidAttnumIndexId(),
+										indexOK, NULL, scanKeyCount, scanKey);
+
+	heapTuple = systable_getnext(scanDescriptor);
+	if (HeapTupleIsValid(heapTuple))
+	{
+		Form_pg_dist_column_statistic columnStatisticForm =
+			(Form_pg_dist_column_statistic) GETSTRUCT(heapTuple);
+
+		distinctCount = columnStatisticForm->n_distinct;
+	}
+
+	systable_endscan(scanDescriptor);
+	heap_close(pgDistColumnStatistic, AccessShareLock);
+
+	/* negative counts are fractions of the table's rows */
+	if (distinctCount < 0.0)
+	{
+		double rowCount = 0.0;
+		double tableSize = 0.0;
+
+		if (DistributedTableStatistics(relationId, &rowCount, &tableSize))
+		{
+			distinctCount = -distinctCount * rowCount;
+		}
+		else
+		{
+			distinctCount = 0.0;
+		}
+	}
+
+	return distinctCount;
+}
@@ -76,6 +76,11 @@ RebuildQueryStrings(Query *originalQuery, List *taskList)
 
 			UpdateRelationToShardNames((Node *) copiedSubquery, relationShardList);
 		}
+		else if (task->rowIndexList != NIL)
+		{
+			/* for multi-row INSERTs, only deparse the rows of the task's shard */
+			query = InsertValuesSubsetQuery(originalQuery, task->rowIndexList);
+		}
 
 		deparse_shard_query(query, relationId, task->anchorShardId,
 							newQueryString);
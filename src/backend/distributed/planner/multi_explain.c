@@ -40,6 +40,7 @@
 #include "tcop/dest.h"
 #include "tcop/tcopprot.h"
 #include "tcop/utility.h"
+#include "utils/builtins.h"
 #include "utils/json.h"
 #include "utils/snapmgr.h"
 
@@ -154,6 +155,9 @@ MultiExplainOneQuery(Query *query, IntoClause *into, ExplainState *es,
 
 	restrictionContext = CreateAndPushRestrictionContext();
 
+	/* plans for EXPLAIN without ANALYZE never run, so skip costly lookups */
+	PlanningForExplainOnly = !es->analyze;
+
 	PG_TRY();
 	{
 		/* call standard planner to modify the query structure before multi planning */
@@ -175,11 +179,13 @@ MultiExplainOneQuery(Query *query, IntoClause *into, ExplainState *es,
 	}
 	PG_CATCH();
 	{
+		PlanningForExplainOnly = false;
 		PopRestrictionContext();
 		PG_RE_THROW();
 	}
 	PG_END_TRY();
 
+	PlanningForExplainOnly = false;
 	PopRestrictionContext();
 
 	INSTR_TIME_SET_CURRENT(planDuration);
@@ -258,6 +264,17 @@ MultiExplainOneQuery(Query *query, IntoClause *into, ExplainState *es,
 		}
 	}
 
+	/* show how much data the planner expected the query's joins to move */
+	if (multiPlan->costBasedJoinOrder && !routerExecutablePlan)
+	{
+		int64 transferSize = (int64) multiPlan->transferSize;
+		Datum transferSizeText = DirectFunctionCall1(pg_size_pretty,
+													 Int64GetDatum(transferSize));
+
+		ExplainPropertyText("Estimated Join Transfer",
+							TextDatumGetCString(transferSizeText), es);
+	}
+
 	workerJob = multiPlan->workerJob;
 	ExplainJob(workerJob, es);
 
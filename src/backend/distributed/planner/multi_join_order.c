@@ -18,10 +18,13 @@
 #include "access/heapam.h"
 #include "access/htup_details.h"
 #include "catalog/pg_am.h"
+#include "distributed/master_metadata_utility.h"
+#include "distributed/master_statistics.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_join_order.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/pg_dist_partition.h"
+#include "distributed/worker_manager.h"
 #include "distributed/worker_protocol.h"
 #include "lib/stringinfo.h"
 #include "optimizer/var.h"
@@ -36,6 +39,7 @@
 /* Config variables managed via guc.c */
 int LargeTableShardCount = 4;   /* shard counts for a large table */
 bool LogMultiJoinOrder = false; /* print join order as a debugging aid */
+bool EnableCostBasedJoinOrder = false; /* pick join rules by bytes transferred */
 
 /* Function pointer type definition for join rule evaluation functions */
 typedef JoinOrderNode *(*RuleEvalFunction) (JoinOrderNode *currentJoinNode,
@@ -58,11 +62,18 @@ static List * MergeShardIntervals(List *leftShardIntervalList,
 static bool ShardIntervalsMatch(List *leftShardIntervalList,
 								List *rightShardIntervalList);
 static List * JoinOrderForTable(TableEntry *firstTable, List *tableEntryList,
-								List *joinClauseList);
-static List * BestJoinOrder(List *candidateJoinOrders);
+								List *joinClauseList, bool costBasedJoinOrder);
+static List * BestJoinOrder(List *candidateJoinOrders, bool costBasedJoinOrder);
 static List * FewestOfJoinRuleType(List *candidateJoinOrders, JoinRuleType ruleType);
 static uint32 JoinRuleTypeCount(List *joinOrder, JoinRuleType ruleTypeToCount);
 static List * LatestLargeDataTransfer(List *candidateJoinOrders);
+static List * CheapestJoinOrders(List *candidateJoinOrders);
+static double JoinOrderTransferSize(List *joinOrder);
+static bool CheaperJoinNode(JoinOrderNode *joinNode, JoinOrderNode *otherJoinNode);
+static void EstimateTransferSize(JoinOrderNode *currentJoinNode,
+								 JoinOrderNode *nextJoinNode, List *candidateShardList);
+static bool TableSizesKnown(List *tableEntryList);
+static double TableSize(Oid relationId, List *shardIntervalList);
 static void PrintJoinOrderList(List *joinOrder);
 static uint32 LargeDataTransferLocation(List *joinOrder);
 static List * TableEntryListDifference(List *lhsTableList, List *rhsTableList);
@@ -612,6 +623,12 @@ ShardIntervalsMatch(List *leftShardIntervalList, List *rightShardIntervalList)
  * candidate join orders, each with a different table as its first table. Then,
  * the function chooses among these candidates the join order that transfers the
  * least amount of data across the network, and returns this join order.
+ *
+ * By default, we rank join rules by their type, and consider a table large if
+ * it has many shards. If cost based join orders are enabled, we instead rank
+ * join rules and join orders by the number of bytes they are estimated to move
+ * across the network, based on table sizes. If we do not know the size of some
+ * table in the query, we rank join rules by their type as usual.
  */
 List *
 JoinOrderList(List *tableEntryList, List *joinClauseList)
@@ -619,6 +636,12 @@ JoinOrderList(List *tableEntryList, List *joinClauseList)
 	List *bestJoinOrder = NIL;
 	List *candidateJoinOrderList = NIL;
 	ListCell *tableEntryCell = NULL;
+	bool costBasedJoinOrder = false;
+
+	if (EnableCostBasedJoinOrder)
+	{
+		costBasedJoinOrder = TableSizesKnown(tableEntryList);
+	}
 
 	foreach(tableEntryCell, tableEntryList)
 	{
@@ -627,12 +650,12 @@ JoinOrderList(List *tableEntryList, List *joinClauseList)
 
 		/* each candidate join order starts with a different table */
 		candidateJoinOrder = JoinOrderForTable(startingTable, tableEntryList,
-											   joinClauseList);
+											   joinClauseList, costBasedJoinOrder);
 
 		candidateJoinOrderList = lappend(candidateJoinOrderList, candidateJoinOrder);
 	}
 
-	bestJoinOrder = BestJoinOrder(candidateJoinOrderList);
+	bestJoinOrder = BestJoinOrder(candidateJoinOrderList, costBasedJoinOrder);
 
 	/* if logging is enabled, print join order */
 	if (LogMultiJoinOrder)
@@ -653,7 +676,8 @@ JoinOrderList(List *tableEntryList, List *joinClauseList)
  * returns this list.
  */
 static List *
-JoinOrderForTable(TableEntry *firstTable, List *tableEntryList, List *joinClauseList)
+JoinOrderForTable(TableEntry *firstTable, List *tableEntryList, List *joinClauseList,
+				  bool costBasedJoinOrder)
 {
 	JoinOrderNode *currentJoinNode = NULL;
 	JoinRuleType firstJoinRule = JOIN_RULE_INVALID_FIRST;
@@ -672,6 +696,14 @@ JoinOrderForTable(TableEntry *firstTable, List *tableEntryList, List *joinClause
 													 firstPartitionColumn,
 													 firstPartitionMethod);
 
+	if (costBasedJoinOrder)
+	{
+		List *firstShardList = LoadShardIntervalList(firstRelationId);
+
+		firstJoinNode->costBased = true;
+		firstJoinNode->joinedSize = TableSize(firstRelationId, firstShardList);
+	}
+
 	/* add first node to the join order */
 	joinOrderList = list_make1(firstJoinNode);
 	joinedTableList = list_make1(firstTable);
@@ -708,7 +740,14 @@ JoinOrderForTable(TableEntry *firstTable, List *tableEntryList, List *joinClause
 
 			/* if this rule is better than previous ones, keep it */
 			pendingJoinRuleType = pendingJoinNode->joinRuleType;
-			if (pendingJoinRuleType < nextJoinRuleType)
+			if (costBasedJoinOrder)
+			{
+				if (nextJoinNode == NULL || CheaperJoinNode(pendingJoinNode, nextJoinNode))
+				{
+					nextJoinNode = pendingJoinNode;
+				}
+			}
+			else if (pendingJoinRuleType < nextJoinRuleType)
 			{
 				nextJoinNode = pendingJoinNode;
 				nextJoinRuleType = pendingJoinRuleType;
@@ -736,9 +775,13 @@ JoinOrderForTable(TableEntry *firstTable, List *tableEntryList, List *joinClause
  * this. First, the function chooses join orders that have the fewest number of
  * join operators that cause large data transfers. Second, the function chooses
  * join orders where large data transfers occur later in the execution.
+ *
+ * If cost based join orders are enabled, the function instead chooses join
+ * orders that have the fewest cartesian products, and then the join orders
+ * that are estimated to transfer the fewest bytes.
  */
 static List *
-BestJoinOrder(List *candidateJoinOrders)
+BestJoinOrder(List *candidateJoinOrders, bool costBasedJoinOrder)
 {
 	List *bestJoinOrder = NULL;
 	uint32 ruleTypeIndex = 0;
@@ -758,11 +801,20 @@ BestJoinOrder(List *candidateJoinOrders)
 	 * have 3 or more, if there isn't a join order with fewer DPs; and so
 	 * forth.
 	 */
-	for (ruleTypeIndex = highestValidIndex; ruleTypeIndex > 0; ruleTypeIndex--)
+	if (costBasedJoinOrder)
 	{
-		JoinRuleType ruleType = (JoinRuleType) ruleTypeIndex;
+		candidateJoinOrders = FewestOfJoinRuleType(candidateJoinOrders,
+												   CARTESIAN_PRODUCT);
+		candidateJoinOrders = CheapestJoinOrders(candidateJoinOrders);
+	}
+	else
+	{
+		for (ruleTypeIndex = highestValidIndex; ruleTypeIndex > 0; ruleTypeIndex--)
+		{
+			JoinRuleType ruleType = (JoinRuleType) ruleTypeIndex;
 
-		candidateJoinOrders = FewestOfJoinRuleType(candidateJoinOrders, ruleType);
+			candidateJoinOrders = FewestOfJoinRuleType(candidateJoinOrders, ruleType);
+		}
 	}
 
 	/*
@@ -907,6 +959,212 @@ LargeDataTransferLocation(List *joinOrder)
 }
 
 
+/*
+ * CheapestJoinOrders finds and returns the join orders that are estimated to
+ * transfer the fewest bytes across the network.
+ */
+static List *
+CheapestJoinOrders(List *candidateJoinOrders)
+{
+	List *cheapestJoinOrders = NIL;
+	double cheapestTransferSize = 0.0;
+	ListCell *joinOrderCell = NULL;
+
+	foreach(joinOrderCell, candidateJoinOrders)
+	{
+		List *joinOrder = (List *) lfirst(joinOrderCell);
+		double transferSize = JoinOrderTransferSize(joinOrder);
+
+		if (cheapestJoinOrders == NIL || transferSize < cheapestTransferSize)
+		{
+			cheapestJoinOrders = list_make1(joinOrder);
+			cheapestTransferSize = transferSize;
+		}
+		else if (transferSize == cheapestTransferSize)
+		{
+			cheapestJoinOrders = lappend(cheapestJoinOrders, joinOrder);
+		}
+	}
+
+	return cheapestJoinOrders;
+}
+
+
+/* Sums up the estimated transfer sizes of all join rules in the join order. */
+static double
+JoinOrderTransferSize(List *joinOrder)
+{
+	double transferSize = 0.0;
+	ListCell *joinOrderNodeCell = NULL;
+
+	foreach(joinOrderNodeCell, joinOrder)
+	{
+		JoinOrderNode *joinOrderNode = (JoinOrderNode *) lfirst(joinOrderNodeCell);
+		transferSize += joinOrderNode->transferSize;
+	}
+
+	return transferSize;
+}
+
+
+/*
+ * CheaperJoinNode checks if the given join node is cheaper than the other join
+ * node. We only pick a cartesian product if no other join rule applies; among
+ * the remaining join rules, we pick the one that transfers fewer bytes, and
+ * fall back to the join rule ranking on ties.
+ */
+static bool
+CheaperJoinNode(JoinOrderNode *joinNode, JoinOrderNode *otherJoinNode)
+{
+	bool cartesianProduct = (joinNode->joinRuleType == CARTESIAN_PRODUCT);
+	bool otherCartesianProduct = (otherJoinNode->joinRuleType == CARTESIAN_PRODUCT);
+
+	if (cartesianProduct != otherCartesianProduct)
+	{
+		return otherCartesianProduct;
+	}
+
+	if (joinNode->transferSize != otherJoinNode->transferSize)
+	{
+		return joinNode->transferSize < otherJoinNode->transferSize;
+	}
+
+	return joinNode->joinRuleType < otherJoinNode->joinRuleType;
+}
+
+
+/*
+ * EstimateTransferSize estimates the number of bytes that the next join node's
+ * join rule moves across the network, and the size of the tables joined after
+ * applying this rule. We don't know how selective joins are, and therefore
+ * take the sum of the joined tables' sizes as the size of their join.
+ *
+ * Broadcast joins and cartesian products copy the candidate table to all worker
+ * nodes, unless it is a reference table that already lives on all nodes. Single
+ * partition joins move the side that gets repartitioned, and dual partition
+ * joins move both sides.
+ */
+static void
+EstimateTransferSize(JoinOrderNode *currentJoinNode, JoinOrderNode *nextJoinNode,
+					 List *candidateShardList)
+{
+	Oid candidateRelationId = nextJoinNode->tableEntry->relationId;
+	double candidateSize = TableSize(candidateRelationId, candidateShardList);
+	double transferSize = 0.0;
+
+	switch (nextJoinNode->joinRuleType)
+	{
+		case BROADCAST_JOIN:
+		case CARTESIAN_PRODUCT:
+		{
+			uint32 workerNodeCount = list_length(ActiveWorkerNodeList());
+
+			if (PartitionMethod(candidateRelationId) != DISTRIBUTE_BY_NONE)
+			{
+				transferSize = candidateSize * Max(workerNodeCount, 1);
+			}
+			break;
+		}
+
+		case SINGLE_PARTITION_JOIN:
+		{
+			/* if we keep the current partitioning, the candidate gets moved */
+			if (equal(nextJoinNode->partitionColumn, currentJoinNode->partitionColumn))
+			{
+				transferSize = candidateSize;
+			}
+			else
+			{
+				transferSize = currentJoinNode->joinedSize;
+			}
+			break;
+		}
+
+		case DUAL_PARTITION_JOIN:
+		{
+			transferSize = currentJoinNode->joinedSize + candidateSize;
+			break;
+		}
+
+		default:
+		{
+			break;
+		}
+	}
+
+	nextJoinNode->costBased = true;
+	nextJoinNode->transferSize = transferSize;
+	nextJoinNode->joinedSize = currentJoinNode->joinedSize + candidateSize;
+}
+
+
+/* Checks if we can estimate the sizes of all tables in the given list. */
+static bool
+TableSizesKnown(List *tableEntryList)
+{
+	ListCell *tableEntryCell = NULL;
+
+	foreach(tableEntryCell, tableEntryList)
+	{
+		TableEntry *tableEntry = (TableEntry *) lfirst(tableEntryCell);
+		Oid relationId = tableEntry->relationId;
+		List *shardIntervalList = LoadShardIntervalList(relationId);
+
+		if (TableSize(relationId, shardIntervalList) < 0.0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * TableSize returns the size of the given table. If we collected statistics
+ * for the table, we use the size recorded there. Otherwise, we add up the
+ * given shards' sizes, as recorded in their finalized placements' shard
+ * lengths; we skip shards without a finalized placement, since we only use
+ * this size for estimates. We only keep shard lengths up to date for append
+ * and range distributed tables, so the function returns -1 for other tables
+ * without statistics.
+ */
+static double
+TableSize(Oid relationId, List *shardIntervalList)
+{
+	double tableSize = 0.0;
+	double rowCount = 0.0;
+	ListCell *shardIntervalCell = NULL;
+	char partitionMethod = 0;
+
+	if (DistributedTableStatistics(relationId, &rowCount, &tableSize))
+	{
+		return tableSize;
+	}
+
+	partitionMethod = PartitionMethod(relationId);
+	if (partitionMethod != DISTRIBUTE_BY_APPEND &&
+		partitionMethod != DISTRIBUTE_BY_RANGE)
+	{
+		return -1.0;
+	}
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		List *placementList = FinalizedShardPlacementList(shardInterval->shardId);
+
+		if (placementList != NIL)
+		{
+			ShardPlacement *placement = (ShardPlacement *) linitial(placementList);
+			tableSize += placement->shardLength;
+		}
+	}
+
+	return tableSize;
+}
+
+
 /* Prints the join order list and join rules for debugging purposes. */
 static void
 PrintJoinOrderList(List *joinOrder)
@@ -932,7 +1190,15 @@ PrintJoinOrderList(List *joinOrder)
 			char *ruleName = JoinRuleName(ruleType);
 
 			appendStringInfo(printBuffer, "[ %s ", ruleName);
-			appendStringInfo(printBuffer, "\"%s\" ]", relationName);
+			appendStringInfo(printBuffer, "\"%s\" ", relationName);
+
+			if (joinOrderNode->costBased)
+			{
+				appendStringInfo(printBuffer, "(%.0f bytes) ",
+								 joinOrderNode->transferSize);
+			}
+
+			appendStringInfoString(printBuffer, "]");
 		}
 	}
 
@@ -1003,6 +1269,10 @@ FindTableEntry(List *tableEntryList, uint32 tableId)
  * next table, evaluates different join rules between the two tables, and finds
  * the best join rule that applies. The function returns the applicable join
  * order node which includes the join rule and the partition information.
+ *
+ * If the current join node is cost based, the function evaluates all join rules
+ * and picks the one that is estimated to transfer the fewest bytes. Otherwise,
+ * the function picks the first join rule that applies.
  */
 static JoinOrderNode *
 EvaluateJoinRules(List *joinedTableList, JoinOrderNode *currentJoinNode,
@@ -1032,17 +1302,28 @@ EvaluateJoinRules(List *joinedTableList, JoinOrderNode *currentJoinNode,
 		JoinRuleType ruleType = (JoinRuleType) ruleIndex;
 		RuleEvalFunction ruleEvalFunction = JoinRuleEvalFunction(ruleType);
 
-		nextJoinNode = (*ruleEvalFunction)(currentJoinNode,
-										   candidateTable,
-										   candidateShardList,
-										   applicableJoinClauses,
-										   joinType);
+		JoinOrderNode *ruleJoinNode = (*ruleEvalFunction)(currentJoinNode,
+														  candidateTable,
+														  candidateShardList,
+														  applicableJoinClauses,
+														  joinType);
+		if (ruleJoinNode == NULL)
+		{
+			continue;
+		}
 
-		/* break after finding the first join rule that applies */
-		if (nextJoinNode != NULL)
+		if (!currentJoinNode->costBased)
 		{
+			/* break after finding the first join rule that applies */
+			nextJoinNode = ruleJoinNode;
 			break;
 		}
+
+		EstimateTransferSize(currentJoinNode, ruleJoinNode, candidateShardList);
+		if (nextJoinNode == NULL || CheaperJoinNode(ruleJoinNode, nextJoinNode))
+		{
+			nextJoinNode = ruleJoinNode;
+		}
 	}
 
 	Assert(nextJoinNode != NULL);
@@ -1157,6 +1438,9 @@ BroadcastJoin(JoinOrderNode *currentJoinNode, TableEntry *candidateTable,
 	 * Left join requires candidate table to have single shard, right join requires
 	 * existing (left) table to have single shard, full outer join requires both tables
 	 * to have single shard.
+	 *
+	 * If join orders are cost based, a feasible broadcast join still competes
+	 * with the other join rules on cost.
 	 */
 	if (joinType == JOIN_INNER)
 	{
@@ -1262,6 +1546,7 @@ SinglePartitionJoin(JoinOrderNode *currentJoinNode, TableEntry *candidateTable,
 	uint32 tableId = candidateTable->rangeTableId;
 	Var *candidatePartitionColumn = PartitionColumn(relationId, tableId);
 	char candidatePartitionMethod = PartitionMethod(relationId);
+	bool repartitionCurrentTable = false;
 
 	/* outer joins are not supported yet */
 	if (IS_OUTER_JOIN(joinType))
@@ -1291,8 +1576,19 @@ SinglePartitionJoin(JoinOrderNode *currentJoinNode, TableEntry *candidateTable,
 		}
 	}
 
-	/* evaluate re-partitioning the current table only if the rule didn't apply above */
-	if (nextJoinNode == NULL && candidatePartitionMethod != DISTRIBUTE_BY_HASH &&
+	/*
+	 * Evaluate re-partitioning the current table only if the rule didn't apply
+	 * above, or if join orders are cost based and the tables joined so far are
+	 * smaller than the candidate table.
+	 */
+	repartitionCurrentTable = (nextJoinNode == NULL);
+	if (nextJoinNode != NULL && currentJoinNode->costBased)
+	{
+		double candidateSize = TableSize(relationId, candidateShardList);
+		repartitionCurrentTable = (currentJoinNode->joinedSize < candidateSize);
+	}
+
+	if (repartitionCurrentTable && candidatePartitionMethod != DISTRIBUTE_BY_HASH &&
 		candidatePartitionMethod != DISTRIBUTE_BY_NONE)
 	{
 		OpExpr *joinClause = SinglePartitionJoinClause(candidatePartitionColumn,
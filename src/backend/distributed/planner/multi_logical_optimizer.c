@@ -54,6 +54,7 @@
 /* Config variable managed via guc.c */
 int LimitClauseRowFetchCount = -1; /* number of rows to fetch from each task */
 double CountDistinctErrorRate = 0.0; /* precision of count(distinct) approximate */
+bool EnableSortedMerge = false; /* merge pre-sorted task results on the master */
 
 
 typedef struct MasterAggregateWalkerContext
@@ -4405,6 +4406,10 @@ WorkerLimitCount(MultiExtendedOp *originalOpNode)
  * add any sorting and grouping clauses to the sort list we push down for the
  * limit. If we do, the function adds these clauses and returns them. Otherwise,
  * the function returns null.
+ *
+ * When sorted merges are enabled, the function also pushes down order by clauses
+ * of queries without a limit, as long as the query has no grouping or aggregates.
+ * The master node then merges the sorted task results instead of sorting them.
  */
 static List *
 WorkerSortClauseList(MultiExtendedOp *originalOpNode)
@@ -4414,10 +4419,16 @@ WorkerSortClauseList(MultiExtendedOp *originalOpNode)
 	List *sortClauseList = originalOpNode->sortClauseList;
 	List *targetList = originalOpNode->targetList;
 
-	/* if no limit node, no need to push down sort clauses */
+	/* if no limit node, push down sort clauses only for sorted merges */
 	if (originalOpNode->limitCount == NULL)
 	{
-		return NIL;
+		if (EnableSortedMerge && groupClauseList == NIL &&
+			!contain_agg_clause((Node *) targetList))
+		{
+			workerSortClauseList = sortClauseList;
+		}
+
+		return workerSortClauseList;
 	}
 
 	/*
@@ -21,6 +21,7 @@
 #include "distributed/multi_logical_optimizer.h"
 #include "distributed/multi_logical_planner.h"
 #include "distributed/multi_physical_planner.h"
+#include "distributed/multi_server_executor.h"
 #include "distributed/worker_protocol.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
@@ -36,6 +37,7 @@
 
 /* Config variable managed via guc.c */
 bool SubqueryPushdown = false; /* is subquery pushdown enabled */
+bool EnableRepartitionedAggregation = false; /* finalize groups on workers */
 
 
 /* Struct to differentiate different qualifier types in an expression tree walker */
@@ -54,6 +56,9 @@ typedef MultiNode *(*RuleApplyFunction) (MultiNode *leftNode, MultiNode *rightNo
 static RuleApplyFunction RuleApplyFunctionArray[JOIN_RULE_LAST] = { 0 }; /* join rules */
 
 /* Local functions forward declarations */
+static bool RepartitionedAggregationApplicable(Query *queryTree);
+static bool HasDistinctAggregateWalker(Node *node, void *context);
+static Query * RepartitionedAggregationQuery(Query *queryTree);
 static MultiNode * MultiPlanTree(Query *queryTree);
 static void ErrorIfQueryNotSupported(Query *queryTree);
 static bool HasUnsupportedJoinWalker(Node *node, void *context);
@@ -116,8 +121,19 @@ MultiLogicalPlanCreate(Query *queryTree)
 {
 	MultiNode *multiQueryNode = NULL;
 	MultiTreeRoot *rootNode = NULL;
+	List *subqueryEntryList = NIL;
+
+	/*
+	 * If enabled, wrap high-cardinality grouped queries into a subquery so that
+	 * the partial aggregates get repartitioned on the group key and finalized
+	 * on the workers.
+	 */
+	if (RepartitionedAggregationApplicable(queryTree))
+	{
+		queryTree = RepartitionedAggregationQuery(queryTree);
+	}
 
-	List *subqueryEntryList = SubqueryEntryList(queryTree);
+	subqueryEntryList = SubqueryEntryList(queryTree);
 	if (subqueryEntryList != NIL)
 	{
 		if (SubqueryPushdown)
@@ -143,6 +159,203 @@ MultiLogicalPlanCreate(Query *queryTree)
 }
 
 
+/*
+ * RepartitionedAggregationApplicable returns true if the given query groups a
+ * single distributed table on columns other than its partition column, and if
+ * we can instead finalize its groups on the workers. For this, the query's
+ * partial aggregates are hash repartitioned on the first group by expression
+ * using a map-merge job, which in turn needs the task tracker executor. Since we
+ * wrap the query into a subquery, the function also returns false if subquery
+ * pushdown is enabled; the pushdown planner would otherwise plan the wrapped
+ * query, and it cannot group on columns other than the partition column.
+ */
+static bool
+RepartitionedAggregationApplicable(Query *queryTree)
+{
+	RangeTblEntry *rangeTableEntry = NULL;
+	Var *partitionColumn = NULL;
+	List *groupTargetEntryList = NIL;
+	TargetEntry *firstGroupTargetEntry = NULL;
+	ListCell *groupTargetEntryCell = NULL;
+
+	if (!EnableRepartitionedAggregation || SubqueryPushdown ||
+		TaskExecutorType != MULTI_EXECUTOR_TASK_TRACKER)
+	{
+		return false;
+	}
+
+	if (queryTree->commandType != CMD_SELECT || !queryTree->hasAggs ||
+		queryTree->groupClause == NIL)
+	{
+		return false;
+	}
+
+	if (queryTree->groupingSets != NIL || queryTree->distinctClause != NIL ||
+		queryTree->hasWindowFuncs || queryTree->hasSubLinks ||
+		queryTree->cteList != NIL || queryTree->setOperations != NULL ||
+		queryTree->rowMarks != NIL)
+	{
+		return false;
+	}
+
+	/* we only wrap single table queries, and leave joins as they are */
+	if (list_length(queryTree->rtable) != 1 ||
+		list_length(queryTree->jointree->fromlist) != 1 ||
+		!IsA(linitial(queryTree->jointree->fromlist), RangeTblRef))
+	{
+		return false;
+	}
+
+	rangeTableEntry = (RangeTblEntry *) linitial(queryTree->rtable);
+	if (rangeTableEntry->rtekind != RTE_RELATION ||
+		!IsDistributedTable(rangeTableEntry->relid))
+	{
+		return false;
+	}
+
+	/* groups on the partition column are already final on each shard */
+	partitionColumn = PartitionColumn(rangeTableEntry->relid, 1);
+	if (partitionColumn == NULL)
+	{
+		return false;
+	}
+
+	groupTargetEntryList = GroupTargetEntryList(queryTree->groupClause,
+												queryTree->targetList);
+	foreach(groupTargetEntryCell, groupTargetEntryList)
+	{
+		TargetEntry *groupTargetEntry = (TargetEntry *) lfirst(groupTargetEntryCell);
+		Expr *groupExpression = groupTargetEntry->expr;
+
+		if (IsA(groupExpression, Var) &&
+			((Var *) groupExpression)->varattno == partitionColumn->varattno)
+		{
+			return false;
+		}
+	}
+
+	/* we repartition on the first group by expression, see TransformSubqueryNode */
+	firstGroupTargetEntry = (TargetEntry *) linitial(groupTargetEntryList);
+	if (!IsA(firstGroupTargetEntry->expr, Var) &&
+		!IsA(firstGroupTargetEntry->expr, FuncExpr))
+	{
+		return false;
+	}
+
+	/* distinct aggregates add their own columns to the worker's group by */
+	if (HasDistinctAggregateWalker((Node *) queryTree->targetList, NULL) ||
+		HasDistinctAggregateWalker(queryTree->havingQual, NULL))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * HasDistinctAggregateWalker returns true if the given expression tree contains
+ * an aggregate with a distinct or an order by clause in it.
+ */
+static bool
+HasDistinctAggregateWalker(Node *node, void *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Aggref))
+	{
+		Aggref *aggregate = (Aggref *) node;
+		if (aggregate->aggdistinct != NIL || aggregate->aggorder != NIL)
+		{
+			return true;
+		}
+	}
+
+	return expression_tree_walker(node, HasDistinctAggregateWalker, context);
+}
+
+
+/*
+ * RepartitionedAggregationQuery wraps the given grouped query into a subquery,
+ * and returns an outer query that only selects, sorts and limits the subquery's
+ * output. The logical planner then plans the subquery as a map-merge job that
+ * repartitions partial aggregates on the group key, and the merge tasks on the
+ * workers compute final groups. The master node only receives these final
+ * groups. Note that all of the subquery's target entries, including junk ones
+ * needed for sorting, become visible subquery columns.
+ */
+static Query *
+RepartitionedAggregationQuery(Query *queryTree)
+{
+	Query *subquery = copyObject(queryTree);
+	Query *outerQuery = makeNode(Query);
+	RangeTblEntry *subqueryRangeTableEntry = makeNode(RangeTblEntry);
+	RangeTblRef *subqueryTableRef = makeNode(RangeTblRef);
+	List *columnNameList = NIL;
+	List *outerTargetList = NIL;
+	ListCell *targetEntryCell = NULL;
+	AttrNumber columnNumber = 1;
+
+	subquery->sortClause = NIL;
+	subquery->limitCount = NULL;
+	subquery->limitOffset = NULL;
+
+	foreach(targetEntryCell, subquery->targetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+		TargetEntry *outerTargetEntry = NULL;
+		Expr *expression = targetEntry->expr;
+		char *columnName = targetEntry->resname;
+		Var *column = NULL;
+
+		if (columnName == NULL)
+		{
+			columnName = "?column?";
+		}
+
+		column = makeVar(1, columnNumber, exprType((Node *) expression),
+						 exprTypmod((Node *) expression),
+						 exprCollation((Node *) expression), 0);
+
+		outerTargetEntry = makeTargetEntry((Expr *) column, columnNumber,
+										   targetEntry->resname,
+										   targetEntry->resjunk);
+		outerTargetEntry->ressortgroupref = targetEntry->ressortgroupref;
+		outerTargetList = lappend(outerTargetList, outerTargetEntry);
+
+		columnNameList = lappend(columnNameList, makeString(pstrdup(columnName)));
+		targetEntry->resjunk = false;
+
+		columnNumber++;
+	}
+
+	subqueryRangeTableEntry->rtekind = RTE_SUBQUERY;
+	subqueryRangeTableEntry->subquery = subquery;
+	subqueryRangeTableEntry->alias = makeAlias("repartitioned_aggregate", NIL);
+	subqueryRangeTableEntry->eref = makeAlias("repartitioned_aggregate",
+											  columnNameList);
+	subqueryRangeTableEntry->inFromCl = true;
+
+	subqueryTableRef->rtindex = 1;
+
+	outerQuery->commandType = CMD_SELECT;
+	outerQuery->querySource = queryTree->querySource;
+	outerQuery->queryId = queryTree->queryId;
+	outerQuery->canSetTag = queryTree->canSetTag;
+	outerQuery->rtable = list_make1(subqueryRangeTableEntry);
+	outerQuery->jointree = makeFromExpr(list_make1(subqueryTableRef), NULL);
+	outerQuery->targetList = outerTargetList;
+	outerQuery->sortClause = copyObject(queryTree->sortClause);
+	outerQuery->limitCount = copyObject(queryTree->limitCount);
+	outerQuery->limitOffset = copyObject(queryTree->limitOffset);
+
+	return outerQuery;
+}
+
+
 /*
  * SubqueryEntryList finds the subquery nodes in the range table entry list, and
  * builds a list of subquery range table entries from these subquery nodes. Range
@@ -1122,6 +1335,14 @@ MultiJoinTree(List *joinOrderList, List *collectTableList, List *joinWhereClause
 										joinRuleType, partitionColumn, joinType,
 										joinClauseList);
 
+			if (CitusIsA(newJoinNode, MultiJoin) && joinOrderNode->costBased)
+			{
+				MultiJoin *joinNode = (MultiJoin *) newJoinNode;
+
+				joinNode->costBased = true;
+				joinNode->transferSize = joinOrderNode->transferSize;
+			}
+
 			/* the new join node becomes the top of our join tree */
 			currentTopNode = newJoinNode;
 		}
@@ -13,6 +13,9 @@
 
 #include "postgres.h"
 
+#include <limits.h>
+
+#include "distributed/multi_logical_optimizer.h"
 #include "distributed/multi_master_planner.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_server_executor.h"
@@ -23,12 +26,17 @@
 #include "optimizer/planmain.h"
 #include "optimizer/tlist.h"
 #include "optimizer/var.h"
+#include "rewrite/rewriteManip.h"
 #include "utils/builtins.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
 
 
+/* Config variable managed via guc.c */
+int MaxSortedMergeFanIn = 32; /* max number of task results to merge on master */
+
+
 /*
  * MasterTargetList uses the given worker target list's expressions, and creates
  * a target target list for the master node. This master target list keeps the
@@ -113,10 +121,11 @@ BuildCreateStatement(char *masterTableName, List *masterTargetList,
 /*
  * BuildAggregatePlan creates and returns an aggregate plan. This aggregate plan
  * builds aggreation and grouping operators (if any) that are to be executed on
- * the master node.
+ * the master node. If we could estimate the number of groups from statistics,
+ * the hashed aggregate sizes its hash table for that many groups.
  */
 static Agg *
-BuildAggregatePlan(Query *masterQuery, Plan *subPlan)
+BuildAggregatePlan(Query *masterQuery, Plan *subPlan, double groupCountEstimate)
 {
 	Agg *aggregatePlan = NULL;
 	AggStrategy aggregateStrategy = AGG_PLAIN;
@@ -131,7 +140,7 @@ BuildAggregatePlan(Query *masterQuery, Plan *subPlan)
 	Node *havingQual = NULL;
 	Oid *groupColumnOpArray = NULL;
 	uint32 groupColumnCount = 0;
-	const long rowEstimate = 10;
+	long rowEstimate = 10;
 
 	/* assert that we need to build an aggregate plan */
 	Assert(masterQuery->hasAggs || masterQuery->groupClause);
@@ -181,6 +190,11 @@ BuildAggregatePlan(Query *masterQuery, Plan *subPlan)
 		/* get column indexes that are being grouped */
 		groupColumnIdArray = extract_grouping_cols(groupColumnList, subPlan->targetlist);
 		groupColumnOpArray = extract_grouping_ops(groupColumnList);
+
+		if (groupCountEstimate >= 1.0)
+		{
+			rowEstimate = (long) Min(groupCountEstimate, (double) LONG_MAX);
+		}
 	}
 
 	/* finally create the plan */
@@ -200,21 +214,88 @@ BuildAggregatePlan(Query *masterQuery, Plan *subPlan)
 }
 
 
+/*
+ * BuildMergeAppendPlan creates and returns a merge append plan that merges the
+ * given tables' rows in the master query's sort order. For this, each table must
+ * already hold its rows in this sort order. The function scans each table with a
+ * separate sequential scan, and expects these tables to follow the master table
+ * in the range table.
+ */
+static MergeAppend *
+BuildMergeAppendPlan(Query *masterQuery, List *mergeTableNameList)
+{
+	MergeAppend *mergeAppendPlan = makeNode(MergeAppend);
+	List *sortClauseList = masterQuery->sortClause;
+	List *targetList = masterQuery->targetList;
+	ListCell *sortClauseCell = NULL;
+	ListCell *mergeTableNameCell = NULL;
+	Index scanRangeTableId = 2; /* first entry is the master table */
+	int sortColumnIndex = 0;
+	int sortColumnCount = list_length(sortClauseList);
+
+	/* merge append only passes on tuples, so the target list only sets types */
+	mergeAppendPlan->plan.targetlist = targetList;
+	mergeAppendPlan->numCols = sortColumnCount;
+	mergeAppendPlan->sortColIdx = palloc0(sortColumnCount * sizeof(AttrNumber));
+	mergeAppendPlan->sortOperators = palloc0(sortColumnCount * sizeof(Oid));
+	mergeAppendPlan->collations = palloc0(sortColumnCount * sizeof(Oid));
+	mergeAppendPlan->nullsFirst = palloc0(sortColumnCount * sizeof(bool));
+
+	foreach(sortClauseCell, sortClauseList)
+	{
+		SortGroupClause *sortClause = (SortGroupClause *) lfirst(sortClauseCell);
+		TargetEntry *sortTargetEntry = get_sortgroupclause_tle(sortClause, targetList);
+
+		mergeAppendPlan->sortColIdx[sortColumnIndex] = sortTargetEntry->resno;
+		mergeAppendPlan->sortOperators[sortColumnIndex] = sortClause->sortop;
+		mergeAppendPlan->collations[sortColumnIndex] =
+			exprCollation((Node *) sortTargetEntry->expr);
+		mergeAppendPlan->nullsFirst[sortColumnIndex] = sortClause->nulls_first;
+
+		sortColumnIndex++;
+	}
+
+	/* scan each table, and project the master query's target list over it */
+	foreach(mergeTableNameCell, mergeTableNameList)
+	{
+		SeqScan *sequentialScan = makeNode(SeqScan);
+		List *scanTargetList = copyObject(targetList);
+
+		ChangeVarNodes((Node *) scanTargetList, 1, scanRangeTableId, 0);
+
+		sequentialScan->scanrelid = scanRangeTableId;
+		sequentialScan->plan.targetlist = scanTargetList;
+
+		mergeAppendPlan->mergeplans = lappend(mergeAppendPlan->mergeplans,
+											  sequentialScan);
+		scanRangeTableId++;
+	}
+
+	return mergeAppendPlan;
+}
+
+
 /*
  * BuildSelectStatement builds the final select statement to run on the master
  * node, before returning results to the user. The function first builds a scan
  * statement for all results fetched to the master, and layers aggregation, sort
  * and limit plans on top of the scan statement if necessary.
+ *
+ * If the given merge table list is not empty, task results were fetched into
+ * these tables in sorted order. In that case, the function merges the tables'
+ * rows instead of scanning and sorting the master table.
  */
 static PlannedStmt *
 BuildSelectStatement(Query *masterQuery, char *masterTableName,
-					 List *masterTargetList)
+					 List *masterTargetList, List *mergeTableNameList,
+					 double groupCountEstimate)
 {
 	PlannedStmt *selectStatement = NULL;
 	RangeTblEntry *rangeTableEntry = NULL;
 	RangeTblEntry *queryRangeTableEntry = NULL;
 	SeqScan *sequentialScan = NULL;
 	Agg *aggregationPlan = NULL;
+	MergeAppend *mergeAppendPlan = NULL;
 	Plan *topLevelPlan = NULL;
 
 	/* (1) make PlannedStmt and set basic information */
@@ -237,38 +318,61 @@ BuildSelectStatement(Query *masterQuery, char *masterTableName,
 	/* set the single element range table list */
 	selectStatement->rtable = list_make1(rangeTableEntry);
 
-	/* (2) build and initialize sequential scan node */
-	sequentialScan = makeNode(SeqScan);
-	sequentialScan->scanrelid = 1;  /* always one */
-
-	/* (3) add an aggregation plan if needed */
-	if (masterQuery->hasAggs || masterQuery->groupClause)
+	/* (2) merge sorted task results if we can, and skip the steps below */
+	if (mergeTableNameList != NIL)
 	{
-		sequentialScan->plan.targetlist = masterTargetList;
+		ListCell *mergeTableNameCell = NULL;
+
+		foreach(mergeTableNameCell, mergeTableNameList)
+		{
+			char *mergeTableName = (char *) lfirst(mergeTableNameCell);
+			RangeTblEntry *mergeRangeTableEntry = copyObject(rangeTableEntry);
 
-		aggregationPlan = BuildAggregatePlan(masterQuery, (Plan *) sequentialScan);
-		topLevelPlan = (Plan *) aggregationPlan;
+			mergeRangeTableEntry->eref = makeAlias(mergeTableName, NIL);
+			selectStatement->rtable = lappend(selectStatement->rtable,
+											  mergeRangeTableEntry);
+		}
+
+		mergeAppendPlan = BuildMergeAppendPlan(masterQuery, mergeTableNameList);
+		topLevelPlan = (Plan *) mergeAppendPlan;
 	}
 	else
 	{
-		/* otherwise set the final projections on the scan plan directly */
-		sequentialScan->plan.targetlist = masterQuery->targetList;
-		topLevelPlan = (Plan *) sequentialScan;
-	}
+		/* (3) build and initialize sequential scan node */
+		sequentialScan = makeNode(SeqScan);
+		sequentialScan->scanrelid = 1;  /* always one */
 
-	/* (4) add a sorting plan if needed */
-	if (masterQuery->sortClause)
-	{
-		List *sortClauseList = masterQuery->sortClause;
+		/* (4) add an aggregation plan if needed */
+		if (masterQuery->hasAggs || masterQuery->groupClause)
+		{
+			sequentialScan->plan.targetlist = masterTargetList;
+
+			aggregationPlan = BuildAggregatePlan(masterQuery, (Plan *) sequentialScan,
+												 groupCountEstimate);
+			topLevelPlan = (Plan *) aggregationPlan;
+		}
+		else
+		{
+			/* otherwise set the final projections on the scan plan directly */
+			sequentialScan->plan.targetlist = masterQuery->targetList;
+			topLevelPlan = (Plan *) sequentialScan;
+		}
+
+		/* (5) add a sorting plan if needed */
+		if (masterQuery->sortClause)
+		{
+			List *sortClauseList = masterQuery->sortClause;
 #if (PG_VERSION_NUM >= 90600)
-		Sort *sortPlan = make_sort_from_sortclauses(sortClauseList, topLevelPlan);
+			Sort *sortPlan = make_sort_from_sortclauses(sortClauseList, topLevelPlan);
 #else
-		Sort *sortPlan = make_sort_from_sortclauses(NULL, sortClauseList, topLevelPlan);
+			Sort *sortPlan = make_sort_from_sortclauses(NULL, sortClauseList,
+														topLevelPlan);
 #endif
-		topLevelPlan = (Plan *) sortPlan;
+			topLevelPlan = (Plan *) sortPlan;
+		}
 	}
 
-	/* (5) add a limit plan if needed */
+	/* (6) add a limit plan if needed */
 	if (masterQuery->limitCount || masterQuery->limitOffset)
 	{
 		Node *limitCount = masterQuery->limitCount;
@@ -285,13 +389,124 @@ BuildSelectStatement(Query *masterQuery, char *masterTableName,
 		topLevelPlan = (Plan *) limitPlan;
 	}
 
-	/* (6) finally set our top level plan in the plan tree */
+	/* (7) finally set our top level plan in the plan tree */
 	selectStatement->planTree = topLevelPlan;
 
 	return selectStatement;
 }
 
 
+/*
+ * SortedMergeApplicable checks if task results for the given plan arrive sorted
+ * in the master query's sort order, and if the master query only needs to merge
+ * these results. If so, the master node fetches each task's results into its own
+ * table, and merges these tables' rows instead of sorting them all over again.
+ */
+static bool
+SortedMergeApplicable(MultiPlan *multiPlan)
+{
+	Query *masterQuery = multiPlan->masterQuery;
+	Job *workerJob = multiPlan->workerJob;
+	Query *workerQuery = workerJob->jobQuery;
+	List *masterSortClauseList = masterQuery->sortClause;
+	List *workerSortClauseList = workerQuery->sortClause;
+	ListCell *masterSortClauseCell = NULL;
+	ListCell *workerSortClauseCell = NULL;
+
+	if (!EnableSortedMerge || masterSortClauseList == NIL)
+	{
+		return false;
+	}
+
+	if (masterQuery->hasAggs || masterQuery->groupClause != NIL)
+	{
+		return false;
+	}
+
+	/*
+	 * Merging only pays off for multiple tasks, and needs a table and a scan for
+	 * each task. We therefore cap the number of tasks we merge, and fall back to
+	 * sorting the master table for jobs with more tasks.
+	 */
+	if (list_length(workerJob->taskList) < 2 ||
+		list_length(workerJob->taskList) > MaxSortedMergeFanIn)
+	{
+		return false;
+	}
+
+	/* worker results must be sorted on a prefix of the worker sort clauses */
+	if (list_length(workerSortClauseList) < list_length(masterSortClauseList))
+	{
+		return false;
+	}
+
+	forboth(masterSortClauseCell, masterSortClauseList,
+			workerSortClauseCell, workerSortClauseList)
+	{
+		SortGroupClause *masterSortClause =
+			(SortGroupClause *) lfirst(masterSortClauseCell);
+		SortGroupClause *workerSortClause =
+			(SortGroupClause *) lfirst(workerSortClauseCell);
+		TargetEntry *masterTargetEntry =
+			get_sortgroupclause_tle(masterSortClause, masterQuery->targetList);
+		TargetEntry *workerTargetEntry =
+			get_sortgroupclause_tle(workerSortClause, workerQuery->targetList);
+		Var *masterColumn = NULL;
+
+		if (!IsA(masterTargetEntry->expr, Var))
+		{
+			return false;
+		}
+
+		/* master columns map to worker target entries in order */
+		masterColumn = (Var *) masterTargetEntry->expr;
+		if (masterColumn->varattno != workerTargetEntry->resno)
+		{
+			return false;
+		}
+
+		if (masterSortClause->sortop != workerSortClause->sortop ||
+			masterSortClause->nulls_first != workerSortClause->nulls_first)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * MergeTableNameList returns the names of tables that keep each task's results
+ * for a sorted merge, in task order. We number these tables by their task's
+ * position in the task list. The function returns an empty list if the given
+ * plan's results cannot be merged.
+ */
+static List *
+MergeTableNameList(MultiPlan *multiPlan)
+{
+	List *mergeTableNameList = NIL;
+	int taskCount = 0;
+	int taskIndex = 0;
+
+	if (!SortedMergeApplicable(multiPlan))
+	{
+		return NIL;
+	}
+
+	taskCount = list_length(multiPlan->workerJob->taskList);
+	for (taskIndex = 1; taskIndex <= taskCount; taskIndex++)
+	{
+		char *mergeTableName = psprintf("%s_%d", multiPlan->masterTableName,
+										taskIndex);
+
+		mergeTableNameList = lappend(mergeTableNameList, mergeTableName);
+	}
+
+	return mergeTableNameList;
+}
+
+
 /*
  * ValueToStringList walks over the given list of string value types, converts
  * value types to cstrings, and adds these cstrings into a new list.
@@ -340,6 +555,38 @@ MasterNodeCreateStatement(MultiPlan *multiPlan)
 }
 
 
+/*
+ * MasterNodeMergeCreateStatementList takes in a multi plan, and constructs
+ * statements to create a temporary table for each task's results if the master
+ * node merges sorted task results. These tables inherit from the master table.
+ * If task results are not merged, the function returns an empty list.
+ */
+List *
+MasterNodeMergeCreateStatementList(MultiPlan *multiPlan)
+{
+	List *mergeTableNameList = MergeTableNameList(multiPlan);
+	List *createStatementList = NIL;
+	ListCell *mergeTableNameCell = NULL;
+
+	foreach(mergeTableNameCell, mergeTableNameList)
+	{
+		char *mergeTableName = (char *) lfirst(mergeTableNameCell);
+		RangeVar *relation = makeRangeVar(NULL, mergeTableName, -1);
+		RangeVar *parentRelation = makeRangeVar(NULL, multiPlan->masterTableName, -1);
+		CreateStmt *createStatement = NULL;
+
+		relation->relpersistence = RELPERSISTENCE_TEMP;
+
+		createStatement = CreateStatement(relation, NIL);
+		createStatement->inhRelations = list_make1(parentRelation);
+
+		createStatementList = lappend(createStatementList, createStatement);
+	}
+
+	return createStatementList;
+}
+
+
 /*
  * MasterNodeSelectPlan takes in a distributed plan, finds the master node query
  * structure in that plan, and builds the final select plan to execute on the
@@ -356,8 +603,11 @@ MasterNodeSelectPlan(MultiPlan *multiPlan)
 	Job *workerJob = multiPlan->workerJob;
 	List *workerTargetList = workerJob->jobQuery->targetList;
 	List *masterTargetList = MasterTargetList(workerTargetList);
+	List *mergeTableNameList = MergeTableNameList(multiPlan);
 
-	masterSelectPlan = BuildSelectStatement(masterQuery, tableName, masterTargetList);
+	masterSelectPlan = BuildSelectStatement(masterQuery, tableName, masterTargetList,
+											mergeTableNameList,
+											multiPlan->groupCountEstimate);
 
 	return masterSelectPlan;
 }
@@ -366,7 +616,8 @@ MasterNodeSelectPlan(MultiPlan *multiPlan)
 /*
  * MasterNodeCopyStatementList takes in a multi plan, and constructs
  * statements that copy over worker task results to a temporary table on the
- * master node.
+ * master node. If the master node merges sorted task results, each statement
+ * instead copies one task's results to that task's own table.
  */
 List *
 MasterNodeCopyStatementList(MultiPlan *multiPlan)
@@ -375,6 +626,8 @@ MasterNodeCopyStatementList(MultiPlan *multiPlan)
 	List *workerTaskList = workerJob->taskList;
 	char *tableName = multiPlan->masterTableName;
 	List *copyStatementList = NIL;
+	List *mergeTableNameList = MergeTableNameList(multiPlan);
+	ListCell *mergeTableNameCell = list_head(mergeTableNameList);
 
 	ListCell *workerTaskCell = NULL;
 	foreach(workerTaskCell, workerTaskList)
@@ -382,9 +635,17 @@ MasterNodeCopyStatementList(MultiPlan *multiPlan)
 		Task *workerTask = (Task *) lfirst(workerTaskCell);
 		StringInfo jobDirectoryName = MasterJobDirectoryName(workerTask->jobId);
 		StringInfo taskFilename = TaskFilename(jobDirectoryName, workerTask->taskId);
+		RangeVar *relation = NULL;
+		CopyStmt *copyStatement = NULL;
+
+		if (mergeTableNameCell != NULL)
+		{
+			tableName = (char *) lfirst(mergeTableNameCell);
+			mergeTableNameCell = lnext(mergeTableNameCell);
+		}
 
-		RangeVar *relation = makeRangeVar(NULL, tableName, -1);
-		CopyStmt *copyStatement = makeNode(CopyStmt);
+		relation = makeRangeVar(NULL, tableName, -1);
+		copyStatement = makeNode(CopyStmt);
 		copyStatement->relation = relation;
 		copyStatement->is_from = true;
 		copyStatement->filename = taskFilename->data;
@@ -31,6 +31,7 @@
 #include "distributed/citus_nodefuncs.h"
 #include "distributed/citus_nodes.h"
 #include "distributed/citus_ruleutils.h"
+#include "distributed/master_metadata_utility.h"
 #include "distributed/master_protocol.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_router_planner.h"
@@ -39,6 +40,7 @@
 #include "distributed/multi_physical_planner.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/pg_dist_shard.h"
+#include "distributed/relay_utility.h"
 #include "distributed/shardinterval_utils.h"
 #include "distributed/task_tracker.h"
 #include "distributed/worker_manager.h"
@@ -63,6 +65,23 @@
 
 /* Policy to use when assigning tasks to worker nodes */
 int TaskAssignmentPolicy = TASK_ASSIGNMENT_GREEDY;
+bool EnableRepartitionPush = false; /* push map outputs to merge task nodes */
+bool EnableSkewAwareRepartition = false; /* handle frequent join keys specially */
+int SemiJoinFilterSize = 0; /* size of semi-join Bloom filters in KB */
+
+/* set while we plan a query for EXPLAIN without ANALYZE */
+bool PlanningForExplainOnly = false;
+
+
+/*
+ * HeavyHitter is a partition key value that makes up a large share of a table,
+ * according to the column statistics of one of the table's shards.
+ */
+typedef struct HeavyHitter
+{
+	char *value;
+	double frequency;
+} HeavyHitter;
 
 
 /*
@@ -78,6 +97,21 @@ static Job * BuildJobTree(MultiTreeRoot *multiTree);
 static MultiNode * LeftMostNode(MultiTreeRoot *multiTree);
 static Oid RangePartitionJoinBaseRelationId(MultiJoin *joinNode);
 static MultiTable * FindTableNode(MultiNode *multiNode, int rangeTableId);
+static void AssignHeavyHitters(MultiJoin *joinNode, Var *leftPartitionKey,
+							   MapMergeJob *leftMapMergeJob, Var *rightPartitionKey,
+							   MapMergeJob *rightMapMergeJob);
+static List * HeavyHitterList(MultiNode *multiNode, Var *partitionKey,
+							  uint32 partitionCount, uint64 *tableSize);
+static HeavyHitter * FindHeavyHitter(List *heavyHitterList, const char *value);
+static uint64 DistributedTableSize(Oid relationId);
+static void AssignSemiJoinSource(PartitionType partitionType, Oid baseRelationId,
+								 MapMergeJob *leftMapMergeJob,
+								 MapMergeJob *rightMapMergeJob);
+static bool SemiJoinFilterTypeSupported(Oid keyType);
+static uint64 JobQueryTableSize(Query *jobQuery);
+static void AddHeavyHitter(MapMergeJob *spreadMapMergeJob,
+						   MapMergeJob *replicateMapMergeJob,
+						   char *value, double frequency);
 static Query * BuildJobQuery(MultiNode *multiNode, List *dependedJobList);
 static Query * BuildReduceQuery(MultiExtendedOp *extendedOpNode, List *dependedJobList);
 static List * BaseRangeTableList(MultiNode *multiNode);
@@ -106,7 +140,6 @@ static AttrNumber NewColumnId(Index originalTableId, AttrNumber originalColumnId
 static Job * JobForRangeTable(List *jobList, RangeTblEntry *rangeTableEntry);
 static Job * JobForTableIdList(List *jobList, List *searchedTableIdList);
 static List * ChildNodeList(MultiNode *multiNode);
-static uint64 UniqueJobId(void);
 static Job * BuildJob(Query *jobQuery, List *dependedJobList);
 static MapMergeJob * BuildMapMergeJob(Query *jobQuery, List *dependedJobList,
 									  Var *partitionKey, PartitionType partitionType,
@@ -174,6 +207,12 @@ static int CompareTasksByTaskId(const void *leftElement, const void *rightElemen
 static void AssignDataFetchDependencies(List *taskList);
 static uint32 TaskListHighestTaskId(List *taskList);
 static List * MapTaskList(MapMergeJob *mapMergeJob, List *filterTaskList);
+static char * MapTaskQueryString(MapMergeJob *mapMergeJob, Task *filterTask,
+								 StringInfo pushTargetString);
+static void AssignPartitionPushTargets(MapMergeJob *mapMergeJob);
+static StringInfo HeavyHitterArrayString(MapMergeJob *mapMergeJob);
+static char * PartitionColumnName(MapMergeJob *mapMergeJob);
+static List * SemiJoinSourceTaskList(MapMergeJob *mapMergeJob, List *jobList);
 static char * ColumnName(Var *column, List *rangeTableList);
 static StringInfo SplitPointArrayString(ArrayType *splitPointObject,
 										Oid columnType, int32 columnTypeMod);
@@ -201,6 +240,8 @@ MultiPhysicalPlanCreate(MultiTreeRoot *multiTree)
 	uint64 workerJobId = 0;
 	Query *masterQuery = NULL;
 	List *masterDependedJobList = NIL;
+	List *joinNodeList = NIL;
+	ListCell *joinNodeCell = NULL;
 
 	/* build the worker job tree and check that we only one job in the tree */
 	workerJob = BuildJobTree(multiTree);
@@ -222,6 +263,18 @@ MultiPhysicalPlanCreate(MultiTreeRoot *multiTree)
 	multiPlan->masterTableName = jobSchemaName->data;
 	multiPlan->routerExecutable = MultiPlanRouterExecutable(multiPlan);
 
+	/* sum up join rule estimates so that EXPLAIN can show them */
+	joinNodeList = FindNodesOfType((MultiNode *) multiTree, T_MultiJoin);
+	foreach(joinNodeCell, joinNodeList)
+	{
+		MultiJoin *joinNode = (MultiJoin *) lfirst(joinNodeCell);
+		if (joinNode->costBased)
+		{
+			multiPlan->costBasedJoinOrder = true;
+			multiPlan->transferSize += joinNode->transferSize;
+		}
+	}
+
 	return multiPlan;
 }
 
@@ -341,6 +394,8 @@ BuildJobTree(MultiTreeRoot *multiTree)
 
 			PartitionType partitionType = PARTITION_INVALID_FIRST;
 			Oid baseRelationId = InvalidOid;
+			MapMergeJob *leftMapMergeJob = NULL;
+			MapMergeJob *rightMapMergeJob = NULL;
 
 			if (joinNode->joinRuleType == SINGLE_PARTITION_JOIN)
 			{
@@ -370,6 +425,8 @@ BuildJobTree(MultiTreeRoot *multiTree)
 				/* reset depended job list */
 				loopDependedJobList = NIL;
 				loopDependedJobList = list_make1(mapMergeJob);
+
+				leftMapMergeJob = mapMergeJob;
 			}
 
 			if (CitusIsA(rightChildNode, MultiPartition))
@@ -390,6 +447,34 @@ BuildJobTree(MultiTreeRoot *multiTree)
 
 				/* append to the depended job list for on-going dependencies */
 				loopDependedJobList = lappend(loopDependedJobList, mapMergeJob);
+
+				rightMapMergeJob = mapMergeJob;
+			}
+
+			/*
+			 * Spreading one side's rows and replicating the other side's rows
+			 * only preserves the results of inner joins. Looking up frequent
+			 * keys takes a round trip to a worker per side, which we skip for
+			 * plans that never run.
+			 */
+			if (EnableSkewAwareRepartition && !PlanningForExplainOnly &&
+				partitionType == HASH_PARTITION_TYPE &&
+				joinNode->joinType == JOIN_INNER &&
+				leftMapMergeJob != NULL && rightMapMergeJob != NULL)
+			{
+				MultiPartition *leftPartitionNode = (MultiPartition *) leftChildNode;
+				MultiPartition *rightPartitionNode = (MultiPartition *) rightChildNode;
+
+				AssignHeavyHitters(joinNode, leftPartitionNode->partitionColumn,
+								   leftMapMergeJob, rightPartitionNode->partitionColumn,
+								   rightMapMergeJob);
+			}
+
+			/* rows without a match can only be dropped early for inner joins */
+			if (SemiJoinFilterSize > 0 && joinNode->joinType == JOIN_INNER)
+			{
+				AssignSemiJoinSource(partitionType, baseRelationId, leftMapMergeJob,
+									 rightMapMergeJob);
 			}
 		}
 		else if (boundaryNodeJobType == SUBQUERY_MAP_MERGE_JOB)
@@ -548,6 +633,342 @@ FindTableNode(MultiNode *multiNode, int rangeTableId)
 }
 
 
+/*
+ * AssignHeavyHitters looks up the most frequent partition key values on both
+ * sides of a dual partition join, and decides how map tasks partition the rows
+ * of each value that would overload a single merge task. For each such value,
+ * the side that has more rows of the value spreads these rows over several
+ * partitions, and the other side replicates its matching rows to all of these
+ * partitions. This way, each pair of matching rows still meets in exactly one
+ * merge task, and no merge task gets much more than an average partition.
+ *
+ * Map tasks only run after we plan the query, so we cannot have them sample
+ * the keys for us. We instead rely on the sample ANALYZE keeps for one shard of
+ * each table. If the statistics are not available, we partition as usual.
+ */
+static void
+AssignHeavyHitters(MultiJoin *joinNode, Var *leftPartitionKey,
+				   MapMergeJob *leftMapMergeJob, Var *rightPartitionKey,
+				   MapMergeJob *rightMapMergeJob)
+{
+	uint32 partitionCount = leftMapMergeJob->partitionCount;
+	uint64 leftTableSize = 0;
+	uint64 rightTableSize = 0;
+	List *leftHeavyHitterList = NIL;
+	List *rightHeavyHitterList = NIL;
+	ListCell *heavyHitterCell = NULL;
+
+	Assert(rightMapMergeJob->partitionCount == partitionCount);
+
+	leftHeavyHitterList = HeavyHitterList((MultiNode *) joinNode, leftPartitionKey,
+										  partitionCount, &leftTableSize);
+	rightHeavyHitterList = HeavyHitterList((MultiNode *) joinNode, rightPartitionKey,
+										   partitionCount, &rightTableSize);
+
+	foreach(heavyHitterCell, leftHeavyHitterList)
+	{
+		HeavyHitter *leftHeavyHitter = (HeavyHitter *) lfirst(heavyHitterCell);
+		HeavyHitter *rightHeavyHitter = FindHeavyHitter(rightHeavyHitterList,
+														leftHeavyHitter->value);
+		double leftValueSize = leftHeavyHitter->frequency * leftTableSize;
+
+		if (rightHeavyHitter != NULL &&
+			rightHeavyHitter->frequency * rightTableSize > leftValueSize)
+		{
+			/* we handle this value when we walk over the right side's values */
+			continue;
+		}
+
+		AddHeavyHitter(leftMapMergeJob, rightMapMergeJob, leftHeavyHitter->value,
+					   leftHeavyHitter->frequency);
+	}
+
+	foreach(heavyHitterCell, rightHeavyHitterList)
+	{
+		HeavyHitter *rightHeavyHitter = (HeavyHitter *) lfirst(heavyHitterCell);
+		HeavyHitter *leftHeavyHitter = FindHeavyHitter(leftHeavyHitterList,
+													   rightHeavyHitter->value);
+		double rightValueSize = rightHeavyHitter->frequency * rightTableSize;
+
+		if (leftHeavyHitter != NULL &&
+			leftHeavyHitter->frequency * leftTableSize >= rightValueSize)
+		{
+			continue;
+		}
+
+		AddHeavyHitter(rightMapMergeJob, leftMapMergeJob, rightHeavyHitter->value,
+					   rightHeavyHitter->frequency);
+	}
+}
+
+
+/*
+ * HeavyHitterList finds the distributed table that the given partition key
+ * belongs to, and asks a worker node for the values of this column that make up
+ * at least an average partition's share of one of the table's shards. The
+ * function returns these values, and sets tableSize to the table's size.
+ */
+static List *
+HeavyHitterList(MultiNode *multiNode, Var *partitionKey, uint32 partitionCount,
+				uint64 *tableSize)
+{
+	List *heavyHitterList = NIL;
+	MultiTable *tableNode = NULL;
+	Oid relationId = InvalidOid;
+	List *shardIntervalList = NIL;
+	ShardInterval *sampleShardInterval = NULL;
+	List *placementList = NIL;
+	ListCell *placementCell = NULL;
+	List *queryResultList = NIL;
+	ListCell *queryResultCell = NULL;
+	StringInfo heavyHitterQuery = NULL;
+	char *shardName = NULL;
+	char *schemaName = NULL;
+	char *columnName = NULL;
+	double minFrequency = 1.0 / partitionCount;
+
+	*tableSize = 0;
+
+	tableNode = FindTableNode(multiNode, partitionKey->varno);
+	relationId = tableNode->relationId;
+	if (!IsDistributedTable(relationId) || partitionKey->varattno <= 0)
+	{
+		return NIL;
+	}
+
+	shardIntervalList = LoadShardIntervalList(relationId);
+	if (shardIntervalList == NIL)
+	{
+		return NIL;
+	}
+
+	*tableSize = DistributedTableSize(relationId);
+
+	sampleShardInterval = (ShardInterval *) linitial(shardIntervalList);
+	shardName = get_rel_name(relationId);
+	AppendShardIdToName(&shardName, sampleShardInterval->shardId);
+	schemaName = get_namespace_name(get_rel_namespace(relationId));
+	columnName = get_attname(relationId, partitionKey->varattno);
+
+	heavyHitterQuery = makeStringInfo();
+	appendStringInfo(heavyHitterQuery, HEAVY_HITTER_QUERY,
+					 quote_literal_cstr(schemaName), quote_literal_cstr(shardName),
+					 quote_literal_cstr(columnName), minFrequency);
+
+	placementList = FinalizedShardPlacementList(sampleShardInterval->shardId);
+	foreach(placementCell, placementList)
+	{
+		ShardPlacement *placement = (ShardPlacement *) lfirst(placementCell);
+
+		queryResultList = ExecuteRemoteQuery(placement->nodeName, placement->nodePort,
+											 NULL, heavyHitterQuery);
+		if (queryResultList != NIL)
+		{
+			break;
+		}
+	}
+
+	foreach(queryResultCell, queryResultList)
+	{
+		StringInfo queryResult = (StringInfo) lfirst(queryResultCell);
+		HeavyHitter *heavyHitter = NULL;
+		char *valueStart = NULL;
+		double frequency = strtod(queryResult->data, &valueStart);
+
+		/* the frequency and the value are separated by a single space */
+		if (valueStart == queryResult->data || *valueStart != ' ')
+		{
+			continue;
+		}
+
+		heavyHitter = palloc0(sizeof(HeavyHitter));
+		heavyHitter->value = pstrdup(valueStart + 1);
+		heavyHitter->frequency = frequency;
+
+		heavyHitterList = lappend(heavyHitterList, heavyHitter);
+	}
+
+	return heavyHitterList;
+}
+
+
+/* Returns the heavy hitter with the given value, or NULL if there is none. */
+static HeavyHitter *
+FindHeavyHitter(List *heavyHitterList, const char *value)
+{
+	ListCell *heavyHitterCell = NULL;
+
+	foreach(heavyHitterCell, heavyHitterList)
+	{
+		HeavyHitter *heavyHitter = (HeavyHitter *) lfirst(heavyHitterCell);
+		if (strcmp(heavyHitter->value, value) == 0)
+		{
+			return heavyHitter;
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Returns the total size of the given distributed table's shards. */
+static uint64
+DistributedTableSize(Oid relationId)
+{
+	List *shardIntervalList = LoadShardIntervalList(relationId);
+	ListCell *shardIntervalCell = NULL;
+	uint64 tableSize = 0;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		tableSize += ShardLength(shardInterval->shardId);
+	}
+
+	return tableSize;
+}
+
+
+/*
+ * AddHeavyHitter has the given spread job spread the rows of the given value
+ * over enough partitions that each gets about an average partition's share,
+ * and has the given replicate job copy its rows of the value to each of these
+ * partitions. Values that fit into a single partition are left as is.
+ */
+static void
+AddHeavyHitter(MapMergeJob *spreadMapMergeJob, MapMergeJob *replicateMapMergeJob,
+			   char *value, double frequency)
+{
+	uint32 partitionCount = spreadMapMergeJob->partitionCount;
+	uint32 valuePartitionCount = (uint32) ceil(frequency * partitionCount);
+
+	valuePartitionCount = Min(valuePartitionCount, partitionCount);
+	if (valuePartitionCount < 2)
+	{
+		return;
+	}
+
+	ereport(DEBUG1, (errmsg("spreading join key value %s over %u partitions",
+							value, valuePartitionCount)));
+
+	spreadMapMergeJob->heavyHitterValueList =
+		lappend(spreadMapMergeJob->heavyHitterValueList, makeString(value));
+	spreadMapMergeJob->heavyHitterPartitionCountList =
+		lappend_int(spreadMapMergeJob->heavyHitterPartitionCountList,
+					valuePartitionCount);
+	spreadMapMergeJob->spreadHeavyHitterList =
+		lappend_int(spreadMapMergeJob->spreadHeavyHitterList, true);
+
+	replicateMapMergeJob->heavyHitterValueList =
+		lappend(replicateMapMergeJob->heavyHitterValueList, makeString(value));
+	replicateMapMergeJob->heavyHitterPartitionCountList =
+		lappend_int(replicateMapMergeJob->heavyHitterPartitionCountList,
+					valuePartitionCount);
+	replicateMapMergeJob->spreadHeavyHitterList =
+		lappend_int(replicateMapMergeJob->spreadHeavyHitterList, false);
+}
+
+
+/*
+ * AssignSemiJoinSource decides whether one side of an inner repartition join is
+ * small enough to filter the other side's rows before they get repartitioned.
+ * If so, the function records the smaller side as the source of the repartition
+ * job's semi-join filter; see ApplySemiJoinFilter() for how we build and apply
+ * the filter.
+ *
+ * In dual partition joins, the smaller side needs to be a repartition job that
+ * only reads shards, since we run its filter queries before any other task. In
+ * single partition joins, the rows of the repartitioned side need to find a
+ * match in the table whose shards we repartition them by.
+ */
+static void
+AssignSemiJoinSource(PartitionType partitionType, Oid baseRelationId,
+					 MapMergeJob *leftMapMergeJob, MapMergeJob *rightMapMergeJob)
+{
+	if (partitionType == HASH_PARTITION_TYPE &&
+		leftMapMergeJob != NULL && rightMapMergeJob != NULL)
+	{
+		Oid leftKeyType = leftMapMergeJob->partitionColumn->vartype;
+		Oid rightKeyType = rightMapMergeJob->partitionColumn->vartype;
+		uint64 leftSize = JobQueryTableSize(leftMapMergeJob->job.jobQuery);
+		uint64 rightSize = JobQueryTableSize(rightMapMergeJob->job.jobQuery);
+
+		if (leftKeyType != rightKeyType || !SemiJoinFilterTypeSupported(leftKeyType))
+		{
+			return;
+		}
+
+		if (leftSize < rightSize && leftMapMergeJob->job.dependedJobList == NIL)
+		{
+			rightMapMergeJob->semiJoinSourceJobId = leftMapMergeJob->job.jobId;
+		}
+		else if (rightSize < leftSize && rightMapMergeJob->job.dependedJobList == NIL)
+		{
+			leftMapMergeJob->semiJoinSourceJobId = rightMapMergeJob->job.jobId;
+		}
+	}
+	else if (partitionType == RANGE_PARTITION_TYPE)
+	{
+		MapMergeJob *mapMergeJob = leftMapMergeJob;
+		Var *baseKey = PartitionKey(baseRelationId);
+		uint64 baseTableSize = 0;
+
+		if (mapMergeJob == NULL)
+		{
+			mapMergeJob = rightMapMergeJob;
+		}
+
+		if (mapMergeJob == NULL || baseKey == NULL ||
+			baseKey->vartype != mapMergeJob->partitionColumn->vartype ||
+			!SemiJoinFilterTypeSupported(baseKey->vartype))
+		{
+			return;
+		}
+
+		baseTableSize = DistributedTableSize(baseRelationId);
+		if (baseTableSize < JobQueryTableSize(mapMergeJob->job.jobQuery))
+		{
+			mapMergeJob->semiJoinSourceRelationId = baseRelationId;
+		}
+	}
+}
+
+
+/* Checks if join keys of the given type can be hashed into a semi-join filter. */
+static bool
+SemiJoinFilterTypeSupported(Oid keyType)
+{
+	TypeCacheEntry *typeEntry = lookup_type_cache(keyType, TYPECACHE_HASH_PROC);
+	return OidIsValid(typeEntry->hash_proc);
+}
+
+
+/*
+ * JobQueryTableSize estimates the amount of data the given job reads as the
+ * total size of the distributed tables in the job's range table. Data that the
+ * job reads from other jobs are not accounted for.
+ */
+static uint64
+JobQueryTableSize(Query *jobQuery)
+{
+	ListCell *rangeTableCell = NULL;
+	uint64 tableSize = 0;
+
+	foreach(rangeTableCell, jobQuery->rtable)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+
+		if (rangeTableEntry->rtekind == RTE_RELATION &&
+			IsDistributedTable(rangeTableEntry->relid))
+		{
+			tableSize += DistributedTableSize(rangeTableEntry->relid);
+		}
+	}
+
+	return tableSize;
+}
+
+
 /*
  * BuildJobQuery traverses the given logical plan tree, determines the job that
  * corresponds to this part of the tree, and builds the query structure for that
@@ -1705,7 +2126,7 @@ ChildNodeList(MultiNode *multiNode)
  * Please note that the jobId sequence wraps around after 2^32 integers. This
  * leaves the upper 32-bits to slave nodes and their jobs.
  */
-static uint64
+uint64
 UniqueJobId(void)
 {
 	text *sequenceName = cstring_to_text(JOBID_SEQUENCE_NAME);
@@ -1891,6 +2312,7 @@ BuildJobTreeTaskList(Job *jobTree)
 	List *flattenedJobList = NIL;
 	uint32 flattenedJobCount = 0;
 	int32 jobIndex = 0;
+	ListCell *jobCell = NULL;
 
 	/*
 	 * We traverse the job tree in preorder, and append each visited job to our
@@ -1970,6 +2392,59 @@ BuildJobTreeTaskList(Job *jobTree)
 		}
 	}
 
+	/*
+	 * Semi-join filters are built by running other MapMerge jobs' filter queries,
+	 * and stored on the nodes that run the filtered job's map tasks. We therefore
+	 * create the tasks that build them once all tasks have been assigned, and
+	 * before we wrap the filter queries into map queries. The executor runs these
+	 * tasks before it starts the job's map tasks.
+	 */
+	foreach(jobCell, flattenedJobList)
+	{
+		Job *job = (Job *) lfirst(jobCell);
+		if (CitusIsA(job, MapMergeJob))
+		{
+			MapMergeJob *mapMergeJob = (MapMergeJob *) job;
+
+			if (mapMergeJob->semiJoinSourceJobId != INVALID_JOB_ID ||
+				OidIsValid(mapMergeJob->semiJoinSourceRelationId))
+			{
+				mapMergeJob->semiJoinSourceTaskList =
+					SemiJoinSourceTaskList(mapMergeJob, flattenedJobList);
+			}
+		}
+	}
+
+	/*
+	 * Merge tasks get assigned to worker nodes together with the tasks that
+	 * depend on them. Now that all tasks have been assigned, we can tell map
+	 * tasks where to push their partitions.
+	 */
+	foreach(jobCell, flattenedJobList)
+	{
+		Job *job = (Job *) lfirst(jobCell);
+		if (!CitusIsA(job, MapMergeJob))
+		{
+			continue;
+		}
+
+		if (EnableRepartitionPush)
+		{
+			AssignPartitionPushTargets((MapMergeJob *) job);
+		}
+		else
+		{
+			MapMergeJob *mapMergeJob = (MapMergeJob *) job;
+			ListCell *mapTaskCell = NULL;
+
+			foreach(mapTaskCell, mapMergeJob->mapTaskList)
+			{
+				Task *mapTask = (Task *) lfirst(mapTaskCell);
+				mapTask->queryString = MapTaskQueryString(mapMergeJob, mapTask, NULL);
+			}
+		}
+	}
+
 	return jobTree;
 }
 
@@ -2276,6 +2751,41 @@ SqlTaskList(Job *job)
 }
 
 
+/*
+ * SingleShardTaskQueryString rebuilds the query string for the given task of a
+ * single relation job, after appending the given clauses to the job query's
+ * filters. The executor uses this function to tighten the filters of tasks
+ * that have not yet been sent to worker nodes.
+ */
+char *
+SingleShardTaskQueryString(Job *job, Task *task, List *additionalClauseList)
+{
+	Query *taskQuery = copyObject(job->jobQuery);
+	FromExpr *joinTree = taskQuery->jointree;
+	List *whereClauseList = NIL;
+	RangeTableFragment *shardFragment = NULL;
+	StringInfo sqlQueryString = makeStringInfo();
+
+	Assert(list_length(taskQuery->rtable) == 1);
+	Assert(task->anchorShardId != INVALID_SHARD_ID);
+
+	whereClauseList = make_ands_implicit((Expr *) joinTree->quals);
+	whereClauseList = list_concat(whereClauseList, copyObject(additionalClauseList));
+	joinTree->quals = (Node *) make_ands_explicit(whereClauseList);
+
+	shardFragment = palloc0(sizeof(RangeTableFragment));
+	shardFragment->fragmentReference = LoadShardInterval(task->anchorShardId);
+	shardFragment->fragmentType = CITUS_RTE_RELATION;
+	shardFragment->rangeTableId = 1;
+
+	/* update range table entry with the shard's alias, and deparse the query */
+	UpdateRangeTableAlias(taskQuery->rtable, list_make1(shardFragment));
+	pg_get_query_def(taskQuery, sqlQueryString);
+
+	return sqlQueryString->data;
+}
+
+
 /*
  * DependsOnHashPartitionJob checks if the given job depends on a hash
  * partitioning job.
@@ -4222,20 +4732,215 @@ PruneSqlTaskDependencies(List *sqlTaskList)
 /*
  * MapTaskList creates a list of map tasks for the given MapMerge job. For this,
  * the function walks over each filter task (sql task) in the given filter task
- * list, and wraps this task with a map function call. The map function call
- * repartitions the filter task's output according to MapMerge job's parameters.
+ * list, and converts this task into a map task. Each map task later wraps its
+ * filter query with a map function call, which repartitions the filter query's
+ * output according to MapMerge job's parameters; see MapTaskQueryString().
+ *
+ * We only wrap filter queries once all tasks are assigned to worker nodes. At
+ * that point, we know where map tasks push their outputs to, and other jobs can
+ * still run the filter queries to build semi-join filters.
  */
 static List *
 MapTaskList(MapMergeJob *mapMergeJob, List *filterTaskList)
 {
 	List *mapTaskList = NIL;
-	Query *filterQuery = mapMergeJob->job.jobQuery;
-	List *rangeTableList = filterQuery->rtable;
 	ListCell *filterTaskCell = NULL;
+
+	foreach(filterTaskCell, filterTaskList)
+	{
+		Task *filterTask = (Task *) lfirst(filterTaskCell);
+		Task *mapTask = NULL;
+
+		/* convert filter query task into map task */
+		mapTask = filterTask;
+		mapTask->taskType = MAP_TASK;
+
+		mapTaskList = lappend(mapTaskList, mapTask);
+	}
+
+	return mapTaskList;
+}
+
+
+/*
+ * MapTaskQueryString wraps the given filter task's query string with a call to
+ * the repartition function that applies the MapMerge job's parameters. If push
+ * targets are given, the function also passes them to the repartition function.
+ */
+static char *
+MapTaskQueryString(MapMergeJob *mapMergeJob, Task *filterTask,
+				   StringInfo pushTargetString)
+{
 	Var *partitionColumn = mapMergeJob->partitionColumn;
 	Oid partitionColumnType = partitionColumn->vartype;
 	char *partitionColumnTypeFullName = format_type_be_qualified(partitionColumnType);
 	int32 partitionColumnTypeMod = partitionColumn->vartypmod;
+	char *partitionColumnName = PartitionColumnName(mapMergeJob);
+	uint64 jobId = filterTask->jobId;
+	uint32 taskId = filterTask->taskId;
+
+	/* wrap repartition query string around filter query string */
+	StringInfo mapQueryString = makeStringInfo();
+	char *filterQueryString = filterTask->queryString;
+	char *filterQueryEscapedText = quote_literal_cstr(filterQueryString);
+	PartitionType partitionType = mapMergeJob->partitionType;
+
+	if (partitionType == RANGE_PARTITION_TYPE)
+	{
+		ShardInterval **intervalArray = mapMergeJob->sortedShardIntervalArray;
+		uint32 intervalCount = mapMergeJob->partitionCount;
+
+		ArrayType *splitPointObject = SplitPointObject(intervalArray, intervalCount);
+		StringInfo splitPointString = SplitPointArrayString(splitPointObject,
+															partitionColumnType,
+															partitionColumnTypeMod);
+
+		if (pushTargetString != NULL)
+		{
+			appendStringInfo(mapQueryString, RANGE_PARTITION_PUSH_COMMAND, jobId,
+							 taskId, filterQueryEscapedText, partitionColumnName,
+							 partitionColumnTypeFullName, splitPointString->data,
+							 pushTargetString->data);
+		}
+		else
+		{
+			appendStringInfo(mapQueryString, RANGE_PARTITION_COMMAND, jobId, taskId,
+							 filterQueryEscapedText, partitionColumnName,
+							 partitionColumnTypeFullName, splitPointString->data);
+		}
+	}
+	else
+	{
+		uint32 partitionCount = mapMergeJob->partitionCount;
+
+		if (mapMergeJob->heavyHitterValueList != NIL)
+		{
+			StringInfo heavyHitterString = HeavyHitterArrayString(mapMergeJob);
+			char *pushTargets = NO_PUSH_TARGETS;
+
+			if (pushTargetString != NULL)
+			{
+				pushTargets = pushTargetString->data;
+			}
+
+			appendStringInfo(mapQueryString, HASH_PARTITION_SKEW_COMMAND, jobId,
+							 taskId, filterQueryEscapedText, partitionColumnName,
+							 partitionColumnTypeFullName, partitionCount, pushTargets,
+							 heavyHitterString->data);
+		}
+		else if (pushTargetString != NULL)
+		{
+			appendStringInfo(mapQueryString, HASH_PARTITION_PUSH_COMMAND, jobId,
+							 taskId, filterQueryEscapedText, partitionColumnName,
+							 partitionColumnTypeFullName, partitionCount,
+							 pushTargetString->data);
+		}
+		else
+		{
+			appendStringInfo(mapQueryString, HASH_PARTITION_COMMAND, jobId, taskId,
+							 filterQueryEscapedText, partitionColumnName,
+							 partitionColumnTypeFullName, partitionCount);
+		}
+	}
+
+	return mapQueryString->data;
+}
+
+
+/*
+ * AssignPartitionPushTargets finds the node that each merge task in the given
+ * MapMerge job is assigned to, and wraps the job's filter queries into map
+ * queries that push each partition to its merge task's node. Partitions that
+ * have no merge task, such as the 0th range partition bucket, are not pushed.
+ */
+static void
+AssignPartitionPushTargets(MapMergeJob *mapMergeJob)
+{
+	List *mapTaskList = mapMergeJob->mapTaskList;
+	List *mergeTaskList = mapMergeJob->mergeTaskList;
+	ListCell *mapTaskCell = NULL;
+	ListCell *mergeTaskCell = NULL;
+	StringInfo nodeNameArrayString = makeStringInfo();
+	StringInfo nodePortArrayString = makeStringInfo();
+	StringInfo upstreamTaskIdArrayString = makeStringInfo();
+	StringInfo pushTargetString = makeStringInfo();
+	uint32 partitionFileCount = mapMergeJob->partitionCount;
+	uint32 partitionFileId = 0;
+	char **nodeNameArray = NULL;
+	uint32 *nodePortArray = NULL;
+	uint32 *upstreamTaskIdArray = NULL;
+
+	/* range repartitioning also writes the 0th partition bucket */
+	if (mapMergeJob->partitionType == RANGE_PARTITION_TYPE)
+	{
+		partitionFileCount = partitionFileCount + 1;
+	}
+
+	nodeNameArray = palloc0(partitionFileCount * sizeof(char *));
+	nodePortArray = palloc0(partitionFileCount * sizeof(uint32));
+	upstreamTaskIdArray = palloc0(partitionFileCount * sizeof(uint32));
+
+	foreach(mergeTaskCell, mergeTaskList)
+	{
+		Task *mergeTask = (Task *) lfirst(mergeTaskCell);
+		uint32 partitionId = mergeTask->partitionId;
+		ShardPlacement *mergePlacement = NULL;
+
+		if (mergeTask->taskPlacementList == NIL || partitionId >= partitionFileCount)
+		{
+			continue;
+		}
+
+		mergePlacement = (ShardPlacement *) linitial(mergeTask->taskPlacementList);
+		nodeNameArray[partitionId] = mergePlacement->nodeName;
+		nodePortArray[partitionId] = mergePlacement->nodePort;
+		upstreamTaskIdArray[partitionId] = mergeTask->taskId;
+	}
+
+	for (partitionFileId = 0; partitionFileId < partitionFileCount; partitionFileId++)
+	{
+		char *nodeName = nodeNameArray[partitionFileId];
+		const char *separator = (partitionFileId > 0) ? ", " : "";
+
+		if (nodeName == NULL)
+		{
+			nodeName = "";
+		}
+
+		appendStringInfo(nodeNameArrayString, "%s%s", separator,
+						 quote_literal_cstr(nodeName));
+		appendStringInfo(nodePortArrayString, "%s%u", separator,
+						 nodePortArray[partitionFileId]);
+		appendStringInfo(upstreamTaskIdArrayString, "%s%u", separator,
+						 upstreamTaskIdArray[partitionFileId]);
+	}
+
+	appendStringInfo(pushTargetString,
+					 "ARRAY[%s]::text[], ARRAY[%s]::int4[], ARRAY[%s]::int4[]",
+					 nodeNameArrayString->data, nodePortArrayString->data,
+					 upstreamTaskIdArrayString->data);
+
+	foreach(mapTaskCell, mapTaskList)
+	{
+		Task *mapTask = (Task *) lfirst(mapTaskCell);
+
+		mapTask->queryString = MapTaskQueryString(mapMergeJob, mapTask,
+												  pushTargetString);
+		mapTask->pushPartitions = true;
+	}
+}
+
+
+/*
+ * PartitionColumnName returns the name under which the given MapMerge job's
+ * filter queries return the job's partition column.
+ */
+static char *
+PartitionColumnName(MapMergeJob *mapMergeJob)
+{
+	Query *filterQuery = mapMergeJob->job.jobQuery;
+	List *rangeTableList = filterQuery->rtable;
+	Var *partitionColumn = mapMergeJob->partitionColumn;
 	char *partitionColumnName = NULL;
 
 	List *groupClauseList = filterQuery->groupClause;
@@ -4253,51 +4958,153 @@ MapTaskList(MapMergeJob *mapMergeJob, List *filterTaskList)
 		partitionColumnName = ColumnName(partitionColumn, rangeTableList);
 	}
 
-	foreach(filterTaskCell, filterTaskList)
+	return partitionColumnName;
+}
+
+
+/*
+ * SemiJoinSourceTaskList returns tasks that each build a semi-join filter over
+ * part of the given MapMerge job's semi-join source. If the source is another
+ * MapMerge job, these tasks run the job's filter queries. If the source is a
+ * distributed table, they read the table's partition column from its shards.
+ * The function returns an empty list if some part of the source cannot be read
+ * before the query runs.
+ */
+static List *
+SemiJoinSourceTaskList(MapMergeJob *mapMergeJob, List *jobList)
+{
+	List *sourceTaskList = NIL;
+	Oid keyType = mapMergeJob->partitionColumn->vartype;
+	char *keyTypeName = format_type_be_qualified(keyType);
+	int32 bitCount = SemiJoinFilterSize * 1024 * BITS_PER_BYTE;
+
+	if (mapMergeJob->semiJoinSourceJobId != INVALID_JOB_ID)
 	{
-		Task *filterTask = (Task *) lfirst(filterTaskCell);
-		uint64 jobId = filterTask->jobId;
-		uint32 taskId = filterTask->taskId;
-		Task *mapTask = NULL;
+		MapMergeJob *sourceJob = NULL;
+		ListCell *jobCell = NULL;
+		ListCell *mapTaskCell = NULL;
+		char *keyColumnName = NULL;
+
+		foreach(jobCell, jobList)
+		{
+			Job *job = (Job *) lfirst(jobCell);
+			if (job->jobId == mapMergeJob->semiJoinSourceJobId)
+			{
+				sourceJob = (MapMergeJob *) job;
+				break;
+			}
+		}
 
-		/* wrap repartition query string around filter query string */
-		StringInfo mapQueryString = makeStringInfo();
-		char *filterQueryString = filterTask->queryString;
-		char *filterQueryEscapedText = quote_literal_cstr(filterQueryString);
+		Assert(sourceJob != NULL && CitusIsA(sourceJob, MapMergeJob));
+		keyColumnName = PartitionColumnName(sourceJob);
 
-		PartitionType partitionType = mapMergeJob->partitionType;
-		if (partitionType == RANGE_PARTITION_TYPE)
+		foreach(mapTaskCell, sourceJob->mapTaskList)
 		{
-			ShardInterval **intervalArray = mapMergeJob->sortedShardIntervalArray;
-			uint32 intervalCount = mapMergeJob->partitionCount;
+			Task *mapTask = (Task *) lfirst(mapTaskCell);
+			StringInfo buildCommand = makeStringInfo();
+			Task *sourceTask = NULL;
 
-			ArrayType *splitPointObject = SplitPointObject(intervalArray, intervalCount);
-			StringInfo splitPointString = SplitPointArrayString(splitPointObject,
-																partitionColumnType,
-																partitionColumnTypeMod);
+			if (mapTask->dependedTaskList != NIL || mapTask->taskPlacementList == NIL)
+			{
+				return NIL;
+			}
 
-			appendStringInfo(mapQueryString, RANGE_PARTITION_COMMAND, jobId, taskId,
-							 filterQueryEscapedText, partitionColumnName,
-							 partitionColumnTypeFullName, splitPointString->data);
+			appendStringInfo(buildCommand, BUILD_SEMI_JOIN_FILTER_COMMAND,
+							 quote_literal_cstr(mapTask->queryString),
+							 quote_literal_cstr(keyColumnName),
+							 quote_literal_cstr(keyTypeName), bitCount);
+
+			sourceTask = CreateBasicTask(mapTask->jobId, mapTask->taskId, SQL_TASK,
+										 buildCommand->data);
+			sourceTask->taskPlacementList = mapTask->taskPlacementList;
+
+			sourceTaskList = lappend(sourceTaskList, sourceTask);
 		}
-		else
+	}
+	else
+	{
+		Oid relationId = mapMergeJob->semiJoinSourceRelationId;
+		Var *partitionKey = PartitionKey(relationId);
+		char *keyColumnName = get_attname(relationId, partitionKey->varattno);
+		char *schemaName = get_namespace_name(get_rel_namespace(relationId));
+		List *shardIntervalList = LoadShardIntervalList(relationId);
+		ListCell *shardIntervalCell = NULL;
+
+		foreach(shardIntervalCell, shardIntervalList)
 		{
-			uint32 partitionCount = mapMergeJob->partitionCount;
+			ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+			uint64 shardId = shardInterval->shardId;
+			char *shardName = get_rel_name(relationId);
+			StringInfo keyQuery = makeStringInfo();
+			StringInfo buildCommand = makeStringInfo();
+			Task *sourceTask = NULL;
+
+			AppendShardIdToName(&shardName, shardId);
+			appendStringInfo(keyQuery, SHARD_KEY_QUERY,
+							 quote_identifier(keyColumnName),
+							 quote_qualified_identifier(schemaName, shardName));
+
+			appendStringInfo(buildCommand, BUILD_SEMI_JOIN_FILTER_COMMAND,
+							 quote_literal_cstr(keyQuery->data),
+							 quote_literal_cstr(keyColumnName),
+							 quote_literal_cstr(keyTypeName), bitCount);
+
+			sourceTask = CreateBasicTask(INVALID_JOB_ID, 0, SQL_TASK,
+										 buildCommand->data);
+			sourceTask->anchorShardId = shardId;
+			sourceTask->taskPlacementList = FinalizedShardPlacementList(shardId);
+			if (sourceTask->taskPlacementList == NIL)
+			{
+				return NIL;
+			}
 
-			appendStringInfo(mapQueryString, HASH_PARTITION_COMMAND, jobId, taskId,
-							 filterQueryEscapedText, partitionColumnName,
-							 partitionColumnTypeFullName, partitionCount);
+			sourceTaskList = lappend(sourceTaskList, sourceTask);
 		}
+	}
 
-		/* convert filter query task into map task */
-		mapTask = filterTask;
-		mapTask->queryString = mapQueryString->data;
-		mapTask->taskType = MAP_TASK;
+	return sourceTaskList;
+}
 
-		mapTaskList = lappend(mapTaskList, mapTask);
-	}
 
-	return mapTaskList;
+/*
+ * HeavyHitterArrayString returns the heavy hitter values of the given MapMerge
+ * job, along with their partition counts and whether map tasks spread or
+ * replicate their rows, as three array arguments to the repartition function.
+ */
+static StringInfo
+HeavyHitterArrayString(MapMergeJob *mapMergeJob)
+{
+	StringInfo valueArrayString = makeStringInfo();
+	StringInfo partitionCountArrayString = makeStringInfo();
+	StringInfo spreadArrayString = makeStringInfo();
+	StringInfo heavyHitterString = makeStringInfo();
+	ListCell *valueCell = NULL;
+	ListCell *partitionCountCell = NULL;
+	ListCell *spreadCell = NULL;
+
+	forthree(valueCell, mapMergeJob->heavyHitterValueList,
+			 partitionCountCell, mapMergeJob->heavyHitterPartitionCountList,
+			 spreadCell, mapMergeJob->spreadHeavyHitterList)
+	{
+		char *value = strVal(lfirst(valueCell));
+		int partitionCount = lfirst_int(partitionCountCell);
+		bool spread = (bool) lfirst_int(spreadCell);
+		const char *separator = (valueArrayString->len > 0) ? ", " : "";
+
+		appendStringInfo(valueArrayString, "%s%s", separator,
+						 quote_literal_cstr(value));
+		appendStringInfo(partitionCountArrayString, "%s%d", separator,
+						 partitionCount);
+		appendStringInfo(spreadArrayString, "%s%s", separator,
+						 spread ? "true" : "false");
+	}
+
+	appendStringInfo(heavyHitterString,
+					 "ARRAY[%s]::text[], ARRAY[%s]::int4[], ARRAY[%s]::bool[]",
+					 valueArrayString->data, partitionCountArrayString->data,
+					 spreadArrayString->data);
+
+	return heavyHitterString;
 }
 
 
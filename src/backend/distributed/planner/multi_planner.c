@@ -15,6 +15,7 @@
 
 #include "distributed/citus_nodefuncs.h"
 #include "distributed/citus_nodes.h"
+#include "distributed/master_statistics.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_planner.h"
 #include "distributed/multi_logical_optimizer.h"
@@ -27,6 +28,8 @@
 #include "nodes/makefuncs.h"
 
 #include "optimizer/planner.h"
+#include "optimizer/tlist.h"
+#include "parser/parsetree.h"
 
 #include "utils/memutils.h"
 
@@ -36,6 +39,7 @@ static List *relationRestrictionContextList = NIL;
 
 /* local function forward declarations */
 static void CheckNodeIsDumpable(Node *node);
+static double GroupCountEstimate(Query *query);
 
 
 /* local function forward declarations */
@@ -131,6 +135,9 @@ CreatePhysicalPlan(Query *originalQuery, Query *query,
 													restrictionContext);
 	if (physicalPlan == NULL)
 	{
+		/* estimate group count before the logical planner changes the query */
+		double groupCountEstimate = GroupCountEstimate(query);
+
 		/* Create and optimize logical plan */
 		MultiTreeRoot *logicalPlan = MultiLogicalPlanCreate(query);
 		MultiLogicalPlanOptimize(logicalPlan);
@@ -146,6 +153,7 @@ CreatePhysicalPlan(Query *originalQuery, Query *query,
 
 		/* Create the physical plan */
 		physicalPlan = MultiPhysicalPlanCreate(logicalPlan);
+		physicalPlan->groupCountEstimate = groupCountEstimate;
 	}
 
 	return physicalPlan;
@@ -326,6 +334,79 @@ GetMultiPlanString(PlannedStmt *result)
 }
 
 
+/*
+ * GroupCountEstimate estimates the number of groups the given query's GROUP BY
+ * clause produces, from the statistics we collected for distributed tables.
+ * We only estimate grouping by plain columns of distributed tables, and assume
+ * that these columns are independent. The function returns 0 if the query has
+ * no GROUP BY clause or if we cannot estimate its group count.
+ */
+static double
+GroupCountEstimate(Query *query)
+{
+	double groupCountEstimate = 1.0;
+	double maxRowCount = 0.0;
+	ListCell *groupClauseCell = NULL;
+
+	if (query->groupClause == NIL)
+	{
+		return 0.0;
+	}
+
+	foreach(groupClauseCell, query->groupClause)
+	{
+		SortGroupClause *groupClause = (SortGroupClause *) lfirst(groupClauseCell);
+		TargetEntry *groupTargetEntry = get_sortgroupclause_tle(groupClause,
+																query->targetList);
+		Var *groupColumn = NULL;
+		RangeTblEntry *rangeTableEntry = NULL;
+		double distinctCount = 0.0;
+		double rowCount = 0.0;
+		double tableSize = 0.0;
+
+		if (!IsA(groupTargetEntry->expr, Var))
+		{
+			return 0.0;
+		}
+
+		groupColumn = (Var *) groupTargetEntry->expr;
+		if (groupColumn->varlevelsup > 0)
+		{
+			return 0.0;
+		}
+
+		rangeTableEntry = rt_fetch(groupColumn->varno, query->rtable);
+		if (rangeTableEntry->rtekind != RTE_RELATION ||
+			!IsDistributedTable(rangeTableEntry->relid))
+		{
+			return 0.0;
+		}
+
+		distinctCount = DistributedColumnDistinctCount(rangeTableEntry->relid,
+													   groupColumn->varattno);
+		if (distinctCount <= 0.0)
+		{
+			return 0.0;
+		}
+
+		if (DistributedTableStatistics(rangeTableEntry->relid, &rowCount, &tableSize))
+		{
+			maxRowCount = Max(maxRowCount, rowCount);
+		}
+
+		groupCountEstimate *= distinctCount;
+	}
+
+	/* a table cannot have more groups than rows */
+	if (maxRowCount > 0.0)
+	{
+		groupCountEstimate = Min(groupCountEstimate, maxRowCount);
+	}
+
+	return groupCountEstimate;
+}
+
+
 /*
  * CheckNodeIsDumpable checks that the passed node can be dumped using
  * CitusNodeToString(). As this checks is expensive, it's only active when
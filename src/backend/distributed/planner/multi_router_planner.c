@@ -15,6 +15,7 @@
 
 #include <stddef.h>
 
+#include "access/heapam.h"
 #include "access/stratnum.h"
 #include "access/xact.h"
 #include "catalog/pg_opfamily.h"
@@ -51,6 +52,7 @@
 #include "optimizer/var.h"
 #include "parser/parsetree.h"
 #include "parser/parse_oper.h"
+#include "rewrite/rewriteManip.h"
 #include "storage/lock.h"
 #include "utils/builtins.h"
 #include "utils/elog.h"
@@ -70,15 +72,42 @@ typedef struct WalkerState
 	bool badCoalesce;
 } WalkerState;
 
+
+/*
+ * ShardInsertRows holds the positions of the rows in the VALUES list of a
+ * multi-row INSERT which fall into a particular shard.
+ */
+typedef struct ShardInsertRows
+{
+	ShardInterval *shardInterval;
+	List *rowIndexList;
+} ShardInsertRows;
+
 bool EnableRouterExecution = true;
+bool EnableRepartitionedInsertSelect = true;
 
 /* planner functions forward declarations */
 static MultiPlan * CreateSingleTaskRouterPlan(Query *originalQuery, Query *query,
 											  RelationRestrictionContext *
 											  restrictionContext);
+static MultiPlan * CreateMultiRowInsertRouterPlan(Query *originalQuery, Query *query);
 static MultiPlan * CreateInsertSelectRouterPlan(Query *originalQuery,
 												RelationRestrictionContext *
 												restrictionContext);
+static bool InsertSelectRequiresRepartition(Query *query, RangeTblEntry *insertRte,
+											RangeTblEntry *subqueryRte);
+static bool RepartitionedInsertSelectSupported(Query *query, RangeTblEntry *insertRte,
+											   RangeTblEntry *subqueryRte);
+static MultiPlan * CreateRepartitionedInsertSelectPlan(Query *originalQuery,
+													   RangeTblEntry *insertRte,
+													   RangeTblEntry *subqueryRte);
+static Query * RepartitionMapQuery(Query *originalQuery, RangeTblEntry *insertRte,
+								   RangeTblEntry *subqueryRte);
+static List * RepartitionMapTaskList(uint64 jobId, Query *mapQuery,
+									 Oid targetRelationId);
+static char * HashSplitPointString(DistTableCacheEntry *cacheEntry);
+static List * RepartitionInsertTaskList(uint64 jobId, Oid targetRelationId,
+										uint32 taskIdIndex);
 static Task * RouterModifyTaskForShardInterval(Query *originalQuery,
 											   ShardInterval *shardInterval,
 											   RelationRestrictionContext *
@@ -91,6 +120,13 @@ static char MostPermissiveVolatileFlag(char left, char right);
 static bool TargetEntryChangesValue(TargetEntry *targetEntry, Var *column,
 									FromExpr *joinTree);
 static Task * RouterModifyTask(Query *originalQuery, Query *query);
+static List * RouterMultiRowInsertTaskList(Query *originalQuery, Query *query);
+static Task * ShardModifyTask(Query *originalQuery, ShardInterval *shardInterval,
+							  List *rowIndexList);
+static RangeTblEntry * ExtractInsertValuesRangeTableEntry(Query *query);
+static bool InsertValuesAreConstant(Query *query, TargetEntry *targetEntry);
+static Expr * InsertValuesRowExpression(Query *query, Expr *expression,
+										List *valuesList);
 static ShardInterval * TargetShardIntervalForModify(Query *query);
 static List * QueryRestrictList(Query *query);
 static bool FastShardPruningPossible(CmdType commandType, char partitionMethod);
@@ -125,6 +161,9 @@ static void ErrorIfInsertPartitionColumnDoesNotMatchSelect(Query *query,
 														   RangeTblEntry *subqueryRte,
 														   Oid *
 														   selectPartitionColumnTableId);
+static bool InsertPartitionColumnMatchesSelect(Query *query, RangeTblEntry *insertRte,
+											   RangeTblEntry *subqueryRte,
+											   Oid *selectPartitionColumnTableId);
 static void AddUninstantiatedEqualityQual(Query *query, Var *targetPartitionColumnVar);
 
 
@@ -135,6 +174,7 @@ static void AddUninstantiatedEqualityQual(Query *query, Var *targetPartitionColu
  *   (ii) select queries  hat can be executed on a single worker
  *   node and does not require any operations on the master node.
  *   (iii) INSERT INTO .... SELECT queries
+ *   (iv) multi-row INSERT queries, whose rows are grouped by shard
  *
  * The function returns NULL if it cannot create the plan for SELECT
  * queries and errors out if it cannot plan the modify queries.
@@ -155,6 +195,11 @@ MultiRouterPlanCreate(Query *originalQuery, Query *query,
 	{
 		multiPlan = CreateInsertSelectRouterPlan(originalQuery, restrictionContext);
 	}
+	else if (query->commandType == CMD_INSERT &&
+			 ExtractInsertValuesRangeTableEntry(query) != NULL)
+	{
+		multiPlan = CreateMultiRowInsertRouterPlan(originalQuery, query);
+	}
 	else
 	{
 		multiPlan = CreateSingleTaskRouterPlan(originalQuery, query, restrictionContext);
@@ -224,6 +269,44 @@ CreateSingleTaskRouterPlan(Query *originalQuery, Query *query,
 }
 
 
+/*
+ * CreateMultiRowInsertRouterPlan creates a router plan for an INSERT with
+ * multiple rows in its VALUES list. The plan contains a modify task for each
+ * shard that receives rows, and each task inserts all of that shard's rows in
+ * a single statement.
+ *
+ * The function never returns NULL, it errors out if cannot create the multi plan.
+ */
+static MultiPlan *
+CreateMultiRowInsertRouterPlan(Query *originalQuery, Query *query)
+{
+	List *taskList = NIL;
+	Job *job = NULL;
+	MultiPlan *multiPlan = NULL;
+
+	ErrorIfModifyQueryNotSupported(query);
+
+	taskList = RouterMultiRowInsertTaskList(originalQuery, query);
+
+	ereport(DEBUG2, (errmsg("Creating router plan")));
+
+	job = CitusMakeNode(Job);
+	job->dependedJobList = NIL;
+	job->jobId = INVALID_JOB_ID;
+	job->subqueryPushdown = false;
+	job->jobQuery = originalQuery;
+	job->taskList = FirstReplicaAssignTaskList(taskList);
+	job->requiresMasterEvaluation = RequiresMasterEvaluation(originalQuery);
+
+	multiPlan = CitusMakeNode(MultiPlan);
+	multiPlan->workerJob = job;
+	multiPlan->masterQuery = NULL;
+	multiPlan->masterTableName = NULL;
+
+	return multiPlan;
+}
+
+
 /*
  * Creates a router plan for INSERT ... SELECT queries which could consists of
  * multiple tasks.
@@ -247,6 +330,18 @@ CreateInsertSelectRouterPlan(Query *originalQuery,
 	int shardCount = targetCacheEntry->shardIntervalArrayLength;
 	bool allReferenceTables = restrictionContext->allReferenceTables;
 
+	/*
+	 * If the SELECT's rows cannot be inserted into colocated target shards, we
+	 * may still be able to repartition them by the target's shard boundaries.
+	 */
+	if (EnableRepartitionedInsertSelect && !allReferenceTables &&
+		InsertSelectRequiresRepartition(originalQuery, insertRte, subqueryRte) &&
+		RepartitionedInsertSelectSupported(originalQuery, insertRte, subqueryRte))
+	{
+		return CreateRepartitionedInsertSelectPlan(originalQuery, insertRte,
+												   subqueryRte);
+	}
+
 	/*
 	 * Error semantics for INSERT ... SELECT queries are different than regular
 	 * modify queries. Thus, handle separately.
@@ -302,6 +397,418 @@ CreateInsertSelectRouterPlan(Query *originalQuery,
 }
 
 
+/*
+ * InsertSelectRequiresRepartition returns true if the given INSERT ... SELECT
+ * query targets a hash distributed table, and the SELECT does not return the
+ * partition column of a table that is colocated with the target. Such queries
+ * cannot push the SELECT down to the target's shards.
+ */
+static bool
+InsertSelectRequiresRepartition(Query *query, RangeTblEntry *insertRte,
+								RangeTblEntry *subqueryRte)
+{
+	Oid targetRelationId = insertRte->relid;
+	Oid selectPartitionColumnTableId = InvalidOid;
+	bool partitionColumnsMatch = false;
+
+	if (PartitionMethod(targetRelationId) != DISTRIBUTE_BY_HASH)
+	{
+		return false;
+	}
+
+	partitionColumnsMatch =
+		InsertPartitionColumnMatchesSelect(query, insertRte, subqueryRte,
+										   &selectPartitionColumnTableId);
+	if (!partitionColumnsMatch)
+	{
+		return true;
+	}
+
+	return !TablesColocated(targetRelationId, selectPartitionColumnTableId);
+}
+
+
+/*
+ * RepartitionedInsertSelectSupported returns true if we can run the given
+ * INSERT ... SELECT query by repartitioning the SELECT's rows. For this, the
+ * SELECT should read from a single distributed table, and should produce its
+ * rows independently on each of that table's shards. The target table's shards
+ * should also cover the hash space uniformly, since we partition the rows by
+ * their boundaries. If the function returns false, we fall back to the regular
+ * planning logic, which errors out with the appropriate message.
+ */
+static bool
+RepartitionedInsertSelectSupported(Query *query, RangeTblEntry *insertRte,
+								   RangeTblEntry *subqueryRte)
+{
+	Query *subquery = subqueryRte->subquery;
+	DistTableCacheEntry *targetCacheEntry = DistributedTableCacheEntry(insertRte->relid);
+	RangeTblEntry *sourceRte = NULL;
+
+	if (!targetCacheEntry->hasUniformHashDistribution)
+	{
+		return false;
+	}
+
+	/* we only insert partition files, and cannot handle conflicts or return rows */
+	if (query->onConflict != NULL || query->returningList != NIL)
+	{
+		return false;
+	}
+
+	if (contain_volatile_functions((Node *) query))
+	{
+		return false;
+	}
+
+	/* each shard of the source table should produce its rows independently */
+	if (subquery->hasAggs || subquery->groupClause != NIL ||
+		subquery->groupingSets != NIL || subquery->havingQual != NULL ||
+		subquery->distinctClause != NIL || subquery->hasWindowFuncs ||
+		subquery->hasSubLinks || subquery->cteList != NIL ||
+		subquery->setOperations != NULL || subquery->limitCount != NULL ||
+		subquery->limitOffset != NULL || subquery->hasForUpdate)
+	{
+		return false;
+	}
+
+	if (list_length(subquery->rtable) != 1)
+	{
+		return false;
+	}
+
+	sourceRte = (RangeTblEntry *) linitial(subquery->rtable);
+	if (sourceRte->rtekind != RTE_RELATION || !IsDistributedTable(sourceRte->relid))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * CreateRepartitionedInsertSelectPlan creates a plan for an INSERT ... SELECT
+ * query whose rows need to move between shards that are not colocated. The plan
+ * first runs the SELECT on each source shard as a map task, which partitions the
+ * SELECT's results into files by the target table's shard boundaries. Then, each
+ * target shard's placements fetch their partition files from the map tasks, and
+ * the plan's modify tasks insert the rows in these files into the target shards.
+ * This way, rows move directly between worker nodes.
+ *
+ * The map tasks are kept in the depended job of the returned plan's worker job,
+ * and the router executor runs them and fetches their results before running the
+ * worker job's tasks.
+ */
+static MultiPlan *
+CreateRepartitionedInsertSelectPlan(Query *originalQuery, RangeTblEntry *insertRte,
+									RangeTblEntry *subqueryRte)
+{
+	Oid targetRelationId = insertRte->relid;
+	uint64 jobId = UniqueJobId();
+	Query *mapQuery = NULL;
+	List *mapTaskList = NIL;
+	List *insertTaskList = NIL;
+	Job *mapJob = NULL;
+	Job *workerJob = NULL;
+	MultiPlan *multiPlan = NULL;
+
+	ereport(DEBUG2, (errmsg("Creating repartitioned INSERT ... SELECT plan")));
+
+	mapQuery = RepartitionMapQuery(originalQuery, insertRte, subqueryRte);
+	mapTaskList = RepartitionMapTaskList(jobId, mapQuery, targetRelationId);
+
+	workerJob = CitusMakeNode(Job);
+	workerJob->jobId = jobId;
+	workerJob->jobQuery = originalQuery;
+	workerJob->subqueryPushdown = false;
+	workerJob->requiresMasterEvaluation = false;
+	workerJob->dependedJobList = NIL;
+	workerJob->taskList = NIL;
+
+	/* nothing to insert if the SELECT was pruned away completely */
+	if (mapTaskList != NIL)
+	{
+		uint32 taskIdIndex = list_length(mapTaskList) + 1;
+
+		insertTaskList = RepartitionInsertTaskList(jobId, targetRelationId,
+												   taskIdIndex);
+
+		mapJob = CitusMakeNode(Job);
+		mapJob->jobId = jobId;
+		mapJob->jobQuery = mapQuery;
+		mapJob->subqueryPushdown = false;
+		mapJob->requiresMasterEvaluation = false;
+		mapJob->dependedJobList = NIL;
+		mapJob->taskList = mapTaskList;
+
+		workerJob->dependedJobList = list_make1(mapJob);
+		workerJob->taskList = insertTaskList;
+	}
+
+	multiPlan = CitusMakeNode(MultiPlan);
+	multiPlan->workerJob = workerJob;
+	multiPlan->masterTableName = NULL;
+	multiPlan->masterQuery = NULL;
+
+	return multiPlan;
+}
+
+
+/*
+ * RepartitionMapQuery builds the query that map tasks run on source shards. The
+ * query selects from the INSERT's subquery, and returns the values that would be
+ * inserted into each of the target table's columns, in the order of the target
+ * table's columns. This way, the map tasks' output files have the target table's
+ * row type. The query also filters out rows with a NULL partition column value,
+ * which we cannot route to any shard.
+ */
+static Query *
+RepartitionMapQuery(Query *originalQuery, RangeTblEntry *insertRte,
+					RangeTblEntry *subqueryRte)
+{
+	Oid targetRelationId = insertRte->relid;
+	Var *partitionColumn = PartitionColumn(targetRelationId, 1);
+	Expr *partitionExpression = NULL;
+	Relation targetRelation = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Query *mapQuery = NULL;
+	RangeTblRef *rangeTableRef = NULL;
+	NullTest *nullTest = NULL;
+	List *targetList = NIL;
+	ListCell *rangeTableCell = NULL;
+	Index subqueryRteIndex = 0;
+	Index rangeTableIndex = 1;
+	int columnIndex = 0;
+	AttrNumber resno = 1;
+
+	foreach(rangeTableCell, originalQuery->rtable)
+	{
+		if (lfirst(rangeTableCell) == subqueryRte)
+		{
+			subqueryRteIndex = rangeTableIndex;
+			break;
+		}
+
+		rangeTableIndex++;
+	}
+
+	Assert(subqueryRteIndex != 0);
+
+	targetRelation = heap_open(targetRelationId, AccessShareLock);
+	tupleDescriptor = RelationGetDescr(targetRelation);
+
+	for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attributeForm = tupleDescriptor->attrs[columnIndex];
+		char *columnName = NameStr(attributeForm->attname);
+		TargetEntry *insertTargetEntry = NULL;
+		TargetEntry *mapTargetEntry = NULL;
+		Expr *columnExpression = NULL;
+
+		if (attributeForm->attisdropped)
+		{
+			continue;
+		}
+
+		/* INSERT target lists are ordered by attribute number after rewriting */
+		insertTargetEntry = get_tle_by_resno(originalQuery->targetList,
+											 attributeForm->attnum);
+		if (insertTargetEntry != NULL)
+		{
+			columnExpression = copyObject(insertTargetEntry->expr);
+
+			/* the subquery is the only range table entry of the map query */
+			ChangeVarNodes((Node *) columnExpression, subqueryRteIndex, 1, 0);
+		}
+		else
+		{
+			columnExpression = (Expr *) makeNullConst(attributeForm->atttypid,
+													  attributeForm->atttypmod,
+													  attributeForm->attcollation);
+		}
+
+		if (attributeForm->attnum == partitionColumn->varattno)
+		{
+			partitionExpression = columnExpression;
+		}
+
+		mapTargetEntry = makeTargetEntry(columnExpression, resno, pstrdup(columnName),
+										 false);
+		targetList = lappend(targetList, mapTargetEntry);
+		resno++;
+	}
+
+	heap_close(targetRelation, NoLock);
+
+	Assert(partitionExpression != NULL);
+
+	nullTest = makeNode(NullTest);
+	nullTest->arg = copyObject(partitionExpression);
+	nullTest->nulltesttype = IS_NOT_NULL;
+	nullTest->argisrow = false;
+	nullTest->location = -1;
+
+	rangeTableRef = makeNode(RangeTblRef);
+	rangeTableRef->rtindex = 1;
+
+	mapQuery = makeNode(Query);
+	mapQuery->commandType = CMD_SELECT;
+	mapQuery->querySource = QSRC_ORIGINAL;
+	mapQuery->canSetTag = true;
+	mapQuery->rtable = list_make1(copyObject(subqueryRte));
+	mapQuery->jointree = makeFromExpr(list_make1(rangeTableRef), (Node *) nullTest);
+	mapQuery->targetList = targetList;
+
+	return mapQuery;
+}
+
+
+/*
+ * RepartitionMapTaskList creates a map task for each shard of the map query's
+ * source table that is not pruned away by the SELECT's filters. Each task runs
+ * the map query on its shard, and hash partitions the results into one file per
+ * shard of the target table.
+ */
+static List *
+RepartitionMapTaskList(uint64 jobId, Query *mapQuery, Oid targetRelationId)
+{
+	RangeTblEntry *subqueryRte = (RangeTblEntry *) linitial(mapQuery->rtable);
+	Query *subquery = subqueryRte->subquery;
+	RangeTblEntry *sourceRte = (RangeTblEntry *) linitial(subquery->rtable);
+	Oid sourceRelationId = sourceRte->relid;
+	List *whereClauseList = make_ands_implicit((Expr *) subquery->jointree->quals);
+	List *shardIntervalList = LoadShardIntervalList(sourceRelationId);
+	List *prunedShardList = NIL;
+	DistTableCacheEntry *targetCacheEntry = DistributedTableCacheEntry(targetRelationId);
+	Var *partitionColumn = PartitionColumn(targetRelationId, 1);
+	char *partitionColumnName = get_attname(targetRelationId,
+											partitionColumn->varattno);
+	char *partitionColumnType = format_type_be_qualified(partitionColumn->vartype);
+	char *splitPointString = HashSplitPointString(targetCacheEntry);
+	List *mapTaskList = NIL;
+	ListCell *shardIntervalCell = NULL;
+	uint32 taskIdIndex = 1;     /* 0 is reserved for invalid taskId */
+
+	prunedShardList = PruneShardList(sourceRelationId, 1, whereClauseList,
+									 shardIntervalList);
+
+	foreach(shardIntervalCell, prunedShardList)
+	{
+		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
+		uint64 shardId = shardInterval->shardId;
+		Query *shardMapQuery = copyObject(mapQuery);
+		RelationShard *relationShard = CitusMakeNode(RelationShard);
+		StringInfo filterQueryString = makeStringInfo();
+		StringInfo mapQueryString = makeStringInfo();
+		Task *mapTask = NULL;
+
+		relationShard->relationId = sourceRelationId;
+		relationShard->shardId = shardId;
+
+		UpdateRelationToShardNames((Node *) shardMapQuery, list_make1(relationShard));
+		pg_get_query_def(shardMapQuery, filterQueryString);
+
+		appendStringInfo(mapQueryString, HASH_RANGE_PARTITION_COMMAND, jobId,
+						 taskIdIndex, quote_literal_cstr(filterQueryString->data),
+						 quote_literal_cstr(partitionColumnName), partitionColumnType,
+						 splitPointString);
+
+		mapTask = CreateBasicTask(jobId, taskIdIndex, MAP_TASK, mapQueryString->data);
+		mapTask->anchorShardId = shardId;
+		mapTask->taskPlacementList = FinalizedShardPlacementList(shardId);
+
+		mapTaskList = lappend(mapTaskList, mapTask);
+		taskIdIndex++;
+	}
+
+	return mapTaskList;
+}
+
+
+/*
+ * HashSplitPointString returns the array literal of the hashed values at which
+ * the given hash distributed table's shards start, omitting the first shard.
+ * worker_hash_partition_table() uses these split points to write the rows of
+ * each shard into a separate partition file.
+ */
+static char *
+HashSplitPointString(DistTableCacheEntry *cacheEntry)
+{
+	StringInfo splitPointString = makeStringInfo();
+	int shardCount = cacheEntry->shardIntervalArrayLength;
+	int shardIndex = 0;
+
+	appendStringInfoChar(splitPointString, '{');
+
+	for (shardIndex = 1; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = cacheEntry->sortedShardIntervalArray[shardIndex];
+		int32 minValue = DatumGetInt32(shardInterval->minValue);
+
+		if (shardIndex > 1)
+		{
+			appendStringInfoChar(splitPointString, ',');
+		}
+
+		appendStringInfo(splitPointString, "%d", minValue);
+	}
+
+	appendStringInfoChar(splitPointString, '}');
+
+	return splitPointString->data;
+}
+
+
+/*
+ * RepartitionInsertTaskList creates a modify task for each shard of the target
+ * table, with task ids starting from the given index. Each task inserts the rows
+ * in the partition files that the shard's placements fetched from the map tasks.
+ * The partition number of each task is the index of its shard, which is also the
+ * number of the partition files it reads.
+ */
+static List *
+RepartitionInsertTaskList(uint64 jobId, Oid targetRelationId, uint32 taskIdIndex)
+{
+	DistTableCacheEntry *targetCacheEntry = DistributedTableCacheEntry(targetRelationId);
+	int shardCount = targetCacheEntry->shardIntervalArrayLength;
+	char *schemaName = get_namespace_name(get_rel_namespace(targetRelationId));
+	List *insertTaskList = NIL;
+	int shardIndex = 0;
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval =
+			targetCacheEntry->sortedShardIntervalArray[shardIndex];
+		uint64 shardId = shardInterval->shardId;
+		char *shardName = get_rel_name(targetRelationId);
+		char *qualifiedShardName = NULL;
+		StringInfo insertQueryString = makeStringInfo();
+		Task *insertTask = NULL;
+
+		/* grab shared metadata lock to stop concurrent placement additions */
+		LockShardDistributionMetadata(shardId, ShareLock);
+
+		AppendShardIdToName(&shardName, shardId);
+		qualifiedShardName = quote_qualified_identifier(schemaName, shardName);
+
+		appendStringInfo(insertQueryString, REPARTITIONED_INSERT_COMMAND,
+						 qualifiedShardName, qualifiedShardName, jobId, taskIdIndex);
+
+		insertTask = CreateBasicTask(jobId, taskIdIndex, MODIFY_TASK,
+									 insertQueryString->data);
+		insertTask->anchorShardId = shardId;
+		insertTask->partitionId = shardIndex;
+		insertTask->taskPlacementList = FinalizedShardPlacementList(shardId);
+
+		insertTaskList = lappend(insertTaskList, insertTask);
+		taskIdIndex++;
+	}
+
+	return insertTaskList;
+}
+
+
 /*
  * RouterModifyTaskForShardInterval creates a modify task by
  * replacing the partitioning qual parameter added in multi_planner()
@@ -799,6 +1306,30 @@ static void
 ErrorIfInsertPartitionColumnDoesNotMatchSelect(Query *query, RangeTblEntry *insertRte,
 											   RangeTblEntry *subqueryRte,
 											   Oid *selectPartitionColumnTableId)
+{
+	bool partitionColumnsMatch =
+		InsertPartitionColumnMatchesSelect(query, insertRte, subqueryRte,
+										   selectPartitionColumnTableId);
+
+	if (!partitionColumnsMatch)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("SELECT query should return bare partition column on "
+							   "the same ordinal position as the INSERT's partition "
+							   "column")));
+	}
+}
+
+
+/*
+ * InsertPartitionColumnMatchesSelect returns true if the INSERTed table's partition
+ * column value comes from any of the SELECTed table's partition column. If so, the
+ * function also sets selectPartitionColumnTableId.
+ */
+static bool
+InsertPartitionColumnMatchesSelect(Query *query, RangeTblEntry *insertRte,
+								   RangeTblEntry *subqueryRte,
+								   Oid *selectPartitionColumnTableId)
 {
 	ListCell *targetEntryCell = NULL;
 	uint32 rangeTableId = 1;
@@ -855,13 +1386,7 @@ ErrorIfInsertPartitionColumnDoesNotMatchSelect(Query *query, RangeTblEntry *inse
 		}
 	}
 
-	if (!partitionColumnsMatch)
-	{
-		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-						errmsg("SELECT query should return bare partition column on "
-							   "the same ordinal position as the INSERT's partition "
-							   "column")));
-	}
+	return partitionColumnsMatch;
 }
 
 
@@ -1104,21 +1629,19 @@ ErrorIfModifyQueryNotSupported(Query *queryTree)
 								  "modifications.")));
 	}
 
-	/* reject queries which involve multi-row inserts */
-	if (hasValuesScan)
+	/*
+	 * Reject VALUES lists outside of multi-row inserts. The rows of multi-row
+	 * inserts are grouped by shard during planning, and the master evaluates
+	 * functions in each row separately, such that VOLATILE functions still
+	 * return a different value for each row.
+	 */
+	if (hasValuesScan && commandType != CMD_INSERT)
 	{
-		/*
-		 * NB: If you remove this check you must also change the checks further in this
-		 * method and ensure that VOLATILE function calls aren't allowed in INSERT
-		 * statements. Currently they're allowed but the function call is replaced
-		 * with a constant, and if you're inserting multiple rows at once the function
-		 * should return a different value for each row.
-		 */
 		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 						errmsg("cannot perform distributed planning for the given"
 							   " modification"),
-						errdetail("Multi-row INSERTs to distributed tables are not "
-								  "supported.")));
+						errdetail("VALUES lists are only supported in distributed"
+								  " INSERTs.")));
 	}
 
 	if (commandType == CMD_INSERT || commandType == CMD_UPDATE ||
@@ -1166,7 +1689,7 @@ ErrorIfModifyQueryNotSupported(Query *queryTree)
 			}
 
 			if (commandType == CMD_INSERT && targetEntryPartitionColumn &&
-				!IsA(targetEntry->expr, Const))
+				!InsertValuesAreConstant(queryTree, targetEntry))
 			{
 				ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 								errmsg("values given for the partition column must be"
@@ -1611,8 +2134,141 @@ static Task *
 RouterModifyTask(Query *originalQuery, Query *query)
 {
 	ShardInterval *shardInterval = TargetShardIntervalForModify(query);
+
+	return ShardModifyTask(originalQuery, shardInterval, NIL);
+}
+
+
+/*
+ * RouterMultiRowInsertTaskList groups the rows of a multi-row INSERT by the
+ * shard that their partition value falls into, and returns a modify task for
+ * each of these shards. If all rows fall into a single shard, the returned task
+ * inserts the VALUES list of the original query as is.
+ */
+static List *
+RouterMultiRowInsertTaskList(Query *originalQuery, Query *query)
+{
+	Oid distributedTableId = ExtractFirstDistributedTableId(query);
+	uint32 rangeTableId = 1;
+	Var *partitionColumn = PartitionColumn(distributedTableId, rangeTableId);
+	RangeTblEntry *valuesRte = ExtractInsertValuesRangeTableEntry(query);
+	Query *rowQuery = NULL;
+	TargetEntry *partitionTargetEntry = NULL;
+	Expr *partitionExpression = NULL;
+	ListCell *targetEntryCell = NULL;
+	ListCell *valuesListCell = NULL;
+	ListCell *shardInsertRowsCell = NULL;
+	List *shardInsertRowsList = NIL;
+	List *taskList = NIL;
+	uint32 taskIdIndex = 1;     /* 0 is reserved for invalid taskId */
+	int rowIndex = 0;
+
+	/* reference tables have a single shard, which receives all rows */
+	if (partitionColumn == NULL)
+	{
+		return list_make1(RouterModifyTask(originalQuery, query));
+	}
+
+	/*
+	 * Route each row like a single-row INSERT, using a shallow copy of the
+	 * query whose partition column target entry we point at the row's value.
+	 */
+	rowQuery = palloc(sizeof(Query));
+	memcpy(rowQuery, query, sizeof(Query));
+	rowQuery->targetList = NIL;
+
+	foreach(targetEntryCell, query->targetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+
+		if (targetEntry->resno == partitionColumn->varattno)
+		{
+			partitionExpression = targetEntry->expr;
+			partitionTargetEntry = flatCopyTargetEntry(targetEntry);
+			targetEntry = partitionTargetEntry;
+		}
+
+		rowQuery->targetList = lappend(rowQuery->targetList, targetEntry);
+	}
+
+	foreach(valuesListCell, valuesRte->values_lists)
+	{
+		List *valuesList = (List *) lfirst(valuesListCell);
+		ShardInterval *shardInterval = NULL;
+		ShardInsertRows *shardInsertRows = NULL;
+
+		if (partitionTargetEntry != NULL)
+		{
+			partitionTargetEntry->expr = InsertValuesRowExpression(query,
+																   partitionExpression,
+																   valuesList);
+		}
+
+		shardInterval = TargetShardIntervalForModify(rowQuery);
+
+		foreach(shardInsertRowsCell, shardInsertRowsList)
+		{
+			ShardInsertRows *existingShardRows =
+				(ShardInsertRows *) lfirst(shardInsertRowsCell);
+
+			if (existingShardRows->shardInterval->shardId == shardInterval->shardId)
+			{
+				shardInsertRows = existingShardRows;
+				break;
+			}
+		}
+
+		if (shardInsertRows == NULL)
+		{
+			shardInsertRows = (ShardInsertRows *) palloc0(sizeof(ShardInsertRows));
+			shardInsertRows->shardInterval = shardInterval;
+			shardInsertRowsList = lappend(shardInsertRowsList, shardInsertRows);
+		}
+
+		shardInsertRows->rowIndexList = lappend_int(shardInsertRows->rowIndexList,
+													rowIndex);
+		rowIndex++;
+	}
+
+	/* no need to split the VALUES list if all rows go to the same shard */
+	if (list_length(shardInsertRowsList) == 1)
+	{
+		ShardInsertRows *shardInsertRows =
+			(ShardInsertRows *) linitial(shardInsertRowsList);
+
+		return list_make1(ShardModifyTask(originalQuery, shardInsertRows->shardInterval,
+										  NIL));
+	}
+
+	foreach(shardInsertRowsCell, shardInsertRowsList)
+	{
+		ShardInsertRows *shardInsertRows =
+			(ShardInsertRows *) lfirst(shardInsertRowsCell);
+		Task *modifyTask = ShardModifyTask(originalQuery, shardInsertRows->shardInterval,
+										   shardInsertRows->rowIndexList);
+
+		modifyTask->taskId = taskIdIndex;
+		taskList = lappend(taskList, modifyTask);
+
+		++taskIdIndex;
+	}
+
+	return taskList;
+}
+
+
+/*
+ * ShardModifyTask builds a Task which performs the modification of the given
+ * query on the given shard. If a row index list is given, the query is a
+ * multi-row INSERT and the task only inserts the rows at those positions in
+ * its VALUES list.
+ */
+static Task *
+ShardModifyTask(Query *originalQuery, ShardInterval *shardInterval, List *rowIndexList)
+{
 	uint64 shardId = shardInterval->shardId;
 	StringInfo queryString = makeStringInfo();
+	Query *shardQuery = originalQuery;
 	Task *modifyTask = NULL;
 	bool upsertQuery = false;
 
@@ -1635,7 +2291,12 @@ RouterModifyTask(Query *originalQuery, Query *query)
 		}
 	}
 
-	deparse_shard_query(originalQuery, shardInterval->relationId, shardId, queryString);
+	if (rowIndexList != NIL)
+	{
+		shardQuery = InsertValuesSubsetQuery(originalQuery, rowIndexList);
+	}
+
+	deparse_shard_query(shardQuery, shardInterval->relationId, shardId, queryString);
 	ereport(DEBUG4, (errmsg("distributed statement: %s", queryString->data)));
 
 	modifyTask = CitusMakeNode(Task);
@@ -1646,11 +2307,149 @@ RouterModifyTask(Query *originalQuery, Query *query)
 	modifyTask->anchorShardId = shardId;
 	modifyTask->dependedTaskList = NIL;
 	modifyTask->upsertQuery = upsertQuery;
+	modifyTask->rowIndexList = rowIndexList;
 
 	return modifyTask;
 }
 
 
+/*
+ * ExtractInsertValuesRangeTableEntry returns the range table entry of the
+ * VALUES list of a multi-row INSERT, or NULL if the query has no such entry.
+ */
+static RangeTblEntry *
+ExtractInsertValuesRangeTableEntry(Query *query)
+{
+	ListCell *rangeTableCell = NULL;
+
+	foreach(rangeTableCell, query->rtable)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+
+		if (rangeTableEntry->rtekind == RTE_VALUES)
+		{
+			return rangeTableEntry;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * InsertValuesAreConstant returns true if the given target entry of an INSERT
+ * is a constant. For multi-row INSERTs, the target entry may also refer to a
+ * column of the VALUES list, in which case each row needs to supply a constant.
+ */
+static bool
+InsertValuesAreConstant(Query *query, TargetEntry *targetEntry)
+{
+	RangeTblEntry *valuesRte = ExtractInsertValuesRangeTableEntry(query);
+	ListCell *valuesListCell = NULL;
+
+	if (valuesRte == NULL)
+	{
+		return IsA(targetEntry->expr, Const);
+	}
+
+	foreach(valuesListCell, valuesRte->values_lists)
+	{
+		List *valuesList = (List *) lfirst(valuesListCell);
+		Expr *rowExpression = InsertValuesRowExpression(query, targetEntry->expr,
+														valuesList);
+
+		if (!IsA(rowExpression, Const))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * InsertValuesRowExpression returns the value that a row of the VALUES list of
+ * a multi-row INSERT supplies for the given target list expression. Expressions
+ * that do not refer to the VALUES list, such as defaults added by the planner,
+ * apply to all rows alike and are returned as is.
+ */
+static Expr *
+InsertValuesRowExpression(Query *query, Expr *expression, List *valuesList)
+{
+	if (IsA(expression, Var))
+	{
+		Var *column = (Var *) expression;
+		RangeTblEntry *rangeTableEntry = rt_fetch(column->varno, query->rtable);
+
+		if (rangeTableEntry->rtekind == RTE_VALUES)
+		{
+			return (Expr *) list_nth(valuesList, column->varattno - 1);
+		}
+	}
+
+	return expression;
+}
+
+
+/*
+ * InsertValuesSubsetQuery returns a shallow copy of the given multi-row INSERT
+ * whose VALUES list only contains the rows at the given, ascending positions.
+ * The copy shares all other nodes with the given query, and is meant to deparse
+ * the rows that fall into a single shard.
+ */
+Query *
+InsertValuesSubsetQuery(Query *query, List *rowIndexList)
+{
+	Query *subsetQuery = palloc(sizeof(Query));
+	ListCell *rangeTableCell = NULL;
+
+	memcpy(subsetQuery, query, sizeof(Query));
+	subsetQuery->rtable = NIL;
+
+	foreach(rangeTableCell, query->rtable)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+
+		if (rangeTableEntry->rtekind == RTE_VALUES)
+		{
+			RangeTblEntry *subsetRangeTableEntry = palloc(sizeof(RangeTblEntry));
+			ListCell *rowIndexCell = list_head(rowIndexList);
+			ListCell *valuesListCell = NULL;
+			int rowIndex = 0;
+
+			memcpy(subsetRangeTableEntry, rangeTableEntry, sizeof(RangeTblEntry));
+			subsetRangeTableEntry->values_lists = NIL;
+
+			/* walk both lists in step, since the row positions are ascending */
+			foreach(valuesListCell, rangeTableEntry->values_lists)
+			{
+				if (rowIndexCell == NULL)
+				{
+					break;
+				}
+
+				if (lfirst_int(rowIndexCell) == rowIndex)
+				{
+					subsetRangeTableEntry->values_lists =
+						lappend(subsetRangeTableEntry->values_lists,
+								lfirst(valuesListCell));
+					rowIndexCell = lnext(rowIndexCell);
+				}
+
+				rowIndex++;
+			}
+
+			rangeTableEntry = subsetRangeTableEntry;
+		}
+
+		subsetQuery->rtable = lappend(subsetQuery->rtable, rangeTableEntry);
+	}
+
+	return subsetQuery;
+}
+
+
 /*
  * TargetShardIntervalForModify determines the single shard targeted by a provided
  * modify command. If no matching shards exist, or if the modification targets more
@@ -19,6 +19,7 @@
 #include "commands/explain.h"
 #include "executor/executor.h"
 #include "distributed/citus_nodefuncs.h"
+#include "distributed/commit_worker.h"
 #include "distributed/connection_management.h"
 #include "distributed/commit_protocol.h"
 #include "distributed/connection_management.h"
@@ -28,11 +29,14 @@
 #include "distributed/multi_explain.h"
 #include "distributed/multi_join_order.h"
 #include "distributed/multi_logical_optimizer.h"
+#include "distributed/multi_master_planner.h"
 #include "distributed/multi_planner.h"
 #include "distributed/multi_router_executor.h"
 #include "distributed/multi_router_planner.h"
 #include "distributed/multi_server_executor.h"
 #include "distributed/multi_utility.h"
+#include "distributed/partition_memory.h"
+#include "distributed/recovery_worker.h"
 #include "distributed/remote_commands.h"
 #include "distributed/task_tracker.h"
 #include "distributed/transaction_management.h"
@@ -157,6 +161,12 @@ _PG_init(void)
 	/* organize that task tracker is started once server is up */
 	TaskTrackerRegister();
 
+	/* and that the commit worker is started as well */
+	CommitWorkerRegister();
+
+	/* as well as the transaction recovery worker, if configured */
+	RecoveryWorkerRegister();
+
 	/* initialize coordinated transaction management */
 	InitializeTransactionManagement();
 	InitializeConnectionManagement();
@@ -237,6 +247,35 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_incremental_result_copy",
+		gettext_noop("Copies task results to the master table as tasks complete."),
+		gettext_noop("When enabled, the real-time and task-tracker executors "
+					 "copy each task's results into the temporary master table "
+					 "as soon as the task completes, so that loading results "
+					 "overlaps with the execution of remaining tasks. "
+					 "Otherwise, results are copied after all tasks complete. "
+					 "In either case, the master query combines the tasks' "
+					 "partial aggregates only after all tasks complete."),
+		&EnableIncrementalResultCopy,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_top_k_bound_propagation",
+		gettext_noop("Tightens top-k tasks using results of completed tasks."),
+		gettext_noop("When enabled, the executor uses the k-th value returned by "
+					 "a completed ORDER BY ... LIMIT task as a filter on tasks "
+					 "that did not start yet. This only applies to queries on a "
+					 "single distributed table without aggregates."),
+		&EnableTopKBoundPropagation,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.binary_worker_copy_format",
 		gettext_noop("Use the binary worker copy format."),
@@ -249,6 +288,80 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.compress_partition_files",
+		gettext_noop("Compresses partition files written during repartitioning."),
+		gettext_noop("When enabled, worker nodes compress the files they write "
+					 "when repartitioning tables for large table joins. Files "
+					 "are compressed in blocks with PostgreSQL's built-in pglz "
+					 "algorithm, and are transferred between worker nodes in "
+					 "their compressed form."),
+		&CompressPartitionFiles,
+		false,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.merge_files_in_place",
+		gettext_noop("Queries merge task files in place instead of loading them."),
+		gettext_noop("When enabled, merge tasks that run a query over repartitioned "
+					 "data read the fetched files directly through a set returning "
+					 "function, rather than first copying them into a task table. "
+					 "This avoids writing the data twice on worker nodes. Files "
+					 "compressed with citus.compress_partition_files are still "
+					 "decompressed into temporary files before they are read."),
+		&MergeFilesInPlace,
+		false,
+		PGC_SIGHUP,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_repartition_push",
+		gettext_noop("Pushes repartitioned data from map tasks to merge task nodes."),
+		gettext_noop("When enabled, map tasks in repartition jobs send each "
+					 "partition to the node that runs the partition's merge task "
+					 "while they write it, using one connection per node. Merge "
+					 "tasks then skip fetching map outputs, unless they fail "
+					 "over to another node."),
+		&EnableRepartitionPush,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_skew_aware_repartition",
+		gettext_noop("Spreads frequent join keys over several merge tasks."),
+		gettext_noop("When enabled, the planner looks up the most common values "
+					 "of the join columns in hash repartitioned inner joins. For "
+					 "each value that would overload a single merge task, the "
+					 "side with more rows of the value spreads these rows over "
+					 "several partitions, and the other side replicates its "
+					 "matching rows to all of these partitions."),
+		&EnableSkewAwareRepartition,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.semi_join_filter_size",
+		gettext_noop("Sets the size of filters that drop non-joining rows "
+					 "before repartitioning."),
+		gettext_noop("When set, the executor builds a Bloom filter over the "
+					 "join keys of the smaller side of a repartitioned inner "
+					 "join, and map tasks of the larger side only repartition "
+					 "rows whose keys may be in the filter. Larger filters "
+					 "drop more rows, but take longer to ship to worker "
+					 "nodes. A value of 0 disables these filters."),
+		&SemiJoinFilterSize,
+		0, 0, 65536,
+		PGC_USERSET,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.expire_cached_shards",
 		gettext_noop("Enables shard cache expiration if a shard's size on disk has "
@@ -272,6 +385,21 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_repartitioned_aggregation",
+		gettext_noop("Enables finalizing grouped aggregates on the workers."),
+		gettext_noop("When enabled, grouped queries over a single distributed "
+					 "table that do not group by the partition column hash "
+					 "repartition their partial aggregates on the group by key, "
+					 "so that the workers compute final groups and the master "
+					 "node only receives final groups. This requires the "
+					 "task-tracker executor."),
+		&EnableRepartitionedAggregation,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.log_multi_join_order",
 		gettext_noop("Logs the distributed join order to the server log."),
@@ -352,6 +480,23 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.pipeline_transaction_modifications",
+		gettext_noop("Returns from modifications in transaction blocks before "
+					 "they finish on the workers."),
+		gettext_noop("When enabled, single-shard modifications without RETURNING "
+					 "inside transaction blocks are sent to the workers without "
+					 "waiting for their results. The results are collected when "
+					 "a later statement needs the same connection, or at "
+					 "commit. Such modifications report zero affected rows, and "
+					 "their errors abort the transaction at the next statement "
+					 "or at commit."),
+		&PipelineTransactionModifications,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.enable_ddl_propagation",
 		gettext_noop("Enables propagating DDL statements to worker shards"),
@@ -372,6 +517,21 @@ RegisterCitusConfigVariables(void)
 		GUC_NO_SHOW_ALL,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_repartitioned_insert_select",
+		gettext_noop("Enables repartitioning INSERT ... SELECT queries between "
+					 "tables that are not colocated"),
+		gettext_noop("When enabled, INSERT ... SELECT queries whose SELECT does not "
+					 "return the partition column of a colocated table run the "
+					 "SELECT on the source shards, partition its results by the "
+					 "target table's shards, and move the partitions directly "
+					 "between worker nodes."),
+		&EnableRepartitionedInsertSelect,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.shard_count",
 		gettext_noop("Sets the number of shards for a new hash-partitioned table"
@@ -444,8 +604,10 @@ RegisterCitusConfigVariables(void)
 		gettext_noop("The task tracker process wakes up regularly, walks over "
 					 "all tasks assigned to it, and schedules and executes these "
 					 "tasks. Then, the task tracker sleeps for a time period "
-					 "before walking over these tasks again. This configuration "
-					 "value determines the length of that sleeping period."),
+					 "before walking over these tasks again. The task tracker "
+					 "also wakes up earlier when new tasks get assigned or when "
+					 "running tasks finish. This configuration value determines "
+					 "the maximum length of that sleeping period."),
 		&TaskTrackerDelay,
 		200, 1, 100000,
 		PGC_SIGHUP,
@@ -466,6 +628,35 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.task_priority",
+		gettext_noop("Sets the scheduling priority of tasks assigned to workers."),
+		gettext_noop("Task trackers on the workers schedule tasks with higher "
+					 "priority before tasks with lower priority. Among tasks "
+					 "with the same priority, task trackers share running "
+					 "tasks fairly between users and then between jobs. This "
+					 "configuration value sets the priority of the tasks that "
+					 "the task-tracker executor assigns to workers."),
+		&TaskPriority,
+		DEFAULT_TASK_PRIORITY, MIN_TASK_PRIORITY, MAX_TASK_PRIORITY,
+		PGC_SUSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.batch_task_status_queries",
+		gettext_noop("Checks statuses of all running tasks in one query per worker."),
+		gettext_noop("When enabled, the task-tracker executor fetches the "
+					 "statuses of all running tasks on a worker in a single "
+					 "round trip, and only receives statuses that changed since "
+					 "its previous check. Otherwise, the executor checks the "
+					 "status of one task per round trip."),
+		&BatchTaskStatusQueries,
+		true,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.max_tracked_tasks_per_node",
 		gettext_noop("Sets the maximum number of tracked tasks per node."),
@@ -493,6 +684,22 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.max_task_workers_per_node",
+		gettext_noop("Sets the maximum number of background workers that run "
+					 "tasks per node."),
+		gettext_noop("By default, the task tracker process runs each task by "
+					 "opening a new connection to the local server. When this "
+					 "value is above zero, the task tracker instead runs tasks "
+					 "in a pool of up to this many background workers, and "
+					 "reuses these workers across tasks in the same database. "
+					 "These workers count against max_worker_processes."),
+		&MaxTaskWorkersPerNode,
+		0, 0, MAX_BACKENDS,
+		PGC_POSTMASTER,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.partition_buffer_size",
 		gettext_noop("Sets the buffer size to use for partition operations."),
@@ -507,6 +714,22 @@ RegisterCitusConfigVariables(void)
 		GUC_UNIT_KB,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.partition_memory_budget",
+		gettext_noop("Sets the shared memory to use for keeping small partitions."),
+		gettext_noop("Worker nodes can keep partitions that fit into their "
+					 "partitioning buffer in shared memory, instead of writing "
+					 "them to files, and serve fetches for these partitions "
+					 "from memory. This configuration value sets the amount "
+					 "of shared memory to reserve for these partitions; "
+					 "partitions that do not fit are written to files as "
+					 "usual. A value of 0 disables keeping partitions in memory."),
+		&PartitionMemoryBudget,
+		0, 0, (INT_MAX / 1024), /* result stored in int variable */
+		PGC_POSTMASTER,
+		GUC_UNIT_KB,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.large_table_shard_count",
 		gettext_noop("The shard count threshold over which a table is considered large."),
@@ -520,6 +743,21 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_cost_based_join_order",
+		gettext_noop("Picks join orders and join rules by estimated data transfer."),
+		gettext_noop("By default, the planner ranks join rules by their type, and "
+					 "considers a table large based on its shard count. When "
+					 "enabled, the planner instead estimates the number of bytes "
+					 "each broadcast, single partition, and dual partition join "
+					 "moves across the network from shard sizes, and picks the "
+					 "join order that moves the fewest bytes."),
+		&EnableCostBasedJoinOrder,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.limit_clause_row_fetch_count",
 		gettext_noop("Number of rows to fetch per task for limit clause optimization."),
@@ -535,6 +773,36 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_sorted_merge",
+		gettext_noop("Merges sorted task results on the master node."),
+		gettext_noop("When enabled, select queries with order by clauses and "
+					 "without aggregates sort their results on worker nodes. "
+					 "The master node then fetches each task's results into a "
+					 "separate table, and merges these sorted tables instead "
+					 "of sorting all results. This avoids a large sort on the "
+					 "master, and allows limits to stop early, at the cost of "
+					 "creating one temporary table per task."),
+		&EnableSortedMerge,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_sorted_merge_fan_in",
+		gettext_noop("Sets the maximum number of task results to merge on the "
+					 "master node."),
+		gettext_noop("Merging sorted task results creates a temporary table "
+					 "and a scan per task on the master node. Queries with "
+					 "more tasks than this value instead sort all task "
+					 "results in a single master table."),
+		&MaxSortedMergeFanIn,
+		32, 2, 1024,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
 	DefineCustomRealVariable(
 		"citus.count_distinct_error_rate",
 		gettext_noop("Desired error rate when calculating count(distinct) "
@@ -564,6 +832,48 @@ RegisterCitusConfigVariables(void)
 		0,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.defer_commit_prepared",
+		gettext_noop("Leaves the second phase of two-phase commits to a background "
+					 "worker."),
+		gettext_noop("When enabled, transactions that use two-phase commit return "
+					 "as soon as they committed on the coordinator, and the commit "
+					 "worker sends COMMIT PREPARED to the worker nodes afterwards. "
+					 "Subsequent statements may briefly not see the changes on the "
+					 "workers, or wait for the locks the transaction held there."),
+		&DeferCommitPrepared,
+		false,
+		PGC_USERSET,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomStringVariable(
+		"citus.transaction_recovery_database",
+		gettext_noop("Sets the database in which prepared transactions are "
+					 "recovered automatically."),
+		gettext_noop("If set, a background worker connects to this database and "
+					 "periodically recovers prepared transactions that failures "
+					 "left behind on the worker nodes, as "
+					 "recover_prepared_transactions() does. The database needs "
+					 "to contain the citus extension."),
+		&TransactionRecoveryDatabase,
+		"",
+		PGC_POSTMASTER,
+		0,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.transaction_recovery_interval",
+		gettext_noop("Sets the time between automatic transaction recoveries."),
+		gettext_noop("The transaction recovery worker recovers prepared "
+					 "transactions on all worker nodes at this interval. "
+					 "Setting the interval to 0 pauses automatic recovery."),
+		&TransactionRecoveryInterval,
+		60000, 0, INT_MAX,
+		PGC_SIGHUP,
+		GUC_UNIT_MS,
+		NULL, NULL, NULL);
+
 	DefineCustomEnumVariable(
 		"citus.task_assignment_policy",
 		gettext_noop("Sets the policy to use when assigning tasks to worker nodes."),
@@ -0,0 +1,570 @@
+/*-------------------------------------------------------------------------
+ *
+ * commit_worker.c
+ *
+ * The commit worker is a background process on the coordinator that runs the
+ * second phase of two-phase commits. Once a coordinated transaction committed
+ * locally, its transaction records in pg_dist_transaction determine that the
+ * prepared transactions on worker nodes will commit. If deferred commits are
+ * enabled, backends therefore acknowledge the commit to the client right away,
+ * and leave sending COMMIT PREPARED to the commit worker.
+ *
+ * Backends hand prepared transactions to the commit worker through a queue in
+ * shared memory. If the queue is full or the commit worker is not running, the
+ * backend commits the prepared transactions itself. If the commit worker fails
+ * to commit a prepared transaction, the transaction stays prepared until
+ * recover_prepared_transactions() commits it, as after a coordinator failure.
+ *
+ * The commit worker does not connect to a database, and only talks to worker
+ * nodes. Errors make the process exit; the postmaster then restarts it. On
+ * shutdown, the commit worker exits even while it waits for a worker node, and
+ * commits that it did not finish stay prepared until recovery.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "libpq-fe.h"
+
+#include "distributed/commit_worker.h"
+#include "distributed/connection_management.h"
+#include "distributed/remote_commands.h"
+#include "lib/stringinfo.h"
+#include "libpq/pqsignal.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/pmsignal.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+
+
+/* Config variable managed via guc.c */
+bool DeferCommitPrepared = false; /* leave COMMIT PREPARED to the commit worker */
+
+static CommitWorkerSharedStateData *CommitWorkerSharedState = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* Flag set by interrupt handler for later service in the main loop */
+static volatile sig_atomic_t got_SIGHUP = false;
+
+
+/* Local functions forward declarations */
+static void CommitWorkerMain(Datum main_arg);
+static Size CommitWorkerShmemSize(void);
+static void CommitWorkerShmemInit(void);
+static void CommitWorkerRegisterLatch(Latch *latch);
+static void CommitWorkerShmemExit(int code, Datum arg);
+static int TakeDeferredCommits(DeferredCommit *deferredCommitArray);
+static void CommitDeferredTransactions(DeferredCommit *deferredCommitArray,
+									   int deferredCommitCount);
+static int CompareDeferredCommits(const void *leftElement, const void *rightElement);
+static void WarnAboutUncommittedTransactions(DeferredCommit *deferredCommit,
+											 int transactionCount);
+static void CommitWorkerSigHupHandler(SIGNAL_ARGS);
+
+
+/* Organize, at startup, that the commit worker is started */
+void
+CommitWorkerRegister(void)
+{
+	BackgroundWorker worker;
+
+	/* organize and register initialization of required shared memory */
+	RequestAddinShmemSpace(CommitWorkerShmemSize());
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = CommitWorkerShmemInit;
+
+	/* and that the commit worker is started once we accept writes */
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 1;
+	worker.bgw_main = CommitWorkerMain;
+	worker.bgw_notify_pid = 0;
+	snprintf(worker.bgw_name, BGW_MAXLEN, "citus commit worker");
+
+	RegisterBackgroundWorker(&worker);
+}
+
+
+/*
+ * DeferRemoteTransactionCommit hands committing the prepared transaction on the
+ * given connection to the commit worker. The function returns false if the
+ * commit worker cannot take the transaction, in which case the caller needs to
+ * commit the prepared transaction itself.
+ *
+ * Callers must only defer commits after the local transaction committed, since
+ * the commit worker commits deferred transactions unconditionally.
+ */
+bool
+DeferRemoteTransactionCommit(MultiConnection *connection)
+{
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+	DeferredCommit deferredCommit;
+	Latch *commitWorkerLatch = NULL;
+	bool commitDeferred = false;
+
+	if (CommitWorkerSharedState == NULL)
+	{
+		return false;
+	}
+
+	memset(&deferredCommit, 0, sizeof(DeferredCommit));
+	strlcpy(deferredCommit.nodeName, connection->hostname, MAX_NODE_LENGTH);
+	deferredCommit.nodePort = connection->port;
+	strlcpy(deferredCommit.userName, connection->user, NAMEDATALEN);
+	strlcpy(deferredCommit.databaseName, connection->database, NAMEDATALEN);
+	strlcpy(deferredCommit.transactionName, transaction->preparedName, NAMEDATALEN);
+
+	SpinLockAcquire(&CommitWorkerSharedState->mutex);
+
+	commitWorkerLatch = CommitWorkerSharedState->commitWorkerLatch;
+	if (commitWorkerLatch != NULL &&
+		CommitWorkerSharedState->queueLength < CommitWorkerSharedState->queueSize)
+	{
+		uint32 queueIndex = (CommitWorkerSharedState->queueHead +
+							 CommitWorkerSharedState->queueLength) %
+							CommitWorkerSharedState->queueSize;
+
+		CommitWorkerSharedState->queue[queueIndex] = deferredCommit;
+		CommitWorkerSharedState->queueLength++;
+
+		commitDeferred = true;
+	}
+
+	SpinLockRelease(&CommitWorkerSharedState->mutex);
+
+	if (commitDeferred)
+	{
+		SetLatch(commitWorkerLatch);
+	}
+
+	return commitDeferred;
+}
+
+
+/* Main entry point for the commit worker process. */
+static void
+CommitWorkerMain(Datum main_arg)
+{
+	MemoryContext commitWorkerContext = NULL;
+	DeferredCommit *deferredCommitArray = NULL;
+
+	/* Properly accept or ignore signals the postmaster might send us */
+	pqsignal(SIGHUP, CommitWorkerSigHupHandler); /* set flag to read config file */
+
+	/*
+	 * On SIGTERM, die() makes the next CHECK_FOR_INTERRUPTS() end the process.
+	 * GetRemoteCommandResult() checks for interrupts while it waits, so we also
+	 * exit when a worker node does not answer.
+	 */
+	pqsignal(SIGTERM, die);
+
+	/* We're now ready to receive signals */
+	BackgroundWorkerUnblockSignals();
+
+	commitWorkerContext = AllocSetContextCreate(TopMemoryContext, "Commit Worker",
+												ALLOCSET_DEFAULT_MINSIZE,
+												ALLOCSET_DEFAULT_INITSIZE,
+												ALLOCSET_DEFAULT_MAXSIZE);
+
+	deferredCommitArray = MemoryContextAllocZero(TopMemoryContext,
+												 DEFERRED_COMMIT_BATCH_SIZE *
+												 sizeof(DeferredCommit));
+
+	/*
+	 * Let backends know that they can defer commits to us. Errors make us exit,
+	 * so we unregister the latch on exit; otherwise backends would keep queueing
+	 * commits and setting a latch that no longer belongs to us until we restart.
+	 */
+	before_shmem_exit(CommitWorkerShmemExit, 0);
+	CommitWorkerRegisterLatch(&MyProc->procLatch);
+
+	/* Loop forever */
+	for (;;)
+	{
+		int deferredCommitCount = 0;
+		int waitResult = 0;
+
+		/*
+		 * Clear any pending wake-up requests before looking at the queue.
+		 * Requests that arrive after this point end our next wait right away.
+		 */
+		ResetLatch(&MyProc->procLatch);
+
+		CHECK_FOR_INTERRUPTS();
+
+		/*
+		 * Emergency bailout if postmaster has died. This is to avoid the
+		 * necessity for manual cleanup of all postmaster children.
+		 */
+		if (!PostmasterIsAlive())
+		{
+			exit(1);
+		}
+
+		/* Process any requests or signals received recently */
+		if (got_SIGHUP)
+		{
+			got_SIGHUP = false;
+
+			/* reload postgres configuration files */
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		MemoryContextSwitchTo(commitWorkerContext);
+
+		deferredCommitCount = TakeDeferredCommits(deferredCommitArray);
+		if (deferredCommitCount > 0)
+		{
+			CommitDeferredTransactions(deferredCommitArray, deferredCommitCount);
+		}
+
+		MemoryContextSwitchTo(TopMemoryContext);
+		MemoryContextReset(commitWorkerContext);
+
+		/* look at the queue again right away if we left commits in it */
+		if (deferredCommitCount == DEFERRED_COMMIT_BATCH_SIZE)
+		{
+			continue;
+		}
+
+		waitResult = WaitLatch(&MyProc->procLatch, WL_LATCH_SET | WL_POSTMASTER_DEATH,
+							   0);
+		if (waitResult & WL_POSTMASTER_DEATH)
+		{
+			exit(1);
+		}
+	}
+}
+
+
+/* Estimates the shared memory size used for queueing deferred commits. */
+static Size
+CommitWorkerShmemSize(void)
+{
+	Size size = 0;
+	Size queueSize = mul_size(MaxConnections, DEFERRED_COMMITS_PER_CONNECTION);
+
+	size = add_size(size, offsetof(CommitWorkerSharedStateData, queue));
+	size = add_size(size, mul_size(queueSize, sizeof(DeferredCommit)));
+
+	return size;
+}
+
+
+/* Initializes the shared memory used for queueing deferred commits. */
+static void
+CommitWorkerShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	CommitWorkerSharedState =
+		(CommitWorkerSharedStateData *) ShmemInitStruct("Citus Commit Worker Queue",
+														CommitWorkerShmemSize(),
+														&alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		SpinLockInit(&CommitWorkerSharedState->mutex);
+
+		/* the commit worker registers its latch once it starts running */
+		CommitWorkerSharedState->commitWorkerLatch = NULL;
+		CommitWorkerSharedState->queueSize = MaxConnections *
+											 DEFERRED_COMMITS_PER_CONNECTION;
+		CommitWorkerSharedState->queueHead = 0;
+		CommitWorkerSharedState->queueLength = 0;
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * CommitWorkerRegisterLatch publishes the given latch in shared memory. Backends
+ * only defer commits while a latch is registered, and set the latch to wake us
+ * up. Passing NULL stops backends from deferring further commits.
+ */
+static void
+CommitWorkerRegisterLatch(Latch *latch)
+{
+	SpinLockAcquire(&CommitWorkerSharedState->mutex);
+	CommitWorkerSharedState->commitWorkerLatch = latch;
+	SpinLockRelease(&CommitWorkerSharedState->mutex);
+}
+
+
+/*
+ * CommitWorkerShmemExit unregisters the commit worker's latch when the process
+ * exits, before our PGPROC and its latch are released.
+ */
+static void
+CommitWorkerShmemExit(int code, Datum arg)
+{
+	CommitWorkerRegisterLatch(NULL);
+}
+
+
+/*
+ * TakeDeferredCommits moves up to a batch of deferred commits from the head of
+ * the shared queue into the given array, and returns their number.
+ */
+static int
+TakeDeferredCommits(DeferredCommit *deferredCommitArray)
+{
+	int deferredCommitCount = 0;
+
+	SpinLockAcquire(&CommitWorkerSharedState->mutex);
+
+	while (deferredCommitCount < DEFERRED_COMMIT_BATCH_SIZE &&
+		   CommitWorkerSharedState->queueLength > 0)
+	{
+		uint32 queueHead = CommitWorkerSharedState->queueHead;
+
+		deferredCommitArray[deferredCommitCount] =
+			CommitWorkerSharedState->queue[queueHead];
+		deferredCommitCount++;
+
+		CommitWorkerSharedState->queueHead =
+			(queueHead + 1) % CommitWorkerSharedState->queueSize;
+		CommitWorkerSharedState->queueLength--;
+	}
+
+	SpinLockRelease(&CommitWorkerSharedState->mutex);
+
+	return deferredCommitCount;
+}
+
+
+/*
+ * CommitDeferredTransactions commits the given prepared transactions. The
+ * function groups the transactions by the connection they need, and uses one
+ * connection per group. It then runs COMMIT PREPARED in rounds, where each
+ * round sends one command over every connection and then waits for all of
+ * them, so that worker nodes commit in parallel.
+ *
+ * If a connection fails, the function warns and leaves the group's remaining
+ * transactions prepared for recovery.
+ */
+static void
+CommitDeferredTransactions(DeferredCommit *deferredCommitArray, int deferredCommitCount)
+{
+	int *groupStartArray = palloc0(deferredCommitCount * sizeof(int));
+	int *groupLengthArray = palloc0(deferredCommitCount * sizeof(int));
+	bool *commandSentArray = palloc0(deferredCommitCount * sizeof(bool));
+	MultiConnection **connectionArray =
+		palloc0(deferredCommitCount * sizeof(MultiConnection *));
+	int groupCount = 0;
+	int groupIndex = 0;
+	int commitIndex = 0;
+	int roundIndex = 0;
+	bool commandSent = true;
+
+	qsort(deferredCommitArray, deferredCommitCount, sizeof(DeferredCommit),
+		  CompareDeferredCommits);
+
+	for (commitIndex = 0; commitIndex < deferredCommitCount; commitIndex++)
+	{
+		if (commitIndex == 0 ||
+			CompareDeferredCommits(&deferredCommitArray[commitIndex - 1],
+								   &deferredCommitArray[commitIndex]) != 0)
+		{
+			groupStartArray[groupCount] = commitIndex;
+			groupCount++;
+		}
+
+		groupLengthArray[groupCount - 1]++;
+	}
+
+	/* start establishing all connections before waiting for any of them */
+	for (groupIndex = 0; groupIndex < groupCount; groupIndex++)
+	{
+		DeferredCommit *deferredCommit =
+			&deferredCommitArray[groupStartArray[groupIndex]];
+
+		connectionArray[groupIndex] =
+			StartNodeUserDatabaseConnection(SESSION_LIFESPAN, deferredCommit->nodeName,
+											deferredCommit->nodePort,
+											deferredCommit->userName,
+											deferredCommit->databaseName);
+	}
+
+	for (groupIndex = 0; groupIndex < groupCount; groupIndex++)
+	{
+		MultiConnection *connection = connectionArray[groupIndex];
+
+		FinishConnectionEstablishment(connection);
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			ReportConnectionError(connection, WARNING);
+			WarnAboutUncommittedTransactions(
+				&deferredCommitArray[groupStartArray[groupIndex]],
+				groupLengthArray[groupIndex]);
+
+			CloseConnection(connection);
+			connectionArray[groupIndex] = NULL;
+		}
+	}
+
+	for (roundIndex = 0; commandSent; roundIndex++)
+	{
+		commandSent = false;
+
+		for (groupIndex = 0; groupIndex < groupCount; groupIndex++)
+		{
+			MultiConnection *connection = connectionArray[groupIndex];
+			DeferredCommit *deferredCommit = NULL;
+			StringInfoData command;
+
+			commandSentArray[groupIndex] = false;
+
+			if (connection == NULL || roundIndex >= groupLengthArray[groupIndex])
+			{
+				continue;
+			}
+
+			deferredCommit =
+				&deferredCommitArray[groupStartArray[groupIndex] + roundIndex];
+
+			initStringInfo(&command);
+			appendStringInfo(&command, "COMMIT PREPARED '%s'",
+							 deferredCommit->transactionName);
+
+			if (!SendRemoteCommand(connection, command.data))
+			{
+				ReportConnectionError(connection, WARNING);
+				WarnAboutUncommittedTransactions(deferredCommit,
+												 groupLengthArray[groupIndex] -
+												 roundIndex);
+
+				CloseConnection(connection);
+				connectionArray[groupIndex] = NULL;
+				continue;
+			}
+
+			commandSentArray[groupIndex] = true;
+			commandSent = true;
+		}
+
+		for (groupIndex = 0; groupIndex < groupCount; groupIndex++)
+		{
+			MultiConnection *connection = connectionArray[groupIndex];
+			const bool raiseInterrupts = true;
+			PGresult *result = NULL;
+
+			if (!commandSentArray[groupIndex])
+			{
+				continue;
+			}
+
+			result = GetRemoteCommandResult(connection, raiseInterrupts);
+			if (!IsResponseOK(result))
+			{
+				DeferredCommit *deferredCommit =
+					&deferredCommitArray[groupStartArray[groupIndex] + roundIndex];
+
+				ReportResultError(connection, result, WARNING);
+				WarnAboutUncommittedTransactions(deferredCommit, 1);
+			}
+
+			PQclear(result);
+			ForgetResults(connection);
+
+			/* drop broken connections, we reconnect for the next batch */
+			if (PQstatus(connection->pgConn) != CONNECTION_OK)
+			{
+				int remainingCount = groupLengthArray[groupIndex] - roundIndex - 1;
+				if (remainingCount > 0)
+				{
+					WarnAboutUncommittedTransactions(
+						&deferredCommitArray[groupStartArray[groupIndex] +
+											 roundIndex + 1],
+						remainingCount);
+				}
+
+				CloseConnection(connection);
+				connectionArray[groupIndex] = NULL;
+			}
+		}
+	}
+}
+
+
+/* Orders deferred commits by the connection they need. */
+static int
+CompareDeferredCommits(const void *leftElement, const void *rightElement)
+{
+	const DeferredCommit *leftCommit = (const DeferredCommit *) leftElement;
+	const DeferredCommit *rightCommit = (const DeferredCommit *) rightElement;
+	int compareResult = 0;
+
+	compareResult = strncmp(leftCommit->nodeName, rightCommit->nodeName,
+							MAX_NODE_LENGTH);
+	if (compareResult != 0)
+	{
+		return compareResult;
+	}
+
+	if (leftCommit->nodePort != rightCommit->nodePort)
+	{
+		return (leftCommit->nodePort < rightCommit->nodePort) ? -1 : 1;
+	}
+
+	compareResult = strncmp(leftCommit->userName, rightCommit->userName, NAMEDATALEN);
+	if (compareResult != 0)
+	{
+		return compareResult;
+	}
+
+	return strncmp(leftCommit->databaseName, rightCommit->databaseName, NAMEDATALEN);
+}
+
+
+/*
+ * WarnAboutUncommittedTransactions warns that we could not commit the given
+ * number of prepared transactions, starting with the given one, and explains
+ * how they get committed.
+ */
+static void
+WarnAboutUncommittedTransactions(DeferredCommit *deferredCommit, int transactionCount)
+{
+	ereport(WARNING, (errmsg("could not commit %d prepared transaction(s) on %s:%d",
+							 transactionCount, deferredCommit->nodeName,
+							 deferredCommit->nodePort),
+					  errdetail("The first of these transactions is '%s'.",
+								deferredCommit->transactionName),
+					  errhint("Run recover_prepared_transactions() on the "
+							  "coordinator to commit them.")));
+}
+
+
+/* SIGHUP: set flag to re-read config file at next convenient time */
+static void
+CommitWorkerSigHupHandler(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+
+	got_SIGHUP = true;
+	if (MyProc != NULL)
+	{
+		SetLatch(&MyProc->procLatch);
+	}
+
+	errno = save_errno;
+}
@@ -0,0 +1,350 @@
+/*-------------------------------------------------------------------------
+ *
+ * recovery_worker.c
+ *
+ * The recovery worker is a background process on the coordinator that
+ * periodically runs transaction recovery, so that prepared transactions left
+ * behind by failures do not hold locks and block vacuum on the workers until
+ * someone calls recover_prepared_transactions(). The recovery worker connects
+ * to the database configured in citus.transaction_recovery_database, and is
+ * only started if that setting is set.
+ *
+ * This file also keeps the counters of recovered transactions in shared
+ * memory, which cover both automatic and manual recovery.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include <signal.h>
+
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/recovery_worker.h"
+#include "distributed/transaction_recovery.h"
+#include "funcapi.h"
+#include "libpq/pqsignal.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/pmsignal.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+
+/* Config variables managed via guc.c */
+char *TransactionRecoveryDatabase = NULL; /* database of the recovery worker */
+int TransactionRecoveryInterval = 60000;  /* milliseconds between recoveries */
+
+static RecoveryStatistics *SharedRecoveryStatistics = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* Flags set by interrupt handlers for later service in the main loop */
+static volatile sig_atomic_t got_SIGHUP = false;
+
+
+/* Local functions forward declarations */
+static void RecoveryWorkerMain(Datum main_arg);
+static void RecoveryStatisticsShmemInit(void);
+static void RunTransactionRecovery(void);
+static void RecoveryWorkerSigHupHandler(SIGNAL_ARGS);
+
+
+/* exports for SQL callable functions */
+PG_FUNCTION_INFO_V1(citus_transaction_recovery_stats);
+
+
+/*
+ * RecoveryWorkerRegister reserves shared memory for the recovery counters, and
+ * organizes that the recovery worker is started once we accept writes, if a
+ * database for it is configured.
+ */
+void
+RecoveryWorkerRegister(void)
+{
+	BackgroundWorker worker;
+
+	/* organize initialization of the recovery counters in shared memory */
+	RequestAddinShmemSpace(MAXALIGN(sizeof(RecoveryStatistics)));
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = RecoveryStatisticsShmemInit;
+
+	if (TransactionRecoveryDatabase == NULL || TransactionRecoveryDatabase[0] == '\0')
+	{
+		return;
+	}
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 10;
+	worker.bgw_main = RecoveryWorkerMain;
+	worker.bgw_notify_pid = 0;
+	snprintf(worker.bgw_name, BGW_MAXLEN, "citus transaction recovery worker");
+
+	RegisterBackgroundWorker(&worker);
+}
+
+
+/*
+ * CountRecoveredTransactions adds the outcome of a transaction recovery run to
+ * the recovery counters in shared memory.
+ */
+void
+CountRecoveredTransactions(int committedTransactionCount, int abortedTransactionCount,
+						   int failedTransactionCount)
+{
+	if (SharedRecoveryStatistics == NULL)
+	{
+		return;
+	}
+
+	SpinLockAcquire(&SharedRecoveryStatistics->mutex);
+
+	SharedRecoveryStatistics->recoveryCount++;
+	SharedRecoveryStatistics->committedTransactionCount += committedTransactionCount;
+	SharedRecoveryStatistics->abortedTransactionCount += abortedTransactionCount;
+	SharedRecoveryStatistics->failedTransactionCount += failedTransactionCount;
+
+	SpinLockRelease(&SharedRecoveryStatistics->mutex);
+}
+
+
+/*
+ * citus_transaction_recovery_stats returns how many times transaction recovery
+ * ran since server start, and how many prepared transactions it committed,
+ * aborted, or failed to resolve.
+ */
+Datum
+citus_transaction_recovery_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple statisticsTuple = NULL;
+	Datum values[4];
+	bool isNulls[4];
+	uint64 recoveryCount = 0;
+	uint64 committedTransactionCount = 0;
+	uint64 abortedTransactionCount = 0;
+	uint64 failedTransactionCount = 0;
+
+	TypeFuncClass resultTypeClass = get_call_result_type(fcinfo, NULL,
+														 &tupleDescriptor);
+	if (resultTypeClass != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
+
+	if (SharedRecoveryStatistics != NULL)
+	{
+		SpinLockAcquire(&SharedRecoveryStatistics->mutex);
+
+		recoveryCount = SharedRecoveryStatistics->recoveryCount;
+		committedTransactionCount = SharedRecoveryStatistics->committedTransactionCount;
+		abortedTransactionCount = SharedRecoveryStatistics->abortedTransactionCount;
+		failedTransactionCount = SharedRecoveryStatistics->failedTransactionCount;
+
+		SpinLockRelease(&SharedRecoveryStatistics->mutex);
+	}
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[0] = Int64GetDatum(recoveryCount);
+	values[1] = Int64GetDatum(committedTransactionCount);
+	values[2] = Int64GetDatum(abortedTransactionCount);
+	values[3] = Int64GetDatum(failedTransactionCount);
+
+	statisticsTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(statisticsTuple));
+}
+
+
+/*
+ * RecoveryWorkerMain is the main entry point for the recovery worker. The
+ * worker runs transaction recovery every citus.transaction_recovery_interval,
+ * and sleeps in between.
+ */
+static void
+RecoveryWorkerMain(Datum main_arg)
+{
+	MemoryContext recoveryWorkerContext = NULL;
+	TimestampTz lastRecoveryTime = 0;
+
+	/* reload the configuration on SIGHUP, and exit on termination */
+	pqsignal(SIGHUP, RecoveryWorkerSigHupHandler);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnection(TransactionRecoveryDatabase, NULL);
+
+	recoveryWorkerContext = AllocSetContextCreate(TopMemoryContext,
+												  "Transaction Recovery Worker",
+												  ALLOCSET_DEFAULT_MINSIZE,
+												  ALLOCSET_DEFAULT_INITSIZE,
+												  ALLOCSET_DEFAULT_MAXSIZE);
+	MemoryContextSwitchTo(recoveryWorkerContext);
+
+	for (;;)
+	{
+		int waitFlags = WL_LATCH_SET | WL_POSTMASTER_DEATH;
+		long timeout = 0;
+		int waitResult = 0;
+
+		ResetLatch(&MyProc->procLatch);
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_SIGHUP)
+		{
+			got_SIGHUP = false;
+
+			/* reload postgres configuration files */
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		/* a zero interval disables recovery until the setting changes */
+		if (TransactionRecoveryInterval > 0)
+		{
+			TimestampTz currentTime = GetCurrentTimestamp();
+
+			if (TimestampDifferenceExceeds(lastRecoveryTime, currentTime,
+										   TransactionRecoveryInterval))
+			{
+				RunTransactionRecovery();
+				MemoryContextReset(recoveryWorkerContext);
+
+				lastRecoveryTime = GetCurrentTimestamp();
+				currentTime = lastRecoveryTime;
+			}
+
+			/* sleep until the next recovery is due */
+			timeout = TransactionRecoveryInterval;
+			if (currentTime > lastRecoveryTime)
+			{
+				long elapsedSeconds = 0;
+				int elapsedMicroseconds = 0;
+
+				TimestampDifference(lastRecoveryTime, currentTime, &elapsedSeconds,
+									&elapsedMicroseconds);
+				timeout -= elapsedSeconds * 1000 + elapsedMicroseconds / 1000;
+			}
+
+			timeout = Max(timeout, 1);
+			waitFlags |= WL_TIMEOUT;
+		}
+
+		waitResult = WaitLatch(&MyProc->procLatch, waitFlags, timeout);
+
+		/*
+		 * Emergency bailout if postmaster has died. This is to avoid the
+		 * necessity for manual cleanup of all postmaster children.
+		 */
+		if (waitResult & WL_POSTMASTER_DEATH)
+		{
+			exit(1);
+		}
+	}
+}
+
+
+/* Initializes the shared memory used for counting recovered transactions. */
+static void
+RecoveryStatisticsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedRecoveryStatistics =
+		(RecoveryStatistics *) ShmemInitStruct("Citus Recovery Statistics",
+											   sizeof(RecoveryStatistics),
+											   &alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		SpinLockInit(&SharedRecoveryStatistics->mutex);
+		SharedRecoveryStatistics->recoveryCount = 0;
+		SharedRecoveryStatistics->committedTransactionCount = 0;
+		SharedRecoveryStatistics->abortedTransactionCount = 0;
+		SharedRecoveryStatistics->failedTransactionCount = 0;
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * RunTransactionRecovery recovers prepared transactions in its own transaction,
+ * provided the citus extension exists in the recovery worker's database. The
+ * function reports errors to the server log, and leaves retrying to the next
+ * recovery run.
+ */
+static void
+RunTransactionRecovery(void)
+{
+	MemoryContext recoveryContext = CurrentMemoryContext;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	pgstat_report_activity(STATE_RUNNING, "SELECT recover_prepared_transactions()");
+
+	PG_TRY();
+	{
+		PushActiveSnapshot(GetTransactionSnapshot());
+
+		if (CitusHasBeenLoaded())
+		{
+			RecoverPreparedTransactions();
+		}
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(recoveryContext);
+
+		EmitErrorReport();
+		FlushErrorState();
+
+		AbortCurrentTransaction();
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(recoveryContext);
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+
+/* SIGHUP: set flag to re-read config file at next convenient time */
+static void
+RecoveryWorkerSigHupHandler(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+
+	got_SIGHUP = true;
+	if (MyProc != NULL)
+	{
+		SetLatch(&MyProc->procLatch);
+	}
+
+	errno = save_errno;
+}
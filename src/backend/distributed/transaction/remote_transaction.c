@@ -15,6 +15,7 @@
 #include "miscadmin.h"
 
 #include "access/xact.h"
+#include "distributed/commit_worker.h"
 #include "distributed/connection_management.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/remote_commands.h"
@@ -22,10 +23,12 @@
 #include "distributed/transaction_management.h"
 #include "distributed/transaction_recovery.h"
 #include "distributed/worker_manager.h"
+#include "storage/lmgr.h"
 #include "utils/hsearch.h"
 
 
 static void CheckTransactionHealth(void);
+static void LogPreparedRemoteTransactions(List *connectionList);
 static void Assign2PCIdentifier(MultiConnection *connection);
 static void WarnAboutLeakedPreparedTransaction(MultiConnection *connection, bool commit);
 
@@ -379,7 +382,6 @@ StartRemoteTransactionPrepare(struct MultiConnection *connection)
 	RemoteTransaction *transaction = &connection->remoteTransaction;
 	StringInfoData command;
 	const bool raiseErrors = true;
-	WorkerNode *workerNode = NULL;
 
 	/* can't prepare a nonexistant transaction */
 	Assert(transaction->transactionState != REMOTE_TRANS_INVALID);
@@ -392,12 +394,12 @@ StartRemoteTransactionPrepare(struct MultiConnection *connection)
 
 	Assign2PCIdentifier(connection);
 
-	/* log transactions to workers in pg_dist_transaction */
-	workerNode = FindWorkerNode(connection->hostname, connection->port);
-	if (workerNode != NULL)
-	{
-		LogTransactionRecord(workerNode->groupId, transaction->preparedName);
-	}
+	/*
+	 * We only log the transaction record once the transaction is prepared,
+	 * see LogPreparedRemoteTransactions(). Until our transaction ends, keep
+	 * recovery from aborting prepared transactions that have no record yet.
+	 */
+	LockRelationOid(DistTransactionRelationId(), RowExclusiveLock);
 
 	initStringInfo(&command);
 	appendStringInfo(&command, "PREPARE TRANSACTION '%s'",
@@ -434,7 +436,18 @@ FinishRemoteTransactionPrepare(struct MultiConnection *connection)
 	if (!IsResponseOK(result))
 	{
 		ReportResultError(connection, result, WARNING);
-		transaction->transactionState = REMOTE_TRANS_ABORTED;
+
+		/*
+		 * Only an error sent by the worker tells us that PREPARE failed. If we
+		 * lost the connection instead, libpq reports an error without a
+		 * SQLSTATE, and the transaction may have prepared. We then stay in the
+		 * preparing state and still log a record for it.
+		 */
+		if (PQresultErrorField(result, PG_DIAG_SQLSTATE) != NULL)
+		{
+			transaction->transactionState = REMOTE_TRANS_ABORTED;
+		}
+
 		MarkRemoteTransactionFailed(connection, raiseErrors);
 	}
 	else
@@ -456,6 +469,8 @@ RemoteTransactionPrepare(struct MultiConnection *connection)
 {
 	StartRemoteTransactionPrepare(connection);
 	FinishRemoteTransactionPrepare(connection);
+
+	LogPreparedRemoteTransactions(list_make1(connection));
 }
 
 
@@ -627,6 +642,7 @@ void
 CoordinatedRemoteTransactionsPrepare(void)
 {
 	dlist_iter iter;
+	List *preparedConnectionList = NIL;
 
 	/* issue PREPARE TRANSACTION; to all relevant remote nodes */
 
@@ -663,8 +679,13 @@ CoordinatedRemoteTransactionsPrepare(void)
 		}
 
 		FinishRemoteTransactionPrepare(connection);
+
+		preparedConnectionList = lappend(preparedConnectionList, connection);
 	}
 
+	/* log all prepared transactions in pg_dist_transaction at once */
+	LogPreparedRemoteTransactions(preparedConnectionList);
+
 	CurrentCoordinatedTransactionState = COORD_TRANS_PREPARED;
 }
 
@@ -709,6 +730,18 @@ CoordinatedRemoteTransactionsCommit(void)
 			continue;
 		}
 
+		/*
+		 * Prepared transactions are bound to commit once we committed
+		 * locally, so we may leave committing them to the commit worker.
+		 */
+		if (DeferCommitPrepared && !transaction->transactionFailed &&
+			transaction->transactionState == REMOTE_TRANS_PREPARED &&
+			DeferRemoteTransactionCommit(connection))
+		{
+			transaction->transactionState = REMOTE_TRANS_COMMITTED;
+			continue;
+		}
+
 		StartRemoteTransactionCommit(connection);
 	}
 
@@ -822,6 +855,50 @@ CheckTransactionHealth(void)
 }
 
 
+/*
+ * LogPreparedRemoteTransactions logs a transaction record in pg_dist_transaction
+ * for each transaction in the given list that prepared, or that may have
+ * prepared since we lost the connection before PREPARE returned. Recovery
+ * commits prepared transactions that have a record once our transaction
+ * committed, and aborts those without one. Only transactions whose PREPARE
+ * returned an error therefore need no record.
+ */
+static void
+LogPreparedRemoteTransactions(List *connectionList)
+{
+	List *groupIdList = NIL;
+	List *transactionNameList = NIL;
+	ListCell *connectionCell = NULL;
+
+	foreach(connectionCell, connectionList)
+	{
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		RemoteTransaction *transaction = &connection->remoteTransaction;
+		WorkerNode *workerNode = NULL;
+
+		if (transaction->transactionState != REMOTE_TRANS_PREPARED &&
+			transaction->transactionState != REMOTE_TRANS_PREPARING)
+		{
+			continue;
+		}
+
+		workerNode = FindWorkerNode(connection->hostname, connection->port);
+		if (workerNode == NULL)
+		{
+			continue;
+		}
+
+		groupIdList = lappend_int(groupIdList, workerNode->groupId);
+		transactionNameList = lappend(transactionNameList, transaction->preparedName);
+	}
+
+	if (transactionNameList != NIL)
+	{
+		LogTransactionRecords(groupIdList, transactionNameList);
+	}
+}
+
+
 /*
  * Assign2PCIdentifier compute the 2PC transaction name to use for a
  * transaction.
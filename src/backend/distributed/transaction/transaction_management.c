@@ -17,6 +17,7 @@
 
 #include "miscadmin.h"
 
+#include "access/htup_details.h"
 #include "access/twophase.h"
 #include "access/xact.h"
 #include "distributed/connection_management.h"
@@ -24,10 +25,28 @@
 #include "distributed/multi_router_executor.h"
 #include "distributed/multi_shard_transaction.h"
 #include "distributed/transaction_management.h"
+#include "funcapi.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
 #include "utils/hsearch.h"
 #include "utils/guc.h"
 
 
+/*
+ * CommitStatistics counts how coordinated transactions committed since the
+ * server started. The counters live in shared memory, so that they cover all
+ * backends.
+ */
+typedef struct CommitStatistics
+{
+	slock_t mutex;
+	uint64 onePhaseCommitCount;
+	uint64 twoPhaseCommitCount;
+	uint64 downgradedCommitCount;
+} CommitStatistics;
+
+
 CoordinatedTransactionState CurrentCoordinatedTransactionState = COORD_TRANS_NONE;
 
 /* GUC, the commit protocol to use for commands affecting more than one connection */
@@ -50,6 +69,10 @@ static bool subXactAbortAttempted = false;
  */
 static bool CurrentTransactionUse2PC = false;
 
+/* commit counters in shared memory */
+static CommitStatistics *SharedCommitStatistics = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
 /* transaction management functions */
 static void CoordinatedTransactionCallback(XactEvent event, void *arg);
 static void CoordinatedSubTransactionCallback(SubXactEvent event, SubTransactionId subId,
@@ -57,6 +80,13 @@ static void CoordinatedSubTransactionCallback(SubXactEvent event, SubTransaction
 
 /* remaining functions */
 static void AdjustMaxPreparedTransactions(void);
+static bool SingleParticipantTransaction(void);
+static void CommitStatisticsShmemInit(void);
+static void UpdateCommitStatistics(bool usedTwoPhaseCommit, bool downgraded);
+
+
+/* exports for SQL callable functions */
+PG_FUNCTION_INFO_V1(citus_commit_protocol_stats);
 
 
 /*
@@ -125,6 +155,12 @@ InitializeTransactionManagement(void)
 	RegisterSubXactCallback(CoordinatedSubTransactionCallback, NULL);
 
 	AdjustMaxPreparedTransactions();
+
+	/* organize initialization of the commit counters in shared memory */
+	RequestAddinShmemSpace(MAXALIGN(sizeof(CommitStatistics)));
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = CommitStatisticsShmemInit;
 }
 
 
@@ -233,11 +269,20 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				break;
 			}
 
+			/* modifications sent without waiting need to succeed first */
+			FinishPipelinedModifications();
 
-			if (CurrentTransactionUse2PC)
+			/*
+			 * 2PC only pays off if more than one node commits. If a single
+			 * remote transaction is the only participant, committing it is
+			 * atomic by itself, and we skip PREPARE and its bookkeeping.
+			 */
+			if (CurrentTransactionUse2PC && !SingleParticipantTransaction())
 			{
 				CoordinatedRemoteTransactionsPrepare();
 				CurrentCoordinatedTransactionState = COORD_TRANS_PREPARED;
+
+				UpdateCommitStatistics(true, false);
 			}
 			else
 			{
@@ -248,6 +293,8 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				 */
 				CoordinatedRemoteTransactionsCommit();
 				CurrentCoordinatedTransactionState = COORD_TRANS_COMMITTED;
+
+				UpdateCommitStatistics(false, CurrentTransactionUse2PC);
 			}
 
 			/*
@@ -319,3 +366,152 @@ AdjustMaxPreparedTransactions(void)
 								newvalue)));
 	}
 }
+
+
+/*
+ * SingleParticipantTransaction returns whether at most one node takes part in
+ * committing the current coordinated transaction. Remote transactions that
+ * failed get rolled back rather than committed, so they don't count. Separate
+ * connections to the same worker are separate transactions on that worker, so
+ * each of them counts as a participant. The local transaction counts as well
+ * if it wrote anything, since its commit then has to agree with the remote
+ * ones.
+ */
+static bool
+SingleParticipantTransaction(void)
+{
+	dlist_iter iter;
+	int participantCount = 0;
+
+	if (TransactionIdIsValid(GetTopTransactionIdIfAny()))
+	{
+		participantCount++;
+	}
+
+	dlist_foreach(iter, &InProgressTransactions)
+	{
+		MultiConnection *connection = dlist_container(MultiConnection, transactionNode,
+													  iter.cur);
+		RemoteTransaction *transaction = &connection->remoteTransaction;
+
+		if (transaction->transactionState == REMOTE_TRANS_INVALID ||
+			transaction->transactionFailed)
+		{
+			continue;
+		}
+
+		participantCount++;
+	}
+
+	return participantCount <= 1;
+}
+
+
+/* Allocates and initializes the commit counters in shared memory. */
+static void
+CommitStatisticsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedCommitStatistics =
+		(CommitStatistics *) ShmemInitStruct("Citus Commit Statistics",
+											 sizeof(CommitStatistics),
+											 &alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		SpinLockInit(&SharedCommitStatistics->mutex);
+		SharedCommitStatistics->onePhaseCommitCount = 0;
+		SharedCommitStatistics->twoPhaseCommitCount = 0;
+		SharedCommitStatistics->downgradedCommitCount = 0;
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * UpdateCommitStatistics counts a coordinated transaction that committed with
+ * the given protocol. Downgraded transactions asked for 2PC, but committed with
+ * a single phase since they had only one participant.
+ */
+static void
+UpdateCommitStatistics(bool usedTwoPhaseCommit, bool downgraded)
+{
+	if (SharedCommitStatistics == NULL)
+	{
+		return;
+	}
+
+	SpinLockAcquire(&SharedCommitStatistics->mutex);
+
+	if (usedTwoPhaseCommit)
+	{
+		SharedCommitStatistics->twoPhaseCommitCount++;
+	}
+	else
+	{
+		SharedCommitStatistics->onePhaseCommitCount++;
+	}
+
+	if (downgraded)
+	{
+		SharedCommitStatistics->downgradedCommitCount++;
+	}
+
+	SpinLockRelease(&SharedCommitStatistics->mutex);
+}
+
+
+/*
+ * citus_commit_protocol_stats returns the number of coordinated transactions
+ * that committed with one and with two phases since the server started, and how
+ * many of the one-phase commits asked for 2PC but had a single participant.
+ */
+Datum
+citus_commit_protocol_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple statisticsTuple = NULL;
+	Datum values[3];
+	bool isNulls[3];
+	uint64 onePhaseCommitCount = 0;
+	uint64 twoPhaseCommitCount = 0;
+	uint64 downgradedCommitCount = 0;
+
+	TypeFuncClass resultTypeClass = get_call_result_type(fcinfo, NULL,
+														 &tupleDescriptor);
+	if (resultTypeClass != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
+
+	if (SharedCommitStatistics != NULL)
+	{
+		SpinLockAcquire(&SharedCommitStatistics->mutex);
+
+		onePhaseCommitCount = SharedCommitStatistics->onePhaseCommitCount;
+		twoPhaseCommitCount = SharedCommitStatistics->twoPhaseCommitCount;
+		downgradedCommitCount = SharedCommitStatistics->downgradedCommitCount;
+
+		SpinLockRelease(&SharedCommitStatistics->mutex);
+	}
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[0] = Int64GetDatum(onePhaseCommitCount);
+	values[1] = Int64GetDatum(twoPhaseCommitCount);
+	values[2] = Int64GetDatum(downgradedCommitCount);
+
+	statisticsTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(statisticsTuple));
+}
@@ -14,6 +14,7 @@
 
 #include "postgres.h"
 #include "miscadmin.h"
+#include "libpq-fe.h"
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -24,10 +25,12 @@
 #include "access/xact.h"
 #include "catalog/indexing.h"
 #include "distributed/commit_protocol.h"
-#include "distributed/connection_cache.h"
+#include "distributed/connection_management.h"
 #include "distributed/listutils.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/pg_dist_transaction.h"
+#include "distributed/recovery_worker.h"
+#include "distributed/remote_commands.h"
 #include "distributed/transaction_recovery.h"
 #include "distributed/worker_manager.h"
 #include "distributed/worker_transaction.h"
@@ -40,20 +43,43 @@
 #include "utils/rel.h"
 
 
+/*
+ * WorkerRecovery holds the state of recovering the prepared transactions on a
+ * single worker. The arrays describe the worker's pending prepared
+ * transactions, whether we commit or abort each of them, and whether that
+ * succeeded.
+ */
+typedef struct WorkerRecovery
+{
+	WorkerNode *workerNode;
+	MultiConnection *connection;
+	List *unconfirmedTransactionList;
+	List *pendingTransactionList;
+	char **transactionNameArray;
+	bool *shouldCommitArray;
+	bool *recoveredArray;
+	int commandCount;
+	bool commandSent;
+} WorkerRecovery;
+
+
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(recover_prepared_transactions);
 
 
 /* Local functions forward declarations */
-static int RecoverPreparedTransactions(void);
-static int RecoverWorkerTransactions(WorkerNode *workerNode);
+static void FetchPendingTransactions(WorkerRecovery *workerRecoveryArray,
+									 int workerCount);
+static void PlanWorkerRecovery(WorkerRecovery *workerRecovery);
+static void RunRecoveryCommands(WorkerRecovery *workerRecoveryArray, int workerCount);
+static void FinishWorkerRecovery(WorkerRecovery *workerRecovery);
+static StringInfo RecoveryCommand(WorkerRecovery *workerRecovery, int commandIndex);
 static List * NameListDifference(List *nameList, List *subtractList);
 static int CompareNames(const void *leftPointer, const void *rightPointer);
 static bool FindMatchingName(char **nameArray, int nameCount, char *needle,
 							 int *matchIndex);
-static List * PendingWorkerTransactionList(PGconn *connection);
 static List * UnconfirmedWorkerTransactionsList(int groupId);
-static void DeleteTransactionRecord(int32 groupId, char *transactionName);
+static void DeleteTransactionRecords(int32 groupId, List *transactionNameList);
 
 
 /*
@@ -80,6 +106,8 @@ recover_prepared_transactions(PG_FUNCTION_ARGS)
 void
 LogPreparedTransactions(List *connectionList)
 {
+	List *groupIdList = NIL;
+	List *transactionNameList = NIL;
 	ListCell *connectionCell = NULL;
 
 	foreach(connectionCell, connectionList)
@@ -95,8 +123,11 @@ LogPreparedTransactions(List *connectionList)
 
 		Assert(transactionState == TRANSACTION_STATE_PREPARED);
 
-		LogTransactionRecord(groupId, transactionName->data);
+		groupIdList = lappend_int(groupIdList, groupId);
+		transactionNameList = lappend(transactionNameList, transactionName->data);
 	}
+
+	LogTransactionRecords(groupIdList, transactionNameList);
 }
 
 
@@ -107,28 +138,69 @@ LogPreparedTransactions(List *connectionList)
  */
 void
 LogTransactionRecord(int groupId, char *transactionName)
+{
+	LogTransactionRecords(list_make1_int(groupId), list_make1(transactionName));
+}
+
+
+/*
+ * LogTransactionRecords registers a set of transactions prepared on workers
+ * at once. Element i of groupIdList and of transactionNameList describe the
+ * i-th transaction. All records are inserted with a single multi-insert, and
+ * the index entries are added while the indexes are open only once.
+ */
+void
+LogTransactionRecords(List *groupIdList, List *transactionNameList)
 {
 	Relation pgDistTransaction = NULL;
 	TupleDesc tupleDescriptor = NULL;
-	HeapTuple heapTuple = NULL;
-	Datum values[Natts_pg_dist_transaction];
-	bool isNulls[Natts_pg_dist_transaction];
+	CatalogIndexState indexState = NULL;
+	HeapTuple *heapTupleArray = NULL;
+	int recordCount = list_length(transactionNameList);
+	int recordIndex = 0;
+	ListCell *groupIdCell = NULL;
+	ListCell *transactionNameCell = NULL;
 
-	/* form new transaction tuple */
-	memset(values, 0, sizeof(values));
-	memset(isNulls, false, sizeof(isNulls));
+	Assert(list_length(groupIdList) == recordCount);
 
-	values[Anum_pg_dist_transaction_groupid - 1] = Int32GetDatum(groupId);
-	values[Anum_pg_dist_transaction_gid - 1] = CStringGetTextDatum(transactionName);
+	if (recordCount == 0)
+	{
+		return;
+	}
 
-	/* open transaction relation and insert new tuple */
+	/* open transaction relation and form the new transaction tuples */
 	pgDistTransaction = heap_open(DistTransactionRelationId(), RowExclusiveLock);
-
 	tupleDescriptor = RelationGetDescr(pgDistTransaction);
-	heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
 
-	simple_heap_insert(pgDistTransaction, heapTuple);
-	CatalogUpdateIndexes(pgDistTransaction, heapTuple);
+	heapTupleArray = (HeapTuple *) palloc0(recordCount * sizeof(HeapTuple));
+
+	forboth(groupIdCell, groupIdList, transactionNameCell, transactionNameList)
+	{
+		int groupId = lfirst_int(groupIdCell);
+		char *transactionName = (char *) lfirst(transactionNameCell);
+		Datum values[Natts_pg_dist_transaction];
+		bool isNulls[Natts_pg_dist_transaction];
+
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[Anum_pg_dist_transaction_groupid - 1] = Int32GetDatum(groupId);
+		values[Anum_pg_dist_transaction_gid - 1] = CStringGetTextDatum(transactionName);
+
+		heapTupleArray[recordIndex] = heap_form_tuple(tupleDescriptor, values, isNulls);
+		recordIndex++;
+	}
+
+	heap_multi_insert(pgDistTransaction, heapTupleArray, recordCount,
+					  GetCurrentCommandId(true), 0, NULL);
+
+	indexState = CatalogOpenIndexes(pgDistTransaction);
+	for (recordIndex = 0; recordIndex < recordCount; recordIndex++)
+	{
+		CatalogIndexInsert(indexState, heapTupleArray[recordIndex]);
+	}
+	CatalogCloseIndexes(indexState);
+
 	CommandCounterIncrement();
 
 	/* close relation and invalidate previous cache entry */
@@ -139,160 +211,415 @@ LogTransactionRecord(int groupId, char *transactionName)
 /*
  * RecoverPreparedTransactions recovers any pending prepared
  * transactions started by this node on other nodes.
+ *
+ * The function recovers all workers at the same time: it opens one connection
+ * per worker, fetches all workers' prepared transactions in parallel, and then
+ * commits or aborts them in rounds that send one command to every worker.
  */
-static int
+int
 RecoverPreparedTransactions(void)
 {
 	List *workerList = NIL;
 	ListCell *workerNodeCell = NULL;
+	WorkerRecovery *workerRecoveryArray = NULL;
+	int workerCount = 0;
+	int workerIndex = 0;
 	int recoveredTransactionCount = 0;
+	int committedTransactionCount = 0;
+	int abortedTransactionCount = 0;
+	int failedTransactionCount = 0;
+
+	MemoryContext localContext = NULL;
+	MemoryContext oldContext = NULL;
+
+	/*
+	 * We prevent concurrent recovery for the rest of the transaction. This lock
+	 * conflicts with itself, but not with transactions writing records.
+	 */
+	LockRelationOid(DistTransactionRelationId(), ShareUpdateExclusiveLock);
 
 	/*
 	 * We block here if metadata transactions are ongoing, since we
 	 * mustn't commit/abort their prepared transactions under their
-	 * feet. We also prevent concurrent recovery.
+	 * feet. We only need to keep them out while we read the prepared
+	 * transactions and their records, and release this lock below.
 	 */
 	LockRelationOid(DistTransactionRelationId(), ExclusiveLock);
 
+	localContext = AllocSetContextCreate(CurrentMemoryContext,
+										 "RecoverPreparedTransactions",
+										 ALLOCSET_DEFAULT_MINSIZE,
+										 ALLOCSET_DEFAULT_INITSIZE,
+										 ALLOCSET_DEFAULT_MAXSIZE);
+	oldContext = MemoryContextSwitchTo(localContext);
+
 	workerList = WorkerNodeList();
+	workerCount = list_length(workerList);
+	workerRecoveryArray = (WorkerRecovery *) palloc0(workerCount *
+													 sizeof(WorkerRecovery));
 
+	/* start establishing all connections before waiting for any of them */
 	foreach(workerNodeCell, workerList)
 	{
 		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		WorkerRecovery *workerRecovery = &workerRecoveryArray[workerIndex];
+
+		workerRecovery->workerNode = workerNode;
+		workerRecovery->connection = StartNodeConnection(FORCE_NEW_CONNECTION,
+														 workerNode->workerName,
+														 workerNode->workerPort);
+		workerIndex++;
+	}
+
+	FetchPendingTransactions(workerRecoveryArray, workerCount);
+
+	for (workerIndex = 0; workerIndex < workerCount; workerIndex++)
+	{
+		PlanWorkerRecovery(&workerRecoveryArray[workerIndex]);
+	}
+
+	/*
+	 * Our decisions are final now. Transactions that prepare from here on are
+	 * not among the ones we recover, so they can log their records while we
+	 * wait for the workers to commit or abort prepared transactions.
+	 */
+	UnlockRelationOid(DistTransactionRelationId(), ExclusiveLock);
+
+	RunRecoveryCommands(workerRecoveryArray, workerCount);
+
+	for (workerIndex = 0; workerIndex < workerCount; workerIndex++)
+	{
+		WorkerRecovery *workerRecovery = &workerRecoveryArray[workerIndex];
+		int commandIndex = 0;
+
+		FinishWorkerRecovery(workerRecovery);
 
-		recoveredTransactionCount += RecoverWorkerTransactions(workerNode);
+		for (commandIndex = 0; commandIndex < workerRecovery->commandCount;
+			 commandIndex++)
+		{
+			if (!workerRecovery->recoveredArray[commandIndex])
+			{
+				failedTransactionCount++;
+			}
+			else if (workerRecovery->shouldCommitArray[commandIndex])
+			{
+				committedTransactionCount++;
+			}
+			else
+			{
+				abortedTransactionCount++;
+			}
+		}
+
+		if (workerRecovery->connection != NULL)
+		{
+			CloseConnection(workerRecovery->connection);
+		}
 	}
 
+	recoveredTransactionCount = committedTransactionCount + abortedTransactionCount;
+
+	CountRecoveredTransactions(committedTransactionCount, abortedTransactionCount,
+							   failedTransactionCount);
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(localContext);
+
 	return recoveredTransactionCount;
 }
 
 
 /*
- * RecoverWorkerTransactions recovers any pending prepared transactions
- * started by this node on the specified worker.
+ * FetchPendingTransactions finishes establishing the connections of the given
+ * worker recoveries, and fetches the pending prepared transactions started by
+ * this node from all workers in parallel. Workers that we cannot reach are
+ * skipped, by leaving them without a connection.
  */
-static int
-RecoverWorkerTransactions(WorkerNode *workerNode)
+static void
+FetchPendingTransactions(WorkerRecovery *workerRecoveryArray, int workerCount)
 {
-	int recoveredTransactionCount = 0;
+	StringInfo command = makeStringInfo();
+	int workerIndex = 0;
+	int coordinatorId = 0;
 
-	int groupId = workerNode->groupId;
-	char *nodeName = workerNode->workerName;
-	int nodePort = workerNode->workerPort;
+	appendStringInfo(command, "SELECT gid FROM pg_prepared_xacts "
+							  "WHERE gid LIKE 'citus_%d_%%'",
+					 coordinatorId);
 
-	List *pendingTransactionList = NIL;
-	ListCell *pendingTransactionCell = NULL;
+	for (workerIndex = 0; workerIndex < workerCount; workerIndex++)
+	{
+		WorkerRecovery *workerRecovery = &workerRecoveryArray[workerIndex];
+		MultiConnection *connection = workerRecovery->connection;
+
+		FinishConnectionEstablishment(connection);
+
+		if (PQstatus(connection->pgConn) != CONNECTION_OK ||
+			!SendRemoteCommand(connection, command->data))
+		{
+			/* cannot recover transactions on this worker right now */
+			ReportConnectionError(connection, WARNING);
+			CloseConnection(connection);
+			workerRecovery->connection = NULL;
+		}
+	}
+
+	for (workerIndex = 0; workerIndex < workerCount; workerIndex++)
+	{
+		WorkerRecovery *workerRecovery = &workerRecoveryArray[workerIndex];
+		MultiConnection *connection = workerRecovery->connection;
+		const bool raiseInterrupts = true;
+		PGresult *result = NULL;
+		int rowCount = 0;
+		int rowIndex = 0;
+
+		if (connection == NULL)
+		{
+			continue;
+		}
+
+		result = GetRemoteCommandResult(connection, raiseInterrupts);
+		if (!IsResponseOK(result))
+		{
+			ReportResultError(connection, result, WARNING);
+			PQclear(result);
+			ForgetResults(connection);
 
-	List *unconfirmedTransactionList = NIL;
+			CloseConnection(connection);
+			workerRecovery->connection = NULL;
+			continue;
+		}
+
+		rowCount = PQntuples(result);
+
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			const int columnIndex = 0;
+			char *transactionName = PQgetvalue(result, rowIndex, columnIndex);
+
+			workerRecovery->pendingTransactionList =
+				lappend(workerRecovery->pendingTransactionList,
+						pstrdup(transactionName));
+		}
+
+		PQclear(result);
+		ForgetResults(connection);
+
+		workerRecovery->pendingTransactionList =
+			SortList(workerRecovery->pendingTransactionList, CompareNames);
+	}
+}
+
+
+/*
+ * PlanWorkerRecovery decides, for each pending prepared transaction on the
+ * worker, whether to commit or to abort it. If there is a transaction record,
+ * we commit. If not, the transaction that started the prepared transaction
+ * must have rolled back and thus the prepared transaction should be aborted.
+ */
+static void
+PlanWorkerRecovery(WorkerRecovery *workerRecovery)
+{
+	int groupId = workerRecovery->workerNode->groupId;
+	ListCell *pendingTransactionCell = NULL;
 	char **unconfirmedTransactionArray = NULL;
 	int unconfirmedTransactionCount = 0;
 	int unconfirmedTransactionIndex = 0;
+	int commandCount = 0;
 
-	List *committedTransactionList = NIL;
-	ListCell *committedTransactionCell = NULL;
-
-	MemoryContext localContext = NULL;
-	MemoryContext oldContext = NULL;
-
-	PGconn *connection = GetOrEstablishConnection(nodeName, nodePort);
-	if (connection == NULL)
+	if (workerRecovery->connection == NULL)
 	{
-		/* cannot recover transactions on this worker right now */
-		return 0;
+		return;
 	}
 
-	localContext = AllocSetContextCreate(CurrentMemoryContext,
-										 "RecoverWorkerTransactions",
-										 ALLOCSET_DEFAULT_MINSIZE,
-										 ALLOCSET_DEFAULT_INITSIZE,
-										 ALLOCSET_DEFAULT_MAXSIZE);
-	oldContext = MemoryContextSwitchTo(localContext);
-
 	/* find transactions that were committed, but not yet confirmed */
-	unconfirmedTransactionList = UnconfirmedWorkerTransactionsList(groupId);
-	unconfirmedTransactionList = SortList(unconfirmedTransactionList, CompareNames);
+	workerRecovery->unconfirmedTransactionList =
+		SortList(UnconfirmedWorkerTransactionsList(groupId), CompareNames);
 
 	/* convert list to an array to use with FindMatchingNames */
-	unconfirmedTransactionCount = list_length(unconfirmedTransactionList);
+	unconfirmedTransactionCount = list_length(workerRecovery->unconfirmedTransactionList);
 	unconfirmedTransactionArray =
-		(char **) PointerArrayFromList(unconfirmedTransactionList);
+		(char **) PointerArrayFromList(workerRecovery->unconfirmedTransactionList);
 
-	/* find stale prepared transactions on the remote node */
-	pendingTransactionList = PendingWorkerTransactionList(connection);
-	pendingTransactionList = SortList(pendingTransactionList, CompareNames);
+	commandCount = list_length(workerRecovery->pendingTransactionList);
+	workerRecovery->commandCount = commandCount;
+	workerRecovery->transactionNameArray =
+		(char **) PointerArrayFromList(workerRecovery->pendingTransactionList);
+	workerRecovery->shouldCommitArray = (bool *) palloc0(commandCount * sizeof(bool));
+	workerRecovery->recoveredArray = (bool *) palloc0(commandCount * sizeof(bool));
 
-	/*
-	 * Transactions that have no pending prepared transaction are assumed to
-	 * have been committed. Any records in unconfirmedTransactionList that
-	 * don't have a transaction in pendingTransactionList can be removed.
-	 */
-	committedTransactionList = NameListDifference(unconfirmedTransactionList,
-												  pendingTransactionList);
-
-	/*
-	 * For each pending prepared transaction, check whether there is a transaction
-	 * record. If so, commit. If not, the transaction that started the transaction
-	 * must have rolled back and thus the prepared transaction should be aborted.
-	 */
-	foreach(pendingTransactionCell, pendingTransactionList)
+	commandCount = 0;
+	foreach(pendingTransactionCell, workerRecovery->pendingTransactionList)
 	{
 		char *transactionName = (char *) lfirst(pendingTransactionCell);
-		StringInfo command = makeStringInfo();
-		PGresult *result = NULL;
 
-		bool shouldCommit = FindMatchingName(unconfirmedTransactionArray,
-											 unconfirmedTransactionCount,
-											 transactionName,
-											 &unconfirmedTransactionIndex);
+		workerRecovery->shouldCommitArray[commandCount] =
+			FindMatchingName(unconfirmedTransactionArray, unconfirmedTransactionCount,
+							 transactionName, &unconfirmedTransactionIndex);
+		commandCount++;
+	}
+}
 
-		if (shouldCommit)
-		{
-			/* should have committed this prepared transaction */
-			appendStringInfo(command, "COMMIT PREPARED '%s'", transactionName);
-		}
-		else
+
+/*
+ * RunRecoveryCommands commits or aborts the pending prepared transactions on
+ * all workers. Each round sends one command over every connection that still
+ * has work, and then waits for all of them, so that workers recover in
+ * parallel. A worker's remaining transactions are skipped if its connection
+ * breaks.
+ */
+static void
+RunRecoveryCommands(WorkerRecovery *workerRecoveryArray, int workerCount)
+{
+	int roundIndex = 0;
+	bool commandSent = true;
+
+	for (roundIndex = 0; commandSent; roundIndex++)
+	{
+		int workerIndex = 0;
+
+		commandSent = false;
+
+		for (workerIndex = 0; workerIndex < workerCount; workerIndex++)
 		{
-			/* no record of this prepared transaction, abort */
-			appendStringInfo(command, "ROLLBACK PREPARED '%s'", transactionName);
+			WorkerRecovery *workerRecovery = &workerRecoveryArray[workerIndex];
+			MultiConnection *connection = workerRecovery->connection;
+			StringInfo command = NULL;
+
+			workerRecovery->commandSent = false;
+
+			if (connection == NULL || roundIndex >= workerRecovery->commandCount)
+			{
+				continue;
+			}
+
+			command = RecoveryCommand(workerRecovery, roundIndex);
+
+			if (!SendRemoteCommand(connection, command->data))
+			{
+				ReportConnectionError(connection, WARNING);
+				CloseConnection(connection);
+				workerRecovery->connection = NULL;
+				continue;
+			}
+
+			workerRecovery->commandSent = true;
+			commandSent = true;
 		}
 
-		result = PQexec(connection, command->data);
-		if (PQresultStatus(result) != PGRES_COMMAND_OK)
+		for (workerIndex = 0; workerIndex < workerCount; workerIndex++)
 		{
-			WarnRemoteError(connection, result);
+			WorkerRecovery *workerRecovery = &workerRecoveryArray[workerIndex];
+			MultiConnection *connection = workerRecovery->connection;
+			const bool raiseInterrupts = true;
+			PGresult *result = NULL;
+
+			if (!workerRecovery->commandSent)
+			{
+				continue;
+			}
+
+			result = GetRemoteCommandResult(connection, raiseInterrupts);
+			if (!IsResponseOK(result))
+			{
+				/* cannot recover this transaction right now */
+				ReportResultError(connection, result, WARNING);
+			}
+			else
+			{
+				workerRecovery->recoveredArray[roundIndex] = true;
+			}
+
 			PQclear(result);
+			ForgetResults(connection);
+
+			if (PQstatus(connection->pgConn) != CONNECTION_OK)
+			{
+				CloseConnection(connection);
+				workerRecovery->connection = NULL;
+			}
+		}
+	}
+}
+
+
+/*
+ * FinishWorkerRecovery reports the prepared transactions we recovered on the
+ * given worker, and removes the transaction records of all transactions that
+ * are confirmed to have committed on it.
+ */
+static void
+FinishWorkerRecovery(WorkerRecovery *workerRecovery)
+{
+	WorkerNode *workerNode = workerRecovery->workerNode;
+	List *committedTransactionList = NIL;
+	int commandIndex = 0;
+
+	if (workerRecovery->pendingTransactionList == NIL &&
+		workerRecovery->unconfirmedTransactionList == NIL)
+	{
+		return;
+	}
 
-			/* cannot recover this transaction right now */
+	/*
+	 * Transactions that have no pending prepared transaction are assumed to
+	 * have been committed. Any records in unconfirmedTransactionList that
+	 * don't have a transaction in pendingTransactionList can be removed.
+	 */
+	committedTransactionList =
+		NameListDifference(workerRecovery->unconfirmedTransactionList,
+						   workerRecovery->pendingTransactionList);
+
+	for (commandIndex = 0; commandIndex < workerRecovery->commandCount; commandIndex++)
+	{
+		StringInfo command = NULL;
+
+		if (!workerRecovery->recoveredArray[commandIndex])
+		{
 			continue;
 		}
 
-		PQclear(result);
+		command = RecoveryCommand(workerRecovery, commandIndex);
 
 		ereport(NOTICE, (errmsg("recovered a prepared transaction on %s:%d",
-								nodeName, nodePort),
+								workerNode->workerName, workerNode->workerPort),
 						 errcontext("%s", command->data)));
 
-		if (shouldCommit)
+		if (workerRecovery->shouldCommitArray[commandIndex])
 		{
-			committedTransactionList = lappend(committedTransactionList,
-											   transactionName);
+			committedTransactionList =
+				lappend(committedTransactionList,
+						workerRecovery->transactionNameArray[commandIndex]);
 		}
-
-		recoveredTransactionCount += 1;
 	}
 
 	/* we can remove the transaction records of confirmed transactions */
-	foreach(committedTransactionCell, committedTransactionList)
-	{
-		char *transactionName = (char *) lfirst(committedTransactionCell);
+	committedTransactionList = SortList(committedTransactionList, CompareNames);
+	DeleteTransactionRecords(workerNode->groupId, committedTransactionList);
+}
 
-		DeleteTransactionRecord(groupId, transactionName);
-	}
 
-	MemoryContextReset(localContext);
-	MemoryContextSwitchTo(oldContext);
+/*
+ * RecoveryCommand returns the command that commits or aborts the pending
+ * prepared transaction at the given index of the worker recovery.
+ */
+static StringInfo
+RecoveryCommand(WorkerRecovery *workerRecovery, int commandIndex)
+{
+	StringInfo command = makeStringInfo();
+	char *transactionName = workerRecovery->transactionNameArray[commandIndex];
 
-	return recoveredTransactionCount;
+	if (workerRecovery->shouldCommitArray[commandIndex])
+	{
+		/* should have committed this prepared transaction */
+		appendStringInfo(command, "COMMIT PREPARED '%s'", transactionName);
+	}
+	else
+	{
+		/* no record of this prepared transaction, abort */
+		appendStringInfo(command, "ROLLBACK PREPARED '%s'", transactionName);
+	}
+
+	return command;
 }
 
 
@@ -393,46 +720,6 @@ FindMatchingName(char **nameArray, int nameCount, char *needle,
 }
 
 
-/*
- * PendingWorkerTransactionList returns a list of pending prepared
- * transactions on a remote node that were started by this node.
- */
-static List *
-PendingWorkerTransactionList(PGconn *connection)
-{
-	StringInfo command = makeStringInfo();
-	PGresult *result = NULL;
-	int rowCount = 0;
-	int rowIndex = 0;
-	List *transactionNames = NIL;
-	int coordinatorId = 0;
-
-	appendStringInfo(command, "SELECT gid FROM pg_prepared_xacts "
-							  "WHERE gid LIKE 'citus_%d_%%'",
-					 coordinatorId);
-
-	result = PQexec(connection, command->data);
-	if (PQresultStatus(result) != PGRES_TUPLES_OK)
-	{
-		ReraiseRemoteError(connection, result);
-	}
-
-	rowCount = PQntuples(result);
-
-	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
-	{
-		const int columnIndex = 0;
-		char *transactionName = PQgetvalue(result, rowIndex, columnIndex);
-
-		transactionNames = lappend(transactionNames, pstrdup(transactionName));
-	}
-
-	PQclear(result);
-
-	return transactionNames;
-}
-
-
 /*
  * UnconfirmedWorkerTransactionList returns a list of unconfirmed transactions
  * for a group of workers from pg_dist_transaction. A transaction is confirmed
@@ -483,12 +770,13 @@ UnconfirmedWorkerTransactionsList(int groupId)
 
 
 /*
- * DeleteTransactionRecord opens the pg_dist_transaction system catalog, finds the
- * first (unique) row that corresponds to the given transactionName and worker node,
- * and deletes this row.
+ * DeleteTransactionRecords opens the pg_dist_transaction system catalog, and
+ * deletes the rows of the given group that correspond to the transaction names
+ * in the sorted transactionNameList. The function scans the group's records
+ * only once, and errors out if it cannot find a record for every name.
  */
 static void
-DeleteTransactionRecord(int32 groupId, char *transactionName)
+DeleteTransactionRecords(int32 groupId, List *transactionNameList)
 {
 	Relation pgDistTransaction = NULL;
 	SysScanDesc scanDescriptor = NULL;
@@ -496,7 +784,16 @@ DeleteTransactionRecord(int32 groupId, char *transactionName)
 	int scanKeyCount = 1;
 	bool indexOK = true;
 	HeapTuple heapTuple = NULL;
-	bool heapTupleFound = false;
+	char **transactionNameArray = NULL;
+	int transactionNameCount = list_length(transactionNameList);
+	int deletedRecordCount = 0;
+
+	if (transactionNameCount == 0)
+	{
+		return;
+	}
+
+	transactionNameArray = (char **) PointerArrayFromList(transactionNameList);
 
 	pgDistTransaction = heap_open(DistTransactionRelationId(), RowExclusiveLock);
 
@@ -519,24 +816,24 @@ DeleteTransactionRecord(int32 groupId, char *transactionName)
 
 		char *gid = TextDatumGetCString(gidDatum);
 
-		if (strncmp(transactionName, gid, NAMEDATALEN) == 0)
+		if (bsearch(&gid, transactionNameArray, transactionNameCount,
+					sizeof(char *), CompareNames) != NULL)
 		{
-			heapTupleFound = true;
-			break;
+			simple_heap_delete(pgDistTransaction, &heapTuple->t_self);
+			deletedRecordCount++;
 		}
 
 		heapTuple = systable_getnext(scanDescriptor);
 	}
 
-	/* if we couldn't find the transaction record to delete, error out */
-	if (!heapTupleFound)
+	/* if we couldn't find all transaction records to delete, error out */
+	if (deletedRecordCount != transactionNameCount)
 	{
-		ereport(ERROR, (errmsg("could not find valid entry for transaction record "
-							   "'%s' in group %d",
-							   transactionName, groupId)));
+		ereport(ERROR, (errmsg("could not find valid entries for %d transaction "
+							   "records in group %d",
+							   transactionNameCount - deletedRecordCount, groupId)));
 	}
 
-	simple_heap_delete(pgDistTransaction, &heapTuple->t_self);
 	CommandCounterIncrement();
 
 	systable_endscan(scanDescriptor);
@@ -22,6 +22,7 @@
 #include "utils/datum.h"
 #include "utils/lsyscache.h"
 
+static void EvaluateValuesLists(RangeTblEntry *valuesRte);
 static Node * PartiallyEvaluateExpression(Node *expression);
 static Node * EvaluateNodeIfReferencesFunction(Node *expression);
 static Node * PartiallyEvaluateExpressionMutator(Node *expression, bool *containsVar);
@@ -53,6 +54,17 @@ RequiresMasterEvaluation(Query *query)
 	{
 		RangeTblEntry *rte = (RangeTblEntry *) lfirst(rteCell);
 
+		/* rows of multi-row INSERTs are evaluated on the master as well */
+		if (rte->rtekind == RTE_VALUES)
+		{
+			if (contain_mutable_functions((Node *) rte->values_lists))
+			{
+				return true;
+			}
+
+			continue;
+		}
+
 		if (rte->rtekind != RTE_SUBQUERY)
 		{
 			continue;
@@ -128,6 +140,12 @@ ExecuteMasterEvaluableFunctions(Query *query)
 	{
 		RangeTblEntry *rte = (RangeTblEntry *) lfirst(rteCell);
 
+		if (rte->rtekind == RTE_VALUES)
+		{
+			EvaluateValuesLists(rte);
+			continue;
+		}
+
 		if (rte->rtekind != RTE_SUBQUERY)
 		{
 			continue;
@@ -145,6 +163,37 @@ ExecuteMasterEvaluableFunctions(Query *query)
 }
 
 
+/*
+ * EvaluateValuesLists evaluates the functions in each row of a multi-row INSERT
+ * separately, such that a VOLATILE function yields a new value for every row
+ * while all placements of a shard still receive the same values.
+ */
+static void
+EvaluateValuesLists(RangeTblEntry *valuesRte)
+{
+	ListCell *valuesListCell = NULL;
+
+	foreach(valuesListCell, valuesRte->values_lists)
+	{
+		List *valuesList = (List *) lfirst(valuesListCell);
+		ListCell *valueCell = NULL;
+
+		foreach(valueCell, valuesList)
+		{
+			Node *value = (Node *) lfirst(valueCell);
+
+			/* performance optimization for the most common case */
+			if (IsA(value, Const))
+			{
+				continue;
+			}
+
+			lfirst(valueCell) = PartiallyEvaluateExpression(value);
+		}
+	}
+}
+
+
 /*
  * Walks the expression evaluating any node which invokes a function as long as a Var
  * doesn't show up in the parameter list.
@@ -279,6 +279,9 @@ OutMultiPlan(OUTFUNC_ARGS)
 	WRITE_NODE_FIELD(masterQuery);
 	WRITE_STRING_FIELD(masterTableName);
 	WRITE_BOOL_FIELD(routerExecutable);
+	WRITE_BOOL_FIELD(costBasedJoinOrder);
+	WRITE_FLOAT_FIELD(transferSize, "%.0f");
+	WRITE_FLOAT_FIELD(groupCountEstimate, "%.0f");
 }
 
 
@@ -338,6 +341,8 @@ OutMultiJoin(OUTFUNC_ARGS)
 	WRITE_NODE_FIELD(joinClauseList);
 	WRITE_ENUM_FIELD(joinRuleType, JoinRuleType);
 	WRITE_ENUM_FIELD(joinType, JoinType);
+	WRITE_BOOL_FIELD(costBased);
+	WRITE_FLOAT_FIELD(transferSize, "%.0f");
 
 	OutMultiBinaryNodeFields(str, (const MultiBinaryNode *) node);
 }
@@ -458,6 +463,12 @@ OutMapMergeJob(OUTFUNC_ARGS)
 
 	WRITE_NODE_FIELD(mapTaskList);
 	WRITE_NODE_FIELD(mergeTaskList);
+	WRITE_NODE_FIELD(heavyHitterValueList);
+	WRITE_NODE_FIELD(heavyHitterPartitionCountList);
+	WRITE_NODE_FIELD(spreadHeavyHitterList);
+	WRITE_UINT64_FIELD(semiJoinSourceJobId);
+	WRITE_OID_FIELD(semiJoinSourceRelationId);
+	WRITE_NODE_FIELD(semiJoinSourceTaskList);
 }
 
 
@@ -504,10 +515,12 @@ OutTask(OUTFUNC_ARGS)
 	WRITE_UINT_FIELD(upstreamTaskId);
 	WRITE_NODE_FIELD(shardInterval);
 	WRITE_BOOL_FIELD(assignmentConstrained);
+	WRITE_BOOL_FIELD(pushPartitions);
 	WRITE_NODE_FIELD(taskExecution);
 	WRITE_BOOL_FIELD(upsertQuery);
 	WRITE_BOOL_FIELD(insertSelectQuery);
 	WRITE_NODE_FIELD(relationShardList);
+	WRITE_NODE_FIELD(rowIndexList);
 }
 
 #if (PG_VERSION_NUM < 90600)
@@ -186,6 +186,9 @@ ReadMultiPlan(READFUNC_ARGS)
 	READ_NODE_FIELD(masterQuery);
 	READ_STRING_FIELD(masterTableName);
 	READ_BOOL_FIELD(routerExecutable);
+	READ_BOOL_FIELD(costBasedJoinOrder);
+	READ_FLOAT_FIELD(transferSize);
+	READ_FLOAT_FIELD(groupCountEstimate);
 
 	READ_DONE();
 }
@@ -252,6 +255,12 @@ ReadMapMergeJob(READFUNC_ARGS)
 
 	READ_NODE_FIELD(mapTaskList);
 	READ_NODE_FIELD(mergeTaskList);
+	READ_NODE_FIELD(heavyHitterValueList);
+	READ_NODE_FIELD(heavyHitterPartitionCountList);
+	READ_NODE_FIELD(spreadHeavyHitterList);
+	READ_UINT64_FIELD(semiJoinSourceJobId);
+	READ_OID_FIELD(semiJoinSourceRelationId);
+	READ_NODE_FIELD(semiJoinSourceTaskList);
 
 	READ_DONE();
 }
@@ -301,10 +310,12 @@ ReadTask(READFUNC_ARGS)
 	READ_UINT_FIELD(upstreamTaskId);
 	READ_NODE_FIELD(shardInterval);
 	READ_BOOL_FIELD(assignmentConstrained);
+	READ_BOOL_FIELD(pushPartitions);
 	READ_NODE_FIELD(taskExecution);
 	READ_BOOL_FIELD(upsertQuery);
 	READ_BOOL_FIELD(insertSelectQuery);
 	READ_NODE_FIELD(relationShardList);
+	READ_NODE_FIELD(rowIndexList);
 
 	READ_DONE();
 }
@@ -68,6 +68,10 @@ static Oid distShardPlacementPlacementidIndexId = InvalidOid;
 static Oid distShardPlacementNodeidIndexId = InvalidOid;
 static Oid distTransactionRelationId = InvalidOid;
 static Oid distTransactionGroupIndexId = InvalidOid;
+static Oid distTableStatisticRelationId = InvalidOid;
+static Oid distTableStatisticLogicalRelidIndexId = InvalidOid;
+static Oid distColumnStatisticRelationId = InvalidOid;
+static Oid distColumnStatisticLogicalRelidAttnumIndexId = InvalidOid;
 static Oid extraDataContainerFuncId = InvalidOid;
 
 /* Hash table for informations about each partition */
@@ -858,6 +862,48 @@ DistTransactionGroupIndexId(void)
 }
 
 
+/* return oid of pg_dist_table_statistic relation */
+Oid
+DistTableStatisticRelationId(void)
+{
+	CachedRelationLookup("pg_dist_table_statistic", &distTableStatisticRelationId);
+
+	return distTableStatisticRelationId;
+}
+
+
+/* return oid of pg_dist_table_statistic_logicalrelid_index */
+Oid
+DistTableStatisticLogicalRelidIndexId(void)
+{
+	CachedRelationLookup("pg_dist_table_statistic_logicalrelid_index",
+						 &distTableStatisticLogicalRelidIndexId);
+
+	return distTableStatisticLogicalRelidIndexId;
+}
+
+
+/* return oid of pg_dist_column_statistic relation */
+Oid
+DistColumnStatisticRelationId(void)
+{
+	CachedRelationLookup("pg_dist_column_statistic", &distColumnStatisticRelationId);
+
+	return distColumnStatisticRelationId;
+}
+
+
+/* return oid of pg_dist_column_statistic_logicalrelid_attnum_index */
+Oid
+DistColumnStatisticLogicalRelidAttnumIndexId(void)
+{
+	CachedRelationLookup("pg_dist_column_statistic_logicalrelid_attnum_index",
+						 &distColumnStatisticLogicalRelidAttnumIndexId);
+
+	return distColumnStatisticLogicalRelidAttnumIndexId;
+}
+
+
 /* return oid of pg_dist_shard_placement_nodeid_index */
 Oid
 DistShardPlacementNodeidIndexId(void)
@@ -1573,6 +1619,10 @@ InvalidateDistRelationCacheCallback(Datum argument, Oid relationId)
 		distShardPlacementShardidIndexId = InvalidOid;
 		distShardPlacementPlacementidIndexId = InvalidOid;
 		distTransactionRelationId = InvalidOid;
+		distTableStatisticRelationId = InvalidOid;
+		distTableStatisticLogicalRelidIndexId = InvalidOid;
+		distColumnStatisticRelationId = InvalidOid;
+		distColumnStatisticLogicalRelidAttnumIndexId = InvalidOid;
 		distTransactionGroupIndexId = InvalidOid;
 		extraDataContainerFuncId = InvalidOid;
 	}
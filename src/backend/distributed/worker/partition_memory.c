@@ -0,0 +1,500 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_memory.c
+ *
+ * Repartition jobs that only move a small amount of data pay most of their
+ * cost in creating, writing, and reading partition files. When configured with
+ * a memory budget, worker nodes instead keep partitions that fit into their
+ * partitioning buffer in shared memory, and serve fetches for these partitions
+ * directly from memory. The following routines manage this shared memory. We
+ * split the memory into fixed-size blocks, and store each partition in a chain
+ * of blocks; partitions that do not fit into the remaining blocks are written
+ * to files as usual.
+ *
+ * Copyright (c) 2012-2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/partition_memory.h"
+#include "distributed/task_tracker.h"
+#include "distributed/transmit.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+
+
+int PartitionMemoryBudget = 0; /* shared memory for partitions, in KB */
+
+
+/* Local functions forward declarations */
+static int32 PartitionMemoryBlockCount(void);
+static void ReleaseInMemoryPartition(PartitionMemoryArea *partitionMemory,
+									 InMemoryPartition *partition);
+static void DropInMemoryPartition(PartitionMemoryArea *partitionMemory,
+								  InMemoryPartition *partition);
+static void FreePartitionBlocks(PartitionMemoryArea *partitionMemory,
+								InMemoryPartition *partition);
+
+
+/* Returns the number of blocks that fit into the configured memory budget. */
+static int32
+PartitionMemoryBlockCount(void)
+{
+	int64 budgetInBytes = (int64) PartitionMemoryBudget * 1024L;
+	int32 blockCount = (int32) (budgetInBytes / PARTITION_MEMORY_BLOCK_SIZE);
+
+	return blockCount;
+}
+
+
+/* Estimates the shared memory size used for keeping partitions in memory. */
+Size
+PartitionMemoryShmemSize(void)
+{
+	Size size = 0;
+	int32 blockCount = PartitionMemoryBlockCount();
+
+	if (blockCount == 0)
+	{
+		return 0;
+	}
+
+	size = add_size(size, sizeof(PartitionMemoryArea));
+	size = add_size(size, mul_size(blockCount, sizeof(int32)));
+	size = add_size(size, mul_size(blockCount, PARTITION_MEMORY_BLOCK_SIZE));
+
+	/* each partition takes up at least one block, except for empty ones */
+	size = add_size(size, hash_estimate_size(blockCount, sizeof(InMemoryPartition)));
+
+	return size;
+}
+
+
+/*
+ * PartitionMemoryShmemInit allocates and initializes the shared memory in which
+ * we keep partitions. Note that this function expects the caller to hold the
+ * add-in shared memory initialization lock.
+ */
+void
+PartitionMemoryShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	PartitionMemoryArea *partitionMemory = NULL;
+	int32 blockCount = PartitionMemoryBlockCount();
+	Size areaSize = 0;
+	HASHCTL info;
+	int hashFlags = 0;
+
+	if (blockCount == 0)
+	{
+		WorkerTasksSharedState->partitionMemory = NULL;
+		return;
+	}
+
+	areaSize = add_size(sizeof(PartitionMemoryArea), mul_size(blockCount,
+															  sizeof(int32)));
+	areaSize = add_size(areaSize, mul_size(blockCount, PARTITION_MEMORY_BLOCK_SIZE));
+
+	partitionMemory = (PartitionMemoryArea *) ShmemInitStruct("Worker Partition Memory",
+															  areaSize,
+															  &alreadyInitialized);
+	if (!alreadyInitialized)
+	{
+		LWLockTranche *tranche = &partitionMemory->lockTranche;
+		int32 blockId = 0;
+		char *areaEnd = (char *) partitionMemory + sizeof(PartitionMemoryArea);
+
+		/* initialize lwlock protecting the partition memory area */
+		partitionMemory->lockTrancheId = LWLockNewTrancheId();
+		tranche->array_base = &partitionMemory->lock;
+		tranche->array_stride = sizeof(LWLock);
+		tranche->name = "Worker Partition Memory Tranche";
+		LWLockRegisterTranche(partitionMemory->lockTrancheId, tranche);
+		LWLockInitialize(&partitionMemory->lock, partitionMemory->lockTrancheId);
+
+		partitionMemory->blockLinkArray = (int32 *) areaEnd;
+		partitionMemory->blockArray = areaEnd + blockCount * sizeof(int32);
+		partitionMemory->blockCount = blockCount;
+
+		/* all blocks start out on the free list */
+		for (blockId = 0; blockId < blockCount; blockId++)
+		{
+			partitionMemory->blockLinkArray[blockId] = blockId + 1;
+		}
+
+		partitionMemory->blockLinkArray[blockCount - 1] = -1;
+		partitionMemory->freeBlockId = 0;
+		partitionMemory->freeBlockCount = blockCount;
+	}
+
+	/* allocate hash table that maps partition file names to their data */
+	memset(&info, 0, sizeof(info));
+	info.keysize = MAXPGPATH;
+	info.entrysize = sizeof(InMemoryPartition);
+	info.hash = string_hash;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION);
+
+	partitionMemory->partitionHash = ShmemInitHash("Worker Partition Memory Hash",
+												   blockCount / 8 + 1, blockCount,
+												   &info, hashFlags);
+
+	WorkerTasksSharedState->partitionMemory = partitionMemory;
+}
+
+
+/*
+ * StoreInMemoryPartition copies the given partition data into shared memory, and
+ * associates these data with the given partition file name. The function returns
+ * false if partition memory is disabled or does not have enough free blocks for
+ * the data; the caller should then write the data to the partition file instead.
+ * In either case, the function replaces data previously stored under the same
+ * name, such as data from an earlier attempt to run the same map task. If these
+ * earlier data are still being read, we leave them to their readers and write
+ * the partition to its file.
+ */
+bool
+StoreInMemoryPartition(uint64 jobId, const char *filename, StringInfo partitionData)
+{
+	PartitionMemoryArea *partitionMemory = WorkerTasksSharedState->partitionMemory;
+	InMemoryPartition *partition = NULL;
+	char partitionKey[MAXPGPATH];
+	int32 requiredBlockCount = 0;
+	int32 previousBlockId = -1;
+	int32 blockId = -1;
+	uint32 copiedSize = 0;
+	bool handleFound = false;
+
+	if (partitionMemory == NULL)
+	{
+		return false;
+	}
+
+	if (strlen(filename) >= MAXPGPATH)
+	{
+		return false;
+	}
+
+	memset(partitionKey, 0, MAXPGPATH);
+	strlcpy(partitionKey, filename, MAXPGPATH);
+
+	requiredBlockCount = (partitionData->len + PARTITION_MEMORY_BLOCK_SIZE - 1) /
+						 PARTITION_MEMORY_BLOCK_SIZE;
+
+	LWLockAcquire(&partitionMemory->lock, LW_EXCLUSIVE);
+
+	partition = (InMemoryPartition *) hash_search(partitionMemory->partitionHash,
+												  partitionKey, HASH_ENTER_NULL,
+												  &handleFound);
+	if (partition != NULL && handleFound)
+	{
+		if (partition->referenceCount > 0)
+		{
+			DropInMemoryPartition(partitionMemory, partition);
+
+			LWLockRelease(&partitionMemory->lock);
+			return false;
+		}
+
+		FreePartitionBlocks(partitionMemory, partition);
+	}
+
+	if (partition == NULL || requiredBlockCount > partitionMemory->freeBlockCount)
+	{
+		if (partition != NULL)
+		{
+			hash_search(partitionMemory->partitionHash, partitionKey, HASH_REMOVE,
+						NULL);
+		}
+
+		LWLockRelease(&partitionMemory->lock);
+		return false;
+	}
+
+	partition->jobId = jobId;
+	partition->dataSize = partitionData->len;
+	partition->firstBlockId = -1;
+	partition->referenceCount = 1;
+	partition->written = false;
+	partition->removed = false;
+
+	/* take blocks off the free list, and chain them up for this partition */
+	while (requiredBlockCount > 0)
+	{
+		blockId = partitionMemory->freeBlockId;
+
+		partitionMemory->freeBlockId = partitionMemory->blockLinkArray[blockId];
+		partitionMemory->freeBlockCount--;
+
+		partitionMemory->blockLinkArray[blockId] = -1;
+		if (previousBlockId == -1)
+		{
+			partition->firstBlockId = blockId;
+		}
+		else
+		{
+			partitionMemory->blockLinkArray[previousBlockId] = blockId;
+		}
+
+		previousBlockId = blockId;
+		requiredBlockCount--;
+	}
+
+	blockId = partition->firstBlockId;
+
+	LWLockRelease(&partitionMemory->lock);
+
+	/* the blocks are ours until we release the partition, so copy without lock */
+	while (blockId != -1)
+	{
+		char *block = partitionMemory->blockArray +
+					  (Size) blockId * PARTITION_MEMORY_BLOCK_SIZE;
+		uint32 blockDataSize = Min(partitionData->len - copiedSize,
+								   PARTITION_MEMORY_BLOCK_SIZE);
+
+		memcpy(block, partitionData->data + copiedSize, blockDataSize);
+		copiedSize += blockDataSize;
+
+		blockId = partitionMemory->blockLinkArray[blockId];
+	}
+
+	LWLockAcquire(&partitionMemory->lock, LW_EXCLUSIVE);
+
+	partition->written = true;
+	ReleaseInMemoryPartition(partitionMemory, partition);
+
+	LWLockRelease(&partitionMemory->lock);
+
+	return true;
+}
+
+
+/*
+ * LoadInMemoryPartition copies the data kept in shared memory for the given
+ * partition file name into local memory. If there are no such data, the
+ * function returns NULL. We only hold the area's lock to reference and release
+ * the partition, and copy the partition's data in between.
+ */
+StringInfo
+LoadInMemoryPartition(const char *filename)
+{
+	PartitionMemoryArea *partitionMemory = WorkerTasksSharedState->partitionMemory;
+	InMemoryPartition *partition = NULL;
+	StringInfo partitionData = NULL;
+	char partitionKey[MAXPGPATH];
+	uint32 dataSize = 0;
+	int32 blockId = -1;
+	bool handleFound = false;
+
+	if (partitionMemory == NULL || strlen(filename) >= MAXPGPATH)
+	{
+		return NULL;
+	}
+
+	memset(partitionKey, 0, MAXPGPATH);
+	strlcpy(partitionKey, filename, MAXPGPATH);
+
+	partitionData = makeStringInfo();
+
+	LWLockAcquire(&partitionMemory->lock, LW_EXCLUSIVE);
+
+	partition = (InMemoryPartition *) hash_search(partitionMemory->partitionHash,
+												  partitionKey, HASH_FIND,
+												  &handleFound);
+	if (partition == NULL || !partition->written || partition->removed)
+	{
+		LWLockRelease(&partitionMemory->lock);
+
+		FreeStringInfo(partitionData);
+		return NULL;
+	}
+
+	partition->referenceCount++;
+	dataSize = partition->dataSize;
+	blockId = partition->firstBlockId;
+
+	LWLockRelease(&partitionMemory->lock);
+
+	/*
+	 * We need to release the partition even if allocating memory fails, so we
+	 * do not leave a reference behind that keeps the blocks from being freed.
+	 */
+	PG_TRY();
+	{
+		enlargeStringInfo(partitionData, dataSize);
+	}
+	PG_CATCH();
+	{
+		LWLockAcquire(&partitionMemory->lock, LW_EXCLUSIVE);
+		ReleaseInMemoryPartition(partitionMemory, partition);
+		LWLockRelease(&partitionMemory->lock);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	while (blockId != -1)
+	{
+		char *block = partitionMemory->blockArray +
+					  (Size) blockId * PARTITION_MEMORY_BLOCK_SIZE;
+		uint32 blockDataSize = Min(dataSize - partitionData->len,
+								   PARTITION_MEMORY_BLOCK_SIZE);
+
+		memcpy(partitionData->data + partitionData->len, block, blockDataSize);
+		partitionData->len += blockDataSize;
+
+		blockId = partitionMemory->blockLinkArray[blockId];
+	}
+
+	partitionData->data[partitionData->len] = '\0';
+
+	LWLockAcquire(&partitionMemory->lock, LW_EXCLUSIVE);
+	ReleaseInMemoryPartition(partitionMemory, partition);
+	LWLockRelease(&partitionMemory->lock);
+
+	return partitionData;
+}
+
+
+/*
+ * RemoveInMemoryPartition removes the data kept in shared memory for the given
+ * partition file name, if there are any.
+ */
+void
+RemoveInMemoryPartition(const char *filename)
+{
+	PartitionMemoryArea *partitionMemory = WorkerTasksSharedState->partitionMemory;
+	InMemoryPartition *partition = NULL;
+	char partitionKey[MAXPGPATH];
+	bool handleFound = false;
+
+	if (partitionMemory == NULL || strlen(filename) >= MAXPGPATH)
+	{
+		return;
+	}
+
+	memset(partitionKey, 0, MAXPGPATH);
+	strlcpy(partitionKey, filename, MAXPGPATH);
+
+	LWLockAcquire(&partitionMemory->lock, LW_EXCLUSIVE);
+
+	partition = (InMemoryPartition *) hash_search(partitionMemory->partitionHash,
+												  partitionKey, HASH_FIND,
+												  &handleFound);
+	if (partition != NULL)
+	{
+		DropInMemoryPartition(partitionMemory, partition);
+	}
+
+	LWLockRelease(&partitionMemory->lock);
+}
+
+
+/*
+ * RemoveInMemoryJobPartitions removes all partitions kept in shared memory for
+ * the given job. We call this function when cleaning up the job's resources.
+ */
+void
+RemoveInMemoryJobPartitions(uint64 jobId)
+{
+	PartitionMemoryArea *partitionMemory = WorkerTasksSharedState->partitionMemory;
+	HASH_SEQ_STATUS status;
+	InMemoryPartition *partition = NULL;
+
+	if (partitionMemory == NULL)
+	{
+		return;
+	}
+
+	LWLockAcquire(&partitionMemory->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, partitionMemory->partitionHash);
+
+	partition = (InMemoryPartition *) hash_seq_search(&status);
+	while (partition != NULL)
+	{
+		/* removing the current element during a sequential scan is safe */
+		if (partition->jobId == jobId)
+		{
+			DropInMemoryPartition(partitionMemory, partition);
+		}
+
+		partition = (InMemoryPartition *) hash_seq_search(&status);
+	}
+
+	LWLockRelease(&partitionMemory->lock);
+}
+
+
+/*
+ * ReleaseInMemoryPartition drops a reference to the given partition. If the
+ * partition was removed while we referenced it, and we were the last ones to
+ * reference it, the function frees the partition's blocks and hash entry. Note
+ * that this function expects the caller to hold the area's lock in exclusive
+ * mode.
+ */
+static void
+ReleaseInMemoryPartition(PartitionMemoryArea *partitionMemory,
+						 InMemoryPartition *partition)
+{
+	Assert(partition->referenceCount > 0);
+
+	partition->referenceCount--;
+	if (partition->removed && partition->referenceCount == 0)
+	{
+		FreePartitionBlocks(partitionMemory, partition);
+		hash_search(partitionMemory->partitionHash, partition->filename,
+					HASH_REMOVE, NULL);
+	}
+}
+
+
+/*
+ * DropInMemoryPartition frees the given partition's blocks and hash entry. If
+ * someone still references the partition, the function only hides it from new
+ * readers, and leaves freeing it to the last reference's release. Note that this
+ * function expects the caller to hold the area's lock in exclusive mode.
+ */
+static void
+DropInMemoryPartition(PartitionMemoryArea *partitionMemory, InMemoryPartition *partition)
+{
+	if (partition->referenceCount > 0)
+	{
+		partition->removed = true;
+		return;
+	}
+
+	FreePartitionBlocks(partitionMemory, partition);
+	hash_search(partitionMemory->partitionHash, partition->filename, HASH_REMOVE,
+				NULL);
+}
+
+
+/*
+ * FreePartitionBlocks returns the given partition's blocks to the free list.
+ * Note that this function expects the caller to hold the area's lock in
+ * exclusive mode, and that no one references the partition anymore.
+ */
+static void
+FreePartitionBlocks(PartitionMemoryArea *partitionMemory, InMemoryPartition *partition)
+{
+	int32 blockId = partition->firstBlockId;
+	while (blockId != -1)
+	{
+		int32 nextBlockId = partitionMemory->blockLinkArray[blockId];
+
+		partitionMemory->blockLinkArray[blockId] = partitionMemory->freeBlockId;
+		partitionMemory->freeBlockId = blockId;
+		partitionMemory->freeBlockCount++;
+
+		blockId = nextBlockId;
+	}
+
+	partition->firstBlockId = -1;
+	partition->dataSize = 0;
+}
@@ -0,0 +1,382 @@
+/*-------------------------------------------------------------------------
+ *
+ * semi_join_filter.c
+ *
+ * Repartition joins partition and transfer every row of the tables they join,
+ * even when only a few of these rows find a match on the other side. For inner
+ * joins, the master node may therefore build a Bloom filter over the join keys
+ * of the smaller side, and store this filter in the job directory of the larger
+ * side's repartition job on worker nodes. Map tasks of that job then drop rows
+ * whose keys are not in the filter before they write and transfer them. The
+ * following routines build, store, and probe these filters.
+ *
+ * Copyright (c) 2012-2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/hash.h"
+#include "catalog/pg_am.h"
+#include "distributed/resource_lock.h"
+#include "distributed/semi_join_filter.h"
+#include "distributed/worker_protocol.h"
+#include "executor/spi.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+
+
+/* Local functions forward declarations */
+static SemiJoinFilter * CreateSemiJoinFilter(Oid keyType, uint32 bitCount,
+											 uint8 *bitArray);
+static void SemiJoinFilterAdd(SemiJoinFilter *filter, Datum key);
+static uint32 SemiJoinFilterBit(uint32 firstHash, uint32 secondHash, int hashIndex,
+								uint32 bitCount);
+static StringInfo SemiJoinFilterFilename(uint64 jobId);
+
+
+/* exports for SQL callable functions */
+PG_FUNCTION_INFO_V1(worker_build_semi_join_filter);
+PG_FUNCTION_INFO_V1(worker_store_semi_join_filter);
+
+
+/*
+ * worker_build_semi_join_filter executes the given filter query, and returns a
+ * Bloom filter with the given number of bits over the values of the given key
+ * column in the query's results. Rows with null keys never match in an inner
+ * join, so the function leaves them out of the filter.
+ */
+Datum
+worker_build_semi_join_filter(PG_FUNCTION_ARGS)
+{
+	text *filterQueryText = PG_GETARG_TEXT_P(0);
+	text *keyColumnText = PG_GETARG_TEXT_P(1);
+	Oid keyType = PG_GETARG_OID(2);
+	int32 bitCount = PG_GETARG_INT32(3);
+
+	const char *filterQuery = text_to_cstring(filterQueryText);
+	const char *keyColumnName = text_to_cstring(keyColumnText);
+
+	bytea *filterBytes = NULL;
+	SemiJoinFilter *filter = NULL;
+	uint32 byteCount = 0;
+	Portal queryPortal = NULL;
+	int keyColumnIndex = 0;
+	int connected = 0;
+	int finished = 0;
+
+	const char *noPortalName = NULL;
+	const bool readOnly = true;
+	const bool fetchForward = true;
+	const int noCursorOptions = 0;
+	const int prefetchCount = ROW_PREFETCH_COUNT;
+
+	if (bitCount <= 0 || bitCount % BITS_PER_BYTE != 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("semi-join filter bit count must be a positive "
+							   "multiple of %d", BITS_PER_BYTE)));
+	}
+
+	/* allocate the filter before SPI switches into its own memory context */
+	byteCount = (uint32) bitCount / BITS_PER_BYTE;
+	filterBytes = (bytea *) palloc0(VARHDRSZ + byteCount);
+	SET_VARSIZE(filterBytes, VARHDRSZ + byteCount);
+
+	filter = CreateSemiJoinFilter(keyType, (uint32) bitCount,
+								  (uint8 *) VARDATA(filterBytes));
+
+	connected = SPI_connect();
+	if (connected != SPI_OK_CONNECT)
+	{
+		ereport(ERROR, (errmsg("could not connect to SPI manager")));
+	}
+
+	queryPortal = SPI_cursor_open_with_args(noPortalName, filterQuery,
+											0, NULL, NULL, NULL, /* no arguments */
+											readOnly, noCursorOptions);
+	if (queryPortal == NULL)
+	{
+		ereport(ERROR, (errmsg("could not open implicit cursor for query \"%s\"",
+							   filterQuery)));
+	}
+
+	SPI_cursor_fetch(queryPortal, fetchForward, prefetchCount);
+	if (SPI_processed > 0)
+	{
+		TupleDesc rowDescriptor = SPI_tuptable->tupdesc;
+		Oid keyColumnType = InvalidOid;
+
+		keyColumnIndex = SPI_fnumber(rowDescriptor, keyColumnName);
+		if (keyColumnIndex == SPI_ERROR_NOATTRIBUTE)
+		{
+			ereport(ERROR, (errcode(ERRCODE_UNDEFINED_COLUMN),
+							errmsg("could not find column name \"%s\"", keyColumnName)));
+		}
+
+		keyColumnType = SPI_gettypeid(rowDescriptor, keyColumnIndex);
+		if (keyColumnType != keyType)
+		{
+			ereport(ERROR, (errmsg("key column types %u and %u do not match",
+								   keyColumnType, keyType)));
+		}
+	}
+
+	while (SPI_processed > 0)
+	{
+		int rowIndex = 0;
+		for (rowIndex = 0; rowIndex < SPI_processed; rowIndex++)
+		{
+			HeapTuple row = SPI_tuptable->vals[rowIndex];
+			TupleDesc rowDescriptor = SPI_tuptable->tupdesc;
+			bool keyNull = false;
+
+			Datum key = SPI_getbinval(row, rowDescriptor, keyColumnIndex, &keyNull);
+			if (!keyNull)
+			{
+				SemiJoinFilterAdd(filter, key);
+			}
+		}
+
+		SPI_freetuptable(SPI_tuptable);
+
+		SPI_cursor_fetch(queryPortal, fetchForward, prefetchCount);
+	}
+
+	SPI_cursor_close(queryPortal);
+
+	finished = SPI_finish();
+	if (finished != SPI_OK_FINISH)
+	{
+		ereport(ERROR, (errmsg("could not disconnect from SPI manager")));
+	}
+
+	PG_RETURN_BYTEA_P(filterBytes);
+}
+
+
+/*
+ * worker_store_semi_join_filter writes the given filter into the given job's
+ * directory, from where the job's map tasks load it. The function first writes
+ * the filter into an attempt file, and then renames this file into place; this
+ * way, map tasks either see the complete filter or no filter at all.
+ */
+Datum
+worker_store_semi_join_filter(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+	bytea *filterBytes = PG_GETARG_BYTEA_P(1);
+	uint32 byteCount = VARSIZE(filterBytes) - VARHDRSZ;
+
+	StringInfo jobDirectoryName = JobDirectoryName(jobId);
+	StringInfo filterFilename = SemiJoinFilterFilename(jobId);
+	StringInfo attemptFilename = makeStringInfo();
+	bool jobDirectoryExists = false;
+	File fileDescriptor = 0;
+	int written = 0;
+	int renamed = 0;
+
+	const int fileFlags = (O_CREAT | O_TRUNC | O_WRONLY | PG_BINARY);
+	const int fileMode = (S_IRUSR | S_IWUSR);
+
+	if (byteCount == 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("semi-join filter cannot be empty")));
+	}
+
+	LockJobResource(jobId, AccessExclusiveLock);
+
+	jobDirectoryExists = DirectoryExists(jobDirectoryName);
+	if (!jobDirectoryExists)
+	{
+		CreateDirectory(jobDirectoryName);
+	}
+
+	UnlockJobResource(jobId, AccessExclusiveLock);
+
+	appendStringInfo(attemptFilename, "%s%s", filterFilename->data,
+					 ATTEMPT_FILE_SUFFIX);
+
+	fileDescriptor = PathNameOpenFile(attemptFilename->data, fileFlags, fileMode);
+	if (fileDescriptor < 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m",
+							   attemptFilename->data)));
+	}
+
+	errno = 0;
+	written = FileWrite(fileDescriptor, VARDATA(filterBytes), byteCount);
+	if (written != (int) byteCount)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not write %u bytes to file \"%s\"",
+							   byteCount, attemptFilename->data)));
+	}
+
+	FileClose(fileDescriptor);
+
+	renamed = rename(attemptFilename->data, filterFilename->data);
+	if (renamed != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename file \"%s\" to \"%s\": %m",
+							   attemptFilename->data, filterFilename->data)));
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * LoadSemiJoinFilter reads the semi-join filter that the master node stored for
+ * the given job, and prepares it for probing with keys of the given type. If the
+ * job has no filter on this node, the function returns NULL.
+ */
+SemiJoinFilter *
+LoadSemiJoinFilter(uint64 jobId, Oid keyType)
+{
+	StringInfo filterFilename = SemiJoinFilterFilename(jobId);
+	struct stat fileStat;
+	File fileDescriptor = 0;
+	uint8 *bitArray = NULL;
+	uint32 byteCount = 0;
+	int bytesRead = 0;
+
+	const int fileFlags = (O_RDONLY | PG_BINARY);
+	const int fileMode = (S_IRUSR | S_IWUSR);
+
+	int statOK = stat(filterFilename->data, &fileStat);
+	if (statOK < 0)
+	{
+		if (errno == ENOENT)
+		{
+			return NULL;
+		}
+
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not stat file \"%s\": %m", filterFilename->data)));
+	}
+
+	if (fileStat.st_size <= 0 || fileStat.st_size > MaxAllocSize)
+	{
+		ereport(ERROR, (errmsg("semi-join filter file \"%s\" is corrupt",
+							   filterFilename->data)));
+	}
+
+	byteCount = (uint32) fileStat.st_size;
+	bitArray = palloc(byteCount);
+
+	fileDescriptor = PathNameOpenFile(filterFilename->data, fileFlags, fileMode);
+	if (fileDescriptor < 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", filterFilename->data)));
+	}
+
+	bytesRead = FileRead(fileDescriptor, (char *) bitArray, byteCount);
+	if (bytesRead != (int) byteCount)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not read file \"%s\": %m", filterFilename->data)));
+	}
+
+	FileClose(fileDescriptor);
+
+	return CreateSemiJoinFilter(keyType, byteCount * BITS_PER_BYTE, bitArray);
+}
+
+
+/*
+ * SemiJoinFilterContains checks if the given key may be in the filter. Keys that
+ * were added to the filter are always found; other keys are found with a small
+ * probability that grows as the filter fills up.
+ */
+bool
+SemiJoinFilterContains(SemiJoinFilter *filter, Datum key)
+{
+	uint32 firstHash = DatumGetUInt32(FunctionCall1(filter->hashFunction, key));
+	uint32 secondHash = DatumGetUInt32(hash_uint32(firstHash));
+	int hashIndex = 0;
+
+	for (hashIndex = 0; hashIndex < SEMI_JOIN_FILTER_HASH_COUNT; hashIndex++)
+	{
+		uint32 bit = SemiJoinFilterBit(firstHash, secondHash, hashIndex,
+									   filter->bitCount);
+		if ((filter->bitArray[bit / BITS_PER_BYTE] & (1 << (bit % BITS_PER_BYTE))) == 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * CreateSemiJoinFilter creates a filter over the given bit array, which hashes
+ * keys of the given type.
+ */
+static SemiJoinFilter *
+CreateSemiJoinFilter(Oid keyType, uint32 bitCount, uint8 *bitArray)
+{
+	SemiJoinFilter *filter = palloc0(sizeof(SemiJoinFilter));
+	filter->hashFunction = GetFunctionInfo(keyType, HASH_AM_OID, HASHPROC);
+	filter->bitCount = bitCount;
+	filter->bitArray = bitArray;
+
+	return filter;
+}
+
+
+/* Sets the filter bits for the given key. */
+static void
+SemiJoinFilterAdd(SemiJoinFilter *filter, Datum key)
+{
+	uint32 firstHash = DatumGetUInt32(FunctionCall1(filter->hashFunction, key));
+	uint32 secondHash = DatumGetUInt32(hash_uint32(firstHash));
+	int hashIndex = 0;
+
+	for (hashIndex = 0; hashIndex < SEMI_JOIN_FILTER_HASH_COUNT; hashIndex++)
+	{
+		uint32 bit = SemiJoinFilterBit(firstHash, secondHash, hashIndex,
+									   filter->bitCount);
+		filter->bitArray[bit / BITS_PER_BYTE] |= (1 << (bit % BITS_PER_BYTE));
+	}
+}
+
+
+/*
+ * SemiJoinFilterBit derives the filter bit for the given hash function index
+ * from two hash values, following Kirsch and Mitzenmacher's double hashing
+ * scheme for Bloom filters.
+ */
+static uint32
+SemiJoinFilterBit(uint32 firstHash, uint32 secondHash, int hashIndex, uint32 bitCount)
+{
+	uint64 combinedHash = (uint64) firstHash + (uint64) hashIndex * secondHash;
+	return (uint32) (combinedHash % bitCount);
+}
+
+
+/* Returns the name of the file that holds the given job's semi-join filter. */
+static StringInfo
+SemiJoinFilterFilename(uint64 jobId)
+{
+	StringInfo jobDirectoryName = JobDirectoryName(jobId);
+	StringInfo filterFilename = makeStringInfo();
+
+	appendStringInfo(filterFilename, "%s/%s", jobDirectoryName->data,
+					 SEMI_JOIN_FILTER_FILENAME);
+
+	return filterFilename;
+}
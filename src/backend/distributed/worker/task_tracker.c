@@ -3,11 +3,13 @@
  * task_tracker.c
  *
  * The task tracker background process runs on every worker node. The process
- * wakes up at regular intervals, reads information from a shared hash, and
- * checks if any new tasks are assigned to this node. If they are, the process
- * runs task-specific logic, and sends queries to the postmaster for execution.
- * The task tracker then tracks the execution of these queries, and updates the
- * shared hash with task progress information.
+ * wakes up when new tasks are assigned to it, when one of its running tasks
+ * makes progress, or at the latest after a configured interval. It then reads
+ * information from a shared hash, and checks if any new tasks are assigned to
+ * this node. If they are, the process runs task-specific logic, and sends
+ * queries to the postmaster for execution. The task tracker then tracks the
+ * execution of these queries, and updates the shared hash with task progress
+ * information.
  *
  * The task tracker is started by the postmaster when the startup process
  * finishes. The process remains alive until the postmaster commands it to
@@ -32,6 +34,7 @@
 #include "commands/dbcommands.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/partition_memory.h"
 #include "distributed/task_tracker.h"
 #include "distributed/transmit.h"
 #include "distributed/worker_protocol.h"
@@ -42,10 +45,12 @@
 #include "postmaster/postmaster.h"
 #include "storage/fd.h"
 #include "storage/ipc.h"
+#include "storage/latch.h"
 #include "storage/lwlock.h"
 #include "storage/pmsignal.h"
 #include "storage/proc.h"
 #include "storage/shmem.h"
+#include "storage/spin.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
 
@@ -57,6 +62,18 @@ WorkerTasksSharedStateData *WorkerTasksSharedState; /* shared memory state */
 
 static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 
+/*
+ * TaskShare keeps the number of tasks one job currently runs on this node. The
+ * scheduler uses these counts to share running tasks fairly between users, and
+ * then between the jobs of the same user.
+ */
+typedef struct TaskShare
+{
+	uint64 jobId;
+	char userName[NAMEDATALEN];
+	uint32 runningTaskCount;
+} TaskShare;
+
 /* Flags set by interrupt handlers for later service in the main loop */
 static volatile sig_atomic_t got_SIGHUP = false;
 static volatile sig_atomic_t got_SIGTERM = false;
@@ -74,18 +91,28 @@ static void TrackerShutdownHandler(SIGNAL_ARGS);
 static void TrackerCleanupJobDirectories(void);
 static void TrackerCleanupJobSchemas(void);
 static void TrackerCleanupConnections(HTAB *WorkerTasksHash);
+static void TrackerRegisterLatch(void);
 static void TrackerRegisterShutDown(HTAB *WorkerTasksHash);
-static void TrackerDelayLoop(void);
+static void TrackerDelayLoop(HTAB *WorkerTasksHash);
 static List * SchedulableTaskList(HTAB *WorkerTasksHash);
 static WorkerTask * SchedulableTaskPriorityQueue(HTAB *WorkerTasksHash);
 static uint32 CountTasksMatchingCriteria(HTAB *WorkerTasksHash,
 										 bool (*CriteriaFunction)(WorkerTask *));
 static bool RunningTask(WorkerTask *workerTask);
 static bool SchedulableTask(WorkerTask *workerTask);
+static List * RunningTaskShareList(HTAB *WorkerTasksHash);
+static List * AddTaskShare(List *taskShareList, WorkerTask *workerTask);
+static uint32 JobRunningTaskCount(List *taskShareList, uint64 jobId);
+static uint32 UserRunningTaskCount(List *taskShareList, const char *userName);
+static int32 NextFairShareTaskIndex(WorkerTask *taskQueue, uint32 queueSize,
+									bool *taskSelectedArray, List *taskShareList);
+static int CompareTaskPriorityLevels(WorkerTask *firstTask, WorkerTask *secondTask);
+static int CompareTasksByPriority(const void *first, const void *second);
 static int CompareTasksByTime(const void *first, const void *second);
 static void ScheduleWorkerTasks(HTAB *WorkerTasksHash, List *schedulableTaskList);
 static void ManageWorkerTasksHash(HTAB *WorkerTasksHash);
 static void ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash);
+static void ManageTaskWorker(WorkerTask *workerTask);
 static void RemoveWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash);
 static void CreateJobDirectoryIfNotExists(uint64 jobId);
 static int32 ConnectToLocalBackend(const char *databaseName, const char *userName);
@@ -211,17 +238,21 @@ TaskTrackerMain(Datum main_arg)
 		TrackerCleanupJobSchemas();
 	}
 
+	/* let task protocol processes know how to wake us up */
+	TrackerRegisterLatch();
+
 	/* Loop forever */
 	for (;;)
 	{
+		/*
+		 * Clear any pending wake-up requests before looking at the shared hash.
+		 * Requests that arrive after this point end our next wait right away.
+		 */
+		ResetLatch(&MyProc->procLatch);
+
 		/*
 		 * Emergency bailout if postmaster has died. This is to avoid the
 		 * necessity for manual cleanup of all postmaster children.
-		 *
-		 * XXX: Note that PostgreSQL background processes no longer nap between
-		 * their loops, but instead uses latches to wake up when necessary. We
-		 * should switch to using latches in here too, and have the task tracker
-		 * assign function notify us when there is a new task.
 		 */
 		if (!PostmasterIsAlive())
 		{
@@ -257,8 +288,8 @@ TaskTrackerMain(Datum main_arg)
 		/* Call the function that does the actual work */
 		ManageWorkerTasksHash(WorkerTasksSharedState->taskHash);
 
-		/* Sleep for the configured time */
-		TrackerDelayLoop();
+		/* Sleep until woken up, or at most for the configured time */
+		TrackerDelayLoop(WorkerTasksSharedState->taskHash);
 	}
 }
 
@@ -324,6 +355,20 @@ WorkerTasksHashFind(uint64 jobId, uint32 taskId)
 }
 
 
+/*
+ * AdvanceTaskStatusSequence advances the shared task status sequence, and stamps
+ * the given task with the new value. The master node uses these values to only
+ * fetch statuses of tasks that changed since its last status check. Note that
+ * the caller needs to hold an exclusive lock over the shared hash.
+ */
+void
+AdvanceTaskStatusSequence(WorkerTask *workerTask)
+{
+	WorkerTasksSharedState->taskStatusSequence++;
+	workerTask->statusSequence = WorkerTasksSharedState->taskStatusSequence;
+}
+
+
 /*
  * TrackerCleanupJobDirectories cleans up all files in the job cache directory
  * as part of this process's start-up logic. The task tracker process manages
@@ -388,6 +433,7 @@ TrackerCleanupJobSchemas(void)
 		 */
 		cleanupTask = WorkerTasksHashEnter(jobId, taskIndex);
 		cleanupTask->assignedAt = HIGH_PRIORITY_TASK_TIME;
+		cleanupTask->priority = 0;
 		cleanupTask->taskStatus = TASK_ASSIGNED;
 
 		strlcpy(cleanupTask->taskCallString, JOB_SCHEMA_CLEANUP, TASK_CALL_STRING_SIZE);
@@ -395,7 +441,9 @@ TrackerCleanupJobSchemas(void)
 
 		/* zero out all other fields */
 		cleanupTask->connectionId = INVALID_CONNECTION_ID;
+		cleanupTask->workerSlotId = INVALID_TASK_WORKER_SLOT;
 		cleanupTask->failureCount = 0;
+		cleanupTask->statusSequence = 0;
 
 		taskIndex++;
 	}
@@ -436,6 +484,41 @@ TrackerCleanupConnections(HTAB *WorkerTasksHash)
 }
 
 
+/*
+ * TrackerRegisterLatch publishes the task tracker's latch in shared memory. Task
+ * protocol processes set this latch through WakeupTaskTracker() to have us look
+ * at the shared hash without waiting for the task tracker delay to elapse.
+ */
+static void
+TrackerRegisterLatch(void)
+{
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_EXCLUSIVE);
+	WorkerTasksSharedState->taskTrackerLatch = &MyProc->procLatch;
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+}
+
+
+/*
+ * WakeupTaskTracker sets the task tracker's latch, if the task tracker has one
+ * registered. Task protocol processes call this function after they change the
+ * shared hash in a way that needs the task tracker's attention.
+ */
+void
+WakeupTaskTracker(void)
+{
+	Latch *taskTrackerLatch = NULL;
+
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_SHARED);
+	taskTrackerLatch = WorkerTasksSharedState->taskTrackerLatch;
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+	if (taskTrackerLatch != NULL)
+	{
+		SetLatch(taskTrackerLatch);
+	}
+}
+
+
 /*
  * TrackerRegisterShutDown enters a special marker task to the shared hash. This
  * marker task indicates to "task protocol processes" that we are shutting down
@@ -453,36 +536,71 @@ TrackerRegisterShutDown(HTAB *WorkerTasksHash)
 	shutdownMarkerTask = WorkerTasksHashEnter(jobId, taskId);
 	shutdownMarkerTask->taskStatus = TASK_SUCCEEDED;
 	shutdownMarkerTask->connectionId = INVALID_CONNECTION_ID;
+	shutdownMarkerTask->workerSlotId = INVALID_TASK_WORKER_SLOT;
+	shutdownMarkerTask->statusSequence = 0;
+
+	WorkerTasksSharedState->taskTrackerLatch = NULL;
 
 	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
 }
 
 
-/* Sleeps either for the configured time or until a signal is received. */
+/*
+ * TrackerDelayLoop sleeps for at most the configured time. The sleep ends early
+ * when our latch is set, either by a signal handler or by a task protocol
+ * process that assigned or canceled a task. On PostgreSQL 9.6 and later, we also
+ * wait on the connections of running tasks, so that we learn about finished
+ * tasks as soon as their local backends respond.
+ */
 static void
-TrackerDelayLoop(void)
+TrackerDelayLoop(HTAB *WorkerTasksHash)
 {
-	const long SignalCheckInterval = 1000000L; /* check signal every second */
+	long trackerDelay = (long) TaskTrackerDelay;
 
-	/*
-	 * On some platforms, signals do not interrupt the sleep. To ensure we
-	 * respond promptly when someone signals us, we break down the sleep into
-	 * 1-second increments, and check for interrupts after each nap.
-	 */
-	long trackerDelay = TaskTrackerDelay * 1000L;
-	while (trackerDelay > (SignalCheckInterval - 1))
+#if (PG_VERSION_NUM >= 90600)
+	HASH_SEQ_STATUS status;
+	WorkerTask *currentTask = NULL;
+	WaitEventSet *waitEventSet = NULL;
+	WaitEvent occurredEvent;
+	uint32 runningTaskCount = 0;
+
+	/* collect sockets of running tasks, which all use our own connections */
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_SHARED);
+
+	runningTaskCount = CountTasksMatchingCriteria(WorkerTasksHash, &RunningTask);
+	waitEventSet = CreateWaitEventSet(CurrentMemoryContext, runningTaskCount + 2);
+
+	AddWaitEventToSet(waitEventSet, WL_LATCH_SET, PGINVALID_SOCKET,
+					  &MyProc->procLatch, NULL);
+	AddWaitEventToSet(waitEventSet, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+
+	hash_seq_init(&status, WorkerTasksHash);
+
+	currentTask = (WorkerTask *) hash_seq_search(&status);
+	while (currentTask != NULL)
 	{
-		if (got_SIGHUP || got_SIGTERM)
+		if (RunningTask(currentTask) &&
+			currentTask->connectionId != INVALID_CONNECTION_ID)
 		{
-			break;
+			int taskSocket = MultiClientSocket(currentTask->connectionId);
+			if (taskSocket != PGINVALID_SOCKET)
+			{
+				AddWaitEventToSet(waitEventSet, WL_SOCKET_READABLE, taskSocket,
+								  NULL, NULL);
+			}
 		}
-		pg_usleep(SignalCheckInterval);
-		trackerDelay -= SignalCheckInterval;
-	}
-	if (!(got_SIGHUP || got_SIGTERM))
-	{
-		pg_usleep(trackerDelay);
+
+		currentTask = (WorkerTask *) hash_seq_search(&status);
 	}
+
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+	WaitEventSetWait(waitEventSet, trackerDelay, &occurredEvent, 1);
+	FreeWaitEventSet(waitEventSet);
+#else
+	(void) WaitLatch(&MyProc->procLatch,
+					 WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, trackerDelay);
+#endif
 }
 
 
@@ -535,6 +653,9 @@ TaskTrackerShmemSize(void)
 	hashSize = hash_estimate_size(MaxTrackedTasksPerNode, sizeof(WorkerTask));
 	size = add_size(size, hashSize);
 
+	size = add_size(size, TaskWorkerShmemSize());
+	size = add_size(size, PartitionMemoryShmemSize());
+
 	return size;
 }
 
@@ -588,6 +709,15 @@ TaskTrackerShmemInit(void)
 		LWLockRegisterTranche(WorkerTasksSharedState->taskHashTrancheId, tranche);
 		LWLockInitialize(&WorkerTasksSharedState->taskHashLock,
 						 WorkerTasksSharedState->taskHashTrancheId);
+
+		/* the task tracker registers its latch once it starts running */
+		WorkerTasksSharedState->taskTrackerLatch = NULL;
+		WorkerTasksSharedState->taskStatusSequence = 0;
+
+		SpinLockInit(&WorkerTasksSharedState->compressionStatisticsMutex);
+		WorkerTasksSharedState->compressedBlockCount = 0;
+		WorkerTasksSharedState->uncompressedByteCount = 0;
+		WorkerTasksSharedState->compressedByteCount = 0;
 	}
 
 	/*  allocate hash table */
@@ -596,6 +726,12 @@ TaskTrackerShmemInit(void)
 					  initTableSize, maxTableSize,
 					  &info, hashFlags);
 
+	/* allocate slots for the pool of background workers running tasks */
+	TaskWorkerShmemInit();
+
+	/* allocate shared memory for keeping small partitions */
+	PartitionMemoryShmemInit();
+
 	LWLockRelease(AddinShmemInitLock);
 
 	Assert(WorkerTasksSharedState->taskHash != NULL);
@@ -616,19 +752,24 @@ TaskTrackerShmemInit(void)
 /*
  * SchedulableTaskList calculates the number of tasks to schedule at this given
  * moment, and creates a deep-copied list containing that many tasks. The tasks
- * in the list are sorted according to a priority criteria, currently the task's
- * assignment time. Note that this function expects the caller to hold a read
- * lock over the shared hash.
+ * are picked in priority order: tasks with higher priority always come first.
+ * Among tasks of the same priority, we pick tasks of the user with the fewest
+ * running tasks, then of the job with the fewest running tasks, and finally by
+ * assignment time. This way, one large job cannot starve other jobs on this
+ * node. Note that this function expects the caller to hold a read lock over
+ * the shared hash.
  */
 static List *
 SchedulableTaskList(HTAB *WorkerTasksHash)
 {
 	List *schedulableTaskList = NIL;
 	WorkerTask *schedulableTaskQueue = NULL;
+	List *taskShareList = NIL;
+	bool *taskSelectedArray = NULL;
 	uint32 runningTaskCount = 0;
 	uint32 schedulableTaskCount = 0;
 	uint32 tasksToScheduleCount = 0;
-	uint32 queueIndex = 0;
+	uint32 scheduledTaskIndex = 0;
 
 	runningTaskCount = CountTasksMatchingCriteria(WorkerTasksHash, &RunningTask);
 	if (runningTaskCount >= MaxRunningTasksPerNode)
@@ -651,22 +792,190 @@ SchedulableTaskList(HTAB *WorkerTasksHash)
 	/* get all schedulable tasks ordered according to a priority criteria */
 	schedulableTaskQueue = SchedulableTaskPriorityQueue(WorkerTasksHash);
 
-	for (queueIndex = 0; queueIndex < tasksToScheduleCount; queueIndex++)
+	/* get each job's share of running tasks, and add to it as we pick tasks */
+	taskShareList = RunningTaskShareList(WorkerTasksHash);
+	taskSelectedArray = (bool *) palloc0(sizeof(bool) * schedulableTaskCount);
+
+	for (scheduledTaskIndex = 0; scheduledTaskIndex < tasksToScheduleCount;
+		 scheduledTaskIndex++)
 	{
-		WorkerTask *schedulableTask = (WorkerTask *) palloc0(sizeof(WorkerTask));
-		schedulableTask->jobId = schedulableTaskQueue[queueIndex].jobId;
-		schedulableTask->taskId = schedulableTaskQueue[queueIndex].taskId;
+		WorkerTask *schedulableTask = NULL;
+		WorkerTask *queuedTask = NULL;
+		int32 queueIndex = NextFairShareTaskIndex(schedulableTaskQueue,
+												  schedulableTaskCount,
+												  taskSelectedArray, taskShareList);
+		Assert(queueIndex >= 0);
+
+		queuedTask = &schedulableTaskQueue[queueIndex];
+		taskSelectedArray[queueIndex] = true;
+		taskShareList = AddTaskShare(taskShareList, queuedTask);
+
+		schedulableTask = (WorkerTask *) palloc0(sizeof(WorkerTask));
+		schedulableTask->jobId = queuedTask->jobId;
+		schedulableTask->taskId = queuedTask->taskId;
 
 		schedulableTaskList = lappend(schedulableTaskList, schedulableTask);
 	}
 
-	/* free priority queue */
+	/* free priority queue and task shares */
 	pfree(schedulableTaskQueue);
+	pfree(taskSelectedArray);
+	list_free_deep(taskShareList);
 
 	return schedulableTaskList;
 }
 
 
+/*
+ * RunningTaskShareList walks over the shared hash, and returns a list with the
+ * number of running tasks for each job that has running tasks.
+ */
+static List *
+RunningTaskShareList(HTAB *WorkerTasksHash)
+{
+	HASH_SEQ_STATUS status;
+	WorkerTask *currentTask = NULL;
+	List *taskShareList = NIL;
+
+	hash_seq_init(&status, WorkerTasksHash);
+
+	currentTask = (WorkerTask *) hash_seq_search(&status);
+	while (currentTask != NULL)
+	{
+		if (RunningTask(currentTask))
+		{
+			taskShareList = AddTaskShare(taskShareList, currentTask);
+		}
+
+		currentTask = (WorkerTask *) hash_seq_search(&status);
+	}
+
+	return taskShareList;
+}
+
+
+/* Adds the given task to the running task count of its job. */
+static List *
+AddTaskShare(List *taskShareList, WorkerTask *workerTask)
+{
+	TaskShare *taskShare = NULL;
+	ListCell *taskShareCell = NULL;
+
+	foreach(taskShareCell, taskShareList)
+	{
+		TaskShare *existingShare = (TaskShare *) lfirst(taskShareCell);
+		if (existingShare->jobId == workerTask->jobId)
+		{
+			taskShare = existingShare;
+			break;
+		}
+	}
+
+	if (taskShare == NULL)
+	{
+		taskShare = (TaskShare *) palloc0(sizeof(TaskShare));
+		taskShare->jobId = workerTask->jobId;
+		strlcpy(taskShare->userName, workerTask->userName, NAMEDATALEN);
+
+		taskShareList = lappend(taskShareList, taskShare);
+	}
+
+	taskShare->runningTaskCount++;
+
+	return taskShareList;
+}
+
+
+/* Returns the number of running tasks for the given job. */
+static uint32
+JobRunningTaskCount(List *taskShareList, uint64 jobId)
+{
+	ListCell *taskShareCell = NULL;
+
+	foreach(taskShareCell, taskShareList)
+	{
+		TaskShare *taskShare = (TaskShare *) lfirst(taskShareCell);
+		if (taskShare->jobId == jobId)
+		{
+			return taskShare->runningTaskCount;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Returns the number of running tasks across all jobs of the given user. */
+static uint32
+UserRunningTaskCount(List *taskShareList, const char *userName)
+{
+	ListCell *taskShareCell = NULL;
+	uint32 runningTaskCount = 0;
+
+	foreach(taskShareCell, taskShareList)
+	{
+		TaskShare *taskShare = (TaskShare *) lfirst(taskShareCell);
+		if (strncmp(taskShare->userName, userName, NAMEDATALEN) == 0)
+		{
+			runningTaskCount += taskShare->runningTaskCount;
+		}
+	}
+
+	return runningTaskCount;
+}
+
+
+/*
+ * NextFairShareTaskIndex returns the index of the next task to schedule from
+ * the given priority queue, skipping tasks that are already selected. Since the
+ * queue is sorted by priority and then by assignment time, the function only
+ * looks at tasks with the highest remaining priority, and picks the task whose
+ * user and then job have the fewest running tasks. Ties go to the task that was
+ * assigned first.
+ */
+static int32
+NextFairShareTaskIndex(WorkerTask *taskQueue, uint32 queueSize,
+					   bool *taskSelectedArray, List *taskShareList)
+{
+	int32 nextTaskIndex = -1;
+	uint32 nextUserTaskCount = 0;
+	uint32 nextJobTaskCount = 0;
+	uint32 queueIndex = 0;
+
+	for (queueIndex = 0; queueIndex < queueSize; queueIndex++)
+	{
+		WorkerTask *queuedTask = &taskQueue[queueIndex];
+		uint32 userTaskCount = 0;
+		uint32 jobTaskCount = 0;
+
+		if (taskSelectedArray[queueIndex])
+		{
+			continue;
+		}
+
+		/* remaining tasks have lower priority than our current pick */
+		if (nextTaskIndex >= 0 &&
+			CompareTaskPriorityLevels(queuedTask, &taskQueue[nextTaskIndex]) != 0)
+		{
+			break;
+		}
+
+		userTaskCount = UserRunningTaskCount(taskShareList, queuedTask->userName);
+		jobTaskCount = JobRunningTaskCount(taskShareList, queuedTask->jobId);
+
+		if (nextTaskIndex < 0 || userTaskCount < nextUserTaskCount ||
+			(userTaskCount == nextUserTaskCount && jobTaskCount < nextJobTaskCount))
+		{
+			nextTaskIndex = (int32) queueIndex;
+			nextUserTaskCount = userTaskCount;
+			nextJobTaskCount = jobTaskCount;
+		}
+	}
+
+	return nextTaskIndex;
+}
+
+
 /*
  * SchedulableTaskPriorityQueue allocates an array containing all schedulable
  * tasks in the shared hash, orders these tasks according to a sorting criteria,
@@ -699,10 +1008,13 @@ SchedulableTaskPriorityQueue(HTAB *WorkerTasksHash)
 	{
 		if (SchedulableTask(currentTask))
 		{
-			/* tasks in the priority queue only need the first three fields */
+			/* tasks in the priority queue only need their scheduling fields */
 			priorityQueue[queueIndex].jobId = currentTask->jobId;
 			priorityQueue[queueIndex].taskId = currentTask->taskId;
 			priorityQueue[queueIndex].assignedAt = currentTask->assignedAt;
+			priorityQueue[queueIndex].priority = currentTask->priority;
+			strlcpy(priorityQueue[queueIndex].userName, currentTask->userName,
+					NAMEDATALEN);
 
 			queueIndex++;
 		}
@@ -711,7 +1023,7 @@ SchedulableTaskPriorityQueue(HTAB *WorkerTasksHash)
 	}
 
 	/* now order elements in the queue according to our sorting criterion */
-	qsort(priorityQueue, queueSize, sizeof(WorkerTask), CompareTasksByTime);
+	qsort(priorityQueue, queueSize, sizeof(WorkerTask), CompareTasksByPriority);
 
 	return priorityQueue;
 }
@@ -772,6 +1084,51 @@ SchedulableTask(WorkerTask *workerTask)
 }
 
 
+/*
+ * CompareTaskPriorityLevels compares two worker tasks by their priorities. High
+ * priority clean up tasks come first, followed by tasks with higher priorities
+ * assigned by the master node.
+ */
+static int
+CompareTaskPriorityLevels(WorkerTask *firstTask, WorkerTask *secondTask)
+{
+	bool firstHighPriority = (firstTask->assignedAt == HIGH_PRIORITY_TASK_TIME);
+	bool secondHighPriority = (secondTask->assignedAt == HIGH_PRIORITY_TASK_TIME);
+
+	if (firstHighPriority != secondHighPriority)
+	{
+		return firstHighPriority ? -1 : 1;
+	}
+
+	if (firstTask->priority != secondTask->priority)
+	{
+		return (firstTask->priority > secondTask->priority) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Comparison function to compare two worker tasks by their priorities, and then
+ * by their assignment times.
+ */
+static int
+CompareTasksByPriority(const void *first, const void *second)
+{
+	WorkerTask *firstTask = (WorkerTask *) first;
+	WorkerTask *secondTask = (WorkerTask *) second;
+
+	int priorityDiff = CompareTaskPriorityLevels(firstTask, secondTask);
+	if (priorityDiff != 0)
+	{
+		return priorityDiff;
+	}
+
+	return CompareTasksByTime(first, second);
+}
+
+
 /* Comparison function to compare two worker tasks by their assignment times. */
 static int
 CompareTasksByTime(const void *first, const void *second)
@@ -823,6 +1180,7 @@ ScheduleWorkerTasks(HTAB *WorkerTasksHash, List *schedulableTaskList)
 			Assert(SchedulableTask(taskToSchedule));
 
 			taskToSchedule->taskStatus = TASK_SCHEDULED;
+			AdvanceTaskStatusSequence(taskToSchedule);
 		}
 		else
 		{
@@ -862,8 +1220,16 @@ ManageWorkerTasksHash(HTAB *WorkerTasksHash)
 	currentTask = (WorkerTask *) hash_seq_search(&status);
 	while (currentTask != NULL)
 	{
+		TaskStatus previousStatus = currentTask->taskStatus;
+
 		ManageWorkerTask(currentTask, WorkerTasksHash);
 
+		/* let the master node pick up the status change on its next poll */
+		if (currentTask->taskStatus != previousStatus)
+		{
+			AdvanceTaskStatusSequence(currentTask);
+		}
+
 		/*
 		 * Typically, we delete worker tasks in the task tracker protocol
 		 * process. This task however was canceled mid-query, and the protocol
@@ -877,6 +1243,9 @@ ManageWorkerTasksHash(HTAB *WorkerTasksHash)
 		currentTask = (WorkerTask *) hash_seq_search(&status);
 	}
 
+	/* release background workers whose tasks are gone or who exited */
+	ReclaimTaskWorkers();
+
 	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
 }
 
@@ -884,8 +1253,11 @@ ManageWorkerTasksHash(HTAB *WorkerTasksHash)
 /*
  * ManageWorkerTask manages the execution of the worker task. More specifically,
  * the function connects to a local backend, sends the query associated with the
- * task, and oversees the query's execution. Note that this function expects the
- * caller to hold an exclusive lock over the shared hash.
+ * task, and oversees the query's execution. If a pool of background workers is
+ * configured, the function instead hands the task to one of these workers, and
+ * only falls back to a local backend connection if no worker is available. Note
+ * that this function expects the caller to hold an exclusive lock over the
+ * shared hash.
  */
 static void
 ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
@@ -902,7 +1274,15 @@ ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 			/* create the job output directory if it does not exist */
 			CreateJobDirectoryIfNotExists(workerTask->jobId);
 
-			/* the task is ready to run; connect to local backend */
+			/* the task is ready to run; try to hand it to a background worker */
+			workerTask->workerSlotId = AssignTaskWorker(workerTask);
+			if (workerTask->workerSlotId != INVALID_TASK_WORKER_SLOT)
+			{
+				workerTask->taskStatus = TASK_RUNNING;
+				break;
+			}
+
+			/* otherwise connect to local backend */
 			workerTask->connectionId = ConnectToLocalBackend(workerTask->databaseName,
 															 workerTask->userName);
 
@@ -935,7 +1315,15 @@ ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 		case TASK_RUNNING:
 		{
 			int32 connectionId = workerTask->connectionId;
-			ResultStatus resultStatus = MultiClientResultStatus(connectionId);
+			ResultStatus resultStatus = CLIENT_INVALID_RESULT_STATUS;
+
+			if (workerTask->workerSlotId != INVALID_TASK_WORKER_SLOT)
+			{
+				ManageTaskWorker(workerTask);
+				break;
+			}
+
+			resultStatus = MultiClientResultStatus(connectionId);
 
 			/* check if query results are ready, in progress, or unavailable */
 			if (resultStatus == CLIENT_RESULT_READY)
@@ -1019,6 +1407,10 @@ ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 					MultiClientCancel(connectionId);
 				}
 			}
+			else if (workerTask->workerSlotId != INVALID_TASK_WORKER_SLOT)
+			{
+				CancelTaskWorker(workerTask->workerSlotId);
+			}
 
 			/* give the backend some time to flush its response */
 			workerTask->taskStatus = TASK_CANCELED;
@@ -1033,6 +1425,9 @@ ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 				workerTask->connectionId = INVALID_CONNECTION_ID;
 			}
 
+			/* the background worker gets released once it finishes the task */
+			workerTask->workerSlotId = INVALID_TASK_WORKER_SLOT;
+
 			workerTask->taskStatus = TASK_TO_REMOVE;
 			break;
 		}
@@ -1050,6 +1445,36 @@ ManageWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
 }
 
 
+/*
+ * ManageTaskWorker checks whether the background worker running the given task
+ * has finished it, and if so, records the task's outcome and releases the
+ * background worker for the next task.
+ */
+static void
+ManageTaskWorker(WorkerTask *workerTask)
+{
+	int32 workerSlotId = workerTask->workerSlotId;
+	TaskWorkerState workerState = TaskWorkerSlotState(workerSlotId);
+
+	if (workerState == TASK_WORKER_SUCCEEDED)
+	{
+		workerTask->taskStatus = TASK_SUCCEEDED;
+	}
+	else if (workerState == TASK_WORKER_FAILED)
+	{
+		workerTask->taskStatus = TASK_FAILED;
+		workerTask->failureCount++;
+	}
+	else
+	{
+		return;  /* the task is still running */
+	}
+
+	ReleaseTaskWorker(workerSlotId);
+	workerTask->workerSlotId = INVALID_TASK_WORKER_SLOT;
+}
+
+
 /* Wrapper function to remove the worker task from the shared hash. */
 static void
 RemoveWorkerTask(WorkerTask *workerTask, HTAB *WorkerTasksHash)
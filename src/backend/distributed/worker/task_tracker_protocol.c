@@ -19,39 +19,87 @@
 
 #include <time.h>
 
+#include "access/htup_details.h"
 #include "access/xact.h"
+#include "catalog/pg_type.h"
 #include "commands/dbcommands.h"
 #include "commands/schemacmds.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/partition_memory.h"
 #include "distributed/resource_lock.h"
 #include "distributed/task_tracker.h"
 #include "distributed/task_tracker_protocol.h"
 #include "distributed/worker_protocol.h"
 #include "storage/lwlock.h"
 #include "storage/pmsignal.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/tuplestore.h"
+
+
+/* Set when the task tracker needs to be woken up at the end of the transaction */
+static bool taskTrackerWakeupPending = false;
+static bool wakeupCallbackRegistered = false;
 
 
 /* Local functions forward declarations */
 static bool TaskTrackerRunning(void);
+static void WakeupTaskTrackerAtXactEnd(void);
+static void TaskTrackerWakeupCallback(XactEvent event, void *arg);
 static void CreateJobSchema(StringInfo schemaName);
-static void CreateTask(uint64 jobId, uint32 taskId, char *taskCallString);
-static void UpdateTask(WorkerTask *workerTask, char *taskCallString);
+static void CreateTask(uint64 jobId, uint32 taskId, char *taskCallString,
+					   int32 taskPriority);
+static void UpdateTask(WorkerTask *workerTask, char *taskCallString,
+					   int32 taskPriority);
 static void CleanupTask(WorkerTask *workerTask);
+static List * JobTaskCountsList(void);
+static List * ChangedTaskStatusList(Datum *jobIdArray, int32 jobIdCount,
+									uint64 sinceSequence);
 
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(task_tracker_assign_task);
 PG_FUNCTION_INFO_V1(task_tracker_task_status);
 PG_FUNCTION_INFO_V1(task_tracker_cleanup_job);
+PG_FUNCTION_INFO_V1(task_tracker_job_task_counts);
+PG_FUNCTION_INFO_V1(task_tracker_task_statuses);
+
+
+/*
+ * JobTaskCounts keeps the number of running and queued tasks for one job, as
+ * reported by task_tracker_job_task_counts().
+ */
+typedef struct JobTaskCounts
+{
+	uint64 jobId;
+	char userName[NAMEDATALEN];
+	uint32 runningTaskCount;
+	uint32 queuedTaskCount;
+} JobTaskCounts;
+
+
+/*
+ * ChangedTaskStatus keeps the status of one task whose status changed since the
+ * sequence number passed to task_tracker_task_statuses().
+ */
+typedef struct ChangedTaskStatus
+{
+	uint64 jobId;
+	uint32 taskId;
+	TaskStatus taskStatus;
+	uint64 statusSequence;
+} ChangedTaskStatus;
 
 
 /*
  * task_tracker_assign_task creates a new task in the shared hash or updates an
  * already existing task. The function also creates a schema for the job if it
- * doesn't already exist.
+ * doesn't already exist. The optional fourth argument sets the task's scheduling
+ * priority; tasks with higher priority get scheduled first. Only superusers may
+ * assign tasks with a priority other than the default, since these tasks take
+ * precedence over other users' tasks.
  */
 Datum
 task_tracker_assign_task(PG_FUNCTION_ARGS)
@@ -59,6 +107,7 @@ task_tracker_assign_task(PG_FUNCTION_ARGS)
 	uint64 jobId = PG_GETARG_INT64(0);
 	uint32 taskId = PG_GETARG_UINT32(1);
 	text *taskCallStringText = PG_GETARG_TEXT_P(2);
+	int32 taskPriority = DEFAULT_TASK_PRIORITY;
 
 	StringInfo jobSchemaName = JobSchemaName(jobId);
 	bool schemaExists = false;
@@ -67,6 +116,24 @@ task_tracker_assign_task(PG_FUNCTION_ARGS)
 	char *taskCallString = text_to_cstring(taskCallStringText);
 	uint32 taskCallStringLength = strlen(taskCallString);
 
+	if (PG_NARGS() > 3)
+	{
+		taskPriority = PG_GETARG_INT32(3);
+	}
+
+	if (taskPriority < MIN_TASK_PRIORITY || taskPriority > MAX_TASK_PRIORITY)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("task priority must be between %d and %d",
+							   MIN_TASK_PRIORITY, MAX_TASK_PRIORITY)));
+	}
+
+	if (taskPriority != DEFAULT_TASK_PRIORITY && !superuser())
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+						errmsg("must be superuser to assign a task priority")));
+	}
+
 	/* check that we have a running task tracker on this host */
 	bool taskTrackerRunning = TaskTrackerRunning();
 	if (!taskTrackerRunning)
@@ -106,15 +173,22 @@ task_tracker_assign_task(PG_FUNCTION_ARGS)
 	workerTask = WorkerTasksHashFind(jobId, taskId);
 	if (workerTask == NULL)
 	{
-		CreateTask(jobId, taskId, taskCallString);
+		CreateTask(jobId, taskId, taskCallString, taskPriority);
 	}
 	else
 	{
-		UpdateTask(workerTask, taskCallString);
+		UpdateTask(workerTask, taskCallString, taskPriority);
 	}
 
 	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
 
+	/*
+	 * The task may need the job schema we created above, and this schema only
+	 * becomes visible once our transaction commits. We therefore wake up the
+	 * task tracker at transaction end instead of right away.
+	 */
+	WakeupTaskTrackerAtXactEnd();
+
 	PG_RETURN_VOID();
 }
 
@@ -191,6 +265,12 @@ task_tracker_cleanup_job(PG_FUNCTION_ARGS)
 
 	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
 
+	/* have the task tracker cancel running tasks without delay */
+	WakeupTaskTracker();
+
+	/* free the shared memory that kept the job's partitions */
+	RemoveInMemoryJobPartitions(jobId);
+
 	/*
 	 * We then delete the job directory and schema, if they exist. This cleans
 	 * up all intermediate files and tables allocated for the job. Note that the
@@ -209,6 +289,299 @@ task_tracker_cleanup_job(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * task_tracker_job_task_counts returns the number of running and queued tasks
+ * for each job in the task tracker's shared hash, along with the user who
+ * assigned the job's tasks. Tasks count as queued until the task tracker starts
+ * running them.
+ */
+Datum
+task_tracker_job_task_counts(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx = NULL;
+	MemoryContext oldcontext = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	List *jobTaskCountsList = NIL;
+	ListCell *jobTaskCountsCell = NULL;
+	bool nulls[4] = { false, false, false, false };
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+	}
+
+	if (!TaskTrackerRunning())
+	{
+		ereport(ERROR, (errcode(ERRCODE_CANNOT_CONNECT_NOW),
+						errmsg("the task tracker has been disabled or shut down")));
+	}
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* get the requested return tuple description */
+	tupleDescriptor = CreateTupleDescCopy(rsinfo->expectedDesc);
+	if (tupleDescriptor->natts != 4 ||
+		tupleDescriptor->attrs[0]->atttypid != INT8OID ||
+		tupleDescriptor->attrs[1]->atttypid != TEXTOID ||
+		tupleDescriptor->attrs[2]->atttypid != INT4OID ||
+		tupleDescriptor->attrs[3]->atttypid != INT4OID)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_COLUMN_DEFINITION),
+				 errmsg("query-specified return tuple and "
+						"function return type are not compatible")));
+	}
+
+	jobTaskCountsList = JobTaskCountsList();
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	foreach(jobTaskCountsCell, jobTaskCountsList)
+	{
+		JobTaskCounts *jobTaskCounts = (JobTaskCounts *) lfirst(jobTaskCountsCell);
+		Datum values[4];
+		HeapTuple tuple = NULL;
+
+		values[0] = Int64GetDatum(jobTaskCounts->jobId);
+		values[1] = PointerGetDatum(cstring_to_text(jobTaskCounts->userName));
+		values[2] = Int32GetDatum(jobTaskCounts->runningTaskCount);
+		values[3] = Int32GetDatum(jobTaskCounts->queuedTaskCount);
+
+		tuple = heap_form_tuple(tupleDescriptor, values, nulls);
+		tuplestore_puttuple(tupleStore, tuple);
+		heap_freetuple(tuple);
+	}
+	tuplestore_donestoring(tupleStore);
+
+	/* let the caller know we're sending back a tuplestore */
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDescriptor;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * task_tracker_task_statuses returns the statuses of all tasks that belong to
+ * the given jobs, and whose statuses changed after the given status sequence
+ * number. The master node uses this function to check the statuses of many
+ * tasks in one round trip; it passes the highest status sequence number it has
+ * seen so far, and therefore only receives statuses that changed since.
+ */
+Datum
+task_tracker_task_statuses(PG_FUNCTION_ARGS)
+{
+	ArrayType *jobIdArrayObject = PG_GETARG_ARRAYTYPE_P(0);
+	uint64 sinceSequence = (uint64) PG_GETARG_INT64(1);
+
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext per_query_ctx = NULL;
+	MemoryContext oldcontext = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	Datum *jobIdArray = NULL;
+	int32 jobIdCount = 0;
+	List *taskStatusList = NIL;
+	ListCell *taskStatusCell = NULL;
+	bool nulls[4] = { false, false, false, false };
+
+	/* check to see if caller supports us returning a tuplestore */
+	if (!rsinfo || !(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("materialize mode required, but it is not "
+						"allowed in this context")));
+	}
+
+	if (!TaskTrackerRunning())
+	{
+		ereport(ERROR, (errcode(ERRCODE_CANNOT_CONNECT_NOW),
+						errmsg("the task tracker has been disabled or shut down")));
+	}
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	/* get the requested return tuple description */
+	tupleDescriptor = CreateTupleDescCopy(rsinfo->expectedDesc);
+	if (tupleDescriptor->natts != 4 ||
+		tupleDescriptor->attrs[0]->atttypid != INT8OID ||
+		tupleDescriptor->attrs[1]->atttypid != INT4OID ||
+		tupleDescriptor->attrs[2]->atttypid != INT4OID ||
+		tupleDescriptor->attrs[3]->atttypid != INT8OID)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_COLUMN_DEFINITION),
+				 errmsg("query-specified return tuple and "
+						"function return type are not compatible")));
+	}
+
+	/* an empty job id array has no dimensions, and no tasks to report */
+	if (ARR_NDIM(jobIdArrayObject) > 0)
+	{
+		jobIdCount = ArrayObjectCount(jobIdArrayObject);
+		jobIdArray = DeconstructArrayObject(jobIdArrayObject);
+		taskStatusList = ChangedTaskStatusList(jobIdArray, jobIdCount, sinceSequence);
+	}
+
+	tupleStore = tuplestore_begin_heap(true, false, work_mem);
+	foreach(taskStatusCell, taskStatusList)
+	{
+		ChangedTaskStatus *taskStatus = (ChangedTaskStatus *) lfirst(taskStatusCell);
+		Datum values[4];
+		HeapTuple tuple = NULL;
+
+		values[0] = Int64GetDatum(taskStatus->jobId);
+		values[1] = UInt32GetDatum(taskStatus->taskId);
+		values[2] = Int32GetDatum((int32) taskStatus->taskStatus);
+		values[3] = Int64GetDatum(taskStatus->statusSequence);
+
+		tuple = heap_form_tuple(tupleDescriptor, values, nulls);
+		tuplestore_puttuple(tupleStore, tuple);
+		heap_freetuple(tuple);
+	}
+	tuplestore_donestoring(tupleStore);
+
+	/* let the caller know we're sending back a tuplestore */
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupleStore;
+	rsinfo->setDesc = tupleDescriptor;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * ChangedTaskStatusList walks over the shared hash, and returns the statuses of
+ * tasks that belong to one of the given jobs, and whose status sequence number
+ * is greater than the given one. We copy statuses out of the shared hash so that
+ * we hold the lock only for the duration of the walk.
+ */
+static List *
+ChangedTaskStatusList(Datum *jobIdArray, int32 jobIdCount, uint64 sinceSequence)
+{
+	List *taskStatusList = NIL;
+	HASH_SEQ_STATUS status;
+	WorkerTask *currentTask = NULL;
+
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_SHARED);
+
+	hash_seq_init(&status, WorkerTasksSharedState->taskHash);
+
+	currentTask = (WorkerTask *) hash_seq_search(&status);
+	while (currentTask != NULL)
+	{
+		bool jobRequested = false;
+		int32 jobIdIndex = 0;
+
+		for (jobIdIndex = 0; jobIdIndex < jobIdCount; jobIdIndex++)
+		{
+			uint64 jobId = (uint64) DatumGetInt64(jobIdArray[jobIdIndex]);
+			if (currentTask->jobId == jobId)
+			{
+				jobRequested = true;
+				break;
+			}
+		}
+
+		if (jobRequested && currentTask->statusSequence > sinceSequence)
+		{
+			ChangedTaskStatus *taskStatus = palloc0(sizeof(ChangedTaskStatus));
+			taskStatus->jobId = currentTask->jobId;
+			taskStatus->taskId = currentTask->taskId;
+			taskStatus->taskStatus = currentTask->taskStatus;
+			taskStatus->statusSequence = currentTask->statusSequence;
+
+			taskStatusList = lappend(taskStatusList, taskStatus);
+		}
+
+		currentTask = (WorkerTask *) hash_seq_search(&status);
+	}
+
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+	return taskStatusList;
+}
+
+
+/*
+ * JobTaskCountsList walks over the shared hash, and counts running and queued
+ * tasks per job. The function skips internal tasks, such as the shutdown marker
+ * and job schema clean up tasks.
+ */
+static List *
+JobTaskCountsList(void)
+{
+	List *jobTaskCountsList = NIL;
+	HASH_SEQ_STATUS status;
+	WorkerTask *currentTask = NULL;
+
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_SHARED);
+
+	hash_seq_init(&status, WorkerTasksSharedState->taskHash);
+
+	currentTask = (WorkerTask *) hash_seq_search(&status);
+	while (currentTask != NULL)
+	{
+		TaskStatus taskStatus = currentTask->taskStatus;
+		JobTaskCounts *jobTaskCounts = NULL;
+		ListCell *jobTaskCountsCell = NULL;
+
+		if (currentTask->jobId == RESERVED_JOB_ID)
+		{
+			currentTask = (WorkerTask *) hash_seq_search(&status);
+			continue;
+		}
+
+		foreach(jobTaskCountsCell, jobTaskCountsList)
+		{
+			JobTaskCounts *existingCounts = (JobTaskCounts *) lfirst(jobTaskCountsCell);
+			if (existingCounts->jobId == currentTask->jobId)
+			{
+				jobTaskCounts = existingCounts;
+				break;
+			}
+		}
+
+		if (jobTaskCounts == NULL)
+		{
+			jobTaskCounts = (JobTaskCounts *) palloc0(sizeof(JobTaskCounts));
+			jobTaskCounts->jobId = currentTask->jobId;
+			strlcpy(jobTaskCounts->userName, currentTask->userName, NAMEDATALEN);
+
+			jobTaskCountsList = lappend(jobTaskCountsList, jobTaskCounts);
+		}
+
+		if (taskStatus == TASK_SCHEDULED || taskStatus == TASK_RUNNING)
+		{
+			jobTaskCounts->runningTaskCount++;
+		}
+		else if (taskStatus == TASK_ASSIGNED || taskStatus == TASK_FAILED)
+		{
+			jobTaskCounts->queuedTaskCount++;
+		}
+
+		currentTask = (WorkerTask *) hash_seq_search(&status);
+	}
+
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+	return jobTaskCountsList;
+}
+
+
 /*
  * TaskTrackerRunning checks if the task tracker process is running. To do this,
  * the function checks if the task tracker is configured to start up, and infers
@@ -247,6 +620,46 @@ TaskTrackerRunning(void)
 }
 
 
+/*
+ * WakeupTaskTrackerAtXactEnd arranges for the task tracker to be woken up when
+ * the current transaction ends. Several task assignments within the same
+ * transaction therefore only wake up the task tracker once.
+ */
+static void
+WakeupTaskTrackerAtXactEnd(void)
+{
+	if (!wakeupCallbackRegistered)
+	{
+		RegisterXactCallback(TaskTrackerWakeupCallback, NULL);
+		wakeupCallbackRegistered = true;
+	}
+
+	taskTrackerWakeupPending = true;
+}
+
+
+/*
+ * TaskTrackerWakeupCallback wakes up the task tracker if a task was assigned in
+ * the transaction that just ended. Tasks live in shared memory and stay assigned
+ * even if the transaction aborts, so we wake up the task tracker in both cases.
+ */
+static void
+TaskTrackerWakeupCallback(XactEvent event, void *arg)
+{
+	if (!taskTrackerWakeupPending)
+	{
+		return;
+	}
+
+	if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT ||
+		event == XACT_EVENT_PREPARE)
+	{
+		taskTrackerWakeupPending = false;
+		WakeupTaskTracker();
+	}
+}
+
+
 /*
  * CreateJobSchema creates a job schema with the given schema name. Note that
  * this function ensures that our pg_ prefixed schema names can be created.
@@ -299,7 +712,7 @@ CreateJobSchema(StringInfo schemaName)
  * hold an exclusive lock over the shared hash.
  */
 static void
-CreateTask(uint64 jobId, uint32 taskId, char *taskCallString)
+CreateTask(uint64 jobId, uint32 taskId, char *taskCallString, int32 taskPriority)
 {
 	WorkerTask *workerTask = NULL;
 	uint32 assignmentTime = 0;
@@ -316,13 +729,17 @@ CreateTask(uint64 jobId, uint32 taskId, char *taskCallString)
 	/* enter the worker task into shared hash and initialize the task */
 	workerTask = WorkerTasksHashEnter(jobId, taskId);
 	workerTask->assignedAt = assignmentTime;
+	workerTask->priority = taskPriority;
 	strlcpy(workerTask->taskCallString, taskCallString, TASK_CALL_STRING_SIZE);
 
 	workerTask->taskStatus = TASK_ASSIGNED;
 	workerTask->connectionId = INVALID_CONNECTION_ID;
+	workerTask->workerSlotId = INVALID_TASK_WORKER_SLOT;
 	workerTask->failureCount = 0;
 	strlcpy(workerTask->databaseName, databaseName, NAMEDATALEN);
 	strlcpy(workerTask->userName, userName, NAMEDATALEN);
+
+	AdvanceTaskStatusSequence(workerTask);
 }
 
 
@@ -332,7 +749,7 @@ CreateTask(uint64 jobId, uint32 taskId, char *taskCallString)
  * shared hash.
  */
 static void
-UpdateTask(WorkerTask *workerTask, char *taskCallString)
+UpdateTask(WorkerTask *workerTask, char *taskCallString, int32 taskPriority)
 {
 	TaskStatus taskStatus = TASK_STATUS_INVALID_FIRST;
 
@@ -341,10 +758,15 @@ UpdateTask(WorkerTask *workerTask, char *taskCallString)
 
 	/*
 	 * 1. If the task has succeeded or has been canceled, we don't do anything.
-	 * 2. If the task has permanently failed, we update the task call string,
-	 * reset the failure count, and change the task's status to schedulable.
-	 * 3. If the task is in conduit, we update the task call string, and reset
-	 * the failure count.
+	 * 2. If the task has permanently failed, we update the task call string and
+	 * priority, reset the failure count, and change the task's status to
+	 * schedulable.
+	 * 3. If the task is in conduit, we update the task call string and priority,
+	 * and reset the failure count.
+	 *
+	 * In all cases, we advance the task's status sequence. The master node may
+	 * have lost track of the task's status before reassigning it, and it then
+	 * picks up the current status on its next status check.
 	 */
 	if (taskStatus == TASK_SUCCEEDED || taskStatus == TASK_CANCEL_REQUESTED ||
 		taskStatus == TASK_CANCELED)
@@ -354,14 +776,18 @@ UpdateTask(WorkerTask *workerTask, char *taskCallString)
 	else if (taskStatus == TASK_PERMANENTLY_FAILED)
 	{
 		strlcpy(workerTask->taskCallString, taskCallString, TASK_CALL_STRING_SIZE);
+		workerTask->priority = taskPriority;
 		workerTask->failureCount = 0;
 		workerTask->taskStatus = TASK_ASSIGNED;
 	}
 	else
 	{
 		strlcpy(workerTask->taskCallString, taskCallString, TASK_CALL_STRING_SIZE);
+		workerTask->priority = taskPriority;
 		workerTask->failureCount = 0;
 	}
+
+	AdvanceTaskStatusSequence(workerTask);
 }
 
 
@@ -373,12 +799,13 @@ CleanupTask(WorkerTask *workerTask)
 	void *hashKey = (void *) workerTask;
 
 	/*
-	 * If the connection is still valid, the master node decided to terminate
-	 * the task prematurely. This can happen when the user wants to cancel the
-	 * query, or when a speculatively executed task finishes elsewhere and the
-	 * query completes.
+	 * If the connection or background worker is still valid, the master node
+	 * decided to terminate the task prematurely. This can happen when the user
+	 * wants to cancel the query, or when a speculatively executed task finishes
+	 * elsewhere and the query completes.
 	 */
-	if (workerTask->connectionId != INVALID_CONNECTION_ID)
+	if (workerTask->connectionId != INVALID_CONNECTION_ID ||
+		workerTask->workerSlotId != INVALID_TASK_WORKER_SLOT)
 	{
 		/*
 		 * The task tracker process owns the connections to local backends, and
@@ -392,6 +819,7 @@ CleanupTask(WorkerTask *workerTask)
 								   workerTask->jobId, workerTask->taskId)));
 
 		workerTask->taskStatus = TASK_CANCEL_REQUESTED;
+		AdvanceTaskStatusSequence(workerTask);
 		return;
 	}
 
@@ -0,0 +1,571 @@
+/*-------------------------------------------------------------------------
+ *
+ * task_tracker_worker.c
+ *
+ * The task tracker can run its tasks in a pool of dynamic background workers,
+ * instead of opening a new connection to the local server for each task. The
+ * following routines manage the pool's shared slots on behalf of the task
+ * tracker, and implement the background workers' main loop. Each background
+ * worker connects to the database of the task it was started for, and then
+ * runs task call strings as they are handed to it. Idle workers exit after a
+ * while, which frees their slots for tasks in other databases.
+ *
+ * Copyright (c) 2012-2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+
+#include <signal.h>
+
+#include "access/xact.h"
+#include "distributed/task_tracker.h"
+#include "executor/spi.h"
+#include "libpq/pqsignal.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/pmsignal.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "tcop/tcopprot.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+
+
+int MaxTaskWorkersPerNode = 0; /* max number of task background workers */
+
+/* Handles of the background workers started by the task tracker process */
+static BackgroundWorkerHandle **taskWorkerHandleArray = NULL;
+
+
+/* Local functions forward declarations */
+static int32 StartTaskWorker(WorkerTask *workerTask);
+static bool TaskWorkerMatchesTask(TaskWorkerSlot *workerSlot, WorkerTask *workerTask);
+static char * TaskWorkerCallString(TaskWorkerSlot *workerSlot);
+static bool RunTaskCallString(const char *taskCallString);
+
+
+/* Estimates the shared memory size used for the pool of task workers. */
+Size
+TaskWorkerShmemSize(void)
+{
+	Size size = mul_size(MaxTaskWorkersPerNode, sizeof(TaskWorkerSlot));
+
+	return size;
+}
+
+
+/*
+ * TaskWorkerShmemInit allocates and initializes the slots for the pool of task
+ * workers. Note that this function expects the caller to hold the add-in shared
+ * memory initialization lock.
+ */
+void
+TaskWorkerShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	TaskWorkerSlot *taskWorkerSlots = NULL;
+
+	if (MaxTaskWorkersPerNode == 0)
+	{
+		WorkerTasksSharedState->taskWorkerSlots = NULL;
+		return;
+	}
+
+	taskWorkerSlots = (TaskWorkerSlot *) ShmemInitStruct("Worker Task Worker Slots",
+														 TaskWorkerShmemSize(),
+														 &alreadyInitialized);
+	if (!alreadyInitialized)
+	{
+		memset(taskWorkerSlots, 0, TaskWorkerShmemSize());
+	}
+
+	WorkerTasksSharedState->taskWorkerSlots = taskWorkerSlots;
+}
+
+
+/*
+ * AssignTaskWorker hands the given task to a task worker. The function prefers
+ * idle workers that are already connected to the task's database as the task's
+ * user, and otherwise starts a new worker for an unused slot. If neither is
+ * possible, the function returns an invalid slot id and the caller should run
+ * the task over a connection to the local server instead. Note that this
+ * function expects the caller to hold an exclusive lock over the shared hash.
+ */
+int32
+AssignTaskWorker(WorkerTask *workerTask)
+{
+	TaskWorkerSlot *taskWorkerSlots = WorkerTasksSharedState->taskWorkerSlots;
+	int32 workerSlotId = 0;
+
+	if (taskWorkerSlots == NULL)
+	{
+		return INVALID_TASK_WORKER_SLOT;
+	}
+
+	for (workerSlotId = 0; workerSlotId < MaxTaskWorkersPerNode; workerSlotId++)
+	{
+		TaskWorkerSlot *workerSlot = &taskWorkerSlots[workerSlotId];
+
+		if (workerSlot->workerState == TASK_WORKER_IDLE &&
+			TaskWorkerMatchesTask(workerSlot, workerTask))
+		{
+			workerSlot->jobId = workerTask->jobId;
+			workerSlot->taskId = workerTask->taskId;
+			workerSlot->workerState = TASK_WORKER_BUSY;
+
+			SetLatch(workerSlot->workerLatch);
+
+			return workerSlotId;
+		}
+	}
+
+	return StartTaskWorker(workerTask);
+}
+
+
+/*
+ * StartTaskWorker registers a new dynamic background worker for the first
+ * unused slot, and hands the given task to this worker. The function returns
+ * an invalid slot id if all slots are in use, or if the postmaster cannot start
+ * any more background workers.
+ */
+static int32
+StartTaskWorker(WorkerTask *workerTask)
+{
+	TaskWorkerSlot *taskWorkerSlots = WorkerTasksSharedState->taskWorkerSlots;
+	BackgroundWorker worker;
+	BackgroundWorkerHandle *workerHandle = NULL;
+	TaskWorkerSlot *workerSlot = NULL;
+	int32 workerSlotId = 0;
+	bool workerRegistered = false;
+
+	for (workerSlotId = 0; workerSlotId < MaxTaskWorkersPerNode; workerSlotId++)
+	{
+		if (taskWorkerSlots[workerSlotId].workerState == TASK_WORKER_UNUSED)
+		{
+			workerSlot = &taskWorkerSlots[workerSlotId];
+			break;
+		}
+	}
+
+	if (workerSlot == NULL)
+	{
+		return INVALID_TASK_WORKER_SLOT;
+	}
+
+	/* handles are local to the task tracker process, so we keep them in memory */
+	if (taskWorkerHandleArray == NULL)
+	{
+		taskWorkerHandleArray = (BackgroundWorkerHandle **)
+								MemoryContextAllocZero(TopMemoryContext,
+													   MaxTaskWorkersPerNode *
+													   sizeof(BackgroundWorkerHandle *));
+	}
+
+	memset(workerSlot, 0, sizeof(TaskWorkerSlot));
+	workerSlot->jobId = workerTask->jobId;
+	workerSlot->taskId = workerTask->taskId;
+	strlcpy(workerSlot->databaseName, workerTask->databaseName, NAMEDATALEN);
+	strlcpy(workerSlot->userName, workerTask->userName, NAMEDATALEN);
+	workerSlot->workerState = TASK_WORKER_STARTING;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	worker.bgw_restart_time = BGW_NEVER_RESTART;
+	worker.bgw_main = NULL;
+	worker.bgw_main_arg = Int32GetDatum(workerSlotId);
+	worker.bgw_notify_pid = MyProcPid;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "citus");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "TaskWorkerMain");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "task tracker worker %d", workerSlotId);
+
+	workerRegistered = RegisterDynamicBackgroundWorker(&worker, &workerHandle);
+	if (!workerRegistered)
+	{
+		ereport(DEBUG1, (errmsg("could not start task tracker worker"),
+						 errhint("Consider increasing max_worker_processes.")));
+
+		workerSlot->workerState = TASK_WORKER_UNUSED;
+		return INVALID_TASK_WORKER_SLOT;
+	}
+
+	if (taskWorkerHandleArray[workerSlotId] != NULL)
+	{
+		pfree(taskWorkerHandleArray[workerSlotId]);
+	}
+	taskWorkerHandleArray[workerSlotId] = workerHandle;
+
+	return workerSlotId;
+}
+
+
+/* Checks if the task worker is connected to the task's database as its user. */
+static bool
+TaskWorkerMatchesTask(TaskWorkerSlot *workerSlot, WorkerTask *workerTask)
+{
+	if (strncmp(workerSlot->databaseName, workerTask->databaseName, NAMEDATALEN) != 0)
+	{
+		return false;
+	}
+
+	if (strncmp(workerSlot->userName, workerTask->userName, NAMEDATALEN) != 0)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * TaskWorkerSlotState returns the state of the given task worker slot. Note that
+ * this function expects the caller to hold a lock over the shared hash.
+ */
+TaskWorkerState
+TaskWorkerSlotState(int32 workerSlotId)
+{
+	TaskWorkerSlot *taskWorkerSlots = WorkerTasksSharedState->taskWorkerSlots;
+
+	Assert(workerSlotId >= 0 && workerSlotId < MaxTaskWorkersPerNode);
+
+	return taskWorkerSlots[workerSlotId].workerState;
+}
+
+
+/*
+ * ReleaseTaskWorker makes the task worker available for the next task, once the
+ * task tracker has consumed the outcome of its last task. If the worker exited
+ * in the meantime, the slot becomes unused instead. Note that this function
+ * expects the caller to hold an exclusive lock over the shared hash.
+ */
+void
+ReleaseTaskWorker(int32 workerSlotId)
+{
+	TaskWorkerSlot *taskWorkerSlots = WorkerTasksSharedState->taskWorkerSlots;
+	TaskWorkerSlot *workerSlot = NULL;
+
+	Assert(workerSlotId >= 0 && workerSlotId < MaxTaskWorkersPerNode);
+	workerSlot = &taskWorkerSlots[workerSlotId];
+
+	if (workerSlot->workerExited)
+	{
+		workerSlot->workerState = TASK_WORKER_UNUSED;
+		workerSlot->workerExited = false;
+	}
+	else
+	{
+		workerSlot->workerState = TASK_WORKER_IDLE;
+	}
+}
+
+
+/*
+ * CancelTaskWorker sends a cancel request to the task worker if it is running a
+ * task. The worker then aborts the task, and reports it as failed. Note that
+ * this function expects the caller to hold an exclusive lock over the shared
+ * hash.
+ */
+void
+CancelTaskWorker(int32 workerSlotId)
+{
+	TaskWorkerSlot *taskWorkerSlots = WorkerTasksSharedState->taskWorkerSlots;
+	TaskWorkerSlot *workerSlot = NULL;
+
+	Assert(workerSlotId >= 0 && workerSlotId < MaxTaskWorkersPerNode);
+	workerSlot = &taskWorkerSlots[workerSlotId];
+
+	if (workerSlot->workerState == TASK_WORKER_BUSY && workerSlot->workerPid != 0)
+	{
+		kill(workerSlot->workerPid, SIGINT);
+	}
+}
+
+
+/*
+ * ReclaimTaskWorkers walks over the task worker slots, and takes care of two
+ * cases that the task tracker does not see while managing tasks. First, task
+ * workers may exit abnormally, for example if they cannot connect to their
+ * database; we then fail their task. Second, the task tracker may have removed
+ * a task while its worker was still running it; we then release the worker as
+ * soon as it finishes. Note that this function expects the caller to hold an
+ * exclusive lock over the shared hash.
+ */
+void
+ReclaimTaskWorkers(void)
+{
+	TaskWorkerSlot *taskWorkerSlots = WorkerTasksSharedState->taskWorkerSlots;
+	int32 workerSlotId = 0;
+
+	if (taskWorkerSlots == NULL)
+	{
+		return;
+	}
+
+	for (workerSlotId = 0; workerSlotId < MaxTaskWorkersPerNode; workerSlotId++)
+	{
+		TaskWorkerSlot *workerSlot = &taskWorkerSlots[workerSlotId];
+		TaskWorkerState workerState = workerSlot->workerState;
+		BackgroundWorkerHandle *workerHandle = NULL;
+		WorkerTask *workerTask = NULL;
+
+		if (taskWorkerHandleArray != NULL)
+		{
+			workerHandle = taskWorkerHandleArray[workerSlotId];
+		}
+
+		if (workerHandle != NULL)
+		{
+			pid_t workerPid = 0;
+			BgwHandleStatus handleStatus = GetBackgroundWorkerPid(workerHandle,
+																  &workerPid);
+			if (handleStatus == BGWH_STOPPED)
+			{
+				pfree(workerHandle);
+				taskWorkerHandleArray[workerSlotId] = NULL;
+
+				if (workerState == TASK_WORKER_STARTING ||
+					workerState == TASK_WORKER_BUSY)
+				{
+					workerSlot->workerState = TASK_WORKER_FAILED;
+					workerSlot->workerExited = true;
+				}
+				else if (workerState == TASK_WORKER_IDLE)
+				{
+					workerSlot->workerState = TASK_WORKER_UNUSED;
+				}
+				else if (workerState != TASK_WORKER_UNUSED)
+				{
+					workerSlot->workerExited = true;
+				}
+
+				workerState = workerSlot->workerState;
+			}
+		}
+
+		if (workerState != TASK_WORKER_SUCCEEDED && workerState != TASK_WORKER_FAILED)
+		{
+			continue;
+		}
+
+		workerTask = WorkerTasksHashFind(workerSlot->jobId, workerSlot->taskId);
+		if (workerTask == NULL || workerTask->workerSlotId != workerSlotId)
+		{
+			ReleaseTaskWorker(workerSlotId);
+		}
+	}
+}
+
+
+/*
+ * TaskWorkerMain is the main entry point for task workers. The task worker
+ * connects to the database of its slot, and then runs the tasks the task
+ * tracker hands to it one after the other. After each task, the worker records
+ * the task's outcome in its slot, and wakes up the task tracker.
+ */
+void
+TaskWorkerMain(Datum main_arg)
+{
+	int32 workerSlotId = DatumGetInt32(main_arg);
+	TaskWorkerSlot *workerSlot = &WorkerTasksSharedState->taskWorkerSlots[workerSlotId];
+	MemoryContext taskWorkerContext = NULL;
+	char *databaseName = NULL;
+	char *userName = NULL;
+
+	/* cancel requests abort the current task, and termination ends the worker */
+	pqsignal(SIGINT, StatementCancelHandler);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_SHARED);
+	databaseName = pstrdup(workerSlot->databaseName);
+	if (workerSlot->userName[0] != '\0')
+	{
+		userName = pstrdup(workerSlot->userName);
+	}
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+	BackgroundWorkerInitializeConnection(databaseName, userName);
+
+	LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_EXCLUSIVE);
+	workerSlot->workerPid = MyProcPid;
+	workerSlot->workerLatch = &MyProc->procLatch;
+	if (workerSlot->workerState == TASK_WORKER_STARTING)
+	{
+		workerSlot->workerState = TASK_WORKER_BUSY;
+	}
+	LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+	taskWorkerContext = AllocSetContextCreate(TopMemoryContext, "Task Tracker Worker",
+											  ALLOCSET_DEFAULT_MINSIZE,
+											  ALLOCSET_DEFAULT_INITSIZE,
+											  ALLOCSET_DEFAULT_MAXSIZE);
+	MemoryContextSwitchTo(taskWorkerContext);
+
+	for (;;)
+	{
+		char *taskCallString = NULL;
+		bool taskSucceeded = false;
+		int waitResult = 0;
+
+		ResetLatch(&MyProc->procLatch);
+
+		/*
+		 * Cancel requests only apply to the task they were sent for. We ignore
+		 * leftover requests here, and only exit if we were asked to terminate.
+		 */
+		QueryCancelPending = false;
+		CHECK_FOR_INTERRUPTS();
+
+		if (!PostmasterIsAlive())
+		{
+			exit(1);
+		}
+
+		LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_EXCLUSIVE);
+		if (workerSlot->workerState == TASK_WORKER_BUSY)
+		{
+			taskCallString = TaskWorkerCallString(workerSlot);
+		}
+		LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+		if (taskCallString != NULL)
+		{
+			taskSucceeded = RunTaskCallString(taskCallString);
+
+			LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_EXCLUSIVE);
+			if (taskSucceeded)
+			{
+				workerSlot->workerState = TASK_WORKER_SUCCEEDED;
+			}
+			else
+			{
+				workerSlot->workerState = TASK_WORKER_FAILED;
+			}
+			LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+			WakeupTaskTracker();
+
+			MemoryContextReset(taskWorkerContext);
+			continue;
+		}
+
+		waitResult = WaitLatch(&MyProc->procLatch,
+							   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+							   TASK_WORKER_IDLE_TIMEOUT);
+		if (waitResult & WL_POSTMASTER_DEATH)
+		{
+			exit(1);
+		}
+
+		/* give our slot back if we have not been used for a while */
+		if (waitResult & WL_TIMEOUT)
+		{
+			bool workerIdle = false;
+
+			LWLockAcquire(&WorkerTasksSharedState->taskHashLock, LW_EXCLUSIVE);
+			if (workerSlot->workerState == TASK_WORKER_IDLE)
+			{
+				workerSlot->workerState = TASK_WORKER_UNUSED;
+				workerSlot->workerPid = 0;
+				workerSlot->workerLatch = NULL;
+				workerIdle = true;
+			}
+			LWLockRelease(&WorkerTasksSharedState->taskHashLock);
+
+			if (workerIdle)
+			{
+				proc_exit(0);
+			}
+		}
+	}
+}
+
+
+/*
+ * TaskWorkerCallString copies the call string of the slot's task from the
+ * shared hash. If the task has already been removed from the shared hash, the
+ * function marks the slot's task as failed and returns NULL. Note that this
+ * function expects the caller to hold an exclusive lock over the shared hash.
+ */
+static char *
+TaskWorkerCallString(TaskWorkerSlot *workerSlot)
+{
+	WorkerTask *workerTask = WorkerTasksHashFind(workerSlot->jobId, workerSlot->taskId);
+	char *taskCallString = NULL;
+
+	if (workerTask == NULL)
+	{
+		/* the task tracker releases the slot once it notices */
+		workerSlot->workerState = TASK_WORKER_FAILED;
+		return NULL;
+	}
+
+	taskCallString = palloc0(TASK_CALL_STRING_SIZE);
+	strlcpy(taskCallString, workerTask->taskCallString, TASK_CALL_STRING_SIZE);
+
+	return taskCallString;
+}
+
+
+/*
+ * RunTaskCallString runs the given task call string in its own transaction,
+ * similar to how a local backend runs the task call string it receives over a
+ * connection. The function reports errors to the server log, and returns false
+ * if the task failed.
+ */
+static bool
+RunTaskCallString(const char *taskCallString)
+{
+	MemoryContext taskContext = CurrentMemoryContext;
+	volatile bool taskSucceeded = false;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	pgstat_report_activity(STATE_RUNNING, taskCallString);
+
+	PG_TRY();
+	{
+		int spiStatus = 0;
+
+		SPI_connect();
+		PushActiveSnapshot(GetTransactionSnapshot());
+
+		spiStatus = SPI_execute(taskCallString, false, 0);
+		if (spiStatus < 0)
+		{
+			ereport(ERROR, (errmsg("could not run task call string"),
+							errdetail("SPI_execute returned %s",
+									  SPI_result_code_string(spiStatus))));
+		}
+
+		SPI_finish();
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+
+		taskSucceeded = true;
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(taskContext);
+
+		EmitErrorReport();
+		FlushErrorState();
+
+		AbortCurrentTransaction();
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(taskContext);
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	return taskSucceeded;
+}
@@ -15,6 +15,7 @@
 #include "postgres.h"
 #include "funcapi.h"
 #include "miscadmin.h"
+#include <arpa/inet.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -73,6 +74,8 @@ static bool check_log_statement(List *stmt_list);
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(worker_fetch_partition_file);
 PG_FUNCTION_INFO_V1(worker_fetch_query_results_file);
+PG_FUNCTION_INFO_V1(worker_prepare_partition_push);
+PG_FUNCTION_INFO_V1(worker_finish_partition_stream);
 PG_FUNCTION_INFO_V1(worker_apply_shard_ddl_command);
 PG_FUNCTION_INFO_V1(worker_apply_inter_shard_ddl_command);
 PG_FUNCTION_INFO_V1(worker_fetch_regular_table);
@@ -162,6 +165,227 @@ worker_fetch_query_results_file(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * worker_prepare_partition_push prepares this node to receive a partition file
+ * that a map task on another node pushes to an upstream merge task. For this,
+ * the function creates the upstream task's directory if it does not already
+ * exist. The pushing node then streams its partitions for this node to a single
+ * file in the job directory, and calls worker_finish_partition_stream() when
+ * done.
+ */
+Datum
+worker_prepare_partition_push(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+	uint32 upstreamTaskId = PG_GETARG_UINT32(2);
+
+	StringInfo taskDirectoryName = TaskDirectoryName(jobId, upstreamTaskId);
+	bool taskDirectoryExists = DirectoryExists(taskDirectoryName);
+	if (!taskDirectoryExists)
+	{
+		InitTaskDirectory(jobId, upstreamTaskId);
+	}
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * worker_finish_partition_stream splits a stream of partitions that a map task
+ * pushed to this node into one file for each of the given upstream tasks, and
+ * atomically renames these files to the names worker_fetch_partition_file()
+ * would have fetched the partition files to. Upstream tasks whose partition
+ * received no rows get an empty file. The function then deletes the stream.
+ */
+Datum
+worker_finish_partition_stream(PG_FUNCTION_ARGS)
+{
+	uint64 jobId = PG_GETARG_INT64(0);
+	uint32 partitionTaskId = PG_GETARG_UINT32(1);
+	ArrayType *upstreamTaskIdObject = PG_GETARG_ARRAYTYPE_P(2);
+
+	Datum *upstreamTaskIdArray = DeconstructArrayObject(upstreamTaskIdObject);
+	int32 upstreamTaskCount = ArrayObjectCount(upstreamTaskIdObject);
+	StringInfo streamFilename = PushStreamFilename(jobId, partitionTaskId);
+	File *attemptFileArray = palloc0(upstreamTaskCount * sizeof(File));
+	StringInfo frameBuffer = makeStringInfo();
+	const uint32 frameBufferSize = 32768; /* 32 KB */
+	const int streamFileFlags = (O_RDONLY | PG_BINARY);
+	const int attemptFileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
+	const int attemptFileMode = (S_IRUSR | S_IWUSR);
+	File streamFile = -1;
+	int32 upstreamTaskIndex = 0;
+
+	for (upstreamTaskIndex = 0; upstreamTaskIndex < upstreamTaskCount;
+		 upstreamTaskIndex++)
+	{
+		uint32 upstreamTaskId = DatumGetUInt32(upstreamTaskIdArray[upstreamTaskIndex]);
+		StringInfo attemptFilename = PushAttemptFilename(jobId, partitionTaskId,
+														 upstreamTaskId);
+
+		File attemptFile = PathNameOpenFile(attemptFilename->data, attemptFileFlags,
+											attemptFileMode);
+		if (attemptFile < 0)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not open file \"%s\": %m",
+								   attemptFilename->data)));
+		}
+
+		attemptFileArray[upstreamTaskIndex] = attemptFile;
+		FreeStringInfo(attemptFilename);
+	}
+
+	streamFile = PathNameOpenFile(streamFilename->data, streamFileFlags, 0);
+	if (streamFile < 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", streamFilename->data)));
+	}
+
+	enlargeStringInfo(frameBuffer, frameBufferSize);
+
+	while (true)
+	{
+		PartitionStreamFrameHeader frameHeader;
+		uint32 upstreamTaskId = 0;
+		uint32 remainingLength = 0;
+		File attemptFile = -1;
+
+		int readBytes = FileRead(streamFile, (char *) &frameHeader,
+								 sizeof(PartitionStreamFrameHeader));
+		if (readBytes == 0)
+		{
+			break;
+		}
+		else if (readBytes != sizeof(PartitionStreamFrameHeader))
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not read frame header from partition "
+								   "stream \"%s\"", streamFilename->data)));
+		}
+
+		upstreamTaskId = ntohl(frameHeader.upstreamTaskId);
+		remainingLength = ntohl(frameHeader.length);
+
+		for (upstreamTaskIndex = 0; upstreamTaskIndex < upstreamTaskCount;
+			 upstreamTaskIndex++)
+		{
+			if (DatumGetUInt32(upstreamTaskIdArray[upstreamTaskIndex]) == upstreamTaskId)
+			{
+				attemptFile = attemptFileArray[upstreamTaskIndex];
+				break;
+			}
+		}
+
+		if (attemptFile < 0)
+		{
+			ereport(ERROR, (errmsg("partition stream \"%s\" contains data for "
+								   "unexpected task %u", streamFilename->data,
+								   upstreamTaskId)));
+		}
+
+		while (remainingLength > 0)
+		{
+			int chunkLength = (int) Min(remainingLength, frameBufferSize);
+			int writtenBytes = 0;
+
+			readBytes = FileRead(streamFile, frameBuffer->data, chunkLength);
+			if (readBytes != chunkLength)
+			{
+				ereport(ERROR, (errcode_for_file_access(),
+								errmsg("could not read frame from partition "
+									   "stream \"%s\"", streamFilename->data)));
+			}
+
+			writtenBytes = FileWrite(attemptFile, frameBuffer->data, chunkLength);
+			if (writtenBytes != chunkLength)
+			{
+				ereport(ERROR, (errcode_for_file_access(),
+								errmsg("could not append to pushed partition file: %m")));
+			}
+
+			remainingLength -= chunkLength;
+		}
+	}
+
+	FileClose(streamFile);
+
+	for (upstreamTaskIndex = 0; upstreamTaskIndex < upstreamTaskCount;
+		 upstreamTaskIndex++)
+	{
+		uint32 upstreamTaskId = DatumGetUInt32(upstreamTaskIdArray[upstreamTaskIndex]);
+		StringInfo taskDirectoryName = TaskDirectoryName(jobId, upstreamTaskId);
+		StringInfo taskFilename = TaskFilename(taskDirectoryName, partitionTaskId);
+		StringInfo attemptFilename = PushAttemptFilename(jobId, partitionTaskId,
+														 upstreamTaskId);
+		int renamed = 0;
+
+		FileClose(attemptFileArray[upstreamTaskIndex]);
+
+		renamed = rename(attemptFilename->data, taskFilename->data);
+		if (renamed != 0)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not rename file \"%s\" to \"%s\": %m",
+								   attemptFilename->data, taskFilename->data)));
+		}
+
+		FreeStringInfo(attemptFilename);
+		FreeStringInfo(taskFilename);
+		FreeStringInfo(taskDirectoryName);
+	}
+
+	DeleteFile(streamFilename->data);
+
+	pfree(attemptFileArray);
+	FreeStringInfo(frameBuffer);
+	FreeStringInfo(streamFilename);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * PushAttemptFilename constructs the name of the attempt file that a pushed
+ * partition file is written to, before it gets renamed into place. We keep these
+ * names short and place them directly in the job directory.
+ */
+StringInfo
+PushAttemptFilename(uint64 jobId, uint32 partitionTaskId, uint32 upstreamTaskId)
+{
+	StringInfo jobDirectoryName = JobDirectoryName(jobId);
+
+	StringInfo attemptFilename = makeStringInfo();
+	appendStringInfo(attemptFilename, "%s/%s%0*u_%0*u%s", jobDirectoryName->data,
+					 PARTITION_FILE_PREFIX, MIN_TASK_FILENAME_WIDTH, upstreamTaskId,
+					 MIN_TASK_FILENAME_WIDTH, partitionTaskId, ATTEMPT_FILE_SUFFIX);
+
+	return attemptFilename;
+}
+
+
+/*
+ * PushStreamFilename constructs the name of the file that a map task streams
+ * all partitions for this node to, before worker_finish_partition_stream()
+ * splits the stream into the pushed partition files. Streams are transmitted with
+ * an overloaded COPY statement that takes the file name as its table name; we
+ * therefore keep these names short and place them directly in the job directory.
+ */
+StringInfo
+PushStreamFilename(uint64 jobId, uint32 partitionTaskId)
+{
+	StringInfo jobDirectoryName = JobDirectoryName(jobId);
+
+	StringInfo streamFilename = makeStringInfo();
+	appendStringInfo(streamFilename, "%s/%s%0*u%s", jobDirectoryName->data,
+					 PARTITION_FILE_PREFIX, MIN_TASK_FILENAME_WIDTH, partitionTaskId,
+					 ATTEMPT_FILE_SUFFIX);
+
+	return streamFilename;
+}
+
+
 /* Constructs a standardized task file path for given directory and task id. */
 StringInfo
 TaskFilename(StringInfo directoryName, uint32 taskId)
@@ -17,6 +17,9 @@
 #include "funcapi.h"
 #include "miscadmin.h"
 
+#include <unistd.h>
+
+#include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/xact.h"
 #include "catalog/dependency.h"
@@ -24,6 +27,7 @@
 #include "commands/copy.h"
 #include "commands/tablecmds.h"
 #include "distributed/metadata_cache.h"
+#include "distributed/transmit.h"
 #include "distributed/worker_protocol.h"
 #include "executor/spi.h"
 #include "nodes/makefuncs.h"
@@ -31,22 +35,56 @@
 #include "storage/lmgr.h"
 #include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
 #include "utils/tqual.h"
 
 
+/* Config variable managed via guc.c */
+bool MergeFilesInPlace = false; /* query merge task files without loading them */
+
+
+/*
+ * TaskFileReadState keeps the state that worker_read_task_files() needs across
+ * calls: the relation whose row type we read the files with, the task files
+ * left to read, and the copy state of the file we currently read from.
+ */
+typedef struct TaskFileReadState
+{
+	Relation relation;
+	List *taskFileList;
+	ListCell *nextTaskFileCell;
+	MemoryContext copyContext;
+	CopyState copyState;
+	StringInfo decompressedFilename;
+	Datum *columnValues;
+	bool *columnNulls;
+} TaskFileReadState;
+
+
 /* Local functions forward declarations */
 static List * ArrayObjectToCStringList(ArrayType *arrayObject);
 static void CreateTaskTable(StringInfo schemaName, StringInfo relationName,
 							List *columnNameList, List *columnTypeList);
 static void CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 									   StringInfo sourceDirectoryName);
+static void CreateMergeFileView(StringInfo schemaName, StringInfo relationName,
+								uint64 jobId, uint32 taskId);
+static List * TaskFileList(const char *directoryName);
+static StringInfo DecompressedFilename(StringInfo filename);
+static void BeginTaskFileRead(TaskFileReadState *readState, StringInfo taskFilename);
+static void EndTaskFileCopy(TaskFileReadState *readState);
+static void EndTaskFileRead(Datum argument);
+static void DeleteFile(const char *filename);
 
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(worker_merge_files_into_table);
 PG_FUNCTION_INFO_V1(worker_merge_files_and_run_query);
+PG_FUNCTION_INFO_V1(worker_read_task_files);
 PG_FUNCTION_INFO_V1(worker_cleanup_job_schema_cache);
 
 
@@ -127,6 +165,11 @@ worker_merge_files_into_table(PG_FUNCTION_ARGS)
  * two approaches. For this purpose creating a directory_fdw extension and using
  * it would make sense. Then we can merge files with a query or without query
  * through directory_fdw.
+ *
+ * If merge files are queried in place, the function does not load the files
+ * into the merge table. It instead replaces the merge table with a view that
+ * reads the files through worker_read_task_files(), and runs the final query
+ * over this view.
  */
 Datum
 worker_merge_files_and_run_query(PG_FUNCTION_ARGS)
@@ -190,7 +233,14 @@ worker_merge_files_and_run_query(PG_FUNCTION_ARGS)
 
 	appendStringInfo(mergeTableName, "%s%s", intermediateTableName->data,
 					 MERGE_TABLE_SUFFIX);
-	CopyTaskFilesFromDirectory(jobSchemaName, mergeTableName, taskDirectoryName);
+	if (MergeFilesInPlace)
+	{
+		CreateMergeFileView(jobSchemaName, mergeTableName, jobId, taskId);
+	}
+	else
+	{
+		CopyTaskFilesFromDirectory(jobSchemaName, mergeTableName, taskDirectoryName);
+	}
 
 	createIntermediateTableResult = SPI_exec(createIntermediateTableQuery, 0);
 	if (createIntermediateTableResult < 0)
@@ -460,16 +510,323 @@ CreateStatement(RangeVar *relation, List *columnDefinitionList)
 /*
  * CopyTaskFilesFromDirectory finds all files in the given directory, except for
  * those having an attempt suffix. The function then copies these files into the
- * database table identified by the given schema and table name.
+ * database table identified by the given schema and table name. Compressed files
+ * are first decompressed into a temporary attempt file, which we copy from and
+ * then delete.
  */
 static void
 CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 						   StringInfo sourceDirectoryName)
 {
-	const char *directoryName = sourceDirectoryName->data;
-	struct dirent *directoryEntry = NULL;
+	List *taskFileList = TaskFileList(sourceDirectoryName->data);
+	ListCell *taskFileCell = NULL;
 	uint64 copiedRowTotal = 0;
 
+	foreach(taskFileCell, taskFileList)
+	{
+		StringInfo fullFilename = (StringInfo) lfirst(taskFileCell);
+		StringInfo decompressedFilename = DecompressedFilename(fullFilename);
+		const char *queryString = NULL;
+		char *copyFilename = fullFilename->data;
+		RangeVar *relation = NULL;
+		CopyStmt *copyStatement = NULL;
+		uint64 copiedRowCount = 0;
+
+		if (decompressedFilename != NULL)
+		{
+			copyFilename = decompressedFilename->data;
+		}
+
+		/* build relation object and copy statement */
+		relation = makeRangeVar(schemaName->data, relationName->data, -1);
+		copyStatement = CopyStatement(relation, copyFilename);
+		if (BinaryWorkerCopyFormat)
+		{
+			DefElem *copyOption = makeDefElem("format", (Node *) makeString("binary"));
+			copyStatement->options = list_make1(copyOption);
+		}
+
+		DoCopy(copyStatement, queryString, &copiedRowCount);
+		copiedRowTotal += copiedRowCount;
+		CommandCounterIncrement();
+
+		if (decompressedFilename != NULL)
+		{
+			DeleteFile(decompressedFilename->data);
+		}
+	}
+
+	ereport(DEBUG2, (errmsg("copied " UINT64_FORMAT " rows into table: \"%s.%s\"",
+							copiedRowTotal, schemaName->data, relationName->data)));
+}
+
+
+/*
+ * CreateMergeFileView renames the given merge table, and creates a view in its
+ * place that reads the task's files in their on-disk copy format. The renamed
+ * table stays empty; we only use it to describe the rows in these files.
+ *
+ * A function scan in the FROM clause collects all rows of a set returning
+ * function into a tuplestore before returning the first one. The view therefore
+ * calls worker_read_task_files() in the target list of a subquery instead, so
+ * that the final query pulls rows from the files one at a time.
+ */
+static void
+CreateMergeFileView(StringInfo schemaName, StringInfo relationName,
+					uint64 jobId, uint32 taskId)
+{
+	StringInfo fileTableName = makeStringInfo();
+	StringInfo renameCommand = makeStringInfo();
+	StringInfo createViewCommand = makeStringInfo();
+	char *qualifiedRelationName = quote_qualified_identifier(schemaName->data,
+															 relationName->data);
+	char *qualifiedFileTableName = NULL;
+	int renameResult = 0;
+	int createViewResult = 0;
+
+	appendStringInfo(fileTableName, "%s%s", relationName->data, MERGE_FILES_TABLE_SUFFIX);
+	qualifiedFileTableName = quote_qualified_identifier(schemaName->data,
+														fileTableName->data);
+
+	appendStringInfo(renameCommand, RENAME_TABLE_COMMAND, qualifiedRelationName,
+					 quote_identifier(fileTableName->data));
+
+	renameResult = SPI_exec(renameCommand->data, 0);
+	if (renameResult < 0)
+	{
+		ereport(ERROR, (errmsg("execution was not successful \"%s\"",
+							   renameCommand->data)));
+	}
+
+	appendStringInfo(createViewCommand, CREATE_MERGE_FILE_VIEW_COMMAND,
+					 qualifiedRelationName, qualifiedFileTableName, jobId, taskId);
+
+	createViewResult = SPI_exec(createViewCommand->data, 0);
+	if (createViewResult < 0)
+	{
+		ereport(ERROR, (errmsg("execution was not successful \"%s\"",
+							   createViewCommand->data)));
+	}
+}
+
+
+/*
+ * worker_read_task_files reads all files in the given task's directory, and
+ * returns their rows. The files are expected to be in the copy format that we
+ * use for transferring data between worker nodes, and to have the row type of
+ * the table whose row is passed in as the first argument; the row itself is
+ * typically NULL. This way, queries can consume merge task files without first
+ * loading them into a table.
+ *
+ * The function returns one row per call, and keeps the copy state of the file
+ * it currently reads from across calls; see TaskFileReadState. Callers only
+ * benefit from this when they call the function in a target list; see
+ * CreateMergeFileView().
+ */
+Datum
+worker_read_task_files(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *resultInfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	FuncCallContext *functionContext = NULL;
+	TaskFileReadState *readState = NULL;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		Oid rowTypeId = get_fn_expr_argtype(fcinfo->flinfo, 0);
+		Oid relationId = InvalidOid;
+		uint64 jobId = 0;
+		uint32 taskId = 0;
+		StringInfo taskDirectoryName = NULL;
+		TupleDesc tupleDescriptor = NULL;
+		MemoryContext oldContext = NULL;
+		uint32 columnCount = 0;
+
+		if (PG_ARGISNULL(1) || PG_ARGISNULL(2))
+		{
+			ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+							errmsg("job id and task id cannot be null")));
+		}
+
+		jobId = PG_GETARG_INT64(1);
+		taskId = PG_GETARG_UINT32(2);
+
+		if (OidIsValid(rowTypeId))
+		{
+			relationId = typeidTypeRelid(rowTypeId);
+		}
+
+		if (!OidIsValid(relationId))
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("first argument must be a row of a table")));
+		}
+
+		functionContext = SRF_FIRSTCALL_INIT();
+		oldContext = MemoryContextSwitchTo(functionContext->multi_call_memory_ctx);
+
+		readState = palloc0(sizeof(TaskFileReadState));
+		readState->relation = heap_open(relationId, AccessShareLock);
+
+		tupleDescriptor = CreateTupleDescCopy(RelationGetDescr(readState->relation));
+		functionContext->tuple_desc = BlessTupleDesc(tupleDescriptor);
+
+		columnCount = tupleDescriptor->natts;
+		readState->columnValues = palloc0(columnCount * sizeof(Datum));
+		readState->columnNulls = palloc0(columnCount * sizeof(bool));
+		readState->copyContext = functionContext->multi_call_memory_ctx;
+
+		taskDirectoryName = TaskDirectoryName(jobId, taskId);
+		readState->taskFileList = TaskFileList(taskDirectoryName->data);
+		readState->nextTaskFileCell = list_head(readState->taskFileList);
+
+		functionContext->user_fctx = readState;
+
+		/* if the caller stops reading early, we still close the file and table */
+		if (resultInfo != NULL && IsA(resultInfo, ReturnSetInfo))
+		{
+			RegisterExprContextCallback(resultInfo->econtext, EndTaskFileRead,
+										PointerGetDatum(readState));
+		}
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	functionContext = SRF_PERCALL_SETUP();
+	readState = (TaskFileReadState *) functionContext->user_fctx;
+
+	while (true)
+	{
+		bool nextRowFound = false;
+
+		if (readState->copyState == NULL)
+		{
+			StringInfo taskFilename = NULL;
+
+			if (readState->nextTaskFileCell == NULL)
+			{
+				break;
+			}
+
+			taskFilename = (StringInfo) lfirst(readState->nextTaskFileCell);
+			readState->nextTaskFileCell = lnext(readState->nextTaskFileCell);
+
+			BeginTaskFileRead(readState, taskFilename);
+		}
+
+		nextRowFound = NextCopyFrom(readState->copyState, NULL,
+									readState->columnValues, readState->columnNulls,
+									NULL);
+		if (nextRowFound)
+		{
+			HeapTuple row = heap_form_tuple(functionContext->tuple_desc,
+											readState->columnValues,
+											readState->columnNulls);
+
+			SRF_RETURN_NEXT(functionContext, HeapTupleGetDatum(row));
+		}
+
+		EndTaskFileCopy(readState);
+	}
+
+	if (resultInfo != NULL && IsA(resultInfo, ReturnSetInfo))
+	{
+		UnregisterExprContextCallback(resultInfo->econtext, EndTaskFileRead,
+									  PointerGetDatum(readState));
+	}
+
+	EndTaskFileRead(PointerGetDatum(readState));
+
+	SRF_RETURN_DONE(functionContext);
+}
+
+
+/*
+ * BeginTaskFileRead starts reading rows from the given task file with the copy
+ * machinery, using the relation's row type. If the task file is compressed, we
+ * read from a decompressed copy of the file instead. The copy machinery only
+ * reads from files, so compressed task files are still written to disk once
+ * more before we read them.
+ */
+static void
+BeginTaskFileRead(TaskFileReadState *readState, StringInfo taskFilename)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(readState->copyContext);
+	const char *copyFilename = taskFilename->data;
+	List *copyOptions = NIL;
+	const bool isProgram = false;
+
+	readState->decompressedFilename = DecompressedFilename(taskFilename);
+	if (readState->decompressedFilename != NULL)
+	{
+		copyFilename = readState->decompressedFilename->data;
+	}
+
+	if (BinaryWorkerCopyFormat)
+	{
+		DefElem *copyOption = makeDefElem("format", (Node *) makeString("binary"));
+		copyOptions = list_make1(copyOption);
+	}
+
+	readState->copyState = BeginCopyFrom(readState->relation, copyFilename, isProgram,
+										 NIL, copyOptions);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * EndTaskFileCopy ends reading from the current task file, and deletes the
+ * file's decompressed copy if we made one.
+ */
+static void
+EndTaskFileCopy(TaskFileReadState *readState)
+{
+	if (readState->copyState != NULL)
+	{
+		EndCopyFrom(readState->copyState);
+		readState->copyState = NULL;
+	}
+
+	if (readState->decompressedFilename != NULL)
+	{
+		DeleteFile(readState->decompressedFilename->data);
+		FreeStringInfo(readState->decompressedFilename);
+		readState->decompressedFilename = NULL;
+	}
+}
+
+
+/*
+ * EndTaskFileRead ends reading from the current task file, and closes the
+ * relation whose row type we read the files with. We call this function when
+ * we return the last row, or as an expression context callback when the caller
+ * stops reading before that.
+ */
+static void
+EndTaskFileRead(Datum argument)
+{
+	TaskFileReadState *readState = (TaskFileReadState *) DatumGetPointer(argument);
+
+	EndTaskFileCopy(readState);
+
+	if (readState->relation != NULL)
+	{
+		heap_close(readState->relation, AccessShareLock);
+		readState->relation = NULL;
+	}
+}
+
+
+/*
+ * TaskFileList finds all files in the given directory, except for those having
+ * an attempt suffix, and returns their full names.
+ */
+static List *
+TaskFileList(const char *directoryName)
+{
+	List *taskFileList = NIL;
+	struct dirent *directoryEntry = NULL;
+
 	DIR *directory = AllocateDir(directoryName);
 	if (directory == NULL)
 	{
@@ -481,11 +838,7 @@ CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 	for (; directoryEntry != NULL; directoryEntry = ReadDir(directory, directoryName))
 	{
 		const char *baseFilename = directoryEntry->d_name;
-		const char *queryString = NULL;
 		StringInfo fullFilename = NULL;
-		RangeVar *relation = NULL;
-		CopyStmt *copyStatement = NULL;
-		uint64 copiedRowCount = 0;
 
 		/* if system file or lingering task file, skip it */
 		if (strncmp(baseFilename, ".", MAXPGPATH) == 0 ||
@@ -498,24 +851,51 @@ CopyTaskFilesFromDirectory(StringInfo schemaName, StringInfo relationName,
 		fullFilename = makeStringInfo();
 		appendStringInfo(fullFilename, "%s/%s", directoryName, baseFilename);
 
-		/* build relation object and copy statement */
-		relation = makeRangeVar(schemaName->data, relationName->data, -1);
-		copyStatement = CopyStatement(relation, fullFilename->data);
-		if (BinaryWorkerCopyFormat)
-		{
-			DefElem *copyOption = makeDefElem("format", (Node *) makeString("binary"));
-			copyStatement->options = list_make1(copyOption);
-		}
+		taskFileList = lappend(taskFileList, fullFilename);
+	}
 
-		DoCopy(copyStatement, queryString, &copiedRowCount);
-		copiedRowTotal += copiedRowCount;
-		CommandCounterIncrement();
+	FreeDir(directory);
+
+	return taskFileList;
+}
+
+
+/*
+ * DecompressedFilename decompresses the given task file into an attempt file
+ * next to it, if the task file is compressed. The function then returns the
+ * attempt file's name, and the caller is responsible for deleting the file
+ * after use. If the task file is not compressed, the function returns NULL.
+ */
+static StringInfo
+DecompressedFilename(StringInfo filename)
+{
+	bool fileDecompressed = false;
+
+	StringInfo decompressedFilename = makeStringInfo();
+	appendStringInfo(decompressedFilename, "%s%s", filename->data, ATTEMPT_FILE_SUFFIX);
+
+	fileDecompressed = DecompressPartitionFile(filename->data,
+											   decompressedFilename->data);
+	if (!fileDecompressed)
+	{
+		FreeStringInfo(decompressedFilename);
+		return NULL;
 	}
 
-	ereport(DEBUG2, (errmsg("copied " UINT64_FORMAT " rows into table: \"%s.%s\"",
-							copiedRowTotal, schemaName->data, relationName->data)));
+	return decompressedFilename;
+}
 
-	FreeDir(directory);
+
+/* Deletes file with the given filename, and warns if the file cannot be deleted. */
+static void
+DeleteFile(const char *filename)
+{
+	int deleted = unlink(filename);
+	if (deleted != 0)
+	{
+		ereport(WARNING, (errcode_for_file_access(),
+						  errmsg("could not delete file \"%s\": %m", filename)));
+	}
 }
 
 
@@ -16,6 +16,7 @@
 
 #include "postgres.h"
 #include "funcapi.h"
+#include "libpq-fe.h"
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -27,15 +28,25 @@
 #include "access/nbtree.h"
 #include "catalog/pg_am.h"
 #include "catalog/pg_collation.h"
+#include "catalog/pg_type.h"
 #include "commands/copy.h"
 #include "commands/defrem.h"
+#include "common/pg_lzcompress.h"
+#include "distributed/connection_management.h"
 #include "distributed/multi_copy.h"
+#include "distributed/partition_memory.h"
+#include "distributed/remote_commands.h"
 #include "distributed/resource_lock.h"
+#include "distributed/semi_join_filter.h"
+#include "distributed/task_tracker.h"
 #include "distributed/transmit.h"
+#include "distributed/worker_manager.h"
 #include "distributed/worker_protocol.h"
 #include "executor/spi.h"
 #include "mb/pg_wchar.h"
+#include "postmaster/postmaster.h"
 #include "storage/lmgr.h"
+#include "storage/spin.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
@@ -44,37 +55,119 @@
 /* Config variables managed via guc.c */
 bool BinaryWorkerCopyFormat = false;   /* binary format for copying between workers */
 int PartitionBufferSize = 16384; /* total partitioning buffer size in KB */
+bool CompressPartitionFiles = false; /* compress partition files in blocks */
 
 /* Local variables */
 static uint32 FileBufferSizeInBytes = 0; /* file buffer size to init later */
 
 
+/*
+ * Compressed partition files start with a magic number. The number begins with
+ * a zero byte, which neither text nor binary copy data start with; this way, we
+ * can tell compressed and regular partition files apart.
+ */
+#define COMPRESSED_FILE_MAGIC "\0CITUSPZ"
+#define COMPRESSED_FILE_MAGIC_SIZE (sizeof(COMPRESSED_FILE_MAGIC) - 1)
+
+
+/*
+ * CompressedBlockHeader precedes each block in a compressed partition file. A
+ * compressed size of zero means that the block did not compress well, and that
+ * we stored the block's raw bytes instead.
+ */
+typedef struct CompressedBlockHeader
+{
+	uint32 rawSize;
+	uint32 compressedSize;
+} CompressedBlockHeader;
+
+
+/*
+ * PartitionPushTarget keeps the node and the upstream merge task for a partition
+ * file that we push. Partitions with an upstream task id of zero have no merge
+ * task, and are only written to the local partition file. Partitions that go to
+ * the same remote node share one connection, over which we stream them while
+ * partitioning; partitions for this node have no connection.
+ */
+typedef struct PartitionPushTarget
+{
+	char *nodeName;
+	int32 nodePort;
+	uint32 upstreamTaskId;
+	MultiConnection *connection;
+} PartitionPushTarget;
+
+
 /* Local functions forward declarations */
 static StringInfo InitTaskAttemptDirectory(uint64 jobId, uint32 taskId);
 static uint32 FileBufferSize(int partitionBufferSizeInKB, uint32 fileCount);
 static FileOutputStream * OpenPartitionFiles(StringInfo directoryName, uint32 fileCount);
-static void ClosePartitionFiles(FileOutputStream *partitionFileArray, uint32 fileCount);
+static void ClosePartitionFiles(FileOutputStream *partitionFileArray, uint32 fileCount,
+								uint64 jobId, StringInfo taskDirectory);
+static bool KeepPartitionInMemory(FileOutputStream *partitionFile, uint64 jobId,
+								  const char *filename);
+static PartitionPushTarget * PartitionPushTargetArray(FileOutputStream *partitionFileArray,
+													  uint32 fileCount,
+													  ArrayType *nodeNameObject,
+													  ArrayType *nodePortObject,
+													  ArrayType *upstreamTaskIdObject);
+static void StartPartitionPushes(uint64 jobId, uint32 taskId,
+								 FileOutputStream *partitionFileArray,
+								 PartitionPushTarget *pushTargetArray, uint32 fileCount);
+static void PushPartitionFiles(uint64 jobId, uint32 taskId, StringInfo taskDirectory,
+							   PartitionPushTarget *pushTargetArray, uint32 fileCount);
+static bool LocalPushTarget(PartitionPushTarget *pushTarget);
+static void PushLocalPartitionFile(uint64 jobId, uint32 taskId,
+								   StringInfo partitionFilename, uint32 upstreamTaskId);
+static void FinishPartitionStream(MultiConnection *connection, uint64 jobId,
+								  uint32 taskId, PartitionPushTarget *pushTargetArray,
+								  uint32 fileCount);
+static void SendPartitionStreamFrame(FileOutputStream *file, const char *data,
+									 int length);
 static void RenameDirectory(StringInfo oldDirectoryName, StringInfo newDirectoryName);
-static void FileOutputStreamWrite(FileOutputStream file, StringInfo dataToWrite);
-static void FileOutputStreamFlush(FileOutputStream file);
+static void FileOutputStreamWrite(FileOutputStream *file, StringInfo dataToWrite);
+static void FileOutputStreamFlush(FileOutputStream *file);
+static void PartitionFileWrite(FileOutputStream *file, const char *data, int length);
+static void UpdateCompressionStatistics(FileOutputStream *file);
+static void ReadPartitionFile(File fileDescriptor, const char *filename, char *buffer,
+							  int length);
+static HashPartitionHeavyHitter * HeavyHitterArray(Oid partitionColumnType,
+												   FmgrInfo *hashFunction,
+												   uint32 partitionCount,
+												   uint32 taskId,
+												   ArrayType *heavyHitterObject,
+												   ArrayType *partitionCountObject,
+												   ArrayType *spreadObject,
+												   uint32 *heavyHitterCount);
+static int CompareHeavyHitters(const void *leftElement, const void *rightElement);
 static void FilterAndPartitionTable(const char *filterQuery,
 									const char *columnName, Oid columnType,
-									uint32 (*PartitionIdFunction)(Datum, const void *),
+									uint32 (*PartitionIdFunction)(Datum, const void *,
+																  uint32 *),
 									const void *partitionIdContext,
+									SemiJoinFilter *semiJoinFilter,
 									FileOutputStream *partitionFileArray,
 									uint32 fileCount);
 static int ColumnIndex(TupleDesc rowDescriptor, const char *columnName);
 static CopyOutState InitRowOutputState(void);
 static void ClearRowOutputState(CopyOutState copyState);
+static void OutputCompressionHeaders(FileOutputStream *partitionFileArray,
+									 uint32 fileCount);
 static void OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount);
 static void OutputBinaryFooters(FileOutputStream *partitionFileArray, uint32 fileCount);
-static uint32 RangePartitionId(Datum partitionValue, const void *context);
-static uint32 HashPartitionId(Datum partitionValue, const void *context);
+static uint32 RangePartitionId(Datum partitionValue, const void *context,
+							   uint32 *partitionCopyCount);
+static uint32 HashPartitionId(Datum partitionValue, const void *context,
+							  uint32 *partitionCopyCount);
+static int32 * HashSplitPointArray(ArrayType *splitPointObject, uint32 *splitPointCount);
+static uint32 HashRangePartitionId(Datum partitionValue, const void *context,
+								   uint32 *partitionCopyCount);
 
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(worker_range_partition_table);
 PG_FUNCTION_INFO_V1(worker_hash_partition_table);
+PG_FUNCTION_INFO_V1(worker_partition_compression_stats);
 
 
 /*
@@ -86,6 +179,12 @@ PG_FUNCTION_INFO_V1(worker_hash_partition_table);
  *
  * This function applies range partitioning through the use of a function
  * pointer and a range context object; for details, see RangePartitionId().
+ *
+ * If the optional node name, node port, and upstream task id arrays are given,
+ * the function also pushes each partition to the node that runs the partition's
+ * upstream merge task. Partitions for remote nodes are streamed as they are
+ * written; for details on pushing partitions, see StartPartitionPushes() and
+ * PushPartitionFiles().
  */
 Datum
 worker_range_partition_table(PG_FUNCTION_ARGS)
@@ -108,6 +207,8 @@ worker_range_partition_table(PG_FUNCTION_ARGS)
 	StringInfo taskDirectory = NULL;
 	StringInfo taskAttemptDirectory = NULL;
 	FileOutputStream *partitionFileArray = NULL;
+	PartitionPushTarget *pushTargetArray = NULL;
+	SemiJoinFilter *semiJoinFilter = NULL;
 
 	/* first check that array element's and partition column's types match */
 	Oid splitPointType = ARR_ELEMTYPE(splitPointObject);
@@ -139,16 +240,36 @@ worker_range_partition_table(PG_FUNCTION_ARGS)
 	partitionFileArray = OpenPartitionFiles(taskAttemptDirectory, fileCount);
 	FileBufferSizeInBytes = FileBufferSize(PartitionBufferSize, fileCount);
 
+	if (PG_NARGS() > 6)
+	{
+		pushTargetArray = PartitionPushTargetArray(partitionFileArray, fileCount,
+												   PG_GETARG_ARRAYTYPE_P(6),
+												   PG_GETARG_ARRAYTYPE_P(7),
+												   PG_GETARG_ARRAYTYPE_P(8));
+		StartPartitionPushes(jobId, taskId, partitionFileArray, pushTargetArray,
+							 fileCount);
+	}
+
+	/* drop rows that cannot join, if the master node left us a filter */
+	semiJoinFilter = LoadSemiJoinFilter(jobId, partitionColumnType);
+
 	/* call the partitioning function that does the actual work */
 	FilterAndPartitionTable(filterQuery, partitionColumn, partitionColumnType,
 							&RangePartitionId, (const void *) partitionContext,
-							partitionFileArray, fileCount);
+							semiJoinFilter, partitionFileArray, fileCount);
 
 	/* close partition files and atomically rename (commit) them */
-	ClosePartitionFiles(partitionFileArray, fileCount);
+	ClosePartitionFiles(partitionFileArray, fileCount, jobId, taskDirectory);
+
 	RemoveDirectory(taskDirectory);
 	RenameDirectory(taskAttemptDirectory, taskDirectory);
 
+	/* hand the committed partition files to the nodes that merge them */
+	if (pushTargetArray != NULL)
+	{
+		PushPartitionFiles(jobId, taskId, taskDirectory, pushTargetArray, fileCount);
+	}
+
 	PG_RETURN_VOID();
 }
 
@@ -162,6 +283,19 @@ worker_range_partition_table(PG_FUNCTION_ARGS)
  *
  * This function applies hash partitioning through the use of a function pointer
  * and a hash context object; for details, see HashPartitionId().
+ *
+ * Like worker_range_partition_table(), the function optionally pushes each
+ * partition to the node that runs the partition's upstream merge task. Empty
+ * push target arrays mean that no partitions are pushed.
+ *
+ * If heavy hitter arrays are also given, the function treats rows whose keys
+ * are heavy hitters specially, so that a few frequent keys do not overload a
+ * single merge task; for details, see HashPartitionHeavyHitter.
+ *
+ * Instead of a partition count, the caller may also pass an array of hashed
+ * split points, such as the shard boundaries of a hash distributed table. The
+ * function then partitions rows by the range their hashed keys fall into; for
+ * details, see HashRangePartitionId().
  */
 Datum
 worker_hash_partition_table(PG_FUNCTION_ARGS)
@@ -171,17 +305,21 @@ worker_hash_partition_table(PG_FUNCTION_ARGS)
 	text *filterQueryText = PG_GETARG_TEXT_P(2);
 	text *partitionColumnText = PG_GETARG_TEXT_P(3);
 	Oid partitionColumnType = PG_GETARG_OID(4);
-	uint32 partitionCount = PG_GETARG_UINT32(5);
+	Oid partitionArgumentType = get_fn_expr_argtype(fcinfo->flinfo, 5);
 
 	const char *filterQuery = text_to_cstring(filterQueryText);
 	const char *partitionColumn = text_to_cstring(partitionColumnText);
 
 	HashPartitionContext *partitionContext = NULL;
 	FmgrInfo *hashFunction = NULL;
+	uint32 (*partitionIdFunction)(Datum, const void *, uint32 *) = &HashPartitionId;
 	StringInfo taskDirectory = NULL;
 	StringInfo taskAttemptDirectory = NULL;
 	FileOutputStream *partitionFileArray = NULL;
-	uint32 fileCount = partitionCount;
+	PartitionPushTarget *pushTargetArray = NULL;
+	SemiJoinFilter *semiJoinFilter = NULL;
+	uint32 partitionCount = 0;
+	uint32 fileCount = 0;
 
 	/* use column's type information to get the hashing function */
 	hashFunction = GetFunctionInfo(partitionColumnType, HASH_AM_OID, HASHPROC);
@@ -189,7 +327,35 @@ worker_hash_partition_table(PG_FUNCTION_ARGS)
 	/* create hash partition context object */
 	partitionContext = palloc0(sizeof(HashPartitionContext));
 	partitionContext->hashFunction = hashFunction;
+
+	if (partitionArgumentType == INT4ARRAYOID)
+	{
+		ArrayType *splitPointObject = PG_GETARG_ARRAYTYPE_P(5);
+		uint32 splitPointCount = 0;
+
+		partitionContext->hashSplitPointArray = HashSplitPointArray(splitPointObject,
+																	&splitPointCount);
+		partitionIdFunction = &HashRangePartitionId;
+
+		/* range partitioning needs an extra bucket */
+		partitionCount = splitPointCount + 1;
+	}
+	else
+	{
+		partitionCount = PG_GETARG_UINT32(5);
+	}
+
 	partitionContext->partitionCount = partitionCount;
+	fileCount = partitionCount;
+
+	if (PG_NARGS() > 9)
+	{
+		partitionContext->heavyHitterArray =
+			HeavyHitterArray(partitionColumnType, hashFunction, partitionCount, taskId,
+							 PG_GETARG_ARRAYTYPE_P(9), PG_GETARG_ARRAYTYPE_P(10),
+							 PG_GETARG_ARRAYTYPE_P(11),
+							 &partitionContext->heavyHitterCount);
+	}
 
 	/* init directories and files to write the partitioned data to */
 	taskDirectory = InitTaskDirectory(jobId, taskId);
@@ -198,20 +364,148 @@ worker_hash_partition_table(PG_FUNCTION_ARGS)
 	partitionFileArray = OpenPartitionFiles(taskAttemptDirectory, fileCount);
 	FileBufferSizeInBytes = FileBufferSize(PartitionBufferSize, fileCount);
 
+	if (PG_NARGS() > 6 && ARR_NDIM(PG_GETARG_ARRAYTYPE_P(6)) > 0)
+	{
+		pushTargetArray = PartitionPushTargetArray(partitionFileArray, fileCount,
+												   PG_GETARG_ARRAYTYPE_P(6),
+												   PG_GETARG_ARRAYTYPE_P(7),
+												   PG_GETARG_ARRAYTYPE_P(8));
+		StartPartitionPushes(jobId, taskId, partitionFileArray, pushTargetArray,
+							 fileCount);
+	}
+
+	/* drop rows that cannot join, if the master node left us a filter */
+	semiJoinFilter = LoadSemiJoinFilter(jobId, partitionColumnType);
+
 	/* call the partitioning function that does the actual work */
 	FilterAndPartitionTable(filterQuery, partitionColumn, partitionColumnType,
-							&HashPartitionId, (const void *) partitionContext,
-							partitionFileArray, fileCount);
+							partitionIdFunction, (const void *) partitionContext,
+							semiJoinFilter, partitionFileArray, fileCount);
 
 	/* close partition files and atomically rename (commit) them */
-	ClosePartitionFiles(partitionFileArray, fileCount);
+	ClosePartitionFiles(partitionFileArray, fileCount, jobId, taskDirectory);
+
 	RemoveDirectory(taskDirectory);
 	RenameDirectory(taskAttemptDirectory, taskDirectory);
 
+	/* hand the committed partition files to the nodes that merge them */
+	if (pushTargetArray != NULL)
+	{
+		PushPartitionFiles(jobId, taskId, taskDirectory, pushTargetArray, fileCount);
+	}
+
 	PG_RETURN_VOID();
 }
 
 
+/*
+ * HeavyHitterArray parses the given heavy hitter values, and returns an array
+ * that describes how to partition each value's rows, sorted by the values' hash
+ * codes. If two heavy hitters hash to the same code, we keep the first one;
+ * since both sides of a join receive the values in the same order, they make
+ * the same choice. Heavy hitters never use more than the given number of hash
+ * partitions. The function sets heavyHitterCount to the array's length.
+ */
+static HashPartitionHeavyHitter *
+HeavyHitterArray(Oid partitionColumnType, FmgrInfo *hashFunction,
+				 uint32 partitionCount, uint32 taskId, ArrayType *heavyHitterObject,
+				 ArrayType *partitionCountObject, ArrayType *spreadObject,
+				 uint32 *heavyHitterCount)
+{
+	HashPartitionHeavyHitter *heavyHitterArray = NULL;
+	int32 valueCount = ArrayObjectCount(heavyHitterObject);
+	Datum *valueArray = NULL;
+	Datum *partitionCountArray = NULL;
+	Datum *spreadArray = NULL;
+	Oid inputFunctionId = InvalidOid;
+	Oid typeIOParam = InvalidOid;
+	int32 valueIndex = 0;
+	uint32 uniqueCount = 0;
+
+	if (ArrayObjectCount(partitionCountObject) != valueCount ||
+		ArrayObjectCount(spreadObject) != valueCount)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("heavy hitter arrays must have the same length")));
+	}
+
+	valueArray = DeconstructArrayObject(heavyHitterObject);
+	partitionCountArray = DeconstructArrayObject(partitionCountObject);
+	spreadArray = DeconstructArrayObject(spreadObject);
+
+	getTypeInputInfo(partitionColumnType, &inputFunctionId, &typeIOParam);
+
+	heavyHitterArray = palloc0(valueCount * sizeof(HashPartitionHeavyHitter));
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		HashPartitionHeavyHitter *heavyHitter = &heavyHitterArray[uniqueCount];
+		char *valueString = TextDatumGetCString(valueArray[valueIndex]);
+		Datum value = OidInputFunctionCall(inputFunctionId, valueString,
+										   typeIOParam, -1);
+		uint32 hashValue = DatumGetUInt32(FunctionCall1(hashFunction, value));
+		int32 heavyHitterPartitionCount = DatumGetInt32(partitionCountArray[valueIndex]);
+		bool hashValueSeen = false;
+		uint32 uniqueIndex = 0;
+
+		if (heavyHitterPartitionCount < 1)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("heavy hitter partition count must be positive")));
+		}
+
+		for (uniqueIndex = 0; uniqueIndex < uniqueCount; uniqueIndex++)
+		{
+			if (heavyHitterArray[uniqueIndex].hashValue == hashValue)
+			{
+				hashValueSeen = true;
+				break;
+			}
+		}
+
+		if (hashValueSeen)
+		{
+			continue;
+		}
+
+		heavyHitter->hashValue = hashValue;
+		heavyHitter->partitionCount = Min((uint32) heavyHitterPartitionCount,
+										  partitionCount);
+		heavyHitter->spread = DatumGetBool(spreadArray[valueIndex]);
+
+		/* start at different offsets so that map tasks do not pile up rows */
+		heavyHitter->nextPartitionOffset = taskId % heavyHitter->partitionCount;
+
+		uniqueCount++;
+	}
+
+	qsort(heavyHitterArray, uniqueCount, sizeof(HashPartitionHeavyHitter),
+		  CompareHeavyHitters);
+
+	*heavyHitterCount = uniqueCount;
+	return heavyHitterArray;
+}
+
+
+/* Compares two heavy hitters by their hash values. */
+static int
+CompareHeavyHitters(const void *leftElement, const void *rightElement)
+{
+	const HashPartitionHeavyHitter *leftHeavyHitter = leftElement;
+	const HashPartitionHeavyHitter *rightHeavyHitter = rightElement;
+
+	if (leftHeavyHitter->hashValue < rightHeavyHitter->hashValue)
+	{
+		return -1;
+	}
+	else if (leftHeavyHitter->hashValue > rightHeavyHitter->hashValue)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+
 /*
  * GetFunctionInfo first resolves the operator for the given data type, access
  * method, and support procedure. The function then uses the resolved operator's
@@ -412,6 +706,14 @@ OpenPartitionFiles(StringInfo directoryName, uint32 fileCount)
 		partitionFileArray[fileIndex].fileDescriptor = fileDescriptor;
 		partitionFileArray[fileIndex].fileBuffer = makeStringInfo();
 		partitionFileArray[fileIndex].filePath = filePath;
+		partitionFileArray[fileIndex].pushed = false;
+		partitionFileArray[fileIndex].pushConnection = NULL;
+		partitionFileArray[fileIndex].pushTaskId = 0;
+		partitionFileArray[fileIndex].compressed = CompressPartitionFiles;
+		partitionFileArray[fileIndex].flushed = false;
+		partitionFileArray[fileIndex].compressedBlockCount = 0;
+		partitionFileArray[fileIndex].uncompressedByteCount = 0;
+		partitionFileArray[fileIndex].compressedByteCount = 0;
 	}
 
 	return partitionFileArray;
@@ -421,27 +723,418 @@ OpenPartitionFiles(StringInfo directoryName, uint32 fileCount)
 /*
  * ClosePartitionFiles walks over each file output stream object, and flushes
  * any remaining data in the file's buffer. The function then closes the file,
- * and deletes any allocated memory for the file stream object.
+ * and deletes any allocated memory for the file stream object. Partitions that
+ * we can keep in shared memory are not flushed; we instead store them under the
+ * name their file will have in the given task directory, and delete the file.
  */
 static void
-ClosePartitionFiles(FileOutputStream *partitionFileArray, uint32 fileCount)
+ClosePartitionFiles(FileOutputStream *partitionFileArray, uint32 fileCount,
+					uint64 jobId, StringInfo taskDirectory)
 {
 	uint32 fileIndex = 0;
 	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
 	{
-		FileOutputStream partitionFile = partitionFileArray[fileIndex];
+		FileOutputStream *partitionFile = &partitionFileArray[fileIndex];
+		StringInfo finalFilename = PartitionFilename(taskDirectory, fileIndex);
 
-		FileOutputStreamFlush(partitionFile);
+		bool keptInMemory = KeepPartitionInMemory(partitionFile, jobId,
+												  finalFilename->data);
+		if (!keptInMemory)
+		{
+			FileOutputStreamFlush(partitionFile);
+		}
 
-		FileClose(partitionFile.fileDescriptor);
-		FreeStringInfo(partitionFile.fileBuffer);
-		FreeStringInfo(partitionFile.filePath);
+		FileClose(partitionFile->fileDescriptor);
+		UpdateCompressionStatistics(partitionFile);
+
+		if (keptInMemory)
+		{
+			int removed = unlink(partitionFile->filePath->data);
+			if (removed != 0)
+			{
+				ereport(ERROR, (errcode_for_file_access(),
+								errmsg("could not delete file \"%s\": %m",
+									   partitionFile->filePath->data)));
+			}
+		}
+
+		FreeStringInfo(partitionFile->fileBuffer);
+		FreeStringInfo(partitionFile->filePath);
+		FreeStringInfo(finalFilename);
 	}
 
 	pfree(partitionFileArray);
 }
 
 
+/*
+ * KeepPartitionInMemory tries to store the given partition in shared memory. We
+ * only keep partitions that fit into their stream's buffer, and that we do not
+ * push to another node. The function returns false if the partition does not
+ * qualify or if partition memory is exhausted; in that case, it also makes sure
+ * that no stale data from an earlier attempt remain in memory.
+ */
+static bool
+KeepPartitionInMemory(FileOutputStream *partitionFile, uint64 jobId,
+					  const char *filename)
+{
+	bool keptInMemory = false;
+
+	if (PartitionMemoryBudget == 0)
+	{
+		return false;
+	}
+
+	if (!partitionFile->flushed && !partitionFile->pushed)
+	{
+		keptInMemory = StoreInMemoryPartition(jobId, filename,
+											  partitionFile->fileBuffer);
+	}
+	else
+	{
+		RemoveInMemoryPartition(filename);
+	}
+
+	return keptInMemory;
+}
+
+
+/*
+ * PartitionPushTargetArray parses the node name, node port, and upstream task id
+ * arrays that tell where to push each partition, and returns them as an array
+ * of push targets. The function also marks the partition files that have an
+ * upstream task, so that we do not keep these partitions in memory.
+ */
+static PartitionPushTarget *
+PartitionPushTargetArray(FileOutputStream *partitionFileArray, uint32 fileCount,
+						 ArrayType *nodeNameObject, ArrayType *nodePortObject,
+						 ArrayType *upstreamTaskIdObject)
+{
+	PartitionPushTarget *pushTargetArray = NULL;
+	Datum *nodeNameArray = NULL;
+	Datum *nodePortArray = NULL;
+	Datum *upstreamTaskIdArray = NULL;
+	uint32 fileIndex = 0;
+
+	if ((uint32) ArrayObjectCount(nodeNameObject) != fileCount ||
+		(uint32) ArrayObjectCount(nodePortObject) != fileCount ||
+		(uint32) ArrayObjectCount(upstreamTaskIdObject) != fileCount)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("partition push targets do not match the number of "
+							   "partitions")));
+	}
+
+	nodeNameArray = DeconstructArrayObject(nodeNameObject);
+	nodePortArray = DeconstructArrayObject(nodePortObject);
+	upstreamTaskIdArray = DeconstructArrayObject(upstreamTaskIdObject);
+
+	pushTargetArray = palloc0(fileCount * sizeof(PartitionPushTarget));
+
+	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
+	{
+		PartitionPushTarget *pushTarget = &pushTargetArray[fileIndex];
+
+		pushTarget->nodeName = TextDatumGetCString(nodeNameArray[fileIndex]);
+		pushTarget->nodePort = DatumGetInt32(nodePortArray[fileIndex]);
+		pushTarget->upstreamTaskId = DatumGetUInt32(upstreamTaskIdArray[fileIndex]);
+
+		partitionFileArray[fileIndex].pushed = (pushTarget->upstreamTaskId != 0);
+	}
+
+	return pushTargetArray;
+}
+
+
+/*
+ * StartPartitionPushes opens one connection per remote node that runs upstream
+ * merge tasks for the given partitions, and starts transmitting a partition
+ * stream to each node. Partition file streams for these nodes then send each
+ * write over their node's connection as a frame tagged with the upstream task
+ * id; see PartitionStreamFrameHeader. This way, we push partitions while we
+ * write them, and the node splits the stream into the merge tasks' files once
+ * we are done. Partitions for this node are linked into place after the task
+ * directory is committed, and do not need a connection.
+ */
+static void
+StartPartitionPushes(uint64 jobId, uint32 taskId, FileOutputStream *partitionFileArray,
+					 PartitionPushTarget *pushTargetArray, uint32 fileCount)
+{
+	StringInfo streamFilename = PushStreamFilename(jobId, taskId);
+	uint32 fileIndex = 0;
+
+	/* the overloaded COPY statement takes the file name as its table name */
+	if (streamFilename->len >= NAMEDATALEN)
+	{
+		ereport(ERROR, (errmsg("partition push file name \"%s\" is too long",
+							   streamFilename->data)));
+	}
+
+	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
+	{
+		PartitionPushTarget *pushTarget = &pushTargetArray[fileIndex];
+		MultiConnection *connection = NULL;
+		StringInfo receiveCommand = NULL;
+		PGresult *result = NULL;
+		uint32 nodeFileIndex = 0;
+		int querySent = 0;
+
+		if (pushTarget->upstreamTaskId == 0 || pushTarget->connection != NULL ||
+			LocalPushTarget(pushTarget))
+		{
+			continue;
+		}
+
+		connection = GetNodeConnection(FORCE_NEW_CONNECTION, pushTarget->nodeName,
+									   pushTarget->nodePort);
+
+		/* this and all later partitions that go to the same node share the stream */
+		for (nodeFileIndex = fileIndex; nodeFileIndex < fileCount; nodeFileIndex++)
+		{
+			PartitionPushTarget *nodePushTarget = &pushTargetArray[nodeFileIndex];
+			FileOutputStream *partitionFile = &partitionFileArray[nodeFileIndex];
+			StringInfo prepareCommand = NULL;
+
+			if (nodePushTarget->upstreamTaskId == 0 ||
+				nodePushTarget->nodePort != pushTarget->nodePort ||
+				strncmp(nodePushTarget->nodeName, pushTarget->nodeName,
+						WORKER_LENGTH) != 0)
+			{
+				continue;
+			}
+
+			prepareCommand = makeStringInfo();
+			appendStringInfo(prepareCommand, PREPARE_PARTITION_PUSH_COMMAND,
+							 jobId, taskId, nodePushTarget->upstreamTaskId);
+			ExecuteCriticalRemoteCommand(connection, prepareCommand->data);
+
+			nodePushTarget->connection = connection;
+			partitionFile->pushConnection = connection;
+			partitionFile->pushTaskId = nodePushTarget->upstreamTaskId;
+
+			FreeStringInfo(prepareCommand);
+		}
+
+		receiveCommand = makeStringInfo();
+		appendStringInfo(receiveCommand, RECEIVE_REGULAR_COMMAND, streamFilename->data);
+
+		querySent = SendRemoteCommand(connection, receiveCommand->data);
+		if (querySent == 0)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+
+		result = GetRemoteCommandResult(connection, true);
+		if (PQresultStatus(result) != PGRES_COPY_IN)
+		{
+			ReportResultError(connection, result, ERROR);
+		}
+
+		PQclear(result);
+		FreeStringInfo(receiveCommand);
+	}
+
+	FreeStringInfo(streamFilename);
+}
+
+
+/*
+ * PushPartitionFiles finishes handing the partition files in the given task
+ * directory to the nodes that run their upstream merge tasks, which saves these
+ * merge tasks from fetching the files later on. If the merge task runs on this
+ * node, we link the partition file into the merge task's directory. Otherwise,
+ * we already streamed the file while writing it, and now end the node's stream
+ * and have the node move the streamed partitions into place. Partitions with an
+ * upstream task id of zero are not pushed.
+ */
+static void
+PushPartitionFiles(uint64 jobId, uint32 taskId, StringInfo taskDirectory,
+				   PartitionPushTarget *pushTargetArray, uint32 fileCount)
+{
+	uint32 fileIndex = 0;
+
+	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
+	{
+		PartitionPushTarget *pushTarget = &pushTargetArray[fileIndex];
+		MultiConnection *connection = pushTarget->connection;
+		uint32 nodeFileIndex = 0;
+
+		if (pushTarget->upstreamTaskId == 0)
+		{
+			continue;
+		}
+
+		if (connection == NULL)
+		{
+			StringInfo partitionFilename = PartitionFilename(taskDirectory, fileIndex);
+
+			PushLocalPartitionFile(jobId, taskId, partitionFilename,
+								   pushTarget->upstreamTaskId);
+
+			FreeStringInfo(partitionFilename);
+			continue;
+		}
+
+		FinishPartitionStream(connection, jobId, taskId, pushTargetArray, fileCount);
+
+		/* we are done with all partitions that went over this connection */
+		for (nodeFileIndex = fileIndex; nodeFileIndex < fileCount; nodeFileIndex++)
+		{
+			PartitionPushTarget *nodePushTarget = &pushTargetArray[nodeFileIndex];
+			if (nodePushTarget->connection == connection)
+			{
+				nodePushTarget->upstreamTaskId = 0;
+				nodePushTarget->connection = NULL;
+			}
+		}
+
+		CloseConnection(connection);
+	}
+
+	pfree(pushTargetArray);
+}
+
+
+/*
+ * LocalPushTarget returns true if the given push target is this node. We only
+ * recognize the local host name and this machine's host name here; pushes to
+ * other names of this node still work, but go through a connection.
+ */
+static bool
+LocalPushTarget(PartitionPushTarget *pushTarget)
+{
+	char localHostName[WORKER_LENGTH];
+
+	if (pushTarget->nodePort != PostPortNumber)
+	{
+		return false;
+	}
+
+	if (strncmp(pushTarget->nodeName, LOCAL_HOST_NAME, WORKER_LENGTH) == 0)
+	{
+		return true;
+	}
+
+	memset(localHostName, 0, sizeof(localHostName));
+	if (gethostname(localHostName, sizeof(localHostName) - 1) != 0)
+	{
+		return false;
+	}
+
+	return (strncmp(pushTarget->nodeName, localHostName, WORKER_LENGTH) == 0);
+}
+
+
+/*
+ * PushLocalPartitionFile places the given partition file under the name that
+ * worker_fetch_partition_file() would have fetched it to for the upstream task.
+ * Since both tasks run on this node, we hard link the file instead of copying
+ * it, and rename the link into place so that the merge task never sees a partial
+ * file.
+ */
+static void
+PushLocalPartitionFile(uint64 jobId, uint32 taskId, StringInfo partitionFilename,
+					   uint32 upstreamTaskId)
+{
+	StringInfo taskDirectoryName = TaskDirectoryName(jobId, upstreamTaskId);
+	StringInfo taskFilename = TaskFilename(taskDirectoryName, taskId);
+	StringInfo attemptFilename = PushAttemptFilename(jobId, taskId, upstreamTaskId);
+	int linked = 0;
+	int renamed = 0;
+
+	bool taskDirectoryExists = DirectoryExists(taskDirectoryName);
+	if (!taskDirectoryExists)
+	{
+		InitTaskDirectory(jobId, upstreamTaskId);
+	}
+
+	/* an earlier attempt of this task may have left its link behind */
+	if (unlink(attemptFilename->data) != 0 && errno != ENOENT)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not delete file \"%s\": %m",
+							   attemptFilename->data)));
+	}
+
+	linked = link(partitionFilename->data, attemptFilename->data);
+	if (linked != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not link file \"%s\" to \"%s\": %m",
+							   partitionFilename->data, attemptFilename->data)));
+	}
+
+	renamed = rename(attemptFilename->data, taskFilename->data);
+	if (renamed != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not rename file \"%s\" to \"%s\": %m",
+							   attemptFilename->data, taskFilename->data)));
+	}
+
+	FreeStringInfo(attemptFilename);
+	FreeStringInfo(taskFilename);
+	FreeStringInfo(taskDirectoryName);
+}
+
+
+/*
+ * FinishPartitionStream ends the partition stream we transmitted over the given
+ * connection. The function then has the remote node split the stream into one
+ * file for each upstream task whose partition went over this connection, and
+ * rename these files to where worker_fetch_partition_file() would have put them.
+ * The node also creates files for partitions that received no rows.
+ */
+static void
+FinishPartitionStream(MultiConnection *connection, uint64 jobId, uint32 taskId,
+					  PartitionPushTarget *pushTargetArray, uint32 fileCount)
+{
+	StringInfo upstreamTaskIdString = makeStringInfo();
+	StringInfo finishCommand = makeStringInfo();
+	PGresult *result = NULL;
+	uint32 fileIndex = 0;
+	int copyEnded = 0;
+
+	copyEnded = PQputCopyEnd(connection->pgConn, NULL);
+	if (copyEnded != 1)
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+
+	result = GetRemoteCommandResult(connection, true);
+	if (PQresultStatus(result) != PGRES_COMMAND_OK)
+	{
+		ReportResultError(connection, result, ERROR);
+	}
+
+	PQclear(result);
+	ForgetResults(connection);
+
+	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
+	{
+		PartitionPushTarget *pushTarget = &pushTargetArray[fileIndex];
+		if (pushTarget->connection != connection)
+		{
+			continue;
+		}
+
+		if (upstreamTaskIdString->len > 0)
+		{
+			appendStringInfoChar(upstreamTaskIdString, ',');
+		}
+
+		appendStringInfo(upstreamTaskIdString, "%u", pushTarget->upstreamTaskId);
+	}
+
+	appendStringInfo(finishCommand, FINISH_PARTITION_STREAM_COMMAND,
+					 jobId, taskId, upstreamTaskIdString->data);
+	ExecuteCriticalRemoteCommand(connection, finishCommand->data);
+
+	FreeStringInfo(finishCommand);
+	FreeStringInfo(upstreamTaskIdString);
+}
+
+
 /*
  * MasterJobDirectoryName constructs a standardized job
  * directory path for the given job id on the master node.
@@ -712,9 +1405,9 @@ RenameDirectory(StringInfo oldDirectoryName, StringInfo newDirectoryName)
  * if so, the function flushes the buffer to the underlying file.
  */
 static void
-FileOutputStreamWrite(FileOutputStream file, StringInfo dataToWrite)
+FileOutputStreamWrite(FileOutputStream *file, StringInfo dataToWrite)
 {
-	StringInfo fileBuffer = file.fileBuffer;
+	StringInfo fileBuffer = file->fileBuffer;
 	uint32 newBufferSize = fileBuffer->len + dataToWrite->len;
 
 	appendBinaryStringInfo(fileBuffer, dataToWrite->data, dataToWrite->len);
@@ -728,20 +1421,323 @@ FileOutputStreamWrite(FileOutputStream file, StringInfo dataToWrite)
 }
 
 
-/* Flushes data buffered in the file stream object to the underlying file. */
+/*
+ * FileOutputStreamFlush flushes data buffered in the file stream object to the
+ * underlying file. If the stream is compressed, the function compresses the
+ * buffered data into a single block, and writes out this block instead.
+ */
 static void
-FileOutputStreamFlush(FileOutputStream file)
+FileOutputStreamFlush(FileOutputStream *file)
+{
+	StringInfo fileBuffer = file->fileBuffer;
+	StringInfo compressedBlock = NULL;
+	CompressedBlockHeader blockHeader;
+	char *blockData = NULL;
+	int32 compressedSize = 0;
+
+	file->flushed = true;
+
+	if (!file->compressed)
+	{
+		PartitionFileWrite(file, fileBuffer->data, fileBuffer->len);
+		return;
+	}
+
+	if (fileBuffer->len == 0)
+	{
+		return;
+	}
+
+	compressedBlock = makeStringInfo();
+	enlargeStringInfo(compressedBlock, sizeof(CompressedBlockHeader) +
+					  PGLZ_MAX_OUTPUT(fileBuffer->len));
+	blockData = compressedBlock->data + sizeof(CompressedBlockHeader);
+
+	compressedSize = pglz_compress(fileBuffer->data, fileBuffer->len, blockData,
+								   PGLZ_strategy_default);
+	if (compressedSize < 0)
+	{
+		/* data did not compress well, so we store the raw bytes */
+		memcpy(blockData, fileBuffer->data, fileBuffer->len);
+		blockHeader.rawSize = fileBuffer->len;
+		blockHeader.compressedSize = 0;
+		compressedBlock->len = sizeof(CompressedBlockHeader) + fileBuffer->len;
+	}
+	else
+	{
+		blockHeader.rawSize = fileBuffer->len;
+		blockHeader.compressedSize = compressedSize;
+		compressedBlock->len = sizeof(CompressedBlockHeader) + compressedSize;
+	}
+
+	memcpy(compressedBlock->data, &blockHeader, sizeof(CompressedBlockHeader));
+
+	PartitionFileWrite(file, compressedBlock->data, compressedBlock->len);
+
+	file->compressedBlockCount++;
+	file->uncompressedByteCount += fileBuffer->len;
+	file->compressedByteCount += compressedBlock->len;
+
+	FreeStringInfo(compressedBlock);
+}
+
+
+/*
+ * PartitionFileWrite writes the given data to the file stream's underlying file.
+ * If the stream has a push connection, the function also streams the data to
+ * the node that merges the partition.
+ */
+static void
+PartitionFileWrite(FileOutputStream *file, const char *data, int length)
 {
-	StringInfo fileBuffer = file.fileBuffer;
 	int written = 0;
 
 	errno = 0;
-	written = FileWrite(file.fileDescriptor, fileBuffer->data, fileBuffer->len);
-	if (written != fileBuffer->len)
+	written = FileWrite(file->fileDescriptor, (char *) data, length);
+	if (written != length)
 	{
 		ereport(ERROR, (errcode_for_file_access(),
 						errmsg("could not write %d bytes to partition file \"%s\"",
-							   fileBuffer->len, file.filePath->data)));
+							   length, file->filePath->data)));
+	}
+
+	if (file->pushConnection != NULL && length > 0)
+	{
+		SendPartitionStreamFrame(file, data, length);
+	}
+}
+
+
+/*
+ * SendPartitionStreamFrame sends the given partition data, as written to the
+ * stream's partition file, over the stream's push connection. The data go out
+ * as one frame that tells the remote node which upstream task they belong to.
+ */
+static void
+SendPartitionStreamFrame(FileOutputStream *file, const char *data, int length)
+{
+	MultiConnection *connection = file->pushConnection;
+	PartitionStreamFrameHeader frameHeader;
+	int copyResult = 0;
+
+	frameHeader.upstreamTaskId = htonl(file->pushTaskId);
+	frameHeader.length = htonl((uint32) length);
+
+	copyResult = PQputCopyData(connection->pgConn, (char *) &frameHeader,
+							   sizeof(PartitionStreamFrameHeader));
+	if (copyResult == 1)
+	{
+		copyResult = PQputCopyData(connection->pgConn, data, length);
+	}
+
+	if (copyResult != 1)
+	{
+		ReportConnectionError(connection, ERROR);
+	}
+}
+
+
+/*
+ * UpdateCompressionStatistics adds the blocks the given file stream compressed
+ * to the partition file compression statistics kept in shared memory. We call
+ * this function once per file, and use a spinlock of its own, so that writing
+ * compressed blocks never waits on the task tracker's hash lock.
+ */
+static void
+UpdateCompressionStatistics(FileOutputStream *file)
+{
+	volatile WorkerTasksSharedStateData *sharedState = WorkerTasksSharedState;
+
+	if (file->compressedBlockCount == 0)
+	{
+		return;
+	}
+
+	SpinLockAcquire(&sharedState->compressionStatisticsMutex);
+
+	sharedState->compressedBlockCount += file->compressedBlockCount;
+	sharedState->uncompressedByteCount += file->uncompressedByteCount;
+	sharedState->compressedByteCount += file->compressedByteCount;
+
+	SpinLockRelease(&sharedState->compressionStatisticsMutex);
+}
+
+
+/*
+ * worker_partition_compression_stats returns the number of compressed partition
+ * file blocks this node wrote since it started, along with the total number of
+ * bytes before and after compression. The ratio of these byte counts shows how
+ * well partition files compress.
+ */
+Datum
+worker_partition_compression_stats(PG_FUNCTION_ARGS)
+{
+	volatile WorkerTasksSharedStateData *sharedState = WorkerTasksSharedState;
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple statisticsTuple = NULL;
+	Datum values[3];
+	bool isNulls[3];
+	uint64 compressedBlockCount = 0;
+	uint64 uncompressedByteCount = 0;
+	uint64 compressedByteCount = 0;
+
+	TypeFuncClass resultTypeClass = get_call_result_type(fcinfo, NULL,
+														 &tupleDescriptor);
+	if (resultTypeClass != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
+
+	SpinLockAcquire(&sharedState->compressionStatisticsMutex);
+
+	compressedBlockCount = sharedState->compressedBlockCount;
+	uncompressedByteCount = sharedState->uncompressedByteCount;
+	compressedByteCount = sharedState->compressedByteCount;
+
+	SpinLockRelease(&sharedState->compressionStatisticsMutex);
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[0] = Int64GetDatum(compressedBlockCount);
+	values[1] = Int64GetDatum(uncompressedByteCount);
+	values[2] = Int64GetDatum(compressedByteCount);
+
+	statisticsTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(statisticsTuple));
+}
+
+
+/*
+ * DecompressPartitionFile checks if the given partition file is compressed, and
+ * if it is, decompresses the file's blocks into the given destination file. A
+ * compressed file starts with a magic number, followed by a sequence of blocks;
+ * each block has a CompressedBlockHeader followed by the block's data. Note that
+ * block headers use the host's byte order, as we expect all worker nodes in the
+ * cluster to run on the same platform. The function returns false without
+ * writing anything if the given file isn't compressed.
+ */
+bool
+DecompressPartitionFile(const char *sourceFilename, const char *destFilename)
+{
+	File sourceFile = 0;
+	File destFile = 0;
+	char magicNumber[COMPRESSED_FILE_MAGIC_SIZE];
+	const int sourceFlags = (O_RDONLY | PG_BINARY);
+	const int destFlags = (O_CREAT | O_TRUNC | O_WRONLY | PG_BINARY);
+	const int fileMode = (S_IRUSR | S_IWUSR);
+	int bytesRead = 0;
+
+	sourceFile = PathNameOpenFile((char *) sourceFilename, sourceFlags, fileMode);
+	if (sourceFile < 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", sourceFilename)));
+	}
+
+	bytesRead = FileRead(sourceFile, magicNumber, COMPRESSED_FILE_MAGIC_SIZE);
+	if (bytesRead != COMPRESSED_FILE_MAGIC_SIZE ||
+		memcmp(magicNumber, COMPRESSED_FILE_MAGIC, COMPRESSED_FILE_MAGIC_SIZE) != 0)
+	{
+		FileClose(sourceFile);
+		return false;
+	}
+
+	destFile = PathNameOpenFile((char *) destFilename, destFlags, fileMode);
+	if (destFile < 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", destFilename)));
+	}
+
+	while (true)
+	{
+		CompressedBlockHeader blockHeader;
+		char *blockData = NULL;
+		char *rawData = NULL;
+		uint32 blockDataSize = 0;
+		int written = 0;
+
+		bytesRead = FileRead(sourceFile, (char *) &blockHeader,
+							 sizeof(CompressedBlockHeader));
+		if (bytesRead == 0)
+		{
+			break;
+		}
+		else if (bytesRead != sizeof(CompressedBlockHeader) ||
+				 blockHeader.rawSize > MaxAllocSize ||
+				 blockHeader.compressedSize > blockHeader.rawSize)
+		{
+			ereport(ERROR, (errmsg("compressed partition file \"%s\" is corrupt",
+								   sourceFilename)));
+		}
+
+		blockDataSize = blockHeader.compressedSize;
+		if (blockDataSize == 0)
+		{
+			blockDataSize = blockHeader.rawSize;
+		}
+
+		blockData = palloc(blockDataSize);
+		ReadPartitionFile(sourceFile, sourceFilename, blockData, blockDataSize);
+
+		if (blockHeader.compressedSize == 0)
+		{
+			rawData = blockData;
+		}
+		else
+		{
+			int32 rawSize = 0;
+
+			rawData = palloc(blockHeader.rawSize);
+			rawSize = pglz_decompress(blockData, blockHeader.compressedSize, rawData,
+									  blockHeader.rawSize);
+			if (rawSize != (int32) blockHeader.rawSize)
+			{
+				ereport(ERROR, (errmsg("compressed partition file \"%s\" is corrupt",
+									   sourceFilename)));
+			}
+
+			pfree(blockData);
+		}
+
+		errno = 0;
+		written = FileWrite(destFile, rawData, blockHeader.rawSize);
+		if (written != (int) blockHeader.rawSize)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not write %u bytes to file \"%s\"",
+								   blockHeader.rawSize, destFilename)));
+		}
+
+		pfree(rawData);
+	}
+
+	FileClose(destFile);
+	FileClose(sourceFile);
+
+	return true;
+}
+
+
+/*
+ * ReadPartitionFile reads exactly the given number of bytes from the file, and
+ * errors out if the file ends early.
+ */
+static void
+ReadPartitionFile(File fileDescriptor, const char *filename, char *buffer, int length)
+{
+	int bytesRead = FileRead(fileDescriptor, buffer, length);
+	if (bytesRead < 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not read file \"%s\": %m", filename)));
+	}
+	else if (bytesRead != length)
+	{
+		ereport(ERROR, (errmsg("compressed partition file \"%s\" is corrupt",
+							   filename)));
 	}
 }
 
@@ -751,13 +1747,18 @@ FileOutputStreamFlush(FileOutputStream file)
  * results in a read-only fashion. For each resulting row, the function applies
  * the partitioning function and determines the partition identifier. Then, the
  * function chooses the partition file corresponding to this identifier, and
- * serializes the row into this file using the copy command's text format.
+ * serializes the row into this file using the copy command's text format. If
+ * the partitioning function asks for more than one copy of the row, the row is
+ * also written to the partition files that follow the chosen one. If we have a
+ * semi-join filter, rows whose partition keys are not in the filter cannot have
+ * a match on the other side of the join, and the function skips them.
  */
 static void
 FilterAndPartitionTable(const char *filterQuery,
 						const char *partitionColumnName, Oid partitionColumnType,
-						uint32 (*PartitionIdFunction)(Datum, const void *),
+						uint32 (*PartitionIdFunction)(Datum, const void *, uint32 *),
 						const void *partitionIdContext,
+						SemiJoinFilter *semiJoinFilter,
 						FileOutputStream *partitionFileArray,
 						uint32 fileCount)
 {
@@ -812,6 +1813,8 @@ FilterAndPartitionTable(const char *filterQuery,
 													  rowOutputState->binary);
 	}
 
+	OutputCompressionHeaders(partitionFileArray, fileCount);
+
 	if (BinaryWorkerCopyFormat)
 	{
 		OutputBinaryHeaders(partitionFileArray, fileCount);
@@ -828,15 +1831,24 @@ FilterAndPartitionTable(const char *filterQuery,
 		{
 			HeapTuple row = SPI_tuptable->vals[rowIndex];
 			TupleDesc rowDescriptor = SPI_tuptable->tupdesc;
-			FileOutputStream partitionFile = { 0, 0, 0 };
+			FileOutputStream *partitionFile = NULL;
 			StringInfo rowText = NULL;
 			Datum partitionKey = 0;
 			bool partitionKeyNull = false;
 			uint32 partitionId = 0;
+			uint32 partitionCopyCount = 1;
+			uint32 copyIndex = 0;
 
 			partitionKey = SPI_getbinval(row, rowDescriptor,
 										 partitionColumnIndex, &partitionKeyNull);
 
+			if (semiJoinFilter != NULL &&
+				(partitionKeyNull ||
+				 !SemiJoinFilterContains(semiJoinFilter, partitionKey)))
+			{
+				continue;
+			}
+
 			/*
 			 * If we have a partition key, we compute its bucket. Else if we have
 			 * a null key, we then put this tuple into the 0th bucket. Note that
@@ -845,7 +1857,8 @@ FilterAndPartitionTable(const char *filterQuery,
 			 */
 			if (!partitionKeyNull)
 			{
-				partitionId = (*PartitionIdFunction)(partitionKey, partitionIdContext);
+				partitionId = (*PartitionIdFunction)(partitionKey, partitionIdContext,
+													 &partitionCopyCount);
 			}
 			else
 			{
@@ -860,8 +1873,13 @@ FilterAndPartitionTable(const char *filterQuery,
 
 			rowText = rowOutputState->fe_msgbuf;
 
-			partitionFile = partitionFileArray[partitionId];
-			FileOutputStreamWrite(partitionFile, rowText);
+			for (copyIndex = 0; copyIndex < partitionCopyCount; copyIndex++)
+			{
+				uint32 copyPartitionId = (partitionId + copyIndex) % fileCount;
+
+				partitionFile = &partitionFileArray[copyPartitionId];
+				FileOutputStreamWrite(partitionFile, rowText);
+			}
 
 			resetStringInfo(rowText);
 			MemoryContextReset(rowOutputState->rowcontext);
@@ -997,6 +2015,27 @@ ClearRowOutputState(CopyOutState rowOutputState)
 }
 
 
+/*
+ * Write the compressed file magic number to each partition file. This function
+ * is a no-op unless partition files are compressed, and needs to run before any
+ * data get written to the files.
+ */
+static void
+OutputCompressionHeaders(FileOutputStream *partitionFileArray, uint32 fileCount)
+{
+	uint32 fileIndex = 0;
+	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
+	{
+		FileOutputStream *partitionFile = &partitionFileArray[fileIndex];
+		if (partitionFile->compressed)
+		{
+			PartitionFileWrite(partitionFile, COMPRESSED_FILE_MAGIC,
+							   COMPRESSED_FILE_MAGIC_SIZE);
+		}
+	}
+}
+
+
 /*
  * Write the header of postgres' binary serialization format to each partition file.
  * This function is used when binary_worker_copy_format is enabled.
@@ -1008,7 +2047,7 @@ OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount)
 	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
 	{
 		/* Generate header for a binary copy */
-		FileOutputStream partitionFile = { 0, 0, 0 };
+		FileOutputStream *partitionFile = NULL;
 		CopyOutStateData headerOutputStateData;
 		CopyOutState headerOutputState = (CopyOutState) & headerOutputStateData;
 
@@ -1017,7 +2056,7 @@ OutputBinaryHeaders(FileOutputStream *partitionFileArray, uint32 fileCount)
 
 		AppendCopyBinaryHeaders(headerOutputState);
 
-		partitionFile = partitionFileArray[fileIndex];
+		partitionFile = &partitionFileArray[fileIndex];
 		FileOutputStreamWrite(partitionFile, headerOutputState->fe_msgbuf);
 	}
 }
@@ -1034,7 +2073,7 @@ OutputBinaryFooters(FileOutputStream *partitionFileArray, uint32 fileCount)
 	for (fileIndex = 0; fileIndex < fileCount; fileIndex++)
 	{
 		/* Generate footer for a binary copy */
-		FileOutputStream partitionFile = { 0, 0, 0 };
+		FileOutputStream *partitionFile = NULL;
 		CopyOutStateData footerOutputStateData;
 		CopyOutState footerOutputState = (CopyOutState) & footerOutputStateData;
 
@@ -1043,7 +2082,7 @@ OutputBinaryFooters(FileOutputStream *partitionFileArray, uint32 fileCount)
 
 		AppendCopyBinaryFooters(footerOutputState);
 
-		partitionFile = partitionFileArray[fileIndex];
+		partitionFile = &partitionFileArray[fileIndex];
 		FileOutputStreamWrite(partitionFile, footerOutputState->fe_msgbuf);
 	}
 }
@@ -1069,9 +2108,10 @@ CompareCall2(FmgrInfo *functionInfo, Datum leftArgument, Datum rightArgument)
  * Note that we employ a version of binary search known as upper_bound; this
  * ensures that all null values fall into the zeroth bucket and that we maintain
  * full compatibility with the semantics of Hadoop's TotalOrderPartitioner.
+ * Range partitioning always writes a single copy of each row.
  */
 static uint32
-RangePartitionId(Datum partitionValue, const void *context)
+RangePartitionId(Datum partitionValue, const void *context, uint32 *partitionCopyCount)
 {
 	RangePartitionContext *rangePartitionContext = (RangePartitionContext *) context;
 	FmgrInfo *comparisonFunction = rangePartitionContext->comparisonFunction;
@@ -1120,6 +2160,78 @@ RangePartitionId(Datum partitionValue, const void *context)
 }
 
 
+/*
+ * HashSplitPointArray deserializes the given array of hashed split points, and
+ * checks that the split points are sorted, as HashRangePartitionId() expects.
+ */
+static int32 *
+HashSplitPointArray(ArrayType *splitPointObject, uint32 *splitPointCount)
+{
+	Datum *splitPointDatumArray = DeconstructArrayObject(splitPointObject);
+	int32 datumCount = ArrayObjectCount(splitPointObject);
+	int32 *splitPointArray = palloc0(Max(datumCount, 1) * sizeof(int32));
+	int32 splitPointIndex = 0;
+
+	for (splitPointIndex = 0; splitPointIndex < datumCount; splitPointIndex++)
+	{
+		int32 splitPoint = DatumGetInt32(splitPointDatumArray[splitPointIndex]);
+
+		if (splitPointIndex > 0 && splitPoint <= splitPointArray[splitPointIndex - 1])
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							errmsg("hashed split points must be in ascending order")));
+		}
+
+		splitPointArray[splitPointIndex] = splitPoint;
+	}
+
+	*splitPointCount = (uint32) datumCount;
+
+	return splitPointArray;
+}
+
+
+/*
+ * HashRangePartitionId determines the partition number for the given data value
+ * using the hashed split points in the partition context. The function applies
+ * the standard Postgres hashing function for the given data type, and returns
+ * the number of split points that are less than or equal to the hashed value.
+ * This way, passing the minimum values of all but the first shard of a hash
+ * distributed table sends each row to the partition of the shard that would
+ * store the row.
+ */
+static uint32
+HashRangePartitionId(Datum partitionValue, const void *context,
+					 uint32 *partitionCopyCount)
+{
+	HashPartitionContext *hashPartitionContext = (HashPartitionContext *) context;
+	FmgrInfo *hashFunction = hashPartitionContext->hashFunction;
+	int32 *splitPointArray = hashPartitionContext->hashSplitPointArray;
+	uint32 currentLength = hashPartitionContext->partitionCount - 1;
+	uint32 firstIndex = 0;
+	int32 hashedValue = DatumGetInt32(FunctionCall1(hashFunction, partitionValue));
+
+	/* same upper_bound search as in RangePartitionId(), on the hashed value */
+	while (currentLength > 0)
+	{
+		uint32 halfLength = currentLength >> 1;
+		uint32 middleIndex = firstIndex + halfLength;
+
+		if (hashedValue < splitPointArray[middleIndex])
+		{
+			currentLength = halfLength;
+		}
+		else
+		{
+			firstIndex = middleIndex + 1;
+			currentLength = currentLength - halfLength - 1;
+		}
+	}
+
+	return firstIndex;
+}
+
+
 /*
  * HashPartitionId determines the partition number for the given data value
  * using hash partitioning. More specifically, the function returns zero if the
@@ -1131,13 +2243,18 @@ RangePartitionId(Datum partitionValue, const void *context)
  * Note that any changes to PostgreSQL's hashing functions will reshuffle the
  * entire distribution created by this function. For a discussion of this issue,
  * see Google "PL/Proxy Users: Hash Functions Have Changed in PostgreSQL 8.4."
+ *
+ * If the data value is a heavy hitter, the function instead picks the next one
+ * of the heavy hitter's partitions for spread values, and asks for a copy of
+ * the row in each of these partitions for replicated values.
  */
 static uint32
-HashPartitionId(Datum partitionValue, const void *context)
+HashPartitionId(Datum partitionValue, const void *context, uint32 *partitionCopyCount)
 {
 	HashPartitionContext *hashPartitionContext = (HashPartitionContext *) context;
 	FmgrInfo *hashFunction = hashPartitionContext->hashFunction;
 	uint32 partitionCount = hashPartitionContext->partitionCount;
+	HashPartitionHeavyHitter *heavyHitter = NULL;
 	Datum hashDatum = 0;
 	uint32 hashResult = 0;
 	uint32 hashPartitionId = 0;
@@ -1147,5 +2264,34 @@ HashPartitionId(Datum partitionValue, const void *context)
 	hashResult = DatumGetUInt32(hashDatum);
 	hashPartitionId = (hashResult % partitionCount);
 
+	if (hashPartitionContext->heavyHitterCount > 0)
+	{
+		HashPartitionHeavyHitter searchedHeavyHitter;
+		searchedHeavyHitter.hashValue = hashResult;
+
+		heavyHitter = bsearch(&searchedHeavyHitter,
+							  hashPartitionContext->heavyHitterArray,
+							  hashPartitionContext->heavyHitterCount,
+							  sizeof(HashPartitionHeavyHitter), CompareHeavyHitters);
+	}
+
+	if (heavyHitter != NULL)
+	{
+		uint32 heavyHitterPartitionCount = heavyHitter->partitionCount;
+
+		if (heavyHitter->spread)
+		{
+			uint32 partitionOffset = heavyHitter->nextPartitionOffset;
+
+			hashPartitionId = (hashPartitionId + partitionOffset) % partitionCount;
+			heavyHitter->nextPartitionOffset =
+				(partitionOffset + 1) % heavyHitterPartitionCount;
+		}
+		else
+		{
+			*partitionCopyCount = heavyHitterPartitionCount;
+		}
+	}
+
 	return hashPartitionId;
 }
@@ -0,0 +1,66 @@
+/*-------------------------------------------------------------------------
+ *
+ * commit_worker.h
+ *	  Type and function declarations for the background worker that finishes
+ *	  two-phase commits on behalf of coordinator backends.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef COMMIT_WORKER_H
+#define COMMIT_WORKER_H
+
+#include "distributed/connection_management.h"
+#include "storage/latch.h"
+#include "storage/spin.h"
+
+
+/* Number of deferred commits we can queue per allowed client connection */
+#define DEFERRED_COMMITS_PER_CONNECTION 4
+
+/* Maximum number of deferred commits the commit worker takes at once */
+#define DEFERRED_COMMIT_BATCH_SIZE 64
+
+
+/*
+ * DeferredCommit describes a prepared transaction on a worker node which the
+ * coordinator committed, and which the commit worker still needs to commit.
+ */
+typedef struct DeferredCommit
+{
+	char nodeName[MAX_NODE_LENGTH];
+	int32 nodePort;
+	char userName[NAMEDATALEN];
+	char databaseName[NAMEDATALEN];
+	char transactionName[NAMEDATALEN];
+} DeferredCommit;
+
+
+/*
+ * CommitWorkerSharedStateData holds the queue of deferred commits in shared
+ * memory. Backends append to the queue at commit time, and the commit worker
+ * takes commits from its head.
+ */
+typedef struct CommitWorkerSharedStateData
+{
+	slock_t mutex;
+	Latch *commitWorkerLatch;
+	uint32 queueSize;
+	uint32 queueHead;
+	uint32 queueLength;
+	DeferredCommit queue[FLEXIBLE_ARRAY_MEMBER];
+} CommitWorkerSharedStateData;
+
+
+/* Config variables managed via guc.c */
+extern bool DeferCommitPrepared;
+
+
+/* Function declarations for deferring and finishing two-phase commits */
+extern void CommitWorkerRegister(void);
+extern bool DeferRemoteTransactionCommit(MultiConnection *connection);
+
+
+#endif   /* COMMIT_WORKER_H */
@@ -0,0 +1,38 @@
+/*-------------------------------------------------------------------------
+ *
+ * master_statistics.h
+ *	  Type and function declarations for collecting statistics of distributed
+ *	  tables from their shards, and for looking these statistics up.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef MASTER_STATISTICS_H
+#define MASTER_STATISTICS_H
+
+#include "fmgr.h"
+
+
+/* Query to fetch a shard's row count, size, and column statistics */
+#define SHARD_STATISTICS_QUERY "SELECT c.reltuples, pg_relation_size(c.oid), \
+ s.attname, s.null_frac, s.avg_width, s.n_distinct, \
+ s.most_common_vals::text::text[], s.most_common_freqs, \
+ s.histogram_bounds::text::text[] FROM pg_class c LEFT JOIN pg_stats s \
+ ON s.schemaname = %s AND s.tablename = c.relname AND NOT s.inherited \
+ WHERE c.oid = %s::regclass"
+
+
+/* Function declarations for collecting and looking up statistics */
+extern void UpdateDistributedTableStatistics(Oid relationId);
+extern void DeleteDistributedTableStatistics(Oid relationId);
+extern bool DistributedTableStatistics(Oid relationId, double *rowCount,
+									   double *tableSize);
+extern double DistributedColumnDistinctCount(Oid relationId, AttrNumber attnum);
+
+/* Function declarations for the SQL callable functions */
+extern Datum master_update_table_statistics(PG_FUNCTION_ARGS);
+
+
+#endif   /* MASTER_STATISTICS_H */
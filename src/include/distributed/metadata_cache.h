@@ -83,6 +83,10 @@ extern Oid DistShardPlacementShardidIndexId(void);
 extern Oid DistShardPlacementPlacementidIndexId(void);
 extern Oid DistTransactionRelationId(void);
 extern Oid DistTransactionGroupIndexId(void);
+extern Oid DistTableStatisticRelationId(void);
+extern Oid DistTableStatisticLogicalRelidIndexId(void);
+extern Oid DistColumnStatisticRelationId(void);
+extern Oid DistColumnStatisticLogicalRelidAttnumIndexId(void);
 extern Oid DistShardPlacementNodeidIndexId(void);
 
 /* function oids */
@@ -70,12 +70,18 @@ typedef struct JoinOrderNode
 	char partitionMethod;
 	List *joinClauseList;       /* not relevant for the first table */
 	List *shardIntervalList;
+
+	/* only set when join orders are cost based; see EstimateTransferSize() */
+	bool costBased;
+	double transferSize;        /* not relevant for the first table */
+	double joinedSize;
 } JoinOrderNode;
 
 
 /* Config variables managed via guc.c */
 extern int LargeTableShardCount;
 extern bool LogMultiJoinOrder;
+extern bool EnableCostBasedJoinOrder;
 
 
 /* Function declaration for determining table join orders */
@@ -103,6 +103,7 @@ static const char *const AggregateNames[] = {
 /* Config variable managed via guc.c */
 extern int LimitClauseRowFetchCount;
 extern double CountDistinctErrorRate;
+extern bool EnableSortedMerge;
 
 
 /* Function declaration for optimizing logical plans */
@@ -131,6 +131,8 @@ typedef struct MultiJoin
 	List *joinClauseList;
 	JoinRuleType joinRuleType;
 	JoinType joinType;
+	bool costBased;             /* true if the join order is cost based */
+	double transferSize;        /* only set when join orders are cost based */
 } MultiJoin;
 
 
@@ -177,6 +179,7 @@ typedef struct MultiExtendedOp
 
 /* Config variables managed via guc.c */
 extern bool SubqueryPushdown;
+extern bool EnableRepartitionedAggregation;
 
 
 /* Function declarations for building logical plans */
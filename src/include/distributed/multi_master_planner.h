@@ -19,9 +19,14 @@
 #include "nodes/plannodes.h"
 
 
+/* Config variables managed via guc.c */
+extern int MaxSortedMergeFanIn;
+
+
 /* Function declarations for building local plans on the master node */
 struct MultiPlan;
 extern CreateStmt * MasterNodeCreateStatement(struct MultiPlan *multiPlan);
+extern List * MasterNodeMergeCreateStatementList(struct MultiPlan *multiPlan);
 extern List * MasterNodeCopyStatementList(struct MultiPlan *multiPlan);
 extern PlannedStmt * MasterNodeSelectPlan(struct MultiPlan *multiPlan);
 
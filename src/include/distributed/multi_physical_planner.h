@@ -42,6 +42,24 @@
  (" UINT64_FORMAT ", %d, %s, '%s', '%s'::regtype, %s)"
 #define HASH_PARTITION_COMMAND "SELECT worker_hash_partition_table \
  (" UINT64_FORMAT ", %d, %s, '%s', '%s'::regtype, %d)"
+#define RANGE_PARTITION_PUSH_COMMAND "SELECT worker_range_partition_table \
+ (" UINT64_FORMAT ", %d, %s, '%s', '%s'::regtype, %s, %s, %s, %s)"
+#define HASH_RANGE_PARTITION_COMMAND "SELECT worker_hash_partition_table \
+ (" UINT64_FORMAT ", %d, %s, %s, '%s'::regtype, '%s'::int4[])"
+#define HASH_PARTITION_PUSH_COMMAND "SELECT worker_hash_partition_table \
+ (" UINT64_FORMAT ", %d, %s, '%s', '%s'::regtype, %d, %s, %s, %s)"
+#define HASH_PARTITION_SKEW_COMMAND "SELECT worker_hash_partition_table \
+ (" UINT64_FORMAT ", %d, %s, '%s', '%s'::regtype, %d, %s, %s)"
+#define NO_PUSH_TARGETS "'{}'::text[], '{}'::int4[], '{}'::int4[]"
+#define HEAVY_HITTER_QUERY "SELECT frequency || ' ' || value \
+ FROM pg_stats, unnest(most_common_vals::text::text[], most_common_freqs) \
+ AS common_value(value, frequency) WHERE schemaname = %s AND tablename = %s \
+ AND attname = %s AND NOT inherited AND frequency >= %f"
+#define BUILD_SEMI_JOIN_FILTER_COMMAND "SELECT worker_build_semi_join_filter \
+ (%s, %s, %s::regtype, %d)"
+#define STORE_SEMI_JOIN_FILTER_COMMAND "SELECT worker_store_semi_join_filter \
+ (" UINT64_FORMAT ", $1)"
+#define SHARD_KEY_QUERY "SELECT %s FROM %s"
 #define MERGE_FILES_INTO_TABLE_COMMAND "SELECT worker_merge_files_into_table \
  (" UINT64_FORMAT ", %d, '%s', '%s')"
 #define MERGE_FILES_AND_RUN_QUERY_COMMAND \
@@ -136,6 +154,16 @@ typedef struct MapMergeJob
 	ShardInterval **sortedShardIntervalArray; /* only applies to range partitioning */
 	List *mapTaskList;
 	List *mergeTaskList;
+
+	/* only apply to hash partitioning; see HashPartitionHeavyHitter */
+	List *heavyHitterValueList;
+	List *heavyHitterPartitionCountList;
+	List *spreadHeavyHitterList;
+
+	/* only apply to inner joins; see AssignSemiJoinSource() */
+	uint64 semiJoinSourceJobId;
+	Oid semiJoinSourceRelationId;
+	List *semiJoinSourceTaskList;
 } MapMergeJob;
 
 
@@ -166,12 +194,14 @@ typedef struct Task
 	uint32 upstreamTaskId;         /* only applies to data fetch tasks */
 	ShardInterval *shardInterval;  /* only applies to merge tasks */
 	bool assignmentConstrained;    /* only applies to merge tasks */
+	bool pushPartitions;           /* only applies to map tasks */
 	uint64 shardId;                /* only applies to shard fetch tasks */
 	TaskExecution *taskExecution;  /* used by task tracker executor */
 	bool upsertQuery;              /* only applies to modify tasks */
 
 	bool insertSelectQuery;
 	List *relationShardList;       /* only applies INSERT/SELECT tasks */
+	List *rowIndexList;            /* only applies to multi-row INSERT tasks */
 } Task;
 
 
@@ -209,6 +239,9 @@ typedef struct MultiPlan
 	Query *masterQuery;
 	char *masterTableName;
 	bool routerExecutable;
+	bool costBasedJoinOrder;    /* true if we estimated the plan's join costs */
+	double transferSize;        /* estimated bytes the plan's joins transfer */
+	double groupCountEstimate;  /* 0 if we cannot estimate the group count */
 } MultiPlan;
 
 
@@ -225,14 +258,23 @@ typedef struct OperatorCacheEntry
 } OperatorCacheEntry;
 
 
-/* Config variable managed via guc.c */
+/* Config variables managed via guc.c */
 extern int TaskAssignmentPolicy;
+extern bool EnableRepartitionPush;
+extern bool EnableSkewAwareRepartition;
+extern int SemiJoinFilterSize;
+
+/* Planner state set by the explain logic */
+extern bool PlanningForExplainOnly;
 
 /* Function declarations for building physical plans and constructing queries */
 extern MultiPlan * MultiPhysicalPlanCreate(MultiTreeRoot *multiTree);
 extern StringInfo ShardFetchQueryString(uint64 shardId);
+extern uint64 UniqueJobId(void);
 extern Task * CreateBasicTask(uint64 jobId, uint32 taskId, TaskType taskType,
 							  char *queryString);
+extern char * SingleShardTaskQueryString(Job *job, Task *task,
+										 List *additionalClauseList);
 
 /* Function declarations for shard pruning */
 extern List * PruneShardList(Oid relationId, Index tableId, List *whereClauseList,
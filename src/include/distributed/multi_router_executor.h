@@ -31,6 +31,7 @@ typedef struct XactShardConnSet
 
 /* Config variables managed via guc.c */
 extern bool AllModificationsCommutative;
+extern bool PipelineTransactionModifications;
 
 
 extern void RouterExecutorStart(QueryDesc *queryDesc, int eflags, List *taskList);
@@ -38,6 +39,7 @@ extern void RouterExecutorRun(QueryDesc *queryDesc, ScanDirection direction, lon
 extern void RouterExecutorFinish(QueryDesc *queryDesc);
 extern void RouterExecutorEnd(QueryDesc *queryDesc);
 extern void RouterExecutorPreCommitCheck(void);
+extern void FinishPipelinedModifications(void);
 extern void RouterExecutorPostCommit(void);
 
 extern int64 ExecuteModifyTasksWithoutResults(List *taskList);
@@ -26,7 +26,13 @@
 /* reserved alias name for UPSERTs */
 #define CITUS_TABLE_ALIAS "citus_table_alias"
 
+/* inserts the rows fetched for a target shard of a repartitioned INSERT ... SELECT */
+#define REPARTITIONED_INSERT_COMMAND "INSERT INTO %s SELECT (task_row).* FROM \
+ (SELECT worker_read_task_files(NULL::%s, " UINT64_FORMAT ", %u) AS task_row \
+ OFFSET 0) task_rows"
+
 extern bool EnableRouterExecution;
+extern bool EnableRepartitionedInsertSelect;
 
 extern MultiPlan * MultiRouterPlanCreate(Query *originalQuery, Query *query,
 										 RelationRestrictionContext *restrictionContext);
@@ -41,6 +47,7 @@ extern RangeTblEntry * ExtractSelectRangeTableEntry(Query *query);
 extern RangeTblEntry * ExtractInsertRangeTableEntry(Query *query);
 extern void AddShardIntervalRestrictionToSelect(Query *subqery,
 												ShardInterval *shardInterval);
+extern Query * InsertValuesSubsetQuery(Query *query, List *rowIndexList);
 
 
 #endif /* MULTI_ROUTER_PLANNER_H */
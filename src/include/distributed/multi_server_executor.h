@@ -14,6 +14,8 @@
 #ifndef MULTI_SERVER_EXECUTOR_H
 #define MULTI_SERVER_EXECUTOR_H
 
+#include "fmgr.h"
+
 #include "distributed/multi_physical_planner.h"
 #include "distributed/task_tracker.h"
 #include "distributed/worker_manager.h"
@@ -32,7 +34,11 @@
 /* Task tracker executor related defines */
 #define TASK_ASSIGNMENT_QUERY "SELECT task_tracker_assign_task \
  ("UINT64_FORMAT ", %u, %s)"
+#define TASK_PRIORITY_ASSIGNMENT_QUERY "SELECT task_tracker_assign_task \
+ ("UINT64_FORMAT ", %u, %s, %d)"
 #define TASK_STATUS_QUERY "SELECT task_tracker_task_status("UINT64_FORMAT ", %u)"
+#define TASK_STATUS_BATCH_QUERY "SELECT job_id, task_id, task_status, status_sequence \
+ FROM task_tracker_task_statuses('{%s}'::bigint[], "UINT64_FORMAT ")"
 #define JOB_CLEANUP_QUERY "SELECT task_tracker_cleanup_job("UINT64_FORMAT ")"
 #define JOB_CLEANUP_TASK_ID INT_MAX
 
@@ -163,6 +169,8 @@ typedef struct TaskTracker
 	int32 currentTaskIndex;
 	bool connectionBusy;
 	TrackerTaskState *connectionBusyOnTask;
+	List *connectionBusyOnTaskList; /* tasks covered by a batched status query */
+	uint64 taskStatusSequence;      /* highest status sequence number seen */
 } TaskTracker;
 
 
@@ -178,16 +186,55 @@ typedef struct WorkerNodeState
 } WorkerNodeState;
 
 
+/*
+ * TopKBound tracks the most selective bound on the first sort column of an
+ * ORDER BY ... LIMIT k job. Each task returns its own top-k rows; once a task
+ * returns k rows, no row that sorts after the task's last row can make it into
+ * the final result. The executors inject the tightest such bound as a filter
+ * into tasks they have not yet sent to worker nodes.
+ */
+typedef struct TopKBound
+{
+	Job *job;
+	int64 limitCount;            /* number of rows each task returns at most */
+	int sortColumnIndex;         /* zero-based index of sort column in results */
+	Expr *sortExpression;        /* sort expression in the job query */
+	Oid sortColumnTypeId;
+	int32 sortColumnTypeMod;
+	Oid sortCollationId;
+	Oid boundOperatorId;         /* <= for ascending, >= for descending order */
+	FmgrInfo sortFunctionInfo;   /* compares candidate bounds */
+	bool boundExists;
+	Datum boundValue;
+} TopKBound;
+
+
+/*
+ * TaskCopyStatement maps a top level task to the statement that copies its
+ * results into the task's table on the master node. The executors keep these
+ * in a hash keyed by task id, and run the statement once the task completes.
+ */
+typedef struct TaskCopyStatement
+{
+	uint32 taskId;               /* hash table key */
+	Node *copyStatement;
+} TaskCopyStatement;
+
+
 /* Config variable managed via guc.c */
 extern int RemoteTaskCheckInterval;
 extern int MaxAssignTaskBatchSize;
+extern int TaskPriority;
+extern bool BatchTaskStatusQueries;
 extern int TaskExecutorType;
 extern bool BinaryMasterCopyFormat;
+extern bool EnableTopKBoundPropagation;
+extern bool EnableIncrementalResultCopy;
 
 
 /* Function declarations for distributed execution */
-extern void MultiRealTimeExecute(Job *job);
-extern void MultiTaskTrackerExecute(Job *job);
+extern void MultiRealTimeExecute(Job *job, List *masterCopyStmtList);
+extern void MultiTaskTrackerExecute(Job *job, List *masterCopyStmtList);
 
 /* Function declarations common to more than one executor */
 extern MultiExecutorType JobExecutorType(MultiPlan *multiPlan);
@@ -197,6 +244,13 @@ extern void CleanupTaskExecution(TaskExecution *taskExecution);
 extern bool TaskExecutionFailed(TaskExecution *taskExecution);
 extern void AdjustStateForFailure(TaskExecution *taskExecution);
 extern int MaxMasterConnectionCount(void);
+extern HTAB * TaskCopyStatementHash(Job *job, List *masterCopyStmtList);
+extern void CopyTaskResults(HTAB *taskCopyStatementHash, Task *task);
+
+/* Function declarations for propagating top-k bounds between tasks */
+extern TopKBound * CreateTopKBound(Job *job);
+extern bool UpdateTopKBound(TopKBound *topKBound, Task *task);
+extern char * TopKBoundedQueryString(TopKBound *topKBound, Task *task);
 
 
 #endif /* MULTI_SERVER_EXECUTOR_H */
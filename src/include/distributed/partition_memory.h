@@ -0,0 +1,82 @@
+/*-------------------------------------------------------------------------
+ *
+ * partition_memory.h
+ *
+ * Declarations for keeping small partition files in shared memory, instead of
+ * writing them to disk.
+ *
+ * Copyright (c) 2012-2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PARTITION_MEMORY_H
+#define PARTITION_MEMORY_H
+
+#include "lib/stringinfo.h"
+#include "storage/lwlock.h"
+#include "utils/hsearch.h"
+
+
+/* Size of the blocks we split shared partition memory into */
+#define PARTITION_MEMORY_BLOCK_SIZE 8192
+
+
+/*
+ * InMemoryPartition represents a partition file that we keep in shared memory.
+ * The partition's data live in a chain of blocks; see PartitionMemoryArea. We
+ * copy data into and out of these blocks without holding the area's lock; the
+ * reference count keeps the blocks from being freed while we copy. Partitions
+ * that are being written, or that were removed while still referenced, are not
+ * visible to readers.
+ */
+typedef struct InMemoryPartition
+{
+	char filename[MAXPGPATH]; /* hash key; partition file's final path */
+	uint64 jobId;
+	uint32 dataSize;
+	int32 firstBlockId;
+	int32 referenceCount;
+	bool written;
+	bool removed;
+} InMemoryPartition;
+
+
+/*
+ * PartitionMemoryArea keeps the shared memory in which we store partitions,
+ * along with the hash that maps partition file names to their data. Blocks are
+ * linked through the block link array; unused blocks form the free list. The
+ * area is guarded by its own lock, which we only hold to look up partitions and
+ * to hand out or take back blocks.
+ */
+typedef struct PartitionMemoryArea
+{
+	int lockTrancheId;
+	LWLockTranche lockTranche;
+	LWLock lock;
+	HTAB *partitionHash;
+	int32 *blockLinkArray;
+	char *blockArray;
+	int32 blockCount;
+	int32 freeBlockId;
+	int32 freeBlockCount;
+} PartitionMemoryArea;
+
+
+/* Config variable managed via guc.c */
+extern int PartitionMemoryBudget;
+
+
+/* Function declarations for keeping partitions in shared memory */
+extern Size PartitionMemoryShmemSize(void);
+extern void PartitionMemoryShmemInit(void);
+extern bool StoreInMemoryPartition(uint64 jobId, const char *filename,
+								   StringInfo partitionData);
+extern StringInfo LoadInMemoryPartition(const char *filename);
+extern void RemoveInMemoryPartition(const char *filename);
+extern void RemoveInMemoryJobPartitions(uint64 jobId);
+
+
+#endif   /* PARTITION_MEMORY_H */
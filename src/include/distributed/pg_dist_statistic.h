@@ -0,0 +1,90 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_dist_statistic.h
+ *	  definition of the relations that hold statistics for distributed tables
+ *	  (pg_dist_table_statistic and pg_dist_column_statistic).
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PG_DIST_STATISTIC_H
+#define PG_DIST_STATISTIC_H
+
+
+/* ----------------
+ *		pg_dist_table_statistic definition.
+ * ----------------
+ */
+typedef struct FormData_pg_dist_table_statistic
+{
+	Oid logicalrelid;          /* distributed table the statistics are for */
+	float8 reltuples;          /* number of rows in all shards */
+	int64 relsize;             /* size of all shards in bytes */
+} FormData_pg_dist_table_statistic;
+
+
+/* ----------------
+ *      Form_pg_dist_table_statistic corresponds to a pointer to a tuple with
+ *      the format of pg_dist_table_statistic relation.
+ * ----------------
+ */
+typedef FormData_pg_dist_table_statistic *Form_pg_dist_table_statistic;
+
+
+/* ----------------
+ *      compiler constants for pg_dist_table_statistic
+ * ----------------
+ */
+#define Natts_pg_dist_table_statistic 3
+#define Anum_pg_dist_table_statistic_logicalrelid 1
+#define Anum_pg_dist_table_statistic_reltuples 2
+#define Anum_pg_dist_table_statistic_relsize 3
+
+
+/* ----------------
+ *		pg_dist_column_statistic definition. The fields follow pg_stats; like
+ *		there, a negative n_distinct is the negated fraction of rows that are
+ *		distinct.
+ * ----------------
+ */
+typedef struct FormData_pg_dist_column_statistic
+{
+	Oid logicalrelid;          /* distributed table the statistics are for */
+	int16 attnum;              /* column number in the distributed table */
+	float4 null_frac;          /* fraction of rows that are null */
+	int32 avg_width;           /* average width of non-null values in bytes */
+	float4 n_distinct;         /* number of distinct non-null values */
+#ifdef CATALOG_VARLEN          /* variable-length fields start here */
+	text most_common_vals[1];  /* text forms of the most common values */
+	float4 most_common_freqs[1]; /* fractions of rows that have these values */
+	text histogram_bounds[1];  /* text forms of equi-depth histogram bounds */
+#endif
+} FormData_pg_dist_column_statistic;
+
+
+/* ----------------
+ *      Form_pg_dist_column_statistic corresponds to a pointer to a tuple with
+ *      the format of pg_dist_column_statistic relation.
+ * ----------------
+ */
+typedef FormData_pg_dist_column_statistic *Form_pg_dist_column_statistic;
+
+
+/* ----------------
+ *      compiler constants for pg_dist_column_statistic
+ * ----------------
+ */
+#define Natts_pg_dist_column_statistic 8
+#define Anum_pg_dist_column_statistic_logicalrelid 1
+#define Anum_pg_dist_column_statistic_attnum 2
+#define Anum_pg_dist_column_statistic_null_frac 3
+#define Anum_pg_dist_column_statistic_avg_width 4
+#define Anum_pg_dist_column_statistic_n_distinct 5
+#define Anum_pg_dist_column_statistic_most_common_vals 6
+#define Anum_pg_dist_column_statistic_most_common_freqs 7
+#define Anum_pg_dist_column_statistic_histogram_bounds 8
+
+
+#endif   /* PG_DIST_STATISTIC_H */
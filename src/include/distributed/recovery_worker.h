@@ -0,0 +1,49 @@
+/*-------------------------------------------------------------------------
+ *
+ * recovery_worker.h
+ *	  Type and function declarations for the background worker that
+ *	  periodically recovers prepared transactions on worker nodes.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef RECOVERY_WORKER_H
+#define RECOVERY_WORKER_H
+
+#include "fmgr.h"
+#include "storage/spin.h"
+
+
+/*
+ * RecoveryStatistics counts the prepared transactions that transaction
+ * recovery resolved since server start, whether recovery ran in the recovery
+ * worker or through recover_prepared_transactions().
+ */
+typedef struct RecoveryStatistics
+{
+	slock_t mutex;
+	uint64 recoveryCount;
+	uint64 committedTransactionCount;
+	uint64 abortedTransactionCount;
+	uint64 failedTransactionCount;
+} RecoveryStatistics;
+
+
+/* Config variables managed via guc.c */
+extern char *TransactionRecoveryDatabase;
+extern int TransactionRecoveryInterval;
+
+
+/* Function declarations for automatic transaction recovery */
+extern void RecoveryWorkerRegister(void);
+extern void CountRecoveredTransactions(int committedTransactionCount,
+									   int abortedTransactionCount,
+									   int failedTransactionCount);
+
+/* SQL function declarations */
+extern Datum citus_transaction_recovery_stats(PG_FUNCTION_ARGS);
+
+
+#endif   /* RECOVERY_WORKER_H */
@@ -0,0 +1,51 @@
+/*-------------------------------------------------------------------------
+ *
+ * semi_join_filter.h
+ *
+ * Declarations for Bloom filters that map tasks use to drop rows which cannot
+ * have a match on the other side of a repartition join.
+ *
+ * Copyright (c) 2012-2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SEMI_JOIN_FILTER_H
+#define SEMI_JOIN_FILTER_H
+
+#include "fmgr.h"
+
+
+/* Number of bits we set in the filter for each join key */
+#define SEMI_JOIN_FILTER_HASH_COUNT 3
+
+/* Name of the file in a job directory that holds the job's filter */
+#define SEMI_JOIN_FILTER_FILENAME "semi_join_filter"
+
+
+/*
+ * SemiJoinFilter is a Bloom filter over the join keys of one side of a join.
+ * We hash keys with their type's hash function, and derive the filter bits
+ * from this hash; the filter may therefore only be probed with keys of a type
+ * whose hash function agrees with the one the filter was built with.
+ */
+typedef struct SemiJoinFilter
+{
+	FmgrInfo *hashFunction;
+	uint32 bitCount;
+	uint8 *bitArray;
+} SemiJoinFilter;
+
+
+/* Function declarations for building and probing semi-join filters */
+extern SemiJoinFilter * LoadSemiJoinFilter(uint64 jobId, Oid keyType);
+extern bool SemiJoinFilterContains(SemiJoinFilter *filter, Datum key);
+
+/* Function declarations for the SQL callable functions */
+extern Datum worker_build_semi_join_filter(PG_FUNCTION_ARGS);
+extern Datum worker_store_semi_join_filter(PG_FUNCTION_ARGS);
+
+
+#endif   /* SEMI_JOIN_FILTER_H */
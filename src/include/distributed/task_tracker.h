@@ -15,7 +15,9 @@
 #ifndef TASK_TRACKER_H
 #define TASK_TRACKER_H
 
+#include "storage/latch.h"
 #include "storage/lwlock.h"
+#include "storage/spin.h"
 #include "utils/hsearch.h"
 
 
@@ -27,6 +29,11 @@
 #define TASK_CALL_STRING_SIZE 12288 /* max length of task call string */
 #define TEMPLATE0_NAME "template0"  /* skip job schema cleanup for template0 */
 #define JOB_SCHEMA_CLEANUP "SELECT worker_cleanup_job_schema_cache()"
+#define INVALID_TASK_WORKER_SLOT -1 /* task does not run in a background worker */
+#define TASK_WORKER_IDLE_TIMEOUT 60000 /* idle background workers exit after 60s */
+#define DEFAULT_TASK_PRIORITY 0     /* priority of tasks assigned without one */
+#define MIN_TASK_PRIORITY -100      /* lowest priority the master node may assign */
+#define MAX_TASK_PRIORITY 100       /* highest priority the master node may assign */
 
 
 /*
@@ -78,16 +85,54 @@ typedef struct WorkerTask
 	uint64 jobId;      /* job id (upper 32-bits reserved); part of hash table key */
 	uint32 taskId;     /* task id; part of hash table key */
 	uint32 assignedAt; /* task assignment time in epoch seconds */
+	int32 priority;    /* scheduling priority assigned by the master node */
 
 	char taskCallString[TASK_CALL_STRING_SIZE]; /* query or function call string */
 	TaskStatus taskStatus;  /* task's current execution status */
 	char databaseName[NAMEDATALEN];   /* name to use for local backend connection */
 	char userName[NAMEDATALEN]; /* user to use for local backend connection */
 	int32 connectionId;     /* connection id to local backend */
+	int32 workerSlotId;     /* background worker slot running the task */
 	uint32 failureCount;    /* number of task failures */
+	uint64 statusSequence;  /* status sequence number at last status change */
 } WorkerTask;
 
 
+/*
+ * TaskWorkerState represents the state of a slot in the task tracker's pool of
+ * background workers. The task tracker hands tasks to idle workers, or starts
+ * new workers for unused slots; the workers report task outcomes back through
+ * the succeeded and failed states.
+ */
+typedef enum
+{
+	TASK_WORKER_UNUSED = 0,     /* no background worker attached to the slot */
+	TASK_WORKER_STARTING = 1,   /* worker registered with a task, not yet running */
+	TASK_WORKER_IDLE = 2,       /* worker waits for its next task */
+	TASK_WORKER_BUSY = 3,       /* worker runs the slot's task */
+	TASK_WORKER_SUCCEEDED = 4,  /* task succeeded; waits for the task tracker */
+	TASK_WORKER_FAILED = 5      /* task failed; waits for the task tracker */
+} TaskWorkerState;
+
+
+/*
+ * TaskWorkerSlot keeps shared memory state for one background worker that runs
+ * task call strings for the task tracker. Background workers connect to one
+ * database as one user, and are only reused for tasks that match both.
+ */
+typedef struct TaskWorkerSlot
+{
+	TaskWorkerState workerState;
+	uint64 jobId;             /* job id of the slot's current or last task */
+	uint32 taskId;            /* task id of the slot's current or last task */
+	char databaseName[NAMEDATALEN]; /* database the worker is connected to */
+	char userName[NAMEDATALEN]; /* user the worker is connected as */
+	pid_t workerPid;          /* process id of the worker, once it runs */
+	Latch *workerLatch;       /* latch of the worker, once it runs */
+	bool workerExited;        /* worker exited without releasing the slot */
+} TaskWorkerSlot;
+
+
 /*
  * WorkerTasksControlData contains task tracker state shared between
  * processes.
@@ -101,6 +146,24 @@ typedef struct WorkerTasksSharedStateData
 	int taskHashTrancheId;
 	LWLockTranche taskHashLockTranche;
 	LWLock taskHashLock;
+
+	/* Latch of the task tracker process, set to wake it up; guarded by the lock */
+	Latch *taskTrackerLatch;
+
+	/* Pool of background workers running tasks; also guarded by the lock */
+	TaskWorkerSlot *taskWorkerSlots;
+
+	/* Advanced on every task status change; also guarded by the lock */
+	uint64 taskStatusSequence;
+
+	/* Partition file compression statistics, guarded by their own spinlock */
+	slock_t compressionStatisticsMutex;
+	uint64 compressedBlockCount;
+	uint64 uncompressedByteCount;
+	uint64 compressedByteCount;
+
+	/* Shared memory for keeping small partitions; guarded by its own lock */
+	struct PartitionMemoryArea *partitionMemory;
 } WorkerTasksSharedStateData;
 
 
@@ -108,6 +171,7 @@ typedef struct WorkerTasksSharedStateData
 extern int TaskTrackerDelay;
 extern int MaxTrackedTasksPerNode;
 extern int MaxRunningTasksPerNode;
+extern int MaxTaskWorkersPerNode;
 
 /* State shared by the task tracker and task tracker protocol functions */
 extern WorkerTasksSharedStateData *WorkerTasksSharedState;
@@ -116,9 +180,21 @@ extern WorkerTasksSharedStateData *WorkerTasksSharedState;
 /* Function declarations local to the worker module */
 extern WorkerTask * WorkerTasksHashEnter(uint64 jobId, uint32 taskId);
 extern WorkerTask * WorkerTasksHashFind(uint64 jobId, uint32 taskId);
+extern void AdvanceTaskStatusSequence(WorkerTask *workerTask);
 
 /* Function declarations for starting up and running the task tracker */
 extern void TaskTrackerRegister(void);
+extern void WakeupTaskTracker(void);
+
+/* Function declarations for running tasks in background workers */
+extern Size TaskWorkerShmemSize(void);
+extern void TaskWorkerShmemInit(void);
+extern int32 AssignTaskWorker(WorkerTask *workerTask);
+extern TaskWorkerState TaskWorkerSlotState(int32 workerSlotId);
+extern void ReleaseTaskWorker(int32 workerSlotId);
+extern void CancelTaskWorker(int32 workerSlotId);
+extern void ReclaimTaskWorkers(void);
+extern void TaskWorkerMain(Datum main_arg);
 
 
 #endif   /* TASK_TRACKER_H */
@@ -23,6 +23,8 @@ extern Datum task_tracker_assign_task(PG_FUNCTION_ARGS);
 extern Datum task_tracker_update_data_fetch_task(PG_FUNCTION_ARGS);
 extern Datum task_tracker_task_status(PG_FUNCTION_ARGS);
 extern Datum task_tracker_cleanup_job(PG_FUNCTION_ARGS);
+extern Datum task_tracker_job_task_counts(PG_FUNCTION_ARGS);
+extern Datum task_tracker_task_statuses(PG_FUNCTION_ARGS);
 
 
 #endif   /* TASK_TRACKER_PROTOCOL_H */
@@ -9,6 +9,7 @@
 #ifndef TRANSACTION_MANAGMENT_H
 #define TRANSACTION_MANAGMENT_H
 
+#include "fmgr.h"
 #include "lib/ilist.h"
 
 /* describes what kind of modifications have occurred in the current transaction */
@@ -77,5 +78,8 @@ extern void CoordinatedTransactionUse2PC(void);
 /* initialization function(s) */
 extern void InitializeTransactionManagement(void);
 
+/* Function declarations for the SQL callable functions */
+extern Datum citus_commit_protocol_stats(PG_FUNCTION_ARGS);
+
 
 #endif /*  TRANSACTION_MANAGMENT_H */
@@ -18,6 +18,8 @@
 /* Functions declarations for worker transactions */
 extern void LogPreparedTransactions(List *connectionList);
 extern void LogTransactionRecord(int groupId, char *transactionName);
+extern void LogTransactionRecords(List *groupIdList, List *transactionNameList);
+extern int RecoverPreparedTransactions(void);
 
 
 #endif /* TRANSACTION_RECOVERY_H */
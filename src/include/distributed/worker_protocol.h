@@ -35,6 +35,7 @@
 #define PARTITION_FILE_PREFIX "p_"
 #define ATTEMPT_FILE_SUFFIX ".attempt"
 #define MERGE_TABLE_SUFFIX "_merge"
+#define MERGE_FILES_TABLE_SUFFIX "_files"
 #define MIN_JOB_DIRNAME_WIDTH 4
 #define MIN_TASK_FILENAME_WIDTH 6
 #define MIN_PARTITION_FILENAME_WIDTH 5
@@ -44,6 +45,7 @@
 /* Defines used for fetching files and tables */
 /* the tablename in the overloaded COPY statement is the to-be-transferred file */
 #define TRANSMIT_REGULAR_COMMAND "COPY \"%s\" TO STDOUT WITH (format 'transmit')"
+#define RECEIVE_REGULAR_COMMAND "COPY \"%s\" FROM STDIN WITH (format 'transmit')"
 #define COPY_OUT_COMMAND "COPY %s TO STDOUT"
 #define COPY_IN_COMMAND "COPY %s FROM '%s'"
 
@@ -57,8 +59,19 @@
 #define FOREIGN_FILE_PATH_COMMAND "SELECT worker_foreign_file_path('%s')"
 #define SET_SEARCH_PATH_COMMAND "SET search_path TO %s"
 #define CREATE_TABLE_COMMAND "CREATE TABLE %s (%s)"
+#define RENAME_TABLE_COMMAND "ALTER TABLE %s RENAME TO %s"
+#define CREATE_MERGE_FILE_VIEW_COMMAND \
+	"CREATE VIEW %s AS SELECT (task_row).* FROM (SELECT " \
+	"worker_read_task_files(NULL::%s, " UINT64_FORMAT ", %u) AS task_row " \
+	"OFFSET 0) task_rows"
 #define CREATE_TABLE_AS_COMMAND "CREATE TABLE %s (%s) AS (%s)"
 
+/* Defines used for pushing partition files to the nodes that merge them */
+#define PREPARE_PARTITION_PUSH_COMMAND "SELECT worker_prepare_partition_push \
+ (" UINT64_FORMAT ", %u, %u)"
+#define FINISH_PARTITION_STREAM_COMMAND "SELECT worker_finish_partition_stream \
+ (" UINT64_FORMAT ", %u, ARRAY[%s]::int4[])"
+
 
 /*
  * RangePartitionContext keeps range re-partitioning related data. The Btree
@@ -72,14 +85,34 @@ typedef struct RangePartitionContext
 } RangePartitionContext;
 
 
+/*
+ * HashPartitionHeavyHitter describes a partition key value that is frequent
+ * enough to overload a single partition. Instead of sending all its rows to the
+ * partition its hash value maps to, we either spread them over that partition
+ * and the ones that follow it, or replicate them to all of these partitions.
+ * The other side of a repartition join does the opposite for the same value.
+ */
+typedef struct HashPartitionHeavyHitter
+{
+	uint32 hashValue;
+	uint32 partitionCount;
+	bool spread;
+	uint32 nextPartitionOffset; /* only applies to spread values */
+} HashPartitionHeavyHitter;
+
+
 /*
  * HashPartitionContext keeps hash re-partitioning related data. The hashing
- * function is set according to the partitioned column's data type.
+ * function is set according to the partitioned column's data type. Heavy hitters
+ * are sorted by their hash values.
  */
 typedef struct HashPartitionContext
 {
 	FmgrInfo *hashFunction;
 	uint32 partitionCount;
+	HashPartitionHeavyHitter *heavyHitterArray;
+	uint32 heavyHitterCount;
+	int32 *hashSplitPointArray;    /* hashed split points, if partitioning by ranges */
 } HashPartitionContext;
 
 
@@ -87,20 +120,49 @@ typedef struct HashPartitionContext
  * FileOutputStream helps buffer write operations to a file; these writes are
  * then regularly flushed to the underlying file. This structure differs from
  * standard file output streams in that it keeps a larger buffer, and only
- * supports appending data to virtual file descriptors.
+ * supports appending data to virtual file descriptors. Streams marked as pushed
+ * are sent to the node that merges them; if that node is remote, the stream has
+ * a push connection, and each write is also streamed over this connection. If
+ * the stream is compressed, each flush writes one compressed block; see
+ * DecompressPartitionFile() for the file format, and the stream counts these
+ * blocks until it is closed. Streams that were never flushed and are not pushed
+ * may be kept in shared memory instead of their file.
  */
 typedef struct FileOutputStream
 {
 	File fileDescriptor;
 	StringInfo fileBuffer;
 	StringInfo filePath;
+	bool pushed;
+	struct MultiConnection *pushConnection;
+	uint32 pushTaskId;
+	bool compressed;
+	bool flushed;
+	uint64 compressedBlockCount;
+	uint64 uncompressedByteCount;
+	uint64 compressedByteCount;
 } FileOutputStream;
 
 
+/*
+ * PartitionStreamFrameHeader precedes each chunk of partition data that a map
+ * task streams to a remote node. A map task sends all partitions for one node
+ * over a single connection, and the upstream task id tells which partition the
+ * chunk belongs to. Both fields are in network byte order.
+ */
+typedef struct PartitionStreamFrameHeader
+{
+	uint32 upstreamTaskId;
+	uint32 length;
+} PartitionStreamFrameHeader;
+
+
 /* Config variables managed via guc.c */
 extern int PartitionBufferSize;
 extern bool ExpireCachedShards;
 extern bool BinaryWorkerCopyFormat;
+extern bool CompressPartitionFiles;
+extern bool MergeFilesInPlace;
 
 
 /* Function declarations local to the worker module */
@@ -111,6 +173,8 @@ extern StringInfo JobDirectoryName(uint64 jobId);
 extern StringInfo MasterJobDirectoryName(uint64 jobId);
 extern StringInfo TaskDirectoryName(uint64 jobId, uint32 taskId);
 extern StringInfo PartitionFilename(StringInfo directoryName, uint32 partitionId);
+extern bool DecompressPartitionFile(const char *sourceFilename,
+									const char *destFilename);
 extern bool CacheDirectoryElement(const char *filename);
 extern bool JobDirectoryElement(const char *filename);
 extern bool DirectoryExists(StringInfo directoryName);
@@ -126,6 +190,9 @@ extern List * TableDDLCommandList(const char *nodeName, uint32 nodePort,
 
 /* Function declarations shared with the master planner */
 extern StringInfo TaskFilename(StringInfo directoryName, uint32 taskId);
+extern StringInfo PushAttemptFilename(uint64 jobId, uint32 partitionTaskId,
+									  uint32 upstreamTaskId);
+extern StringInfo PushStreamFilename(uint64 jobId, uint32 partitionTaskId);
 extern List * ExecuteRemoteQuery(const char *nodeName, uint32 nodePort, char *runAsUser,
 								 StringInfo queryString);
 extern bool ExecuteRemoteCommand(const char *nodeName, uint32 nodePort,
@@ -141,11 +208,15 @@ extern Node * ParseTreeNode(const char *ddlCommand);
 /* Function declarations for applying distributed execution primitives */
 extern Datum worker_fetch_partition_file(PG_FUNCTION_ARGS);
 extern Datum worker_fetch_query_results_file(PG_FUNCTION_ARGS);
+extern Datum worker_prepare_partition_push(PG_FUNCTION_ARGS);
+extern Datum worker_finish_partition_stream(PG_FUNCTION_ARGS);
 extern Datum worker_apply_shard_ddl_command(PG_FUNCTION_ARGS);
 extern Datum worker_range_partition_table(PG_FUNCTION_ARGS);
 extern Datum worker_hash_partition_table(PG_FUNCTION_ARGS);
+extern Datum worker_partition_compression_stats(PG_FUNCTION_ARGS);
 extern Datum worker_merge_files_into_table(PG_FUNCTION_ARGS);
 extern Datum worker_merge_files_and_run_query(PG_FUNCTION_ARGS);
+extern Datum worker_read_task_files(PG_FUNCTION_ARGS);
 extern Datum worker_cleanup_job_schema_cache(PG_FUNCTION_ARGS);
 
 /* Function declarations for fetching regular and foreign tables */
@@ -0,0 +1,64 @@
+setup
+{
+    ALTER SEQUENCE pg_catalog.pg_dist_shardid_seq RESTART 102030;
+    CREATE TABLE test_table (test_id integer PRIMARY KEY, data text);
+    SELECT master_create_distributed_table('test_table', 'test_id', 'hash');
+    SELECT master_create_worker_shards('test_table', 1, 2);
+}
+
+teardown
+{
+    DROP TABLE IF EXISTS test_table CASCADE;
+}
+
+session "s1"
+
+step "s1-begin"
+{
+    BEGIN;
+}
+
+step "s1-insert"
+{
+    INSERT INTO test_table VALUES(1, 's1');
+}
+
+step "s1-commit"
+{
+    COMMIT;
+}
+
+session "s2"
+
+step "s2-insert"
+{
+    INSERT INTO test_table VALUES(1, 's2');
+}
+
+step "s2-insert-other"
+{
+    INSERT INTO test_table VALUES(2, 's2');
+}
+
+step "s2-display-57637"
+{
+    UPDATE pg_dist_shard_placement SET shardstate = '3' WHERE shardid = 102030 AND nodeport = 57638;
+    SELECT * FROM test_table ORDER BY test_id;
+    UPDATE pg_dist_shard_placement SET shardstate = '1' WHERE shardid = 102030 AND nodeport = 57638;
+}
+
+step "s2-display-57638"
+{
+    UPDATE pg_dist_shard_placement SET shardstate = '3' WHERE shardid = 102030 AND nodeport = 57637;
+    SELECT * FROM test_table ORDER BY test_id;
+    UPDATE pg_dist_shard_placement SET shardstate = '1' WHERE shardid = 102030 AND nodeport = 57637;
+}
+
+# verify that a concurrent insert of the same key waits and then fails on all placements
+permutation "s1-begin" "s1-insert" "s2-insert" "s1-commit" "s2-display-57637" "s2-display-57638"
+
+# verify that inserts into a replicated shard with a unique index are serialized
+permutation "s1-begin" "s1-insert" "s2-insert-other" "s1-commit" "s2-display-57637" "s2-display-57638"
+
+# verify that the second insert of a key fails without leaving rows behind
+permutation "s1-insert" "s2-insert" "s2-display-57637" "s2-display-57638"
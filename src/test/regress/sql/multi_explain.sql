@@ -227,3 +227,79 @@ EXPLAIN EXECUTE router_executor_query;
 PREPARE real_time_executor_query AS
 	SELECT avg(l_linenumber) FROM lineitem WHERE l_orderkey > 9030;
 EXPLAIN (COSTS FALSE) EXECUTE real_time_executor_query;
+
+-- Grouping on columns other than the partition column may finalize groups on
+-- the workers, by repartitioning partial aggregates on the group key
+SET citus.task_executor_type TO 'task-tracker';
+SET citus.enable_repartitioned_aggregation TO on;
+ALTER SEQUENCE pg_catalog.pg_dist_jobid_seq RESTART 570100;
+EXPLAIN (COSTS FALSE)
+	SELECT l_partkey, count(*) FROM lineitem GROUP BY l_partkey ORDER BY l_partkey;
+SELECT l_partkey, count(*) FROM lineitem
+	GROUP BY l_partkey ORDER BY count(*) DESC, l_partkey LIMIT 3;
+-- queries grouping on the partition column, and queries planned with subquery
+-- pushdown keep the regular plan
+SELECT explain_json($$
+	SELECT l_orderkey, count(*) FROM lineitem GROUP BY l_orderkey$$)->0->'Job'
+	? 'Depended Jobs' AS repartitioned;
+SET citus.subquery_pushdown TO on;
+SELECT explain_json($$
+	SELECT l_partkey, count(*) FROM lineitem GROUP BY l_partkey$$)->0->'Job'
+	? 'Depended Jobs' AS repartitioned;
+RESET citus.subquery_pushdown;
+RESET citus.enable_repartitioned_aggregation;
+RESET citus.task_executor_type;
+
+-- Cost based join orders pick the join rule that moves the fewest bytes. Both
+-- tables have few enough shards to be broadcast, but broadcasting a table moves
+-- it to every worker node, while repartitioning it moves it once.
+\a\t
+CREATE TABLE cost_left (key int, value int);
+SELECT master_create_distributed_table('cost_left', 'key', 'append');
+CREATE TABLE cost_right (key int, left_key int);
+SELECT master_create_distributed_table('cost_right', 'key', 'append');
+CREATE TABLE cost_hashed (key int, value int);
+SELECT master_create_distributed_table('cost_hashed', 'key', 'hash');
+SELECT master_create_worker_shards('cost_hashed', 2, 1);
+SELECT master_create_empty_shard('cost_left') AS left_shard_1 \gset
+SELECT master_create_empty_shard('cost_left') AS left_shard_2 \gset
+SELECT master_create_empty_shard('cost_right') AS right_shard_1 \gset
+SELECT master_create_empty_shard('cost_right') AS right_shard_2 \gset
+UPDATE pg_dist_shard SET shardminvalue = '1', shardmaxvalue = '1000'
+	WHERE shardid IN (:left_shard_1, :right_shard_1);
+UPDATE pg_dist_shard SET shardminvalue = '1001', shardmaxvalue = '2000'
+	WHERE shardid IN (:left_shard_2, :right_shard_2);
+UPDATE pg_dist_shard_placement SET shardlength = 536870912
+	WHERE shardid IN (:left_shard_1, :left_shard_2);
+UPDATE pg_dist_shard_placement SET shardlength = 268435456
+	WHERE shardid IN (:right_shard_1, :right_shard_2);
+\a\t
+SET citus.task_executor_type TO 'task-tracker';
+SET citus.large_table_shard_count TO 4;
+SET citus.log_multi_join_order TO on;
+SET client_min_messages TO LOG;
+-- ranking join rules by their type broadcasts one of the tables
+SET citus.explain_distributed_queries TO off;
+EXPLAIN (COSTS FALSE)
+	SELECT count(*) FROM cost_left, cost_right WHERE cost_left.key = cost_right.left_key;
+-- ranking join rules by their cost repartitions the smaller table instead
+SET citus.explain_distributed_queries TO on;
+SET citus.enable_cost_based_join_order TO on;
+ALTER SEQUENCE pg_catalog.pg_dist_jobid_seq RESTART 570200;
+EXPLAIN (COSTS FALSE)
+	SELECT count(*) FROM cost_left, cost_right WHERE cost_left.key = cost_right.left_key;
+RESET client_min_messages;
+RESET citus.log_multi_join_order;
+-- we do not know the size of hash distributed tables without statistics, so
+-- their joins are not costed, and their plans show no transfer estimate
+SET citus.large_table_shard_count TO 1;
+SELECT explain_json($$
+	SELECT count(*) FROM cost_left, cost_hashed
+	WHERE cost_left.value = cost_hashed.value$$)->0 ? 'Estimated Join Transfer' AS costed;
+SELECT explain_json($$
+	SELECT count(*) FROM cost_left, cost_right
+	WHERE cost_left.key = cost_right.left_key$$)->0 ? 'Estimated Join Transfer' AS costed;
+RESET citus.enable_cost_based_join_order;
+RESET citus.large_table_shard_count;
+RESET citus.task_executor_type;
+DROP TABLE cost_left, cost_right, cost_hashed;
@@ -68,6 +68,18 @@ ALTER EXTENSION citus UPDATE TO '6.1-7';
 ALTER EXTENSION citus UPDATE TO '6.1-8';
 ALTER EXTENSION citus UPDATE TO '6.1-9';
 ALTER EXTENSION citus UPDATE TO '6.1-10';
+ALTER EXTENSION citus UPDATE TO '6.1-11';
+ALTER EXTENSION citus UPDATE TO '6.1-12';
+ALTER EXTENSION citus UPDATE TO '6.1-13';
+ALTER EXTENSION citus UPDATE TO '6.1-14';
+ALTER EXTENSION citus UPDATE TO '6.1-15';
+ALTER EXTENSION citus UPDATE TO '6.1-16';
+ALTER EXTENSION citus UPDATE TO '6.1-17';
+ALTER EXTENSION citus UPDATE TO '6.1-18';
+ALTER EXTENSION citus UPDATE TO '6.1-19';
+ALTER EXTENSION citus UPDATE TO '6.1-20';
+ALTER EXTENSION citus UPDATE TO '6.1-21';
+ALTER EXTENSION citus UPDATE TO '6.1-22';
 
 -- ensure no objects were created outside pg_catalog
 SELECT COUNT(*)
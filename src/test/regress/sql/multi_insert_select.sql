@@ -530,6 +530,10 @@ FROM   (SELECT SUM(raw_events_second.value_4) AS v4,
         GROUP  BY raw_events_second.value_3) AS foo;
 
 -- error cases
+-- these queries are repartitioned by default, so we check their pushdown
+-- errors with repartitioning disabled
+SET citus.enable_repartitioned_insert_select TO off;
+
 -- no part column at all
 INSERT INTO raw_events_second
             (value_1)
@@ -556,6 +560,8 @@ INSERT INTO raw_events_second
 SELECT user_id :: bigint
 FROM   raw_events_first;
 
+RESET citus.enable_repartitioned_insert_select;
+
 INSERT INTO agg_events
             (value_3_agg,
              value_4_agg,
@@ -586,11 +592,13 @@ GROUP  BY user_id,
           value_2;
 
 -- tables should be co-located
+SET citus.enable_repartitioned_insert_select TO off;
 INSERT INTO agg_events (user_id)
 SELECT
   user_id
 FROM
   reference_table;
+RESET citus.enable_repartitioned_insert_select;
 
 -- unsupported joins between subqueries
 -- we do not return bare partition column on the inner query
@@ -0,0 +1,97 @@
+--
+-- MULTI_INSERT_SELECT_REPARTITION
+--
+-- Tests INSERT ... SELECT queries that repartition the SELECT's rows by the
+-- target table's shards, since the source and target are not colocated.
+
+ALTER SEQUENCE pg_catalog.pg_dist_shardid_seq RESTART 1410000;
+ALTER SEQUENCE pg_catalog.pg_dist_jobid_seq RESTART 1410000;
+
+SET citus.shard_replication_factor TO 1;
+
+-- tables with different shard counts are not colocated
+SET citus.shard_count TO 4;
+CREATE TABLE source_table (a int, b int, c text);
+SELECT create_distributed_table('source_table', 'a');
+
+SET citus.shard_count TO 3;
+CREATE TABLE target_table (key int, value int, note text);
+SELECT create_distributed_table('target_table', 'key');
+
+-- every tenth row has a NULL in b
+COPY source_table FROM PROGRAM
+	'awk ''BEGIN { for (i = 1; i <= 100; i++) print i "," (i % 10 ? i % 7 : "") ",row" i }'''
+	WITH (FORMAT 'csv');
+
+-- without repartitioning, the tables need to be colocated
+SET citus.enable_repartitioned_insert_select TO off;
+INSERT INTO target_table SELECT * FROM source_table;
+RESET citus.enable_repartitioned_insert_select;
+
+-- the source's partition column becomes the target's partition column
+INSERT INTO target_table SELECT * FROM source_table;
+
+SELECT count(*), sum(key), sum(value) FROM target_table;
+
+-- rows landed on the shards their key prunes to
+SELECT note FROM target_table WHERE key = 42;
+SELECT count(*) FROM target_table WHERE key IN (1, 50, 100);
+
+-- the SELECT does not need to return the source's partition column, and rows
+-- with a NULL partition column value are skipped
+TRUNCATE target_table;
+INSERT INTO target_table (key, value, note) SELECT b, a, c FROM source_table;
+
+SELECT count(*), count(DISTINCT key), sum(value) FROM target_table;
+SELECT count(*) FROM target_table WHERE key = 3;
+
+-- columns the INSERT does not list are left NULL
+TRUNCATE target_table;
+INSERT INTO target_table (key) SELECT a FROM source_table WHERE a <= 10;
+SELECT count(*), count(value), count(note) FROM target_table;
+
+-- the SELECT reads the source shards outside of the transaction, so it cannot
+-- follow earlier modifications in the same transaction block
+TRUNCATE target_table;
+BEGIN;
+INSERT INTO source_table VALUES (101, 1, 'row101');
+INSERT INTO target_table SELECT * FROM source_table;
+ROLLBACK;
+
+-- without earlier modifications, transaction blocks are fine
+BEGIN;
+INSERT INTO target_table SELECT * FROM source_table WHERE a <= 10;
+COMMIT;
+SELECT count(*), sum(key) FROM target_table;
+
+-- all placements of replicated target shards get the same rows
+SET citus.shard_replication_factor TO 2;
+SET citus.shard_count TO 2;
+CREATE TABLE replicated_target (key int, value int);
+SELECT create_distributed_table('replicated_target', 'key');
+
+INSERT INTO replicated_target SELECT b, a FROM source_table WHERE a <= 50;
+
+SELECT count(*), sum(value) FROM replicated_target;
+
+\c - - - :worker_1_port
+SELECT (SELECT count(*) FROM replicated_target_1410007) +
+	   (SELECT count(*) FROM replicated_target_1410008) AS row_count;
+
+\c - - - :worker_2_port
+SELECT (SELECT count(*) FROM replicated_target_1410007) +
+	   (SELECT count(*) FROM replicated_target_1410008) AS row_count;
+
+\c - - - :master_port
+
+-- no placement is marked unhealthy
+SELECT count(*)
+FROM   pg_dist_shard_placement AS sp,
+	   pg_dist_shard           AS s
+WHERE  sp.shardid = s.shardid
+AND    sp.shardstate = 3
+AND    s.logicalrelid = 'replicated_target'::regclass;
+
+DROP TABLE replicated_target;
+DROP TABLE target_table;
+DROP TABLE source_table;
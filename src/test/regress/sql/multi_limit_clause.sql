@@ -63,4 +63,63 @@ SELECT l_quantity, l_discount, avg(l_partkey) FROM lineitem
 	GROUP BY l_quantity, l_discount
 	ORDER BY l_quantity, l_discount LIMIT 1;
 
+-- Check that merging sorted task results on the master returns the same results.
+
+SET citus.enable_sorted_merge TO on;
+SELECT * FROM lineitem ORDER BY l_orderkey DESC, l_linenumber DESC LIMIT 3;
+
+-- Show that the master node merges sorted task results instead of sorting them
+\a\t
+SET citus.task_executor_type TO 'real-time';
+ALTER SEQUENCE pg_catalog.pg_dist_jobid_seq RESTART 730100;
+EXPLAIN (COSTS FALSE)
+	SELECT l_quantity, l_extendedprice FROM lineitem
+	ORDER BY l_quantity, l_extendedprice LIMIT 3;
+
+-- Jobs with more tasks than the fan-in limit sort all task results instead
+SET citus.max_sorted_merge_fan_in TO 4;
+ALTER SEQUENCE pg_catalog.pg_dist_jobid_seq RESTART 730110;
+EXPLAIN (COSTS FALSE)
+	SELECT l_quantity, l_extendedprice FROM lineitem
+	ORDER BY l_quantity, l_extendedprice LIMIT 3;
+RESET citus.max_sorted_merge_fan_in;
+RESET citus.task_executor_type;
+\a\t
+
+RESET citus.enable_sorted_merge;
+
 SET client_min_messages TO NOTICE;
+
+-- Check that bounding the tasks of top-k queries by the results of completed
+-- tasks does not change query results. Rows that tie with the bound on the
+-- first sort column should still make it into the results.
+
+SET citus.enable_top_k_bound_propagation TO off;
+SELECT l_orderkey, l_linenumber, l_quantity FROM lineitem
+	ORDER BY l_quantity, l_orderkey, l_linenumber LIMIT 5;
+RESET citus.enable_top_k_bound_propagation;
+SELECT l_orderkey, l_linenumber, l_quantity FROM lineitem
+	ORDER BY l_quantity, l_orderkey, l_linenumber LIMIT 5;
+SELECT l_orderkey, l_linenumber, l_extendedprice FROM lineitem
+	ORDER BY l_extendedprice, l_orderkey, l_linenumber LIMIT 4;
+
+-- The task-tracker executor bounds tasks that it did not assign yet
+
+SET citus.task_executor_type TO 'task-tracker';
+SELECT l_orderkey, l_linenumber, l_quantity FROM lineitem
+	ORDER BY l_quantity, l_orderkey, l_linenumber LIMIT 5;
+SELECT l_orderkey, l_linenumber, l_extendedprice FROM lineitem
+	ORDER BY l_extendedprice, l_orderkey, l_linenumber LIMIT 4;
+RESET citus.task_executor_type;
+
+-- Copying task results into the master table as tasks complete should not
+-- change query results, also when the master node merges sorted task results
+
+SET citus.enable_incremental_result_copy TO on;
+SELECT l_orderkey, l_linenumber, l_quantity FROM lineitem
+	ORDER BY l_quantity, l_orderkey, l_linenumber LIMIT 5;
+SET citus.enable_sorted_merge TO on;
+SELECT l_orderkey, l_linenumber, l_extendedprice FROM lineitem
+	ORDER BY l_extendedprice, l_orderkey, l_linenumber LIMIT 4;
+RESET citus.enable_sorted_merge;
+RESET citus.enable_incremental_result_copy;
@@ -8,7 +8,8 @@ ALTER SEQUENCE pg_catalog.pg_dist_jobid_seq RESTART 1360000;
 CREATE USER no_access;
 SET ROLE no_access;
 
--- list relations in the citus extension without sufficient privileges
+-- list relations in the citus extension without sufficient privileges, only
+-- the statistics catalogs should be listed since they contain column values
 SELECT pg_class.oid::regclass
 FROM pg_class
     JOIN pg_namespace nsp ON (pg_class.relnamespace = nsp.oid)
@@ -19,7 +20,8 @@ WHERE
     AND classid ='pg_class'::regclass
     AND ext.extname = 'citus'
     AND nsp.nspname = 'pg_catalog'
-    AND NOT has_table_privilege(pg_class.oid, 'select');
+    AND NOT has_table_privilege(pg_class.oid, 'select')
+ORDER BY 1;
 
 
 RESET role;
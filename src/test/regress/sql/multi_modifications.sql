@@ -147,9 +147,69 @@ DELETE FROM limit_orders WHERE id = 246 AND bidder_id = (random() * 1000);
 -- (the cast to timestamp is because the timestamp_eq_timestamptz operator is stable)
 DELETE FROM limit_orders WHERE id = 246 AND placed_at = current_timestamp::timestamp;
 
--- commands with multiple rows are unsupported
+-- commands with multiple rows must supply a partition value for each row
 INSERT INTO limit_orders VALUES (DEFAULT), (DEFAULT);
 
+-- commands with multiple rows are routed to the shard of each row
+INSERT INTO limit_orders VALUES (12037, 'GOOG', 5634, now(), 'buy', random()),
+                                (12038, 'GOOG', 5634, now(), 'sell', random()),
+                                (12039, 'GOOG', 5634, '2016-01-01 12:00:00', 'buy', 1.50);
+SELECT COUNT(*) FROM limit_orders WHERE id IN (12037, 12038, 12039);
+
+-- rows of multi-row INSERTs are returned grouped by shard
+INSERT INTO range_partitioned VALUES (100, 'AAPL', 1, '2016-01-01 12:00:00', 'buy', 1.00),
+                                     (60000, 'AAPL', 2, '2016-01-01 12:00:00', 'sell', 2.00),
+                                     (200, 'AAPL', 3, '2016-01-01 12:00:00', 'buy', 3.00)
+                                     RETURNING id, bidder_id;
+
+-- multi-row INSERTs may update conflicting rows in each shard
+INSERT INTO limit_orders VALUES (12037, 'GOOG', 5635, '2016-01-01 12:00:00', 'buy', 1.50),
+                                (12038, 'GOOG', 5635, '2016-01-01 12:00:00', 'sell', 1.50),
+                                (12040, 'GOOG', 5635, '2016-01-01 12:00:00', 'buy', 1.50)
+                                ON CONFLICT (id) DO UPDATE SET bidder_id = EXCLUDED.bidder_id;
+SELECT id, bidder_id FROM limit_orders WHERE id IN (12037, 12038, 12039, 12040) ORDER BY id;
+
+-- each row needs a constant partition value
+INSERT INTO range_partitioned VALUES (300, 'AAPL', 1, '2016-01-01 12:00:00', 'buy', 1.00),
+                                     ((random() * 100)::bigint, 'AAPL', 2,
+                                      '2016-01-01 12:00:00', 'sell', 2.00);
+
+-- rows that all fall into one shard form a single-shard modification, which may
+-- follow other single-shard modifications in a transaction block; rows that span
+-- shards may not
+BEGIN;
+INSERT INTO range_partitioned VALUES (500, 'AAPL', 1, '2016-01-01 12:00:00', 'buy', 1.00);
+INSERT INTO range_partitioned VALUES (600, 'AAPL', 2, '2016-01-01 12:00:00', 'buy', 1.00),
+                                     (700, 'AAPL', 3, '2016-01-01 12:00:00', 'buy', 1.00);
+SELECT count(*) FROM range_partitioned WHERE id IN (500, 600, 700);
+INSERT INTO range_partitioned VALUES (800, 'AAPL', 4, '2016-01-01 12:00:00', 'buy', 1.00),
+                                     (80000, 'AAPL', 5, '2016-01-01 12:00:00', 'buy', 1.00);
+ROLLBACK;
+SELECT count(*) FROM range_partitioned WHERE id IN (500, 600, 700, 800, 80000);
+
+-- volatile functions are evaluated for each row, and all placements of a shard
+-- receive the same values
+INSERT INTO range_partitioned VALUES (1000, 'VOL', (random() * 1000000000)::bigint,
+                                      '2016-01-01 12:00:00', 'buy', 1.00),
+                                     (1001, 'VOL', (random() * 1000000000)::bigint,
+                                      '2016-01-01 12:00:00', 'buy', 1.00),
+                                     (70001, 'VOL', (random() * 1000000000)::bigint,
+                                      '2016-01-01 12:00:00', 'buy', 1.00);
+SELECT count(DISTINCT bidder_id) FROM range_partitioned WHERE symbol = 'VOL';
+
+\c - - - :worker_1_port
+SELECT string_agg(id || ':' || bidder_id, ',' ORDER BY id) AS worker_1_rows
+FROM (SELECT id, bidder_id FROM range_partitioned_750005 WHERE symbol = 'VOL' UNION ALL
+      SELECT id, bidder_id FROM range_partitioned_750006 WHERE symbol = 'VOL') vol_rows \gset
+
+\c - - - :worker_2_port
+SELECT string_agg(id || ':' || bidder_id, ',' ORDER BY id) AS worker_2_rows
+FROM (SELECT id, bidder_id FROM range_partitioned_750005 WHERE symbol = 'VOL' UNION ALL
+      SELECT id, bidder_id FROM range_partitioned_750006 WHERE symbol = 'VOL') vol_rows \gset
+
+\c - - - :master_port
+SELECT :'worker_1_rows' = :'worker_2_rows' AS placements_match;
+
 -- Who says that? :)
 -- INSERT ... SELECT ... FROM commands are unsupported
 -- INSERT INTO limit_orders SELECT * FROM limit_orders;
@@ -219,6 +279,20 @@ UPDATE limit_orders SET (kind, limit_price) = ('buy', 999) WHERE id = 246 RETURN
 INSERT INTO limit_orders VALUES (275, 'ADR', 140, '2007-07-02 16:32:15', 'sell', 43.67);
 INSERT INTO limit_orders VALUES (275, 'ADR', 140, '2007-07-02 16:32:15', 'sell', 43.67);
 
+-- Constraint violations on replicated shards don't mark other placements as
+-- unhealthy, and leave all placements usable
+UPDATE limit_orders SET limit_price = -1 WHERE id = 275;
+INSERT INTO limit_orders VALUES (275, 'ADR', 140, '2007-07-02 16:32:15', 'sell', 43.67)
+RETURNING id;
+SELECT count(*)
+FROM   pg_dist_shard_placement AS sp,
+	   pg_dist_shard           AS s
+WHERE  sp.shardid = s.shardid
+AND    sp.shardstate = 3
+AND    s.logicalrelid = 'limit_orders'::regclass;
+UPDATE limit_orders SET limit_price = 44.00 WHERE id = 275;
+SELECT limit_price FROM limit_orders WHERE id = 275;
+
 -- Test that shards which miss a modification are marked unhealthy
 
 -- First: Connect to the second worker node
@@ -468,3 +468,35 @@ INSERT INTO append_researchers VALUES (500000, 500000, 'Tony Hoare');
 ROLLBACK;
 
 SELECT * FROM append_researchers;
+
+-- pipelined modifications return before they finish on the workers
+SET citus.pipeline_transaction_modifications TO on;
+BEGIN;
+INSERT INTO researchers VALUES (12, 1, 'Peter Naur');
+UPDATE researchers SET name = 'Peter Naur, Jr.' WHERE lab_id = 1 AND id = 12;
+COMMIT;
+
+SELECT name FROM researchers WHERE lab_id = 1 AND id = 12;
+
+-- their errors abort the transaction at the next statement on the same node...
+BEGIN;
+INSERT INTO researchers VALUES (13, 1, 'Donald Knuth');
+SELECT name FROM researchers WHERE lab_id = 1 AND id = 13;
+ROLLBACK;
+
+-- ...or at commit
+BEGIN;
+INSERT INTO researchers VALUES (13, 1, 'Donald Knuth');
+COMMIT;
+
+SELECT count(*) FROM researchers WHERE lab_id = 1 AND name = 'Donald Knuth';
+
+-- no placement is marked unhealthy
+SELECT count(*)
+FROM   pg_dist_shard_placement AS sp,
+	   pg_dist_shard           AS s
+WHERE  sp.shardid = s.shardid
+AND    sp.shardstate = 3
+AND    s.logicalrelid = 'researchers'::regclass;
+
+RESET citus.pipeline_transaction_modifications;
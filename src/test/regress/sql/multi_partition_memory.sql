@@ -0,0 +1,64 @@
+--
+-- MULTI_PARTITION_MEMORY
+--
+
+
+-- Worker nodes in this schedule keep partitions that fit into their partitioning
+-- buffer in shared memory. We partition a small query result on worker_1, and
+-- fetch the partitions from there to worker_2.
+
+\set JobId 1480010
+\set TaskId 1480101
+\set Upstream_Task_Id_00 1480201
+\set Upstream_Task_Id_01 1480202
+
+\c - - - :worker_1_port
+
+SHOW citus.partition_memory_budget;
+
+SELECT worker_hash_partition_table(:JobId, :TaskId,
+				   'SELECT generate_series(1, 1000) AS a', 'a',
+				   'int4'::regtype, 2);
+
+-- The partitions are kept in memory, so their files are not written
+
+SELECT count(*) FROM pg_ls_dir('base/pgsql_job_cache/job_1480010/task_1480101');
+
+\c - - - :worker_2_port
+
+SELECT worker_fetch_partition_file(:JobId, :TaskId, 0, :Upstream_Task_Id_00,
+				   'localhost', :worker_1_port);
+SELECT worker_fetch_partition_file(:JobId, :TaskId, 1, :Upstream_Task_Id_01,
+				   'localhost', :worker_1_port);
+
+-- Both partitions' data arrived
+
+CREATE TABLE fetched_partitions (a int);
+COPY fetched_partitions FROM 'base/pgsql_job_cache/job_1480010/task_1480201/task_1480101';
+COPY fetched_partitions FROM 'base/pgsql_job_cache/job_1480010/task_1480202/task_1480101';
+
+SELECT count(*), count(DISTINCT a), sum(a) FROM fetched_partitions;
+
+-- Partitions stay in memory after they were fetched
+
+SELECT worker_fetch_partition_file(:JobId, :TaskId, 1, :Upstream_Task_Id_01,
+				   'localhost', :worker_1_port);
+
+TRUNCATE fetched_partitions;
+COPY fetched_partitions FROM 'base/pgsql_job_cache/job_1480010/task_1480202/task_1480101';
+
+SELECT count(*) AS diff_lhs FROM (
+       SELECT a FROM fetched_partitions EXCEPT ALL
+       SELECT a FROM generate_series(1, 1000) AS a WHERE (hashint4(a) & 1) = 1) diff;
+SELECT count(*) AS diff_rhs FROM (
+       SELECT a FROM generate_series(1, 1000) AS a WHERE (hashint4(a) & 1) = 1 EXCEPT ALL
+       SELECT a FROM fetched_partitions) diff;
+
+DROP TABLE fetched_partitions;
+SELECT task_tracker_cleanup_job(:JobId);
+
+\c - - - :worker_1_port
+
+SELECT task_tracker_cleanup_job(:JobId);
+
+\c - - - :master_port
@@ -0,0 +1,49 @@
+--
+-- MULTI_REPARTITION_PUSH
+--
+-- Tests that repartition joins return the same results when map tasks push
+-- their partitions to the nodes that run the merge tasks. We run a single
+-- partition join, whose map tasks range partition lineitem, and a dual hash
+-- partition join.
+
+
+ALTER SEQUENCE pg_catalog.pg_dist_shardid_seq RESTART 1430000;
+ALTER SEQUENCE pg_catalog.pg_dist_jobid_seq RESTART 1430000;
+
+
+SET citus.large_table_shard_count TO 2;
+SET citus.task_executor_type TO 'task-tracker';
+
+SELECT
+	count(*), count(DISTINCT c_custkey)
+FROM
+	lineitem, customer
+WHERE
+	l_suppkey = c_custkey;
+
+SELECT
+	count(*)
+FROM
+	lineitem, customer
+WHERE
+	l_partkey = c_nationkey;
+
+SET citus.enable_repartition_push TO on;
+
+SELECT
+	count(*), count(DISTINCT c_custkey)
+FROM
+	lineitem, customer
+WHERE
+	l_suppkey = c_custkey;
+
+SELECT
+	count(*)
+FROM
+	lineitem, customer
+WHERE
+	l_partkey = c_nationkey;
+
+RESET citus.enable_repartition_push;
+RESET citus.task_executor_type;
+RESET citus.large_table_shard_count;
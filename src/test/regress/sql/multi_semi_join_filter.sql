@@ -0,0 +1,38 @@
+--
+-- MULTI_SEMI_JOIN_FILTER
+--
+-- Tests that a dual hash repartition join returns the same results with and
+-- without semi-join filters, and that the master node stores a filter for the
+-- larger table's repartition job when citus.semi_join_filter_size is set.
+
+
+ALTER SEQUENCE pg_catalog.pg_dist_shardid_seq RESTART 1420000;
+ALTER SEQUENCE pg_catalog.pg_dist_jobid_seq RESTART 1420000;
+
+
+SET citus.large_table_shard_count TO 2;
+SET citus.task_executor_type TO 'task-tracker';
+
+-- Only lineitem rows with part keys between 0 and 24 find a match in customer
+
+SELECT
+	count(*)
+FROM
+	lineitem, customer
+WHERE
+	l_partkey = c_nationkey;
+
+SET citus.semi_join_filter_size TO 8;
+SET client_min_messages TO DEBUG1;
+
+SELECT
+	count(*)
+FROM
+	lineitem, customer
+WHERE
+	l_partkey = c_nationkey;
+
+RESET client_min_messages;
+RESET citus.semi_join_filter_size;
+RESET citus.task_executor_type;
+RESET citus.large_table_shard_count;
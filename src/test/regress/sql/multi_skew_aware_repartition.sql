@@ -0,0 +1,90 @@
+--
+-- MULTI_SKEW_AWARE_REPARTITION
+--
+-- Tests that a dual hash repartition join returns the same results with and
+-- without skew-aware repartitioning, when one join key makes up most rows on
+-- one side of the join. The master node looks up frequent keys in the column
+-- statistics of one shard, but not for plain EXPLAIN.
+
+
+ALTER SEQUENCE pg_catalog.pg_dist_shardid_seq RESTART 1440000;
+ALTER SEQUENCE pg_catalog.pg_dist_jobid_seq RESTART 1440000;
+
+
+CREATE TABLE skewed_left (id int, key int);
+SELECT master_create_distributed_table('skewed_left', 'id', 'hash');
+SELECT master_create_worker_shards('skewed_left', 2, 1);
+
+CREATE TABLE skewed_right (id int, key int);
+SELECT master_create_distributed_table('skewed_right', 'id', 'hash');
+SELECT master_create_worker_shards('skewed_right', 2, 1);
+
+-- Five out of eight rows in skewed_left have the key 1, and all keys in
+-- skewed_right are distinct
+
+COPY (SELECT id, CASE WHEN id % 8 < 5 THEN 1 ELSE id END
+	  FROM generate_series(1, 1000) AS id) TO 'skewed_left.data';
+COPY skewed_left FROM 'skewed_left.data';
+
+COPY (SELECT id, id FROM generate_series(1, 100) AS id) TO 'skewed_right.data';
+COPY skewed_right FROM 'skewed_right.data';
+
+-- Gather column statistics for the shards
+
+\c - - - :worker_1_port
+DO $$
+DECLARE
+	shard_name text;
+BEGIN
+	FOR shard_name IN SELECT relname FROM pg_class
+					  WHERE relname LIKE 'skewed\_%' AND relkind = 'r' LOOP
+		EXECUTE 'ANALYZE ' || quote_ident(shard_name);
+	END LOOP;
+END;
+$$;
+
+\c - - - :worker_2_port
+DO $$
+DECLARE
+	shard_name text;
+BEGIN
+	FOR shard_name IN SELECT relname FROM pg_class
+					  WHERE relname LIKE 'skewed\_%' AND relkind = 'r' LOOP
+		EXECUTE 'ANALYZE ' || quote_ident(shard_name);
+	END LOOP;
+END;
+$$;
+
+\c - - - :master_port
+
+SET citus.large_table_shard_count TO 2;
+SET citus.task_executor_type TO 'task-tracker';
+
+SELECT count(*) FROM skewed_left l, skewed_right r WHERE l.key = r.key;
+
+SET citus.enable_skew_aware_repartition TO on;
+SET client_min_messages TO DEBUG1;
+
+-- Plain EXPLAIN does not look up frequent keys
+
+DO $$
+DECLARE
+	plan_line text;
+BEGIN
+	FOR plan_line IN EXECUTE 'EXPLAIN SELECT count(*) FROM skewed_left l, skewed_right r '
+							 'WHERE l.key = r.key' LOOP
+	END LOOP;
+END;
+$$;
+
+-- The query spreads rows with the key 1 over several partitions
+
+SELECT count(*) FROM skewed_left l, skewed_right r WHERE l.key = r.key;
+
+RESET client_min_messages;
+RESET citus.enable_skew_aware_repartition;
+RESET citus.task_executor_type;
+RESET citus.large_table_shard_count;
+
+DROP TABLE skewed_left;
+DROP TABLE skewed_right;
@@ -0,0 +1,67 @@
+--
+-- MULTI_TABLE_STATISTICS
+--
+-- Tests merging the statistics of a distributed table's shards into
+-- pg_dist_table_statistic and pg_dist_column_statistic.
+
+ALTER SEQUENCE pg_catalog.pg_dist_shardid_seq RESTART 1400000;
+
+SET citus.shard_count TO 4;
+
+CREATE TABLE stats_table (key int, value int, category text);
+SELECT create_distributed_table('stats_table', 'key');
+
+-- a table whose shards were never analyzed only has a row count and a size
+SELECT master_update_table_statistics('stats_table');
+SELECT reltuples, relsize FROM pg_dist_table_statistic
+	WHERE logicalrelid = 'stats_table'::regclass;
+SELECT count(*) FROM pg_dist_column_statistic
+	WHERE logicalrelid = 'stats_table'::regclass;
+
+-- every fourth row has a NULL category, and value has five distinct values
+COPY stats_table FROM PROGRAM
+	'awk ''BEGIN { for (i = 1; i <= 1000; i++) print i "," i % 5 "," (i % 4 ? "x" : "") }'''
+	WITH (FORMAT 'csv');
+
+-- ANALYZE analyzes the shards, and then merges their statistics
+ANALYZE stats_table;
+
+SELECT reltuples, relsize > 0 AS has_size FROM pg_dist_table_statistic
+	WHERE logicalrelid = 'stats_table'::regclass;
+
+-- distinct counts add up for the partition column, which is unique in the
+-- table, and the largest shard count is used for other columns
+SELECT attnum, null_frac, avg_width, n_distinct,
+	   array_length(most_common_vals, 1) AS common_values,
+	   round((SELECT sum(f) FROM unnest(most_common_freqs) f)::numeric, 2) AS common_frac,
+	   array_length(histogram_bounds, 1) > 0 AS has_histogram
+	FROM pg_dist_column_statistic
+	WHERE logicalrelid = 'stats_table'::regclass
+	ORDER BY attnum;
+
+SELECT most_common_vals, most_common_freqs FROM pg_dist_column_statistic
+	WHERE logicalrelid = 'stats_table'::regclass AND attnum = 3;
+
+-- histogram bounds span the partition column's values
+SELECT histogram_bounds[1] AS first_bound,
+	   histogram_bounds[array_length(histogram_bounds, 1)] AS last_bound
+	FROM pg_dist_column_statistic
+	WHERE logicalrelid = 'stats_table'::regclass AND attnum = 1;
+
+-- updating the statistics again replaces them rather than adding to them
+SELECT master_update_table_statistics('stats_table');
+SELECT count(*) FROM pg_dist_table_statistic
+	WHERE logicalrelid = 'stats_table'::regclass;
+SELECT count(*) FROM pg_dist_column_statistic
+	WHERE logicalrelid = 'stats_table'::regclass;
+
+-- only distributed tables have shard statistics
+CREATE TABLE stats_local (key int);
+SELECT master_update_table_statistics('stats_local');
+DROP TABLE stats_local;
+
+-- dropping the table removes its statistics
+SELECT 'stats_table'::regclass::oid AS stats_table_oid \gset
+DROP TABLE stats_table;
+SELECT count(*) FROM pg_dist_table_statistic WHERE logicalrelid::oid = :stats_table_oid;
+SELECT count(*) FROM pg_dist_column_statistic WHERE logicalrelid::oid = :stats_table_oid;
@@ -0,0 +1,36 @@
+--
+-- MULTI_TASK_STATUS_BATCHING
+--
+-- Tests that a repartition join returns the same results whether the task
+-- tracker executor checks the statuses of all running tasks on a worker in one
+-- query, or the status of one task per query.
+
+
+ALTER SEQUENCE pg_catalog.pg_dist_shardid_seq RESTART 1450000;
+ALTER SEQUENCE pg_catalog.pg_dist_jobid_seq RESTART 1450000;
+
+
+SET citus.large_table_shard_count TO 2;
+SET citus.task_executor_type TO 'task-tracker';
+
+SHOW citus.batch_task_status_queries;
+
+SELECT
+	count(*)
+FROM
+	lineitem, customer
+WHERE
+	l_partkey = c_nationkey;
+
+SET citus.batch_task_status_queries TO off;
+
+SELECT
+	count(*)
+FROM
+	lineitem, customer
+WHERE
+	l_partkey = c_nationkey;
+
+RESET citus.batch_task_status_queries;
+RESET citus.task_executor_type;
+RESET citus.large_table_shard_count;
@@ -81,5 +81,78 @@ SELECT count(*) FROM pg_dist_transaction;
 SELECT recover_prepared_transactions();
 SELECT count(*) FROM pg_dist_transaction;
 
+-- Transactions with a single participant commit in one phase even under 2PC
+SET citus.shard_replication_factor TO 1;
+CREATE TABLE test_downgrade (x int, y int);
+SELECT create_distributed_table('test_downgrade', 'x');
+INSERT INTO test_downgrade VALUES (1, 1);
+INSERT INTO test_downgrade VALUES (2, 2);
+
+-- Modifying a single placement should write no transaction recovery records
+SELECT * FROM citus_commit_protocol_stats() \gset before_
+SELECT master_modify_multiple_shards($$UPDATE test_downgrade SET y = 3 WHERE x = 1$$);
+SELECT one_phase_commit_count - :before_one_phase_commit_count AS one_phase,
+	   two_phase_commit_count - :before_two_phase_commit_count AS two_phase,
+	   downgraded_commit_count - :before_downgraded_commit_count AS downgraded
+	FROM citus_commit_protocol_stats();
+SELECT count(*) FROM pg_dist_transaction;
+
+-- Modifying both placements still uses 2PC
+SELECT * FROM citus_commit_protocol_stats() \gset before_
+SELECT master_modify_multiple_shards($$UPDATE test_downgrade SET y = 4$$);
+SELECT one_phase_commit_count - :before_one_phase_commit_count AS one_phase,
+	   two_phase_commit_count - :before_two_phase_commit_count AS two_phase,
+	   downgraded_commit_count - :before_downgraded_commit_count AS downgraded
+	FROM citus_commit_protocol_stats();
+SELECT count(*) FROM pg_dist_transaction;
+SELECT recover_prepared_transactions();
+
+-- Under 1PC, single-participant commits don't count as downgraded
+SET citus.multi_shard_commit_protocol TO '1pc';
+SELECT * FROM citus_commit_protocol_stats() \gset before_
+SELECT master_modify_multiple_shards($$UPDATE test_downgrade SET y = 5 WHERE x = 2$$);
+SELECT one_phase_commit_count - :before_one_phase_commit_count AS one_phase,
+	   two_phase_commit_count - :before_two_phase_commit_count AS two_phase,
+	   downgraded_commit_count - :before_downgraded_commit_count AS downgraded
+	FROM citus_commit_protocol_stats();
+SELECT * FROM test_downgrade ORDER BY x;
+DROP TABLE test_downgrade;
+
+-- With deferred commits, the commit worker sends COMMIT PREPARED to the workers
+-- after the coordinator committed. Wait for the workers' prepared transactions
+-- to drain, and check that the changes are visible.
+SET citus.multi_shard_commit_protocol TO '2pc';
+SET citus.defer_commit_prepared TO on;
+SELECT master_modify_multiple_shards($$UPDATE test_recovery SET y = 'moon'$$);
+RESET citus.defer_commit_prepared;
+SELECT count(*) FROM pg_dist_transaction;
+
+\c - - - :worker_1_port
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		EXIT WHEN NOT EXISTS (SELECT 1 FROM pg_prepared_xacts);
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+SELECT count(*) FROM pg_prepared_xacts;
+
+\c - - - :worker_2_port
+DO $$
+BEGIN
+	FOR i IN 1..100 LOOP
+		EXIT WHEN NOT EXISTS (SELECT 1 FROM pg_prepared_xacts);
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+END;
+$$;
+SELECT count(*) FROM pg_prepared_xacts;
+
+\c - - - :master_port
+SELECT y, count(*) FROM test_recovery GROUP BY y;
+SELECT recover_prepared_transactions();
+SELECT count(*) FROM pg_dist_transaction;
+
 \c - - - :master_port
 DROP TABLE test_recovery;
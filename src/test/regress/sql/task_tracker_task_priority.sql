@@ -0,0 +1,71 @@
+--
+-- TASK_TRACKER_TASK_PRIORITY
+--
+
+
+\set JobA 401110
+\set JobB 401111
+\set JobC 401112
+\set JobD 401113
+\set LongTask '\'SELECT pg_sleep(4)\''
+\set ShortTask '\'SELECT pg_sleep(1)\''
+
+-- Queued tasks record when they start running in the following table
+
+CREATE TABLE task_start_order (task_name text, started_at timestamptz);
+
+-- We first fill all four task slots with tasks of the same job, and free one of
+-- these slots after a second.
+
+SELECT task_tracker_assign_task(:JobA, 1, :LongTask);
+SELECT task_tracker_assign_task(:JobA, 2, :LongTask);
+SELECT task_tracker_assign_task(:JobA, 3, :LongTask);
+SELECT task_tracker_assign_task(:JobA, 4, :ShortTask);
+
+SELECT pg_sleep(0.5);
+
+-- We then queue another task of the same job, a task of a second job, and tasks
+-- with a lower and a higher priority. The task tracker should run the high
+-- priority task first, then the second job's task since the first job already
+-- runs tasks, and the low priority task last.
+
+SELECT task_tracker_assign_task(:JobA, 5,
+				'INSERT INTO task_start_order VALUES (''a5'', clock_timestamp())');
+SELECT task_tracker_assign_task(:JobB, 1,
+				'INSERT INTO task_start_order VALUES (''b1'', clock_timestamp())');
+SELECT task_tracker_assign_task(:JobC, 1,
+				'INSERT INTO task_start_order VALUES (''c1'', clock_timestamp())', -1);
+SELECT task_tracker_assign_task(:JobD, 1,
+				'INSERT INTO task_start_order VALUES (''d1'', clock_timestamp())', 1);
+
+SELECT job_id, user_name = current_user AS own_job, running_task_count,
+       queued_task_count
+FROM task_tracker_job_task_counts()
+WHERE job_id IN (:JobA, :JobB, :JobC, :JobD)
+ORDER BY job_id;
+
+SELECT pg_sleep(4.5);
+
+SELECT task_name FROM task_start_order ORDER BY started_at;
+
+SELECT job_id, running_task_count, queued_task_count
+FROM task_tracker_job_task_counts()
+WHERE job_id IN (:JobA, :JobB, :JobC, :JobD)
+ORDER BY job_id;
+
+-- Check that we reject invalid priorities, and priorities set by regular users
+
+SELECT task_tracker_assign_task(:JobD, 2, 'SELECT 1', 101);
+
+CREATE USER task_priority_user;
+SET ROLE task_priority_user;
+SELECT task_tracker_assign_task(:JobD, 2, 'SELECT 1', 1);
+RESET ROLE;
+DROP USER task_priority_user;
+
+SELECT task_tracker_cleanup_job(:JobA);
+SELECT task_tracker_cleanup_job(:JobB);
+SELECT task_tracker_cleanup_job(:JobC);
+SELECT task_tracker_cleanup_job(:JobD);
+
+DROP TABLE task_start_order;
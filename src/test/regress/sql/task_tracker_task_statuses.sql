@@ -0,0 +1,47 @@
+--
+-- TASK_TRACKER_TASK_STATUSES
+--
+
+
+\set JobId 401120
+\set OtherJobId 401121
+\set QuickTask '\'SELECT 1\''
+
+-- We assign three quick tasks over two jobs, and wait for them to complete
+
+SELECT task_tracker_assign_task(:JobId, 101101, :QuickTask);
+SELECT task_tracker_assign_task(:JobId, 101102, :QuickTask);
+SELECT task_tracker_assign_task(:OtherJobId, 101101, :QuickTask);
+
+SELECT pg_sleep(1.0);
+
+-- A zero sequence number returns the statuses of all tasks in the given jobs
+
+SELECT job_id, task_id, task_status
+FROM task_tracker_task_statuses(ARRAY[:JobId, :OtherJobId]::bigint[], 0)
+ORDER BY job_id, task_id;
+
+SELECT job_id, task_id, task_status
+FROM task_tracker_task_statuses(ARRAY[:OtherJobId]::bigint[], 0);
+
+SELECT count(*) FROM task_tracker_task_statuses('{}'::bigint[], 0);
+
+-- Only statuses that changed after the given sequence number are returned.
+-- Reassigning a completed task does not run it again, but reports its status
+-- anew.
+
+SELECT max(status_sequence) AS last_sequence
+FROM task_tracker_task_statuses(ARRAY[:JobId, :OtherJobId]::bigint[], 0) \gset
+
+SELECT count(*)
+FROM task_tracker_task_statuses(ARRAY[:JobId, :OtherJobId]::bigint[], :last_sequence);
+
+SELECT task_tracker_assign_task(:JobId, 101102, :QuickTask);
+
+SELECT job_id, task_id, task_status, status_sequence > :last_sequence AS changed
+FROM task_tracker_task_statuses(ARRAY[:JobId, :OtherJobId]::bigint[], :last_sequence);
+
+SELECT task_tracker_cleanup_job(:JobId);
+SELECT task_tracker_cleanup_job(:OtherJobId);
+
+SELECT count(*) FROM task_tracker_task_statuses(ARRAY[:JobId, :OtherJobId]::bigint[], 0);
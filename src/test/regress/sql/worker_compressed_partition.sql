@@ -0,0 +1,57 @@
+--
+-- WORKER_COMPRESSED_PARTITION
+--
+
+
+-- Hash partition lineitem into compressed partition files, and check that we
+-- merge these files back into the same rows.
+
+\set JobId 201050
+\set TaskId 101107
+\set Task_Table_Name public.task_101107
+\set Select_All 'SELECT *'
+
+ALTER SYSTEM SET citus.compress_partition_files TO on;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+SHOW citus.compress_partition_files;
+
+SELECT compressed_block_count AS blocks_before FROM worker_partition_compression_stats() \gset
+
+SELECT worker_hash_partition_table(:JobId, :TaskId, 'SELECT * FROM lineitem',
+				   'l_orderkey', 'int8'::regtype, 4);
+
+-- Each partition fits into its buffer, and is written as one compressed block
+
+SELECT pg_read_binary_file('base/pgsql_job_cache/job_201050/task_101107/p_00000', 0, 8)
+       = '\x004349545553505a'::bytea AS compressed;
+
+SELECT compressed_block_count - :blocks_before AS new_blocks,
+       compressed_bytes < uncompressed_bytes AS smaller
+       FROM worker_partition_compression_stats();
+
+-- Merging the partition files decompresses them
+
+SELECT worker_merge_files_into_table(:JobId, :TaskId,
+       ARRAY['orderkey', 'partkey', 'suppkey', 'linenumber', 'quantity', 'extendedprice',
+             'discount', 'tax', 'returnflag', 'linestatus', 'shipdate', 'commitdate',
+	     'receiptdate', 'shipinstruct', 'shipmode', 'comment']::_text,
+       ARRAY['bigint', 'integer', 'integer', 'integer', 'decimal(15, 2)', 'decimal(15, 2)',
+             'decimal(15, 2)', 'decimal(15, 2)', 'char(1)', 'char(1)', 'date', 'date',
+	     'date', 'char(25)', 'char(10)', 'varchar(44)']::_text);
+
+SELECT COUNT(*) FROM :Task_Table_Name;
+
+SELECT COUNT(*) AS diff_lhs FROM ( :Select_All FROM :Task_Table_Name EXCEPT ALL
+				   :Select_All FROM lineitem ) diff;
+
+SELECT COUNT(*) AS diff_rhs FROM ( :Select_All FROM lineitem EXCEPT ALL
+				   :Select_All FROM :Task_Table_Name ) diff;
+
+DROP TABLE :Task_Table_Name;
+SELECT task_tracker_cleanup_job(:JobId);
+
+ALTER SYSTEM RESET citus.compress_partition_files;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+SHOW citus.compress_partition_files;
@@ -0,0 +1,79 @@
+--
+-- WORKER_HASH_PARTITION_HEAVY_HITTERS
+--
+
+
+-- Hash partition a query result in which the key 7 makes up 600 of 1000 rows.
+-- We first spread the rows for this key over three partitions, and then
+-- replicate these rows to three partitions.
+
+\set JobId 201060
+\set Spread_Task_Id 101108
+\set Replicate_Task_Id 101109
+\set Skewed_Query '\'SELECT CASE WHEN a <= 600 THEN 7 ELSE a END AS k FROM generate_series(1, 1000) a\''
+
+CREATE TABLE heavy_hitter_part_00 (k int);
+CREATE TABLE heavy_hitter_part_01 (k int);
+CREATE TABLE heavy_hitter_part_02 (k int);
+CREATE TABLE heavy_hitter_part_03 (k int);
+
+CREATE VIEW heavy_hitter_counts AS
+       SELECT 0 AS partition_id, k FROM heavy_hitter_part_00 UNION ALL
+       SELECT 1, k FROM heavy_hitter_part_01 UNION ALL
+       SELECT 2, k FROM heavy_hitter_part_02 UNION ALL
+       SELECT 3, k FROM heavy_hitter_part_03;
+
+SELECT worker_hash_partition_table(:JobId, :Spread_Task_Id, :Skewed_Query, 'k',
+				   'int4'::regtype, 4,
+				   ARRAY[]::text[], ARRAY[]::int4[], ARRAY[]::int4[],
+				   ARRAY['7'], ARRAY[3], ARRAY[true]);
+
+COPY heavy_hitter_part_00 FROM 'base/pgsql_job_cache/job_201060/task_101108/p_00000';
+COPY heavy_hitter_part_01 FROM 'base/pgsql_job_cache/job_201060/task_101108/p_00001';
+COPY heavy_hitter_part_02 FROM 'base/pgsql_job_cache/job_201060/task_101108/p_00002';
+COPY heavy_hitter_part_03 FROM 'base/pgsql_job_cache/job_201060/task_101108/p_00003';
+
+-- Spread rows are split evenly over three partitions, and written once
+
+SELECT count(*) AS partitions, min(row_count), max(row_count), sum(row_count)
+       FROM (SELECT partition_id, count(*) AS row_count FROM heavy_hitter_counts
+	     WHERE k = 7 GROUP BY partition_id) heavy_hitter_rows;
+
+-- Other keys are hash partitioned as usual
+
+SELECT count(*), count(DISTINCT k) FROM heavy_hitter_counts WHERE k <> 7;
+SELECT count(*) FROM (SELECT k FROM heavy_hitter_counts WHERE k <> 7
+		      GROUP BY k HAVING count(DISTINCT partition_id) > 1) split_keys;
+
+TRUNCATE heavy_hitter_part_00, heavy_hitter_part_01, heavy_hitter_part_02,
+	 heavy_hitter_part_03;
+
+SELECT worker_hash_partition_table(:JobId, :Replicate_Task_Id, :Skewed_Query, 'k',
+				   'int4'::regtype, 4,
+				   ARRAY[]::text[], ARRAY[]::int4[], ARRAY[]::int4[],
+				   ARRAY['7'], ARRAY[3], ARRAY[false]);
+
+COPY heavy_hitter_part_00 FROM 'base/pgsql_job_cache/job_201060/task_101109/p_00000';
+COPY heavy_hitter_part_01 FROM 'base/pgsql_job_cache/job_201060/task_101109/p_00001';
+COPY heavy_hitter_part_02 FROM 'base/pgsql_job_cache/job_201060/task_101109/p_00002';
+COPY heavy_hitter_part_03 FROM 'base/pgsql_job_cache/job_201060/task_101109/p_00003';
+
+-- Replicated rows are written to each of the three partitions
+
+SELECT count(*) AS partitions, min(row_count), max(row_count), sum(row_count)
+       FROM (SELECT partition_id, count(*) AS row_count FROM heavy_hitter_counts
+	     WHERE k = 7 GROUP BY partition_id) heavy_hitter_rows;
+
+SELECT count(*), count(DISTINCT k) FROM heavy_hitter_counts WHERE k <> 7;
+
+-- Check that we reject heavy hitter arrays of different lengths
+
+SELECT worker_hash_partition_table(:JobId, :Replicate_Task_Id, :Skewed_Query, 'k',
+				   'int4'::regtype, 4,
+				   ARRAY[]::text[], ARRAY[]::int4[], ARRAY[]::int4[],
+				   ARRAY['7'], ARRAY[3, 2], ARRAY[false]);
+
+DROP VIEW heavy_hitter_counts;
+DROP TABLE heavy_hitter_part_00, heavy_hitter_part_01, heavy_hitter_part_02,
+	   heavy_hitter_part_03;
+SELECT task_tracker_cleanup_job(:JobId);
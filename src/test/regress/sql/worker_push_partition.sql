@@ -0,0 +1,60 @@
+--
+-- WORKER_PUSH_PARTITION
+--
+
+
+-- Hash partition lineitem, and push each partition to the node that runs its
+-- merge task. This node merges partition 1, so we link that partition into the
+-- merge task's directory; worker_1 merges partitions 0 and 2, which we stream
+-- over a single connection. Partition 3 has no merge task and is not pushed.
+
+\set JobId 201040
+\set TaskId 101105
+\set Hash_Mod_Function '( (hashint8(l_orderkey) & 2147483647) % 4 )'
+
+SELECT worker_hash_partition_table(:JobId, :TaskId, 'SELECT * FROM lineitem',
+				   'l_orderkey', 'int8'::regtype, 4,
+				   ARRAY['localhost', 'localhost', 'localhost', '']::text[],
+				   ARRAY[:worker_1_port, :master_port, :worker_1_port, 0]::int4[],
+				   ARRAY[101201, 101202, 101203, 0]::int4[]);
+
+-- The locally pushed file has the same rows as the partition
+
+CREATE TABLE lineitem_pushed_01 (LIKE lineitem);
+COPY lineitem_pushed_01 FROM 'base/pgsql_job_cache/job_201040/task_101202/task_101105';
+
+SELECT COUNT(*) AS diff_lhs_01 FROM (
+       SELECT * FROM lineitem_pushed_01 EXCEPT ALL
+       SELECT * FROM lineitem WHERE (:Hash_Mod_Function = 1) ) diff;
+SELECT COUNT(*) AS diff_rhs_01 FROM (
+       SELECT * FROM lineitem WHERE (:Hash_Mod_Function = 1) EXCEPT ALL
+       SELECT * FROM lineitem_pushed_01 ) diff;
+
+SELECT count(*) FROM pg_ls_dir('base/pgsql_job_cache/job_201040') AS file_name
+       WHERE file_name LIKE 'task_1012%';
+
+-- Files pushed to worker_1 match the partition files byte for byte
+
+SELECT md5(pg_read_binary_file('base/pgsql_job_cache/job_201040/task_101105/p_00000'))
+       AS part_00_md5 \gset
+SELECT md5(pg_read_binary_file('base/pgsql_job_cache/job_201040/task_101105/p_00002'))
+       AS part_02_md5 \gset
+
+\c - - - :worker_1_port
+
+SELECT md5(pg_read_binary_file('base/pgsql_job_cache/job_201040/task_101201/task_101105'))
+       = :'part_00_md5' AS pushed_00_matches;
+SELECT md5(pg_read_binary_file('base/pgsql_job_cache/job_201040/task_101203/task_101105'))
+       = :'part_02_md5' AS pushed_02_matches;
+
+-- No attempt files are left behind, and no other partitions were pushed
+
+SELECT file_name FROM pg_ls_dir('base/pgsql_job_cache/job_201040') AS file_name
+       ORDER BY file_name;
+
+SELECT task_tracker_cleanup_job(:JobId);
+
+\c - - - :master_port
+
+DROP TABLE lineitem_pushed_01;
+SELECT task_tracker_cleanup_job(:JobId);
@@ -0,0 +1,69 @@
+--
+-- WORKER_READ_TASK_FILES
+--
+
+
+-- Read the hash partitioned files of lineitem without loading them into a table
+
+\set JobId 201010
+\set TaskId 101103
+\set Select_All 'SELECT *'
+
+SELECT COUNT(*) FROM worker_read_task_files(NULL::lineitem, :JobId, :TaskId);
+
+SELECT COUNT(*) AS diff_lhs FROM (
+       :Select_All FROM worker_read_task_files(NULL::lineitem, :JobId, :TaskId)
+       EXCEPT ALL :Select_All FROM lineitem ) diff;
+SELECT COUNT(*) AS diff_rhs FROM (
+       :Select_All FROM lineitem EXCEPT ALL
+       :Select_All FROM worker_read_task_files(NULL::lineitem, :JobId, :TaskId) ) diff;
+
+-- The function returns one row per call, so callers can stop reading early
+
+SELECT COUNT(*) FROM (
+       SELECT worker_read_task_files(NULL::lineitem, :JobId, :TaskId) LIMIT 5 ) task_rows;
+SELECT COUNT(*) FROM (
+       :Select_All FROM worker_read_task_files(NULL::lineitem, :JobId, :TaskId)
+       LIMIT 5 ) task_rows;
+
+-- Check that we reject invalid arguments
+
+SELECT COUNT(*) FROM worker_read_task_files(NULL::lineitem, NULL, :TaskId);
+SELECT COUNT(*) FROM worker_read_task_files(NULL::int, :JobId, :TaskId);
+
+-- Run a merge task's query over the partition files in place. The merge table
+-- becomes a view over the files, and the task table holds the query's results.
+
+ALTER SYSTEM SET citus.merge_files_in_place TO on;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+SHOW citus.merge_files_in_place;
+
+CREATE SCHEMA pg_merge_job_201010;
+
+SELECT worker_merge_files_and_run_query(:JobId, :TaskId,
+       'CREATE TABLE task_101103_merge (LIKE lineitem)',
+       'CREATE TABLE task_101103 AS SELECT * FROM task_101103_merge');
+
+SELECT relname, relkind FROM pg_class
+       WHERE relnamespace = 'pg_merge_job_201010'::regnamespace ORDER BY relname;
+
+SELECT COUNT(*) FROM pg_merge_job_201010.task_101103_merge_files;
+SELECT COUNT(*) FROM pg_merge_job_201010.task_101103;
+
+SELECT COUNT(*) AS diff_lhs FROM (
+       :Select_All FROM pg_merge_job_201010.task_101103
+       EXCEPT ALL :Select_All FROM lineitem ) diff;
+SELECT COUNT(*) AS diff_rhs FROM (
+       :Select_All FROM lineitem EXCEPT ALL
+       :Select_All FROM pg_merge_job_201010.task_101103 ) diff;
+
+DROP TABLE pg_merge_job_201010.task_101103;
+DROP VIEW pg_merge_job_201010.task_101103_merge;
+DROP TABLE pg_merge_job_201010.task_101103_merge_files;
+DROP SCHEMA pg_merge_job_201010;
+
+ALTER SYSTEM RESET citus.merge_files_in_place;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.1);
+SHOW citus.merge_files_in_place;
@@ -0,0 +1,56 @@
+--
+-- WORKER_SEMI_JOIN_FILTER
+--
+
+
+-- Build a semi-join filter over ten keys, store it in a job directory, and hash
+-- partition a query result for that job. The job's map task should then drop
+-- all rows whose keys are not in the filter.
+
+\set JobId 201070
+\set TaskId 101110
+\set Filter_Query '\'SELECT a AS k FROM generate_series(1, 100, 10) a\''
+\set Partition_Query '\'SELECT a AS k FROM generate_series(1, 1000) a\''
+
+CREATE TABLE semi_join_part_00 (k int);
+CREATE TABLE semi_join_part_01 (k int);
+CREATE TABLE semi_join_part_02 (k int);
+CREATE TABLE semi_join_part_03 (k int);
+
+CREATE VIEW semi_join_rows AS
+       SELECT k FROM semi_join_part_00 UNION ALL
+       SELECT k FROM semi_join_part_01 UNION ALL
+       SELECT k FROM semi_join_part_02 UNION ALL
+       SELECT k FROM semi_join_part_03;
+
+CREATE TEMP TABLE semi_join_filter AS
+       SELECT worker_build_semi_join_filter(:Filter_Query, 'k', 'int4'::regtype, 8192)
+       AS filter;
+
+SELECT octet_length(filter) FROM semi_join_filter;
+
+SELECT worker_store_semi_join_filter(:JobId, filter) FROM semi_join_filter;
+
+SELECT worker_hash_partition_table(:JobId, :TaskId, :Partition_Query, 'k',
+				   'int4'::regtype, 4);
+
+COPY semi_join_part_00 FROM 'base/pgsql_job_cache/job_201070/task_101110/p_00000';
+COPY semi_join_part_01 FROM 'base/pgsql_job_cache/job_201070/task_101110/p_00001';
+COPY semi_join_part_02 FROM 'base/pgsql_job_cache/job_201070/task_101110/p_00002';
+COPY semi_join_part_03 FROM 'base/pgsql_job_cache/job_201070/task_101110/p_00003';
+
+-- All filtered keys pass, and only a few other keys pass as false positives
+
+SELECT count(*) AS filtered_keys FROM semi_join_rows WHERE k % 10 = 1 AND k <= 100;
+SELECT count(*) < 100 AS rows_dropped FROM semi_join_rows;
+
+-- Check that we reject invalid filters and mismatched key types
+
+SELECT worker_build_semi_join_filter(:Filter_Query, 'k', 'int4'::regtype, 100);
+SELECT worker_build_semi_join_filter(:Filter_Query, 'k', 'int8'::regtype, 8192);
+SELECT worker_store_semi_join_filter(:JobId, ''::bytea);
+
+DROP VIEW semi_join_rows;
+DROP TABLE semi_join_part_00, semi_join_part_01, semi_join_part_02,
+	   semi_join_part_03;
+SELECT task_tracker_cleanup_job(:JobId);